@@ -38,6 +38,10 @@
 #define CONF_BATCH_SIZE_WIDTH "batch_size_width"
 #define CONF_BATCH_SIZE_HEIGHT "batch_size_height"
 #define CONF_BATCH_SIZE_SCALE "batch_size_scale"
+#define CONF_BATCH_THREADS "batch_threads"
+#define CONF_BATCH_MAX_MEMORY "batch_max_memory"
+#define CONF_BATCH_SHOW_PREVIEW "batch_show_preview"
+#define CONF_PREVIEW_TILE_MEMORY "preview_tile_memory"
 #define CONF_ROI_GRID "roi_grid"
 #define CONF_CROP_ASPECT "crop_aspect"
 #define CONF_SHOW_FILENAMES "show_filenames_in_iconview"
@@ -66,6 +70,9 @@
 #define CONF_LIBRARY_TAG_SEARCH "library_tag_search"
 #define CONF_EXPORT_AS_FOLDER "export_as_folder"
 #define CONF_EXPORT_AS_SIZE_PERCENT "export_as_size_percent"
+#define CONF_EXPORT_DOWNSCALE_OVERSAMPLE "export_downscale_oversample"
+#define CONF_IO_CONCURRENCY "io_concurrency"
+#define CONF_DENOISE_FFTW_PATIENT "denoise_fftw_patient"
 #define CONF_MAIN_WINDOW_WIDTH "main_window_width"
 #define CONF_MAIN_WINDOW_HEIGHT "main_window_height"
 #define CONF_MAIN_WINDOW_POS_X "main_window_pos_x"
@@ -93,6 +100,13 @@
 #define DEFAULT_CONF_BATCH_FILENAME "%f_%2c"
 #define DEFAULT_CONF_BATCH_FILETYPE "jpeg"
 #define DEFAULT_CONF_BATCH_JPEG_QUALITY "100"
+#define DEFAULT_CONF_BATCH_THREADS 2
+#define DEFAULT_CONF_BATCH_MAX_MEMORY 2048
+#define DEFAULT_CONF_BATCH_SHOW_PREVIEW TRUE
+#define DEFAULT_CONF_PREVIEW_TILE_MEMORY 256
+#define DEFAULT_CONF_EXPORT_DOWNSCALE_OVERSAMPLE 2.0
+#define DEFAULT_CONF_IO_CONCURRENCY 4
+#define DEFAULT_CONF_DENOISE_FFTW_PATIENT FALSE
 #define DEFAULT_CONF_FULLSCREEN FALSE
 #define DEFAULT_CONF_SHOW_TOOLBOX_FULLSCREEN TRUE
 #define DEFAULT_CONF_SHOW_TOOLBOX TRUE
@@ -47,6 +47,7 @@ extern "C" {
 #include "rs-image.h"
 #include "rs-image16.h"
 #include "rs-metadata.h"
+#include "rs-metadata-pack.h"
 #include "rs-lens.h"
 #include "rs-lens-db.h"
 #include "rs-lens-fix.h"
@@ -58,8 +59,11 @@ extern "C" {
 #include "rs-filter-response.h"
 #include "rs-filter.h"
 #include "rs-output.h"
+#include "rs-export-plan.h"
 #include "rs-plugin-manager.h"
 #include "rs-job-queue.h"
+#include "rs-task-pool.h"
+#include "rs-profiler.h"
 #include "rs-utils.h"
 #include "rs-math.h"
 #include "rs-color.h"
@@ -0,0 +1,101 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>, 
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <rawstudio.h>
+#include "rs-export-plan.h"
+
+gdouble
+rs_export_plan_get_oversample(RSOutput *output, const gchar *conf_prefix)
+{
+	gdouble oversample = DEFAULT_CONF_EXPORT_DOWNSCALE_OVERSAMPLE;
+	gchar *confpath;
+
+	rs_conf_get_double(CONF_EXPORT_DOWNSCALE_OVERSAMPLE, &oversample);
+
+	/* Allow each output type to override the global setting */
+	if (RS_IS_OUTPUT(output) && conf_prefix)
+	{
+		confpath = g_strdup_printf("%s:%s:downscale-oversample", conf_prefix, G_OBJECT_TYPE_NAME(output));
+		rs_conf_get_double(confpath, &oversample);
+		g_free(confpath);
+	}
+
+	return oversample;
+}
+
+gdouble
+rs_export_plan_downscale(RSFilter *demosaic, RSFilter *prescale, RSFilter *size_reference, gint width, gint height, gboolean bounding_box, gdouble oversample)
+{
+	gint source_width, source_height;
+	gint prescale_width, prescale_height;
+	gdouble scale_x = 1.0, scale_y = 1.0;
+	gboolean half_size;
+
+	g_return_val_if_fail(RS_IS_FILTER(prescale), 1.0);
+	g_return_val_if_fail(RS_IS_FILTER(size_reference), 1.0);
+
+	/* Filters are reused between photos, start from a full size demosaic */
+	if (demosaic)
+		g_object_set(demosaic, "demosaic-force-downscale", FALSE, NULL);
+
+	/* If we don't know the size, prescale is left at the final size, the
+	 * final resampler will then pass the image through */
+	if (!rs_filter_get_size_simple(size_reference, RS_FILTER_REQUEST_QUICK, &source_width, &source_height))
+		return 1.0;
+
+	if (oversample > 0.0 && width > 0 && height > 0)
+	{
+		scale_x = ((gdouble) width) / source_width;
+		scale_y = ((gdouble) height) / source_height;
+		if (bounding_box)
+			scale_x = scale_y = MIN(scale_x, scale_y);
+
+		/* Keep oversample times the final resolution for DCP and denoise */
+		scale_x = MIN(scale_x * oversample, 1.0);
+		scale_y = MIN(scale_y * oversample, 1.0);
+	}
+
+	prescale_width = MAX(6, (gint) (source_width * scale_x + 0.5));
+	prescale_height = MAX(6, (gint) (source_height * scale_y + 0.5));
+
+	/* Binning 2x2 CFA blocks is only done when we would throw away at least
+	 * that much resolution anyway */
+	half_size = (scale_x <= 0.5) && (scale_y <= 0.5);
+	if (half_size)
+	{
+		prescale_width = MIN(prescale_width, source_width / 2);
+		prescale_height = MIN(prescale_height, source_height / 2);
+		if (demosaic)
+			g_object_set(demosaic, "demosaic-force-downscale", TRUE, NULL);
+	}
+
+	/* A resampler asked for the size of its input will pass the image through */
+	g_object_set(prescale,
+		"bounding-box", FALSE,
+		"width", prescale_width,
+		"height", prescale_height,
+		NULL);
+
+	g_debug("Export plan: %dx%d -> %dx%d (%s demosaic, prescale to %dx%d), %.1fx fewer pixels after demosaic",
+		source_width, source_height, width, height,
+		(half_size && demosaic) ? "half size" : "full size",
+		prescale_width, prescale_height, 1.0 / (scale_x * scale_y));
+
+	return 1.0 / (scale_x * scale_y);
+}
@@ -0,0 +1,64 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>, 
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RS_EXPORT_PLAN_H
+#define RS_EXPORT_PLAN_H
+
+#include <glib.h>
+#include "rs-filter.h"
+#include "rs-output.h"
+
+G_BEGIN_DECLS
+
+/**
+ * Get the early downscale quality guard for an output. This is how many
+ * times larger than the final output the image must stay until after DCP
+ * and denoise. It is read from "<conf_prefix>:<output type>:downscale-oversample"
+ * and falls back to CONF_EXPORT_DOWNSCALE_OVERSAMPLE
+ * @param output A RSOutput or NULL
+ * @param conf_prefix The prefix used when saving settings for output or NULL
+ * @return The oversampling factor, 0.0 or less disables early downscaling
+ */
+extern gdouble
+rs_export_plan_get_oversample(RSOutput *output, const gchar *conf_prefix);
+
+/**
+ * Plan an export chain so that downscaling happens as early as possible.
+ * The image is binned to half size in demosaic when that is still at least
+ * oversample times the final size, and a RSResample placed right after
+ * crop - before colorspace transform, DCP and denoise - scales it down to
+ * oversample times the final size. When no early downscaling is possible,
+ * prescale will be set to pass the image through untouched.
+ * @note This must be called after width and height has been set on the chain,
+ *       since rs_filter_set_recursive() will change prescale as well
+ * @param demosaic A RSDemosaic private to this chain or NULL
+ * @param prescale A RSResample placed after the geometric filters
+ * @param size_reference The filter just before prescale
+ * @param width The width of the final output
+ * @param height The height of the final output
+ * @param bounding_box TRUE if width and height are a bounding box for the output
+ * @param oversample The quality guard from rs_export_plan_get_oversample()
+ * @return The estimated speedup of the filters after demosaic, 1.0 if nothing was gained
+ */
+extern gdouble
+rs_export_plan_downscale(RSFilter *demosaic, RSFilter *prescale, RSFilter *size_reference, gint width, gint height, gboolean bounding_box, gdouble oversample);
+
+G_END_DECLS
+
+#endif /* RS_EXPORT_PLAN_H */
@@ -21,17 +21,6 @@
 #include <rawstudio.h>
 #include "rs-filter.h"
 
-#if 0 /* Change to 1 to enable performance info */
-#define filter_performance printf
-#define FILTER_SHOW_PERFORMANCE
-#else
-#define filter_performance(...) {}
-#endif
-
-/* How much time should a filter at least have taken to show performance number */
-#define FILTER_PERF_ELAPSED_MIN 0.001
-#define CHAIN_PERF_ELAPSED_MIN 0.001
-
 G_DEFINE_TYPE (RSFilter, rs_filter, G_TYPE_OBJECT)
 
 enum {
@@ -207,24 +196,17 @@ rs_filter_get_image(RSFilter *filter, const RSFilterRequest *request)
 {
 	GdkRectangle* roi = NULL;
 	RSFilterRequest *r = NULL;
+	RSFilterResponse *response;
+	RS_IMAGE16 *image;
+	RSProfilerFrame frame;
+	gint width = 0, height = 0;
 
 	g_return_val_if_fail(RS_IS_FILTER(filter), NULL);
 	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), NULL);
 
 	RS_DEBUG(FILTERS, "rs_filter_get_image(%s [%p])", RS_FILTER_NAME(filter), filter);
 
-	/* This timer-hack will break badly when multithreaded! */
-	static gfloat last_elapsed = 0.0;
-	static gint count = -1;
-	gfloat elapsed;
-	static GTimer *gt = NULL;
-
-	RSFilterResponse *response;
-	RS_IMAGE16 *image;
-
-	if (count == -1)
-		gt = g_timer_new();
-	count++;
+	rs_profiler_begin(&frame);
 
 	if (filter->enabled && (roi = rs_filter_request_get_roi(request)))
 	{
@@ -246,48 +228,26 @@ rs_filter_get_image(RSFilter *filter, const RSFilterRequest *request)
 
 	image = rs_filter_response_get_image(response);
 
-	elapsed = g_timer_elapsed(gt, NULL) - last_elapsed;
-
 	if (roi)
 		g_free(roi);
 	if (r)
 		g_object_unref(r);
 
-#ifdef FILTER_SHOW_PERFORMANCE
-	if ((elapsed > FILTER_PERF_ELAPSED_MIN) && (image != NULL)) 
+	g_assert(RS_IS_IMAGE16(image) || (image == NULL));
+
+	if (image)
 	{
-		gint iw = image->w;
-		gint ih = image->h;
-		if (rs_filter_response_get_roi(response)) 
+		width = image->w;
+		height = image->h;
+		if ((roi = rs_filter_response_get_roi(response)))
 		{
-			roi = rs_filter_response_get_roi(response);
-			iw = roi->width;
-			ih = roi->height;
+			width = roi->width;
+			height = roi->height;
 		}
-		filter_performance("%s took: \033[32m%.0f\033[0mms", RS_FILTER_NAME(filter), elapsed*1000);
-		if ((elapsed > 0.001) && (image != NULL))
-			filter_performance(" [\033[33m%.01f\033[0mMpix/s]", ((gfloat)(iw*ih))/elapsed/1000000.0);
-		if (image)
-			filter_performance(" [w: %d, h: %d, roi-w:%d, roi-h:%d, channels: %d, pixelsize: %d, rowstride: %d]",
-				image->w, image->h, iw, ih, image->channels, image->pixelsize, image->rowstride);
-		filter_performance("\n");
+		g_object_unref(image);
 	}
-#endif
-	g_assert(RS_IS_IMAGE16(image) || (image == NULL));
-	last_elapsed += elapsed;
 
-	count--;
-	if (count == -1)
-	{
-		last_elapsed = 0.0;
-		if (g_timer_elapsed(gt,NULL) > CHAIN_PERF_ELAPSED_MIN)
-			filter_performance("Complete 16 bit chain took: \033[32m%.0f\033[0mms\n\n", g_timer_elapsed(gt, NULL)*1000.0);
-		rs_filter_param_set_float(RS_FILTER_PARAM(response), "16-bit-time", g_timer_elapsed(gt, NULL));
-		g_timer_destroy(gt);
-	}
-	
-	if (image)
-		g_object_unref(image);
+	rs_profiler_end(&frame, RS_FILTER_NAME(filter), filter, width, height, FALSE);
 
 	return response;
 }
@@ -302,28 +262,19 @@ rs_filter_get_image(RSFilter *filter, const RSFilterRequest *request)
 RSFilterResponse *
 rs_filter_get_image8(RSFilter *filter, const RSFilterRequest *request)
 {
-	g_return_val_if_fail(RS_IS_FILTER(filter), NULL);
-	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), NULL);
-
-	RS_DEBUG(FILTERS, "rs_filter_get_image8(%s [%p])", RS_FILTER_NAME(filter), filter);
-
-	/* This timer-hack will break badly when multithreaded! */
-	static gfloat last_elapsed = 0.0;
-	static gint count = -1;
-	gfloat elapsed, temp;
-	static GTimer *gt = NULL;
-
 	RSFilterResponse *response = NULL;
 	GdkPixbuf *image = NULL;
 	GdkRectangle* roi = NULL;
 	RSFilterRequest *r = NULL;
+	RSProfilerFrame frame;
+	gint width = 0, height = 0;
 
 	g_return_val_if_fail(RS_IS_FILTER(filter), NULL);
 	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), NULL);
 
-	if (count == -1)
-		gt = g_timer_new();
-	count++;
+	RS_DEBUG(FILTERS, "rs_filter_get_image8(%s [%p])", RS_FILTER_NAME(filter), filter);
+
+	rs_profiler_begin(&frame);
 
 	if (filter->enabled && (roi = rs_filter_request_get_roi(request)))
 	{
@@ -344,51 +295,27 @@ rs_filter_get_image8(RSFilter *filter, const RSFilterRequest *request)
 	g_assert(RS_IS_FILTER_RESPONSE(response));
 
 	image = rs_filter_response_get_image8(response);
-	elapsed = g_timer_elapsed(gt, NULL) - last_elapsed;
-
-	/* Subtract 16 bit time */
-	if (rs_filter_param_get_float(RS_FILTER_PARAM(response), "16-bit-time", &temp))
-		elapsed -= temp;
 
 	if (roi)
 		g_free(roi);
 	if (r)
 		g_object_unref(r);
 
-#ifdef FILTER_SHOW_PERFORMANCE
-	if ((elapsed > FILTER_PERF_ELAPSED_MIN) && (image != NULL)) {
-		gint iw = gdk_pixbuf_get_width(image);
-		gint ih = gdk_pixbuf_get_height(image);
-		if (rs_filter_response_get_roi(response)) 
-		{
-			GdkRectangle *roi = rs_filter_response_get_roi(response);
-			iw = roi->width;
-			ih = roi->height;
-		}
-		filter_performance("%s took: \033[32m%.0f\033[0mms", RS_FILTER_NAME(filter), elapsed * 1000);
-		filter_performance(" [\033[33m%.01f\033[0mMpix/s]", ((gfloat)(iw * ih)) / elapsed / 1000000.0);
-		filter_performance("\n");
-	}
-#endif
-
-	last_elapsed += elapsed;
-
 	g_assert(GDK_IS_PIXBUF(image) || (image == NULL));
 
-	count--;
-	if (count == -1)
+	if (image)
 	{
-		last_elapsed = 0.0;
-		rs_filter_param_get_float(RS_FILTER_PARAM(response), "16-bit-time", &last_elapsed);
-		last_elapsed = g_timer_elapsed(gt, NULL)-last_elapsed;
-		if (last_elapsed > CHAIN_PERF_ELAPSED_MIN)
-			filter_performance("Complete 8 bit chain took: \033[32m%.0f\033[0mms\n\n", last_elapsed*1000.0);
-		g_timer_destroy(gt);
-		last_elapsed = 0.0;
+		width = gdk_pixbuf_get_width(image);
+		height = gdk_pixbuf_get_height(image);
+		if ((roi = rs_filter_response_get_roi(response)))
+		{
+			width = roi->width;
+			height = roi->height;
+		}
+		g_object_unref(image);
 	}
 
-	if (image)
-		g_object_unref(image);
+	rs_profiler_end(&frame, RS_FILTER_NAME(filter), filter, width, height, TRUE);
 
 	return response;
 }
@@ -56,7 +56,12 @@ rs_image16_finalize (GObject *obj)
 	RS_IMAGE16 *self = (RS_IMAGE16 *)obj;
 
 	if (self->pixels && (self->pixels_refcount == 1))
-		free(self->pixels);
+	{
+		if (self->pixels_release)
+			self->pixels_release(self->pixels_release_data);
+		else
+			free(self->pixels);
+	}
 
 	self->pixels_refcount--;
 
@@ -81,6 +86,8 @@ rs_image16_init (RS_IMAGE16 *self)
 	self->filters = 0;
 	self->pixels = NULL;
 	self->pixels_refcount = 0;
+	self->pixels_release = NULL;
+	self->pixels_release_data = NULL;
 }
 
 void
@@ -160,6 +167,7 @@ rs_image16_new(const guint width, const guint height, const guint channels, cons
 		return NULL;
 	}
 	rsi->pixels_refcount = 1;
+	rs_profiler_add_allocation(rsi->h*rsi->rowstride * sizeof(gushort));
 
 	/* Verify alignment */
 	g_assert((GPOINTER_TO_INT(rsi->pixels) % 16) == 0);
@@ -168,6 +176,58 @@ rs_image16_new(const guint width, const guint height, const guint channels, cons
 	return(rsi);
 }
 
+/**
+ * Initializes a new RS_IMAGE16 adopting externally allocated pixels
+ * @note Pixeldata is NOT copied, @release will be called when the image is freed.
+ * @param width The width of the image
+ * @param height The height of the image
+ * @param channels Number of channels per pixel
+ * @param pixelsize The size of a pixel in SHORTS
+ * @param pixels The pixeldata, must be 16 byte aligned
+ * @param rowstride The distance between rows in SHORTS, must be a multiple of 8 (16 bytes)
+ * @param release A function to release the pixeldata or NULL
+ * @param release_data Data passed to @release
+ * @return A new RS_IMAGE16 with a refcount of 1 or NULL if the buffer is unsuitable
+ */
+RS_IMAGE16 *
+rs_image16_new_from_buffer(const guint width, const guint height, const guint channels, const guint pixelsize,
+	gushort *pixels, const gint rowstride, GDestroyNotify release, gpointer release_data)
+{
+	RS_IMAGE16 *rsi;
+
+	g_return_val_if_fail(width < 65536, NULL);
+	g_return_val_if_fail(height < 65536, NULL);
+
+	g_return_val_if_fail(width > 0, NULL);
+	g_return_val_if_fail(height > 0, NULL);
+
+	g_return_val_if_fail(channels > 0, NULL);
+	g_return_val_if_fail(pixelsize >= channels, NULL);
+	g_return_val_if_fail(pixels != NULL, NULL);
+
+	/* SSE code expects every row to start at a 16 byte boundary */
+	if ((GPOINTER_TO_SIZE(pixels) % 16) != 0)
+		return NULL;
+	if ((rowstride % 8) != 0 || rowstride < (gint) (width * pixelsize))
+		return NULL;
+
+	rsi = g_object_new(RS_TYPE_IMAGE16, NULL);
+	rsi->w = width;
+	rsi->h = height;
+	rsi->rowstride = rowstride;
+	rsi->pitch = rsi->rowstride / pixelsize;
+	rsi->channels = channels;
+	rsi->pixelsize = pixelsize;
+	rsi->filters = 0;
+
+	rsi->pixels = pixels;
+	rsi->pixels_refcount = 1;
+	rsi->pixels_release = release;
+	rsi->pixels_release_data = release_data;
+
+	return(rsi);
+}
+
 /**
  * Initializes a new RS_IMAGE16 with pixeldata from @input.
  * @note Pixeldata is NOT copied to new RS_IMAGE16.
@@ -233,9 +293,9 @@ rs_image16_new_subframe(RS_IMAGE16 *input, GdkRectangle *rectangle)
 
 	g_assert((output->w - 4) <= rectangle->width);
 
-	/* Verify alignment */
+	/* Verify alignment, adopted buffers may have a 16 byte rowstride */
 	g_assert((GPOINTER_TO_INT(output->pixels) % 16) == 0);
-	g_assert((output->rowstride % 16) == 0);
+	g_assert((output->rowstride % 8) == 0);
 
 	return output;
 }
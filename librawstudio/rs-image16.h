@@ -39,6 +39,8 @@ struct _rs_image16 {
 	guint pixelsize; /* the size of a pixel in SHORTS */
 	gushort *pixels;
 	gint pixels_refcount;
+	GDestroyNotify pixels_release; /* Called instead of free() for adopted pixels */
+	gpointer pixels_release_data;
 	guint filters;
 	gboolean dispose_has_run;
 };
@@ -63,6 +65,23 @@ GType rs_image16_get_type (void);
 
 extern RS_IMAGE16 *rs_image16_new(const guint width, const guint height, const guint channels, const guint pixelsize);
 
+/**
+ * Initializes a new RS_IMAGE16 adopting externally allocated pixels
+ * @note Pixeldata is NOT copied, @release will be called when the image is freed.
+ * @param width The width of the image
+ * @param height The height of the image
+ * @param channels Number of channels per pixel
+ * @param pixelsize The size of a pixel in SHORTS
+ * @param pixels The pixeldata, must be 16 byte aligned
+ * @param rowstride The distance between rows in SHORTS, must be a multiple of 8 (16 bytes)
+ * @param release A function to release the pixeldata or NULL
+ * @param release_data Data passed to @release
+ * @return A new RS_IMAGE16 with a refcount of 1 or NULL if the buffer is unsuitable
+ */
+extern RS_IMAGE16 *
+rs_image16_new_from_buffer(const guint width, const guint height, const guint channels, const guint pixelsize,
+	gushort *pixels, const gint rowstride, GDestroyNotify release, gpointer release_data);
+
 /**
  * Initializes a new RS_IMAGE16 with pixeldata from @input.
  * @note Pixeldata is NOT copied to new RS_IMAGE16.
@@ -36,7 +36,7 @@ execute(RSIoJob *job)
 {
 	RSIoJobChecksum *checksum = RS_IO_JOB_CHECKSUM(job);
 
-	rs_io_lock();
+	rs_io_lock_file(checksum->path);
 	checksum->checksum = rs_file_checksum(checksum->path);
 	rs_io_unlock();
 }
@@ -73,6 +73,7 @@ rs_io_job_checksum_class_init(RSIoJobChecksumClass *klass)
 	object_class->dispose = rs_io_job_checksum_dispose;
 	job_class->execute = execute;
 	job_class->do_callback = do_callback;
+	job_class->io_class = RS_IO_CLASS_PREFETCH;
 }
 
 static void
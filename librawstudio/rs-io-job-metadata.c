@@ -72,6 +72,7 @@ rs_io_job_metadata_class_init(RSIoJobMetadataClass *klass)
 	object_class->dispose = rs_io_job_metadata_dispose;
 	job_class->execute = execute;
 	job_class->do_callback = do_callback;
+	job_class->io_class = RS_IO_CLASS_THUMBNAIL;
 }
 
 static void
@@ -72,6 +72,7 @@ rs_io_job_tagging_class_init(RSIoJobTaggingClass *klass)
 
 	object_class->dispose = rs_io_job_tagging_dispose;
 	job_class->execute = execute;
+	job_class->io_class = RS_IO_CLASS_THUMBNAIL;
 }
 
 static void
@@ -17,6 +17,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <rawstudio.h>
 #include "rs-io-job.h"
 
 G_DEFINE_TYPE(RSIoJob, rs_io_job, G_TYPE_OBJECT)
@@ -24,6 +25,7 @@ G_DEFINE_TYPE(RSIoJob, rs_io_job, G_TYPE_OBJECT)
 static void
 rs_io_job_class_init(RSIoJobClass *klass)
 {
+	klass->io_class = RS_IO_CLASS_INTERACTIVE;
 }
 
 static void
@@ -45,7 +47,11 @@ rs_io_job_execute(RSIoJob *job)
 	RSIoJobClass *klass = RS_IO_JOB_GET_CLASS(job);
 
 	if (klass->execute)
+	{
+		RSIoClass previous = rs_io_set_class(klass->io_class);
 		klass->execute(job);
+		rs_io_set_class(previous);
+	}
 }
 
 void
@@ -31,6 +31,16 @@ G_BEGIN_DECLS
 #define RS_IS_IO_JOB_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), RS_TYPE_IO_JOB))
 #define RS_IO_JOB_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), RS_TYPE_IO_JOB, RSIoJobClass))
 
+/* Classes of I/O, in order of priority. The I/O scheduler lets waiting
+ * requests of a higher class go first on a busy device */
+typedef enum {
+	RS_IO_CLASS_INTERACTIVE = 0, /* Opening a photo for editing */
+	RS_IO_CLASS_THUMBNAIL,       /* Metadata and thumbnails for the browser */
+	RS_IO_CLASS_PREFETCH,        /* Reading ahead and checksumming */
+	RS_IO_CLASS_EXPORT,          /* Writing exported photos */
+	RS_IO_CLASS_MAX
+} RSIoClass;
+
 typedef struct {
 	GObject parent;
 
@@ -44,6 +54,9 @@ typedef struct {
 
 	void (*execute)(RSIoJob *job);
 	void (*do_callback)(RSIoJob *job);
+
+	/* The I/O class execute() will run as */
+	RSIoClass io_class;
 } RSIoJobClass;
 
 GType rs_io_job_get_type(void);
@@ -17,64 +17,235 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#if __gnu_linux__
+#include <sys/sysmacros.h> /* major(), minor() */
+#endif
 #include "rs-io.h"
 
+/* How long to wait for a device before ignoring its limit. This prevents
+ * deadlocks if two threads each hold one device and wait for the other */
+#define IO_LOCK_TIMEOUT (10 * G_TIME_SPAN_SECOND)
+
+/* One block device as seen by the I/O scheduler */
+typedef struct {
+	guint64 device;
+	gint max_active;
+	gboolean max_active_set; /* Set by rs_io_set_device_concurrency() */
+	gint active;
+	gint waiting[RS_IO_CLASS_MAX];
+	GCond cond;
+} IoDevice;
+
+/* A device held by a thread, locks are recursive per thread. Only the
+ * outermost hold is counted as active on the device */
+typedef struct {
+	IoDevice *device;
+	gboolean counted;
+	gint64 start;
+} IoHold;
+
+typedef struct {
+	RSIoClass io_class;
+	GArray *holds;
+} IoThread;
+
+/* A queued job. Entries live in a binary heap ordered by priority, and
+ * by submission order within the same priority */
+typedef struct {
+	RSIoJob *job;
+	guint64 sequence;
+	gint64 queued;
+	guint index; /* Position in the heap */
+	guint generation;
+	struct IdleClass *idle_class;
+} QueueEntry;
+
+/* Cancelling a class bumps its generation, queued entries of older
+ * generations are dropped when they reach the top of the heap */
+typedef struct IdleClass {
+	gint idle_class;
+	guint generation;
+	gint queued;
+} IdleClass;
+
 static GMutex init_lock;
-static GAsyncQueue *queue = NULL;
-static GRecMutex io_lock;
-static GTimer *io_lock_timer = NULL;
+static gboolean initialized = FALSE;
+static GMutex queue_lock;
+static GCond queue_cond;
+static GPtrArray *heap = NULL;
+static GHashTable *entries = NULL; /* RSIoJob -> QueueEntry */
+static GHashTable *idle_classes = NULL; /* idle_class -> IdleClass */
+static guint64 queue_sequence = 0;
 static gboolean pause_queue = FALSE;
-static gint queue_active_count = 0;
-static GMutex count_lock;
+static RSIoQueueStats stats = {0};
+static GMutex scheduler_lock;
+static GHashTable *devices = NULL;
+static gint default_concurrency = 0;
+static void io_thread_free(gpointer data);
+static GPrivate io_thread = G_PRIVATE_INIT(io_thread_free);
 
+#define HEAP_ENTRY(i) ((QueueEntry *) g_ptr_array_index(heap, (i)))
 
-static gint
-queue_sort(gconstpointer a, gconstpointer b, gpointer user_data)
+static inline gboolean
+entry_before(const QueueEntry *a, const QueueEntry *b)
+{
+	if (a->job->priority != b->job->priority)
+		return a->job->priority < b->job->priority;
+	return a->sequence < b->sequence;
+}
+
+static inline void
+heap_set(guint i, QueueEntry *entry)
+{
+	g_ptr_array_index(heap, i) = entry;
+	entry->index = i;
+}
+
+static void
+heap_sift_up(guint i)
+{
+	QueueEntry *entry = HEAP_ENTRY(i);
+
+	while (i > 0)
+	{
+		guint parent = (i - 1) / 2;
+		if (!entry_before(entry, HEAP_ENTRY(parent)))
+			break;
+		heap_set(i, HEAP_ENTRY(parent));
+		i = parent;
+	}
+	heap_set(i, entry);
+}
+
+static void
+heap_sift_down(guint i)
+{
+	QueueEntry *entry = HEAP_ENTRY(i);
+
+	while (TRUE)
+	{
+		guint child = i * 2 + 1;
+		if (child >= heap->len)
+			break;
+		if (child + 1 < heap->len && entry_before(HEAP_ENTRY(child + 1), HEAP_ENTRY(child)))
+			child++;
+		if (!entry_before(HEAP_ENTRY(child), entry))
+			break;
+		heap_set(i, HEAP_ENTRY(child));
+		i = child;
+	}
+	heap_set(i, entry);
+}
+
+/**
+ * Remove an entry from the heap in O(log n)
+ * @note Must be called with queue_lock held
+ */
+static void
+heap_remove(QueueEntry *entry)
+{
+	guint i = entry->index;
+	QueueEntry *last = g_ptr_array_remove_index(heap, heap->len - 1);
+
+	if (last == entry)
+		return;
+
+	heap_set(i, last);
+	if (i > 0 && entry_before(last, HEAP_ENTRY((i - 1) / 2)))
+		heap_sift_up(i);
+	else
+		heap_sift_down(i);
+}
+
+/**
+ * @note Must be called with queue_lock held
+ */
+static IdleClass *
+get_idle_class(gint idle_class)
+{
+	IdleClass *klass = g_hash_table_lookup(idle_classes, GINT_TO_POINTER(idle_class));
+
+	if (!klass)
+	{
+		klass = g_new0(IdleClass, 1);
+		klass->idle_class = idle_class;
+		g_hash_table_insert(idle_classes, GINT_TO_POINTER(idle_class), klass);
+	}
+
+	return klass;
+}
+
+/**
+ * Forget an entry that has left the heap
+ * @note Must be called with queue_lock held
+ */
+static void
+entry_free(QueueEntry *entry)
+{
+	g_hash_table_remove(entries, entry->job);
+	g_slice_free(QueueEntry, entry);
+}
+
+/**
+ * Get the next job to run, skipping jobs from cancelled classes
+ * @note Must be called with queue_lock held
+ * @return The next entry or NULL if the queue is empty or paused
+ */
+static QueueEntry *
+queue_pop(void)
 {
-	gint id1 = 0;
-	gint id2 = 0;
+	while (!pause_queue && heap->len > 0)
+	{
+		QueueEntry *entry = HEAP_ENTRY(0);
+		heap_remove(entry);
+
+		/* Cancelled by rs_io_idle_cancel_class(), already accounted for */
+		if (entry->generation != entry->idle_class->generation)
+		{
+			entry_free(entry);
+			continue;
+		}
 
-	if (a)
-		id1 = RS_IO_JOB(a)->priority;
-	if (b)
-		id2 = RS_IO_JOB(b)->priority;
+		entry->idle_class->queued--;
+		stats.queued--;
+		return entry;
+	}
 
-	return (id1 > id2 ? +1 : id1 == id2 ? 0 : -1);
+	return NULL;
 }
 
 static gpointer
 queue_worker(gpointer data)
 {
-	GAsyncQueue *queue = data;
+	QueueEntry *entry;
 	RSIoJob *job;
+	gint64 start, wait;
 
 	while (1)
 	{
-		if (pause_queue)
-			g_usleep(1000);
-		else
-		{
-			g_mutex_lock(&count_lock);
-			job = g_async_queue_try_pop(queue);
-			if (job)
-				queue_active_count++;
-			g_mutex_unlock(&count_lock);
-
-			/* If we somehow got NULL, continue. I'm not sure this will ever happen, but this is better than random segfaults :) */
-			if (job)
-			{
-				rs_io_job_execute(job);
-				rs_io_job_do_callback(job);
-				g_mutex_lock(&count_lock);
-				queue_active_count--;
-				g_mutex_unlock(&count_lock);
-			}
-			else
-			{
-				/* Sleep 1 ms */
-				g_usleep(1000);
-			}
-		}
+		g_mutex_lock(&queue_lock);
+		while (!(entry = queue_pop()))
+			g_cond_wait(&queue_cond, &queue_lock);
+
+		job = entry->job;
+		start = g_get_monotonic_time();
+		wait = start - entry->queued;
+		stats.active++;
+		stats.wait_total += wait;
+		stats.wait_max = MAX(stats.wait_max, wait);
+		entry_free(entry);
+		g_mutex_unlock(&queue_lock);
+
+		rs_io_job_execute(job);
+		rs_io_job_do_callback(job);
+
+		g_mutex_lock(&queue_lock);
+		stats.active--;
+		stats.completed++;
+		stats.run_total += g_get_monotonic_time() - start;
+		g_mutex_unlock(&queue_lock);
 	}
 
 	return NULL;
@@ -85,13 +256,14 @@ init(void)
 {
 	int i;
 	g_mutex_lock(&init_lock);
-	if (!queue)
+	if (!initialized)
 	{
-		queue = g_async_queue_new();
+		heap = g_ptr_array_new();
+		entries = g_hash_table_new(g_direct_hash, g_direct_equal);
+		idle_classes = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
 		for (i = 0; i < rs_get_number_of_processor_cores(); i++)
-			g_thread_new("io worker", queue_worker, queue);
-
-		io_lock_timer = g_timer_new();
+			g_thread_new("io worker", queue_worker, NULL);
+		initialized = TRUE;
 	}
 	g_mutex_unlock(&init_lock);
 }
@@ -106,13 +278,33 @@ init(void)
 void
 rs_io_idle_add_job(RSIoJob *job, gint idle_class, gint priority, gpointer user_data)
 {
+	QueueEntry *entry;
+
 	g_return_if_fail(RS_IS_IO_JOB(job));
 
+	init();
+
 	job->idle_class = idle_class;
 	job->priority = priority;
 	job->user_data = user_data;
 
-	g_async_queue_push_sorted(queue, job, queue_sort, NULL);
+	entry = g_slice_new(QueueEntry);
+	entry->job = job;
+	entry->queued = g_get_monotonic_time();
+
+	g_mutex_lock(&queue_lock);
+	entry->sequence = queue_sequence++;
+	entry->idle_class = get_idle_class(idle_class);
+	entry->generation = entry->idle_class->generation;
+	entry->idle_class->queued++;
+	g_hash_table_insert(entries, job, entry);
+	g_ptr_array_add(heap, entry);
+	heap_sift_up(heap->len - 1);
+
+	stats.queued++;
+	stats.queued_max = MAX(stats.queued_max, stats.queued);
+	g_cond_signal(&queue_cond);
+	g_mutex_unlock(&queue_lock);
 }
 
 /**
@@ -228,118 +420,350 @@ rs_io_idle_restore_tags(const gchar *path, gint idle_class)
 void
 rs_io_idle_cancel_class(gint idle_class)
 {
-	/* This behaves like rs_io_idle_cancel_class(), please see comments there */
-	RSIoJob *current_job;
-	RSIoJob *marker_job = rs_io_job_new();
+	IdleClass *klass;
 
 	init();
 
-	g_async_queue_lock(queue);
+	g_mutex_lock(&queue_lock);
+	klass = get_idle_class(idle_class);
 
-	/* Put a marker in the queue, we will rotate the complete queue, so we have to know when we're around */
-	g_async_queue_push_unlocked(queue, marker_job);
+	/* Queued jobs of this class are now stale, queue_pop() will drop them */
+	klass->generation++;
+	stats.queued -= klass->queued;
+	stats.cancelled += klass->queued;
+	klass->queued = 0;
+	g_mutex_unlock(&queue_lock);
+}
 
-	while((current_job = g_async_queue_pop_unlocked(queue)))
+/**
+ * Cancel an idle request
+ * @param request_id A request_id as returned by rs_io_idle_read_complete_file()
+ */
+void
+rs_io_idle_cancel(RSIoJob *job)
+{
+	QueueEntry *entry;
+
+	init();
+
+	g_mutex_lock(&queue_lock);
+	entry = g_hash_table_lookup(entries, job);
+
+	/* The job may already be running, finished or stale */
+	if (entry && entry->generation == entry->idle_class->generation)
 	{
-		/* If current job matches marker, we're done */
-		if (current_job == marker_job)
-			break;
+		heap_remove(entry);
+		entry->idle_class->queued--;
+		stats.queued--;
+		stats.cancelled++;
+		entry_free(entry);
+	}
+	g_mutex_unlock(&queue_lock);
+}
+
+/**
+ * Change the priority of a queued idle request
+ * @param job A RSIoJob as returned by one of the rs_io_idle_*() functions
+ * @param priority Lower value means higher priority
+ */
+void
+rs_io_idle_set_priority(const RSIoJob *job, gint priority)
+{
+	QueueEntry *entry;
+	gint old_priority;
+
+	init();
+
+	g_mutex_lock(&queue_lock);
+	entry = g_hash_table_lookup(entries, job);
+
+	/* Only jobs still waiting can be moved */
+	if (entry && entry->generation == entry->idle_class->generation)
+	{
+		old_priority = entry->job->priority;
+		entry->job->priority = priority;
+		if (priority < old_priority)
+			heap_sift_up(entry->index);
+		else
+			heap_sift_down(entry->index);
+	}
+	g_mutex_unlock(&queue_lock);
+}
+
+static void
+io_thread_free(gpointer data)
+{
+	IoThread *thread = data;
+
+	g_array_free(thread->holds, TRUE);
+	g_free(thread);
+}
+
+static IoThread *
+get_io_thread(void)
+{
+	IoThread *thread = g_private_get(&io_thread);
+
+	if (!thread)
+	{
+		thread = g_new0(IoThread, 1);
+		thread->io_class = RS_IO_CLASS_INTERACTIVE;
+		thread->holds = g_array_new(FALSE, FALSE, sizeof(IoHold));
+		g_private_set(&io_thread, thread);
+	}
+
+	return thread;
+}
+
+/**
+ * Guess how many concurrent requests a device handles well
+ * @note Must be called with scheduler_lock held
+ */
+static gint
+device_concurrency(guint64 device)
+{
+	gint concurrency = default_concurrency;
+
+	if (concurrency <= 0 && !rs_conf_get_integer(CONF_IO_CONCURRENCY, &concurrency))
+		concurrency = 0;
 
-		/* Of the job's idle_class doesn't match the class to cancel, we put the job back in the queue */
-		if (current_job->idle_class != idle_class)
+#if __gnu_linux__
+	/* Spinning disks only get slower from concurrent requests */
+	if (concurrency <= 0 && device != RS_IO_DEVICE_ANY)
+	{
+		gchar *path;
+		gchar *contents = NULL;
+
+		path = g_strdup_printf("/sys/dev/block/%u:%u/queue/rotational", major(device), minor(device));
+		if (!g_file_get_contents(path, &contents, NULL, NULL))
 		{
-			g_async_queue_push_unlocked(queue, current_job);
+			/* Partitions keep the queue in the parent device */
+			g_free(path);
+			path = g_strdup_printf("/sys/dev/block/%u:%u/../queue/rotational", major(device), minor(device));
+			g_file_get_contents(path, &contents, NULL, NULL);
 		}
+		if (contents && contents[0] == '1')
+			concurrency = 1;
+		g_free(contents);
+		g_free(path);
 	}
+#endif
 
-	/* Make sure the queue is sorted */
-	g_async_queue_sort_unlocked(queue, queue_sort, NULL);
+	if (concurrency <= 0)
+		concurrency = DEFAULT_CONF_IO_CONCURRENCY;
 
-	g_async_queue_unlock(queue);
+	return concurrency;
+}
 
-	g_object_unref(marker_job);
+/**
+ * @note Must be called with scheduler_lock held
+ */
+static IoDevice *
+get_device(guint64 device)
+{
+	IoDevice *dev;
+
+	if (!devices)
+		devices = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+
+	dev = g_hash_table_lookup(devices, &device);
+	if (!dev)
+	{
+		dev = g_new0(IoDevice, 1);
+		dev->device = device;
+		dev->max_active = device_concurrency(device);
+		g_cond_init(&dev->cond);
+		g_hash_table_insert(devices, &dev->device, dev);
+	}
+
+	return dev;
 }
 
 /**
- * Cancel an idle request
- * @param request_id A request_id as returned by rs_io_idle_read_complete_file()
+ * Check if a request of io_class may start on a device
+ * @note Must be called with scheduler_lock held
  */
-void
-rs_io_idle_cancel(RSIoJob *job)
+static gboolean
+device_available(IoDevice *dev, RSIoClass io_class)
 {
-	/* This behaves like rs_io_idle_cancel_class(), please see comments there */
-	RSIoJob *current_job;
-	RSIoJob *marker_job = rs_io_job_new();
+	gint c;
 
-	init();
+	if (dev->active >= dev->max_active)
+		return FALSE;
+
+	/* Let more important requests go first */
+	for (c = 0; c < io_class; c++)
+		if (dev->waiting[c] > 0)
+			return FALSE;
 
-	g_async_queue_lock(queue);
+	return TRUE;
+}
 
-	/* Put a marker in the queue, we will rotate the complete queue, so we have to know when we're around */
-	g_async_queue_push_unlocked(queue, marker_job);
+/**
+ * Get the device a file is stored on
+ * @param path Absolute path to a file or directory. If it doesn't exist, the
+ *        directory it would be created in is used
+ * @return A device number or RS_IO_DEVICE_ANY if unknown
+ */
+guint64
+rs_io_get_device(const gchar *path)
+{
+	struct stat st;
+	guint64 device = RS_IO_DEVICE_ANY;
 
-	while((current_job = g_async_queue_pop_unlocked(queue)))
+	g_return_val_if_fail(path != NULL, RS_IO_DEVICE_ANY);
+
+	if (stat(path, &st) == 0)
+		device = st.st_dev;
+	else
 	{
-		/* If current job matches marker, we're done */
-		if (current_job == marker_job)
-			break;
+		gchar *dirname = g_path_get_dirname(path);
+		if (stat(dirname, &st) == 0)
+			device = st.st_dev;
+		g_free(dirname);
+	}
+
+	return device;
+}
 
-		if (current_job != job)
-			g_async_queue_push_unlocked(queue, current_job);
+/**
+ * Set the maximum number of concurrent requests for a device
+ * @param path A file on the device or NULL to change the default for all
+ *        devices not set explicitly
+ * @param concurrency Number of concurrent requests, 0 to guess
+ */
+void
+rs_io_set_device_concurrency(const gchar *path, gint concurrency)
+{
+	GHashTableIter iter;
+	IoDevice *dev;
+
+	guint64 device = path ? rs_io_get_device(path) : RS_IO_DEVICE_ANY;
+
+	g_mutex_lock(&scheduler_lock);
+	if (path)
+	{
+		dev = get_device(device);
+		dev->max_active = (concurrency > 0) ? concurrency : device_concurrency(device);
+		dev->max_active_set = (concurrency > 0);
+		g_cond_broadcast(&dev->cond);
+	}
+	else
+	{
+		default_concurrency = concurrency;
+		if (devices)
+		{
+			g_hash_table_iter_init(&iter, devices);
+			while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &dev))
+			{
+				if (!dev->max_active_set)
+					dev->max_active = device_concurrency(dev->device);
+				g_cond_broadcast(&dev->cond);
+			}
+		}
 	}
+	g_mutex_unlock(&scheduler_lock);
+}
+
+/**
+ * Set the I/O class of the calling thread
+ * @param io_class The class to use for following rs_io_lock() calls
+ * @return The previous class
+ */
+RSIoClass
+rs_io_set_class(RSIoClass io_class)
+{
+	IoThread *thread = get_io_thread();
+	RSIoClass previous = thread->io_class;
 
-	/* Make sure the queue is sorted */
-	g_async_queue_sort_unlocked(queue, queue_sort, NULL);
+	g_return_val_if_fail(io_class < RS_IO_CLASS_MAX, previous);
 
-	g_async_queue_unlock(queue);
+	thread->io_class = io_class;
 
-	g_object_unref(marker_job);
+	return previous;
 }
 
 /**
- * Aquire the IO lock
+ * Aquire an I/O slot on a device
  */
 void
-rs_io_lock_real(const gchar *source_file, gint line, const gchar *caller)
+rs_io_lock_real(guint64 device, const gchar *source_file, gint line, const gchar *caller)
 {
-	RS_DEBUG(LOCKING, "[%s:%d %s()] \033[33mrequesting\033[0m IO lock (thread %p)",
-		source_file, line, caller,
-		(g_timer_start(io_lock_timer), g_thread_self()));
-
-	/* Each loop tries approx every millisecond, so we wait 10 secs */
-	int tries_left = 10*1000;
+	IoThread *thread = get_io_thread();
+	IoHold hold = {NULL, TRUE, 0};
+	gint64 end_time;
+	guint i;
 
-	while (FALSE == g_rec_mutex_trylock(&io_lock))
+	/* Locks are recursive. An unknown device means whatever we hold already */
+	for (i = thread->holds->len; i > 0; i--)
 	{
-		g_usleep(1000);
-		if (--tries_left <= 0)
+		IoHold *held = &g_array_index(thread->holds, IoHold, i - 1);
+		if (device == RS_IO_DEVICE_ANY || held->device->device == device)
 		{
-			RS_DEBUG(LOCKING, "[%s:%d %s()] \033[31mIO Lock was not released after \033[36m%.2f\033[0mms\033[0m, ignoring IO lock (thread %p)",
-				source_file, line, caller,
-				g_timer_elapsed(io_lock_timer, NULL)*1000.0,
-				(g_timer_start(io_lock_timer), g_thread_self()));
+			hold = *held;
+			hold.counted = FALSE;
+			g_array_append_val(thread->holds, hold);
 			return;
 		}
 	}
 
+	RS_DEBUG(LOCKING, "[%s:%d %s()] \033[33mrequesting\033[0m IO lock on device %" G_GUINT64_FORMAT " (thread %p)",
+		source_file, line, caller, device, g_thread_self());
+
+	hold.start = g_get_monotonic_time();
+	end_time = hold.start + IO_LOCK_TIMEOUT;
+
+	g_mutex_lock(&scheduler_lock);
+	hold.device = get_device(device);
+	hold.device->waiting[thread->io_class]++;
+	while (!device_available(hold.device, thread->io_class))
+		if (!g_cond_wait_until(&hold.device->cond, &scheduler_lock, end_time))
+		{
+			RS_DEBUG(LOCKING, "[%s:%d %s()] \033[31mIO lock was not released after \033[36m%.2f\033[0mms\033[0m, ignoring IO lock (thread %p)",
+				source_file, line, caller,
+				(g_get_monotonic_time() - hold.start) / 1000.0, g_thread_self());
+			hold.counted = FALSE;
+			break;
+		}
+	hold.device->waiting[thread->io_class]--;
+	if (hold.counted)
+		hold.device->active++;
+	g_mutex_unlock(&scheduler_lock);
+
 	RS_DEBUG(LOCKING, "[%s:%d %s()] \033[32mgot\033[0m IO lock after \033[36m%.2f\033[0mms (thread %p)",
 		source_file, line, caller,
-		g_timer_elapsed(io_lock_timer, NULL)*1000.0,
-		(g_timer_start(io_lock_timer), g_thread_self()));
+		(g_get_monotonic_time() - hold.start) / 1000.0, g_thread_self());
+
+	hold.start = g_get_monotonic_time();
+	g_array_append_val(thread->holds, hold);
 }
 
 /**
- * Release the IO lock
+ * Release the I/O slot aquired last by this thread
  */
 void
 rs_io_unlock_real(const gchar *source_file, gint line, const gchar *caller)
 {
+	IoThread *thread = get_io_thread();
+	IoHold hold;
+
+	g_return_if_fail(thread->holds->len > 0);
+
+	hold = g_array_index(thread->holds, IoHold, thread->holds->len - 1);
+	g_array_set_size(thread->holds, thread->holds->len - 1);
+
+	if (!hold.counted)
+		return;
+
 	RS_DEBUG(LOCKING, "[%s:%d %s()] releasing IO lock after \033[36m%.2f\033[0mms (thread %p)",
 		source_file, line, caller,
-		g_timer_elapsed(io_lock_timer, NULL)*1000.0,
+		(g_get_monotonic_time() - hold.start) / 1000.0,
 		g_thread_self());
 
-	g_rec_mutex_unlock(&io_lock);
+	g_mutex_lock(&scheduler_lock);
+	hold.device->active--;
+	g_cond_broadcast(&hold.device->cond);
+	g_mutex_unlock(&scheduler_lock);
 }
 
 /**
@@ -348,7 +772,9 @@ rs_io_unlock_real(const gchar *source_file, gint line, const gchar *caller)
 void
 rs_io_idle_pause(void)
 {
+	g_mutex_lock(&queue_lock);
 	pause_queue = TRUE;
+	g_mutex_unlock(&queue_lock);
 }
 
 /**
@@ -357,7 +783,10 @@ rs_io_idle_pause(void)
 void
 rs_io_idle_unpause(void)
 {
+	g_mutex_lock(&queue_lock);
 	pause_queue = FALSE;
+	g_cond_broadcast(&queue_cond);
+	g_mutex_unlock(&queue_lock);
 }
 
 /**
@@ -366,8 +795,38 @@ rs_io_idle_unpause(void)
 gint
 rs_io_get_jobs_left(void)
 {
-	g_mutex_lock(&count_lock);
-	gint left = g_async_queue_length(queue) + queue_active_count;
-	g_mutex_unlock(&count_lock);
+	g_mutex_lock(&queue_lock);
+	gint left = stats.queued + stats.active;
+	g_mutex_unlock(&queue_lock);
 	return left;
-}
\ No newline at end of file
+}
+
+/**
+ * Get queue statistics for monitoring
+ * @param out_stats A RSIoQueueStats to fill
+ */
+void
+rs_io_get_queue_stats(RSIoQueueStats *out_stats)
+{
+	g_return_if_fail(out_stats != NULL);
+
+	g_mutex_lock(&queue_lock);
+	*out_stats = stats;
+	g_mutex_unlock(&queue_lock);
+}
+
+/**
+ * Reset the cumulative queue statistics
+ */
+void
+rs_io_reset_queue_stats(void)
+{
+	g_mutex_lock(&queue_lock);
+	stats.queued_max = stats.queued;
+	stats.completed = 0;
+	stats.cancelled = 0;
+	stats.wait_total = 0;
+	stats.wait_max = 0;
+	stats.run_total = 0;
+	g_mutex_unlock(&queue_lock);
+}
@@ -22,6 +22,18 @@
 #ifndef RS_IO_H
 #define RS_IO_H
 
+/* Counters for the idle queue, times are in microseconds */
+typedef struct {
+	gint queued;        /* Jobs waiting in the queue */
+	gint queued_max;    /* Deepest the queue has been */
+	gint active;        /* Jobs currently executing */
+	guint64 completed;  /* Jobs executed */
+	guint64 cancelled;  /* Jobs cancelled before they could run */
+	gint64 wait_total;  /* Time spent queued by executed jobs */
+	gint64 wait_max;    /* Longest time a job spent queued */
+	gint64 run_total;   /* Time spent executing jobs */
+} RSIoQueueStats;
+
 /**
  * Add a RSIoJob to be executed later
  * @param job A RSIoJob. This will be unreffed upon completion
@@ -97,6 +109,14 @@ rs_io_idle_cancel_class(gint idle_class);
 void
 rs_io_idle_cancel(RSIoJob *job);
 
+/**
+ * Change the priority of a queued idle request
+ * @param job A RSIoJob as returned by one of the rs_io_idle_*() functions
+ * @param priority Lower value means higher priority
+ */
+void
+rs_io_idle_set_priority(const RSIoJob *job, gint priority);
+
 /**
  * Pause the worker threads
  */
@@ -109,25 +129,73 @@ rs_io_idle_pause(void);
 void
 rs_io_idle_unpause(void);
 
-#define rs_io_lock() rs_io_lock_real(__FILE__, __LINE__, __FUNCTION__)
+/* Used when the device is unknown, this will reuse a device already held
+ * by the calling thread */
+#define RS_IO_DEVICE_ANY 0
+
+/* I/O is arbitrated per device by class, see rs_io_set_class(). All locks
+ * are recursive and rs_io_unlock() releases the most recent lock taken by
+ * the calling thread */
+#define rs_io_lock() rs_io_lock_real(RS_IO_DEVICE_ANY, __FILE__, __LINE__, __FUNCTION__)
+#define rs_io_lock_file(path) rs_io_lock_real(rs_io_get_device(path), __FILE__, __LINE__, __FUNCTION__)
+#define rs_io_lock_rawfile(rawfile) rs_io_lock_real(raw_get_device(rawfile), __FILE__, __LINE__, __FUNCTION__)
 #define rs_io_unlock() rs_io_unlock_real(__FILE__, __LINE__, __FUNCTION__)
 
 /**
- * Aquire the IO lock
+ * Aquire an I/O slot on a device
  */
 void
-rs_io_lock_real(const gchar *source_file, gint line, const gchar *caller);
+rs_io_lock_real(guint64 device, const gchar *source_file, gint line, const gchar *caller);
 
 /**
- * Release the IO lock
+ * Release the I/O slot aquired last by this thread
  */
 void
 rs_io_unlock_real(const gchar *source_file, gint line, const gchar *caller);
 
+/**
+ * Get the device a file is stored on
+ * @param path Absolute path to a file or directory. If it doesn't exist, the
+ *        directory it would be created in is used
+ * @return A device number or RS_IO_DEVICE_ANY if unknown
+ */
+guint64
+rs_io_get_device(const gchar *path);
+
+/**
+ * Set the maximum number of concurrent requests for a device
+ * @param path A file on the device or NULL to change the default for all
+ *        devices not set explicitly
+ * @param concurrency Number of concurrent requests, 0 to guess
+ */
+void
+rs_io_set_device_concurrency(const gchar *path, gint concurrency);
+
+/**
+ * Set the I/O class of the calling thread
+ * @param io_class The class to use for following rs_io_lock() calls
+ * @return The previous class
+ */
+RSIoClass
+rs_io_set_class(RSIoClass io_class);
+
 /**
  * Returns the number of jobs left
  */
 gint
 rs_io_get_jobs_left(void);
 
+/**
+ * Get queue statistics for monitoring
+ * @param out_stats A RSIoQueueStats to fill
+ */
+void
+rs_io_get_queue_stats(RSIoQueueStats *out_stats);
+
+/**
+ * Reset the cumulative queue statistics
+ */
+void
+rs_io_reset_queue_stats(void);
+
 #endif /* RS_IO_H */
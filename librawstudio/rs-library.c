@@ -41,6 +41,13 @@
  *
  * version: Version information for upgrading
  *   version integer: Version written by Rawstudio, can be compared to LIBRARY_VERSION
+ *
+ * Indexes (from version 3):
+ *   library_filename: library(filename)
+ *   tags_tagname: tags(tagname)
+ *   tags_tagname_nocase: tags(tagname COLLATE NOCASE), used by searches
+ *   phototags_photo_tag: phototags(photo, tag)
+ *   phototags_tag: phototags(tag)
  */
 /*
 #include <glib.h>
@@ -63,11 +70,58 @@
 #include <libxml/xmlwriter.h>
 #include <sqlite3.h>
 
-#define LIBRARY_VERSION 2
+#define LIBRARY_VERSION 3
 #define TAGS_XML_FILE "tags.xml"
 #define MAX_SEARCH_RESULTS 1000
+/* Number of writes to collect before committing an open batch */
+#define LIBRARY_BATCH_SIZE 500
+/* Commit an open batch at least this often, in microseconds */
+#define LIBRARY_BATCH_TIME (2*G_USEC_PER_SEC)
 #include "rs-types.h"
 
+/* Statements prepared once and kept for the lifetime of the library */
+typedef enum {
+	STMT_USER_VERSION,
+	STMT_FIND_TAG,
+	STMT_FIND_PHOTO,
+	STMT_PHOTO_ADD_TAG,
+	STMT_IS_PHOTO_TAGGED,
+	STMT_SET_IDENTIFIER,
+	STMT_ADD_PHOTO,
+	STMT_ADD_TAG,
+	STMT_DELETE_PHOTO,
+	STMT_DELETE_TAG,
+	STMT_PHOTO_DELETE_TAGS,
+	STMT_TAG_DELETE_PHOTOS,
+	STMT_TAG_IS_USED,
+	STMT_PHOTO_TAGS,
+	STMT_PHOTO_TAGS_MANUAL,
+	STMT_FIND_TAGS,
+	STMT_BACKUP_TAGS,
+	STMT_MAX
+} LibraryStatement;
+
+static const gchar *library_statement_sql[STMT_MAX] = {
+	[STMT_USER_VERSION] = "PRAGMA user_version;",
+	[STMT_FIND_TAG] = "SELECT id FROM tags WHERE tagname = ?1;",
+	[STMT_FIND_PHOTO] = "SELECT id FROM library WHERE filename = ?1;",
+	[STMT_PHOTO_ADD_TAG] = "INSERT INTO phototags (photo, tag, autotag) VALUES (?1, ?2, ?3);",
+	[STMT_IS_PHOTO_TAGGED] = "SELECT 1 FROM phototags WHERE photo = ?1 AND tag = ?2 LIMIT 1;",
+	[STMT_SET_IDENTIFIER] = "UPDATE library SET identifier = ?1 WHERE id = ?2;",
+	[STMT_ADD_PHOTO] = "INSERT INTO library (filename) VALUES (?1);",
+	[STMT_ADD_TAG] = "INSERT INTO tags (tagname) VALUES (?1);",
+	[STMT_DELETE_PHOTO] = "DELETE FROM library WHERE id = ?1;",
+	[STMT_DELETE_TAG] = "DELETE FROM tags WHERE id = ?1;",
+	[STMT_PHOTO_DELETE_TAGS] = "DELETE FROM phototags WHERE photo = ?1;",
+	[STMT_TAG_DELETE_PHOTOS] = "DELETE FROM phototags WHERE tag = ?1;",
+	[STMT_TAG_IS_USED] = "SELECT 1 FROM phototags WHERE tag = ?1 LIMIT 1;",
+	[STMT_PHOTO_TAGS] = "select tags.tagname from library,phototags,tags WHERE library.id=phototags.photo and phototags.tag=tags.id and library.filename = ?1;",
+	[STMT_PHOTO_TAGS_MANUAL] = "select tags.tagname from library,phototags,tags WHERE library.id=phototags.photo and phototags.tag=tags.id and library.filename = ?1 and phototags.autotag = 0;",
+	[STMT_FIND_TAGS] = "select tags.tagname from tags WHERE tags.tagname like ?1 order by tags.tagname;",
+	/* A range instead of LIKE, so the filename index can be used */
+	[STMT_BACKUP_TAGS] = "select library.filename,library.identifier,tags.tagname,phototags.autotag from library,phototags,tags where library.filename >= ?1 and library.filename < ?2 and phototags.photo = library.id and tags.id = phototags.tag order by library.filename;",
+};
+
 struct _RSLibrary {
 	GObject parent;
 	gboolean dispose_has_run;
@@ -78,6 +132,13 @@ struct _RSLibrary {
 	/* This mutex must be used when inserting data in a table with an
 	   autocrementing column - which is ALWAYS for sqlite */
 	GMutex id_lock;
+
+	/* Protects the cached statements and the batch state */
+	GRecMutex db_lock;
+	sqlite3_stmt *statements[STMT_MAX];
+	gint batch_depth;
+	gint batch_writes;
+	gint64 batch_started;
 };
 
 G_DEFINE_TYPE(RSLibrary, rs_library, G_TYPE_OBJECT)
@@ -85,6 +146,7 @@ G_DEFINE_TYPE(RSLibrary, rs_library, G_TYPE_OBJECT)
 static gint library_execute_sql(sqlite3 *db, const gchar *sql);
 static void library_sqlite_error(sqlite3 *db, const gint result);
 static gint library_create_tables(sqlite3 *db);
+static void library_create_indexes(sqlite3 *db);
 static gint library_find_tag_id(RSLibrary *library, const gchar *tagname);
 static gint library_find_photo_id(RSLibrary *library, const gchar *photo);
 static void library_photo_add_tag(RSLibrary *library, const gint photo_id, const gint tag_id, const gboolean autotag);
@@ -107,8 +169,14 @@ rs_library_dispose(GObject *object)
 
 	if (!library->dispose_has_run)
 	{
+		gint i;
 		library->dispose_has_run = TRUE;
 
+		if (library->batch_depth > 0)
+			library_execute_sql(library->db, "COMMIT;");
+		for (i = 0; i < STMT_MAX; i++)
+			if (library->statements[i])
+				sqlite3_finalize(library->statements[i]);
 		sqlite3_close(library->db);
 	}
 
@@ -131,15 +199,138 @@ rs_library_class_init(RSLibraryClass *klass)
 	object_class->finalize = rs_library_finalize;
 }
 
+/**
+ * Get a cached prepared statement, this must be followed by a call to
+ * library_statement_end() when done with the statement
+ * @param library A RSLibrary
+ * @param which The statement to get
+ * @return A statement ready for binding or NULL on error
+ */
+static sqlite3_stmt *
+library_statement_begin(RSLibrary *library, LibraryStatement which)
+{
+	gint rc;
+
+	g_rec_mutex_lock(&library->db_lock);
+	if (!library->statements[which])
+	{
+		rc = sqlite3_prepare_v2(library->db, library_statement_sql[which], -1, &library->statements[which], NULL);
+		if (rc != SQLITE_OK)
+			library->statements[which] = NULL;
+	}
+
+	return library->statements[which];
+}
+
+/**
+ * Reset a statement from library_statement_begin() for later use
+ * @param library A RSLibrary
+ * @param stmt A statement as returned by library_statement_begin()
+ */
+static void
+library_statement_end(RSLibrary *library, sqlite3_stmt *stmt)
+{
+	if (stmt)
+	{
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+	}
+	g_rec_mutex_unlock(&library->db_lock);
+}
+
+/**
+ * Count a write and commit the batch if it has grown large or old, this
+ * keeps a long import from piling everything up in one transaction
+ */
+static void
+library_batch_wrote(RSLibrary *library)
+{
+	g_rec_mutex_lock(&library->db_lock);
+	if (library->batch_depth > 0 && (++library->batch_writes >= LIBRARY_BATCH_SIZE
+		|| g_get_monotonic_time() - library->batch_started >= LIBRARY_BATCH_TIME))
+	{
+		library_execute_sql(library->db, "COMMIT;");
+		library_execute_sql(library->db, "BEGIN TRANSACTION;");
+		library->batch_writes = 0;
+		library->batch_started = g_get_monotonic_time();
+	}
+	g_rec_mutex_unlock(&library->db_lock);
+}
+
+/**
+ * Start a batch of writes. Writes from all threads are collected in a
+ * transaction until the last batch is ended. Batches can be nested
+ * @param library A RSLibrary
+ */
+void
+rs_library_begin_batch(RSLibrary *library)
+{
+	g_return_if_fail(RS_IS_LIBRARY(library));
+
+	if (!rs_library_has_database_connection(library)) return;
+
+	g_rec_mutex_lock(&library->db_lock);
+	if (library->batch_depth++ == 0)
+	{
+		library_execute_sql(library->db, "BEGIN TRANSACTION;");
+		library->batch_writes = 0;
+		library->batch_started = g_get_monotonic_time();
+	}
+	g_rec_mutex_unlock(&library->db_lock);
+}
+
+/**
+ * End a batch started with rs_library_begin_batch()
+ * @param library A RSLibrary
+ */
+void
+rs_library_end_batch(RSLibrary *library)
+{
+	g_return_if_fail(RS_IS_LIBRARY(library));
+
+	g_rec_mutex_lock(&library->db_lock);
+	if (library->batch_depth > 0 && --library->batch_depth == 0)
+	{
+		RS_DEBUG(LIBRARY, "Committing batch of %d writes", library->batch_writes);
+		library_execute_sql(library->db, "COMMIT;");
+	}
+	g_rec_mutex_unlock(&library->db_lock);
+}
+
+/**
+ * Commit and end all open batches, even if they were not ended by their
+ * owners. Call this before exiting, the batch of a cancelled job would
+ * otherwise never be committed
+ * @param library A RSLibrary
+ */
+void
+rs_library_flush(RSLibrary *library)
+{
+	g_return_if_fail(RS_IS_LIBRARY(library));
+
+	g_rec_mutex_lock(&library->db_lock);
+	if (library->batch_depth > 0)
+	{
+		RS_DEBUG(LIBRARY, "Flushing batch of %d writes", library->batch_writes);
+		library_execute_sql(library->db, "COMMIT;");
+		library->batch_depth = 0;
+	}
+	g_rec_mutex_unlock(&library->db_lock);
+}
+
 gboolean
 rs_library_has_database_connection(RSLibrary *library)
 {
+	sqlite3_stmt *stmt;
+	gint rc;
+
 	g_return_val_if_fail(RS_IS_LIBRARY(library), FALSE);
 
-  if (library_execute_sql(library->db, "PRAGMA user_version;") == 0)
-    return TRUE;
-  else
-    return FALSE;
+	stmt = library_statement_begin(library, STMT_USER_VERSION);
+	rc = stmt ? sqlite3_step(stmt) : SQLITE_ERROR;
+	library_statement_end(library, stmt);
+
+	return (rc == SQLITE_ROW || rc == SQLITE_DONE);
 }
 
 gchar *
@@ -237,6 +428,11 @@ library_check_version(sqlite3 *db)
 			library_execute_sql(db, "COMMIT;");
 			break;
 
+		case 2:
+			library_create_indexes(db);
+			library_set_version(db, version+1);
+			break;
+
 		default:
 			/* We should never hit this */
 			g_warning("Some error occured in library_check_version() - please notify developers");
@@ -255,6 +451,8 @@ rs_library_init(RSLibrary *library)
 
 	gchar *database = g_strdup_printf("%s/.rawstudio/library.db", g_get_home_dir());
 
+	g_rec_mutex_init(&library->db_lock);
+
 	/* If unable to create database we exit */
 	if(sqlite3_open(database, &(library->db)))
 	{
@@ -264,6 +462,7 @@ rs_library_init(RSLibrary *library)
 		  g_free(library->error_init);
 		library->error_init = g_strdup(msg);
 		sqlite3_close(library->db);
+		library->db = NULL;
 	}
 	g_free(database);
 
@@ -367,6 +566,9 @@ library_create_tables(sqlite3 *db)
 		rc = sqlite3_step(stmt);
 		sqlite3_finalize(stmt);
 
+		/* Nothing to migrate, create the indexes right away */
+		library_create_indexes(db);
+
 		rc = sqlite3_prepare_v2(db, "select identifier from library", -1, &stmt, NULL);
 		rc = sqlite3_step(stmt);
 		sqlite3_finalize(stmt);
@@ -385,19 +587,36 @@ library_create_tables(sqlite3 *db)
 	return SQLITE_OK;
 }
 
+static void
+library_create_indexes(sqlite3 *db)
+{
+	GTimer *gt = g_timer_new();
+
+	library_execute_sql(db, "BEGIN TRANSACTION;");
+	library_execute_sql(db, "CREATE INDEX IF NOT EXISTS library_filename ON library (filename);");
+	library_execute_sql(db, "CREATE INDEX IF NOT EXISTS tags_tagname ON tags (tagname);");
+	library_execute_sql(db, "CREATE INDEX IF NOT EXISTS tags_tagname_nocase ON tags (tagname COLLATE NOCASE);");
+	library_execute_sql(db, "CREATE INDEX IF NOT EXISTS phototags_photo_tag ON phototags (photo, tag);");
+	library_execute_sql(db, "CREATE INDEX IF NOT EXISTS phototags_tag ON phototags (tag);");
+	library_execute_sql(db, "COMMIT;");
+
+	RS_DEBUG(LIBRARY, "Indexes created in %.0fms", g_timer_elapsed(gt, NULL)*1000.0);
+
+	g_timer_destroy(gt);
+}
+
 static gint
 library_find_tag_id(RSLibrary *library, const gchar *tagname)
 {
-	sqlite3 *db = library->db;
 	sqlite3_stmt *stmt;
 	gint rc, tag_id = -1;
 
-	rc = sqlite3_prepare_v2(db, "SELECT id FROM tags WHERE tagname = ?1;", -1, &stmt, NULL);
+	stmt = library_statement_begin(library, STMT_FIND_TAG);
 	rc = sqlite3_bind_text(stmt, 1, tagname, -1, SQLITE_TRANSIENT);
 	rc = sqlite3_step(stmt);
 	if (rc == SQLITE_ROW)
 		tag_id = sqlite3_column_int(stmt, 0);
-	rc = sqlite3_finalize(stmt);
+	library_statement_end(library, stmt);
 	return tag_id;
 }
 
@@ -408,13 +627,13 @@ library_find_photo_id(RSLibrary *library, const gchar *photo)
 	sqlite3_stmt *stmt;
 	gint rc, photo_id = -1;
 
-	rc = sqlite3_prepare_v2(db, "SELECT id FROM library WHERE filename = ?1;", -1, &stmt, NULL);
+	stmt = library_statement_begin(library, STMT_FIND_PHOTO);
 	rc = sqlite3_bind_text(stmt, 1, photo, -1, SQLITE_TRANSIENT);
 	library_sqlite_error(db, rc);
 	rc = sqlite3_step(stmt);
 	if (rc == SQLITE_ROW)
 		photo_id = sqlite3_column_int(stmt, 0);
-	rc = sqlite3_finalize(stmt);
+	library_statement_end(library, stmt);
 	return photo_id;
 }
 
@@ -430,29 +649,29 @@ library_photo_add_tag(RSLibrary *library, const gint photo_id, const gint tag_id
 		autotag_tag = 1;
 
 	g_mutex_lock(&library->id_lock);
-	rc = sqlite3_prepare_v2(db, "INSERT INTO phototags (photo, tag, autotag) VALUES (?1, ?2, ?3);", -1, &stmt, NULL);
+	stmt = library_statement_begin(library, STMT_PHOTO_ADD_TAG);
 	rc = sqlite3_bind_int (stmt, 1, photo_id);
 	rc = sqlite3_bind_int (stmt, 2, tag_id);
 	rc = sqlite3_bind_int (stmt, 3, autotag_tag);
 	rc = sqlite3_step(stmt);
-	g_mutex_unlock(&library->id_lock);
 	if (rc != SQLITE_DONE)
 		library_sqlite_error(db, rc);
-	sqlite3_finalize(stmt);
+	library_statement_end(library, stmt);
+	g_mutex_unlock(&library->id_lock);
+	library_batch_wrote(library);
 }
 
 static gboolean
 library_is_photo_tagged(RSLibrary *library, gint photo_id, gint tag_id)
 {
-	sqlite3 *db = library->db;
 	gint rc;
 	sqlite3_stmt *stmt;
 
-	rc = sqlite3_prepare_v2(db, "SELECT * FROM phototags WHERE photo = ?1 AND tag = ?2;", -1, &stmt, NULL);
+	stmt = library_statement_begin(library, STMT_IS_PHOTO_TAGGED);
 	rc = sqlite3_bind_int (stmt, 1, photo_id);
 	rc = sqlite3_bind_int (stmt, 2, tag_id);
 	rc = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
+	library_statement_end(library, stmt);
 
 	if (rc == SQLITE_ROW)
 		return TRUE;
@@ -464,14 +683,14 @@ static void
 got_checksum(const gchar *checksum, gpointer user_data)
 {
 	RSLibrary *library = rs_library_get_singleton();
-	sqlite3 *db = library->db;
 	sqlite3_stmt *stmt;
 
-	sqlite3_prepare_v2(db, "UPDATE LIBRARY SET  identifier=?1 WHERE id=?2;", -1, &stmt, NULL);
+	stmt = library_statement_begin(library, STMT_SET_IDENTIFIER);
 	sqlite3_bind_text(stmt, 1, checksum, -1, SQLITE_TRANSIENT);
 	sqlite3_bind_int(stmt, 2, GPOINTER_TO_INT(user_data));
 	sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
+	library_statement_end(library, stmt);
+	library_batch_wrote(library);
 }
 
 static gint
@@ -483,14 +702,15 @@ library_add_photo(RSLibrary *library, const gchar *filename)
 	sqlite3_stmt *stmt;
 
 	g_mutex_lock(&library->id_lock);
-	sqlite3_prepare_v2(db, "INSERT INTO library (filename) VALUES (?1);", -1, &stmt, NULL);
+	stmt = library_statement_begin(library, STMT_ADD_PHOTO);
 	rc = sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_TRANSIENT);
 	rc = sqlite3_step(stmt);
 	id = sqlite3_last_insert_rowid(db);
-	g_mutex_unlock(&library->id_lock);
 	if (rc != SQLITE_DONE)
 		library_sqlite_error(db, rc);
-	sqlite3_finalize(stmt);
+	library_statement_end(library, stmt);
+	g_mutex_unlock(&library->id_lock);
+	library_batch_wrote(library);
 
 	rs_io_idle_read_checksum(filename, -1, got_checksum, GINT_TO_POINTER(id));
 
@@ -506,93 +726,73 @@ library_add_tag(RSLibrary *library, const gchar *tagname)
 	sqlite3_stmt *stmt;
 
 	g_mutex_lock(&library->id_lock);
-	sqlite3_prepare_v2(db, "INSERT INTO tags (tagname) VALUES (?1);", -1, &stmt, NULL);
+	stmt = library_statement_begin(library, STMT_ADD_TAG);
 	rc = sqlite3_bind_text(stmt, 1, tagname, -1, SQLITE_TRANSIENT);
 	rc = sqlite3_step(stmt);
 	id = sqlite3_last_insert_rowid(db);
-	g_mutex_unlock(&library->id_lock);
 	if (rc != SQLITE_DONE)
 		library_sqlite_error(db, rc);
-	sqlite3_finalize(stmt);
+	library_statement_end(library, stmt);
+	g_mutex_unlock(&library->id_lock);
+	library_batch_wrote(library);
 
 	return id;
 }
 
-static void 
-library_delete_photo(RSLibrary *library, gint photo_id)
+/**
+ * Run a cached statement taking a single integer
+ */
+static void
+library_execute_int(RSLibrary *library, LibraryStatement which, gint value)
 {
 	sqlite3 *db = library->db;
 	sqlite3_stmt *stmt;
 	gint rc;
 
-	rc = sqlite3_prepare_v2(db, "DELETE FROM library WHERE id = ?1;", -1, &stmt, NULL);
-	rc = sqlite3_bind_int(stmt, 1, photo_id);
+	stmt = library_statement_begin(library, which);
+	rc = sqlite3_bind_int(stmt, 1, value);
 	library_sqlite_error(db, rc);
 	rc = sqlite3_step(stmt);
 	if (rc != SQLITE_DONE)
 		library_sqlite_error(db, rc);
-	rc = sqlite3_finalize(stmt);
+	library_statement_end(library, stmt);
+	library_batch_wrote(library);
 }
 
 static void 
-library_delete_tag(RSLibrary *library, gint tag_id)
+library_delete_photo(RSLibrary *library, gint photo_id)
 {
-	sqlite3 *db = library->db;
-	sqlite3_stmt *stmt;
-	gint rc;
+	library_execute_int(library, STMT_DELETE_PHOTO, photo_id);
+}
 
-	rc = sqlite3_prepare_v2(db, "DELETE FROM library WHERE filename = ?1;", -1, &stmt, NULL);
-	rc = sqlite3_bind_int(stmt, 1, tag_id);
-	library_sqlite_error(db, rc);
-	rc = sqlite3_step(stmt);
-	if (rc != SQLITE_DONE)
-		library_sqlite_error(db, rc);
-	rc = sqlite3_finalize(stmt);
+static void 
+library_delete_tag(RSLibrary *library, gint tag_id)
+{
+	library_execute_int(library, STMT_DELETE_TAG, tag_id);
 }
 
 static void 
 library_photo_delete_tags(RSLibrary *library, gint photo_id)
 {
-	sqlite3 *db = library->db;
-	sqlite3_stmt *stmt;
-	gint rc;
-
-	rc = sqlite3_prepare_v2(db, "DELETE FROM phototags WHERE photo = ?1;", -1, &stmt, NULL);
-	rc = sqlite3_bind_int(stmt, 1, photo_id);
-	library_sqlite_error(db, rc);
-	rc = sqlite3_step(stmt);
-	if (rc != SQLITE_DONE)
-		library_sqlite_error(db, rc);
-	rc = sqlite3_finalize(stmt);
+	library_execute_int(library, STMT_PHOTO_DELETE_TAGS, photo_id);
 }
 
 static void
 library_tag_delete_photos(RSLibrary *library, gint tag_id)
 {
-	sqlite3 *db = library->db;
-	sqlite3_stmt *stmt;
-	gint rc;
-
-	rc = sqlite3_prepare_v2(db, "DELETE FROM phototags WHERE tag = ?1;", -1, &stmt, NULL);
-	rc = sqlite3_bind_int(stmt, 1, tag_id);
-	library_sqlite_error(db, rc);
-	rc = sqlite3_step(stmt);
-	if (rc != SQLITE_DONE)
-		library_sqlite_error(db, rc);
-	rc = sqlite3_finalize(stmt);
+	library_execute_int(library, STMT_TAG_DELETE_PHOTOS, tag_id);
 }
 
 static gboolean
 library_tag_is_used(RSLibrary *library, gint tag_id)
 {
-	sqlite3 *db = library->db;
 	gint rc;
 	sqlite3_stmt *stmt;
 
-	rc = sqlite3_prepare_v2(db, "SELECT * FROM phototags WHERE tag = ?1;", -1, &stmt, NULL);
+	stmt = library_statement_begin(library, STMT_TAG_IS_USED);
 	rc = sqlite3_bind_int (stmt, 1, tag_id);
 	rc = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
+	library_statement_end(library, stmt);
 
 	if (rc == SQLITE_ROW)
 		return TRUE;
@@ -725,99 +925,114 @@ rs_library_delete_tag(RSLibrary *library, const gchar *tag, const gboolean force
 	return TRUE;
 }
 
-GList *
-rs_library_search(RSLibrary *library, const gchar *needle)
+/**
+ * Search the library for photos carrying all of a set of tags. Photos are
+ * passed to the callback as they are found, in filename order
+ * @param library A RSLibrary
+ * @param needle Space separated tags to search for, case insensitive
+ * @param func A function to call for each photo found, return FALSE from
+ *             this to stop the search
+ * @param user_data Data to pass to func
+ * @return The number of photos passed to func
+ */
+gint
+rs_library_search_foreach(RSLibrary *library, const gchar *needle, RSLibrarySearchFunc func, gpointer user_data)
 {
-	g_return_val_if_fail(RS_IS_LIBRARY(library), NULL);
-	g_return_val_if_fail(needle != NULL, NULL);
+	g_return_val_if_fail(RS_IS_LIBRARY(library), 0);
+	g_return_val_if_fail(needle != NULL, 0);
+	g_return_val_if_fail(func != NULL, 0);
 
-	if (!rs_library_has_database_connection(library)) return NULL;
+	if (!rs_library_has_database_connection(library)) return 0;
 
 	sqlite3_stmt *stmt;
 	gint rc;
 	sqlite3 *db = library->db;
-	gchar *tag;
-	gint n, num_tags;
-	GList *photos = NULL;
+	gint n, num_tags = 0;
+	gint count = 0;
 	GTimer *gt = g_timer_new();
-	gchar *filename;
+	const gchar *filename;
 	gchar **needle_parts;
+	GString *sql;
 
-	/* Create filter table */
-	sqlite3_prepare_v2(db, "create temp table filter (photo integer)", -1, &stmt, NULL);
-	rc = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
-	library_sqlite_error(db, rc);
-
+	/* Collect unique tags, ignoring empty parts from repeated spaces */
 	needle_parts = g_strsplit_set(needle, " ", 0);
-	num_tags = g_strv_length(needle_parts);
-
-	/* Populate filter */
-	for (n = 0; n < num_tags; n++)
+	for (n = 0; needle_parts[n]; n++)
 	{
-		tag = needle_parts[n];
+		gint i;
+		gboolean seen = (needle_parts[n][0] == '\0');
 
-		g_mutex_lock(&library->id_lock);
-		sqlite3_prepare_v2(db, "insert into filter select phototags.photo from phototags, tags where phototags.tag = tags.id and lower(tags.tagname) = lower(?1) ;", -1, &stmt, NULL);
-		rc = sqlite3_bind_text(stmt, 1, tag, -1, SQLITE_TRANSIENT);
-		rc = sqlite3_step(stmt);
-		sqlite3_finalize(stmt);
-		g_mutex_unlock(&library->id_lock);
-	}
+		for (i = 0; i < num_tags && !seen; i++)
+			seen = (g_ascii_strcasecmp(needle_parts[i], needle_parts[n]) == 0);
 
-	g_strfreev(needle_parts);
+		if (seen)
+			g_free(needle_parts[n]);
+		else
+			needle_parts[num_tags++] = needle_parts[n];
+	}
+	needle_parts[num_tags] = NULL;
 
-	RS_DEBUG(LIBRARY, "Filter table populated @%.0fms", g_timer_elapsed(gt, NULL)*1000.0);
+	if (num_tags == 0)
+	{
+		g_strfreev(needle_parts);
+		g_timer_destroy(gt);
+		return 0;
+	}
 
-	/* Create result table */
-	sqlite3_prepare_v2(db, "create temp table result (photo integer, count integer)", -1, &stmt, NULL);
-	rc = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
-	library_sqlite_error(db, rc);
+	/* Photos matching every tag, found through the tag indexes in one query */
+	sql = g_string_new("select library.filename from library where library.id in "
+		"(select phototags.photo from phototags, tags where phototags.tag = tags.id and tags.tagname collate nocase in (");
+	for (n = 0; n < num_tags; n++)
+		g_string_append_printf(sql, "%s?%d", (n > 0) ? ", " : "", n + 1);
+	g_string_append_printf(sql, ") group by phototags.photo having count(distinct lower(tags.tagname)) = %d) order by library.filename;", num_tags);
 
-	/* Populate result table */
-	g_mutex_lock(&library->id_lock);
-	sqlite3_prepare_v2(db, "insert into result select photo, count(photo) from filter group by photo;", -1, &stmt, NULL);
-	rc = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
-	g_mutex_unlock(&library->id_lock);
+	rc = sqlite3_prepare_v2(db, sql->str, -1, &stmt, NULL);
 	library_sqlite_error(db, rc);
+	g_string_free(sql, TRUE);
 
-	/* Get filename */
-	sqlite3_prepare_v2(db, "select library.filename from library,result where library.id = result.photo and result.count = ?1 order by library.filename;", -1, &stmt, NULL);
-        rc = sqlite3_bind_int(stmt, 1, num_tags);
+	for (n = 0; n < num_tags; n++)
+		sqlite3_bind_text(stmt, n + 1, needle_parts[n], -1, SQLITE_TRANSIENT);
 
-	gint count = 0;
 	while (sqlite3_step(stmt) == SQLITE_ROW && count < MAX_SEARCH_RESULTS)
 	{
-		filename = g_strdup((gchar *) sqlite3_column_text(stmt, 0));
+		filename = (const gchar *) sqlite3_column_text(stmt, 0);
 		if (g_file_test(filename, G_FILE_TEST_EXISTS))
 		{
-			photos = g_list_append(photos, filename);
 			count++;
+			if (!func(filename, user_data))
+				break;
 		}
-	}				       
-	sqlite3_finalize(stmt);
-	library_sqlite_error(db, rc);
-
-	RS_DEBUG(LIBRARY, "Search done @%.0fms", g_timer_elapsed(gt, NULL)*1000.0);
-
-	/* Empty filter */
-	sqlite3_prepare_v2(db, "delete from filter;", -1, &stmt, NULL);
-	rc = sqlite3_step(stmt);
+	}
 	sqlite3_finalize(stmt);
-	library_sqlite_error(db, rc);
 
-	/* Empty result */
-	sqlite3_prepare_v2(db, "delete from result;", -1, &stmt, NULL);
-	rc = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
-	library_sqlite_error(db, rc);
+	g_strfreev(needle_parts);
 
 	RS_DEBUG(LIBRARY, "Search for '%s' in library took %.0fms seconds", needle, g_timer_elapsed(gt, NULL)*1000.0);
 	g_timer_destroy(gt);
 
-	return photos;
+	return count;
+}
+
+static gboolean
+search_append(const gchar *filename, gpointer user_data)
+{
+	GList **photos = user_data;
+
+	*photos = g_list_prepend(*photos, g_strdup(filename));
+
+	return TRUE;
+}
+
+GList *
+rs_library_search(RSLibrary *library, const gchar *needle)
+{
+	GList *photos = NULL;
+
+	g_return_val_if_fail(RS_IS_LIBRARY(library), NULL);
+	g_return_val_if_fail(needle != NULL, NULL);
+
+	rs_library_search_foreach(library, needle, search_append, &photos);
+
+	return g_list_reverse(photos);
 }
 
 static void
@@ -915,7 +1130,7 @@ library_photo_default_tags(RSLibrary *library, const gint photo_id, RSMetadata *
 	}
 
 	gint i, j;
-	library_execute_sql(library->db, "BEGIN TRANSACTION;");
+	rs_library_begin_batch(library);
 	gint *used_tags = g_malloc(g_list_length(tags) * sizeof(gint));
 	for(i = 0; i < g_list_length(tags); i++)
 	{
@@ -934,7 +1149,7 @@ library_photo_default_tags(RSLibrary *library, const gint photo_id, RSMetadata *
 		g_free(tag);
 	}
 	g_free(used_tags);
-	library_execute_sql(library->db, "COMMIT;");
+	rs_library_end_batch(library);
 	g_list_free(tags);
 }
 
@@ -952,21 +1167,16 @@ rs_library_photo_tags(RSLibrary *library, const gchar *photo, const gboolean aut
 	GList *tags = NULL;
 
 	if (autotag)
-	{
-		sqlite3_prepare_v2(db, "select tags.tagname from library,phototags,tags WHERE library.id=phototags.photo and phototags.tag=tags.id and library.filename = ?1;", -1, &stmt, NULL);
-		rc = sqlite3_bind_text(stmt, 1, photo, -1, NULL);
-	}
+		stmt = library_statement_begin(library, STMT_PHOTO_TAGS);
 	else
-	{
-		sqlite3_prepare_v2(db, "select tags.tagname from library,phototags,tags WHERE library.id=phototags.photo and phototags.tag=tags.id and library.filename = ?1 and phototags.autotag = 0;", -1, &stmt, NULL);
-		rc = sqlite3_bind_text(stmt, 1, photo, -1, NULL);
-	}
+		stmt = library_statement_begin(library, STMT_PHOTO_TAGS_MANUAL);
+	rc = sqlite3_bind_text(stmt, 1, photo, -1, NULL);
 	while (sqlite3_step(stmt) == SQLITE_ROW)
-		tags = g_list_append(tags, g_strdup((gchar *) sqlite3_column_text(stmt, 0)));
-	sqlite3_finalize(stmt);
+		tags = g_list_prepend(tags, g_strdup((gchar *) sqlite3_column_text(stmt, 0)));
+	library_statement_end(library, stmt);
 	library_sqlite_error(db, rc);
 
-	return tags;
+	return g_list_reverse(tags);
 }
 
 GList *
@@ -982,19 +1192,19 @@ rs_library_find_tag(RSLibrary *library, const gchar *tag)
 	sqlite3 *db = library->db;
 	GList *tags = NULL;
 
-	rc = sqlite3_prepare_v2(db, "select tags.tagname from tags WHERE tags.tagname like ?1 order by tags.tagname;", -1, &stmt, NULL);
+	stmt = library_statement_begin(library, STMT_FIND_TAGS);
 	gchar *like = g_strdup_printf("%%%s%%", tag);
         rc = sqlite3_bind_text(stmt, 1, like, -1, NULL);
 	library_sqlite_error(db, rc);
 	
 	while (sqlite3_step(stmt) == SQLITE_ROW)
-		tags = g_list_append(tags, g_strdup((gchar *) sqlite3_column_text(stmt, 0)));
-	sqlite3_finalize(stmt);
+		tags = g_list_prepend(tags, g_strdup((gchar *) sqlite3_column_text(stmt, 0)));
+	library_statement_end(library, stmt);
 	library_sqlite_error(db, rc);
 
 	g_free(like);
 
-	return tags;
+	return g_list_reverse(tags);
 }
 
 
@@ -1078,10 +1288,15 @@ rs_library_backup_tags(RSLibrary *library, const gchar *photo_filename)
 	xmlTextWriterStartElement(writer, BAD_CAST "rawstudio-tags");
 	xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "version", "%d", LIBRARY_VERSION);
 
-	const gchar *temp = g_strdup_printf("%s/%%", directory);
-	rc = sqlite3_prepare_v2(db, "select library.filename,library.identifier,tags.tagname,phototags.autotag from library,phototags,tags where library.filename like ?1 and phototags.photo = library.id and tags.id = phototags.tag order by library.filename;", -1, &stmt, NULL);
-	rc = sqlite3_bind_text(stmt, 1, temp, -1, SQLITE_TRANSIENT);
+	/* Every filename starting with "directory/", '0' sorts right after '/' */
+	gchar *first = g_strdup_printf("%s/", directory);
+	gchar *last = g_strdup_printf("%s0", directory);
+	stmt = library_statement_begin(library, STMT_BACKUP_TAGS);
+	rc = sqlite3_bind_text(stmt, 1, first, -1, SQLITE_TRANSIENT);
+	rc = sqlite3_bind_text(stmt, 2, last, -1, SQLITE_TRANSIENT);
 	library_sqlite_error(db, rc);
+	g_free(first);
+	g_free(last);
 	while (sqlite3_step(stmt) == SQLITE_ROW)
 	{
 		t_filename = g_path_get_basename((gchar *) sqlite3_column_text(stmt, 0));
@@ -1105,7 +1320,7 @@ rs_library_backup_tags(RSLibrary *library, const gchar *photo_filename)
 	}
 	xmlTextWriterEndElement(writer);
 
-	rc = sqlite3_finalize(stmt);
+	library_statement_end(library, stmt);
 
 	xmlTextWriterEndDocument(writer);
 	xmlFreeTextWriter(writer);
@@ -1181,6 +1396,9 @@ rs_library_restore_tags(const gchar *directory)
 		}
 	}
 
+	/* Import the whole directory in one transaction */
+	rs_library_begin_batch(library);
+
 	cur = cur->xmlChildrenNode;
 	while(cur)
 	{
@@ -1226,6 +1444,8 @@ rs_library_restore_tags(const gchar *directory)
 		cur = cur->next;
 	}
 
+	rs_library_end_batch(library);
+
 	g_free(dotdir);
 	g_free(xmlfile);
 	xmlFreeDoc(doc);
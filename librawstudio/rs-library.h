@@ -40,6 +40,9 @@ typedef struct {
 	GObjectClass parent_class;
 } RSLibraryClass;
 
+/* Called for each photo found by rs_library_search_foreach(), return FALSE to stop */
+typedef gboolean (*RSLibrarySearchFunc)(const gchar *filename, gpointer user_data);
+
 GType rs_library_get_type(void);
 
 gboolean rs_library_has_database_connection(RSLibrary *library);
@@ -55,6 +58,7 @@ void rs_library_photo_add_tag(RSLibrary *library, const gchar *filename, gint ta
 void rs_library_delete_photo(RSLibrary *library, const gchar *photo);
 gboolean rs_library_delete_tag(RSLibrary *library, const gchar *tag, const gboolean force);
 GList *rs_library_search(RSLibrary *library, const gchar *needle);
+gint rs_library_search_foreach(RSLibrary *library, const gchar *needle, RSLibrarySearchFunc func, gpointer user_data);
 GList *rs_library_photo_tags(RSLibrary *library, const gchar *photo, const gboolean autotag);
 GList *rs_library_find_tag(RSLibrary *library, const gchar *tag);
 gboolean rs_library_set_tag_search(gchar *str);
@@ -62,6 +66,11 @@ void rs_library_add_photo_with_metadata(RSLibrary *library, const gchar *photo,
 void rs_library_restore_tags(const gchar *directory);
 void rs_library_backup_tags(RSLibrary *library, const gchar *photo_filename);
 
+/* Collect writes from all threads in one transaction until the last batch ends */
+void rs_library_begin_batch(RSLibrary *library);
+void rs_library_end_batch(RSLibrary *library);
+void rs_library_flush(RSLibrary *library);
+
 G_END_DECLS
 
 #endif /* RS_LIBRARY_H */
@@ -0,0 +1,774 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>, 
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* A metadata pack holds cached metadata and thumbnails for every photo in
+ * a directory in one file, so a directory can be shown with a single mmap
+ * instead of opening an XML and a JPEG file per photo.
+ *
+ * Layout:
+ *   PackHeader
+ *   PackRecord, name, strings, padding, thumbnail pixels, padding
+ *   PackRecord, ...
+ *
+ * Records are only ever appended, the last record for a name wins. A
+ * record with PACK_RECORD_DELETED set removes the name, one with
+ * PACK_RECORD_NO_THUMBNAIL set is for a photo without a thumbnail.
+ * Thumbnails are stored decoded, so pixbufs can point directly into the
+ * mapping. The pack is rewritten without dead records when they make up
+ * most of it.
+ */
+
+#include <rawstudio.h>
+#include <glib/gstdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include "rs-metadata-pack.h"
+
+#define PACK_MAGIC "RSMPACK\n"
+#define PACK_VERSION 1
+#define PACK_BYTE_ORDER 0x01020304
+#define PACK_RECORD_DELETED (1<<0)
+#define PACK_RECORD_NO_THUMBNAIL (1<<1)
+#define PACK_ALIGN(x) (((x) + 7) & ~((guint64) 7))
+/* Don't bother compacting packs with less dead data than this */
+#define PACK_COMPACT_MIN (4*1024*1024)
+/* Packs kept mapped after their last user is done with them */
+#define PACK_CACHE_SIZE 4
+
+typedef struct {
+	gchar magic[8];
+	guint32 version;
+	guint32 byte_order;
+} PackHeader;
+
+typedef struct {
+	guint32 length;           /* Whole record including name, strings and thumbnail */
+	guint32 checksum;         /* FNV-1a of everything after this field up to the thumbnail */
+	gint64 mtime;             /* Of the photo when the record was written */
+	gint64 size;              /* Of the photo when the record was written */
+	gdouble cam_mul[4];
+	gdouble contrast;
+	gdouble saturation;
+	gdouble color_tone;
+	gdouble lens_min_focal;
+	gdouble lens_max_focal;
+	gdouble lens_min_aperture;
+	gdouble lens_max_aperture;
+	gint32 make;
+	gint32 timestamp;
+	gfloat aperture;
+	gfloat exposurebias;
+	gfloat shutterspeed;
+	gint32 lens_id;
+	guint32 flags;
+	guint32 name_length;
+	guint32 strings_length;
+	guint32 thumb_rowstride;
+	guint16 orientation;
+	guint16 iso;
+	gint16 focallength;
+	guint16 thumb_width;
+	guint16 thumb_height;
+	guint8 thumb_channels;
+	guint8 thumb_has_alpha;
+	guint32 reserved;
+} PackRecord;
+
+G_STATIC_ASSERT(sizeof(PackHeader) == 16);
+G_STATIC_ASSERT(sizeof(PackRecord) == 168);
+
+typedef struct {
+	goffset offset;
+	guint32 length;
+} PackEntry;
+
+struct _RSMetadataPack {
+	GObject parent;
+	gboolean dispose_has_run;
+
+	gchar *path;
+	GMutex lock;
+	GMappedFile *map;
+	goffset mapped_length;
+	goffset end;       /* End of the last valid record */
+	goffset live;      /* Bytes used by records in the index */
+	GHashTable *index; /* Photo basename -> PackEntry */
+	gint users;        /* Holders of rs_metadata_pack_get(), protected by packs_lock */
+};
+
+G_DEFINE_TYPE(RSMetadataPack, rs_metadata_pack, G_TYPE_OBJECT)
+
+static GMutex packs_lock;
+static GHashTable *packs = NULL;
+static GQueue packs_lru = G_QUEUE_INIT; /* Most recently used first */
+
+static void
+rs_metadata_pack_dispose(GObject *object)
+{
+	RSMetadataPack *pack = RS_METADATA_PACK(object);
+
+	if (!pack->dispose_has_run)
+	{
+		pack->dispose_has_run = TRUE;
+
+		if (pack->map)
+			g_mapped_file_unref(pack->map);
+		g_hash_table_destroy(pack->index);
+		g_free(pack->path);
+		g_mutex_clear(&pack->lock);
+	}
+
+	G_OBJECT_CLASS(rs_metadata_pack_parent_class)->dispose(object);
+}
+
+static void
+rs_metadata_pack_class_init(RSMetadataPackClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+	object_class->dispose = rs_metadata_pack_dispose;
+}
+
+static void
+rs_metadata_pack_init(RSMetadataPack *pack)
+{
+	g_mutex_init(&pack->lock);
+	pack->index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+}
+
+static guint32
+pack_checksum(const guchar *data, gsize length)
+{
+	guint32 hash = 2166136261U;
+	gsize i;
+
+	for (i = 0; i < length; i++)
+		hash = (hash ^ data[i]) * 16777619U;
+
+	return hash;
+}
+
+static inline guint64
+record_pixels_offset(const PackRecord *record)
+{
+	return PACK_ALIGN(sizeof(PackRecord) + (guint64) record->name_length + record->strings_length);
+}
+
+/**
+ * Check that a record is complete and intact
+ * @return The record or NULL if it is invalid
+ */
+static const PackRecord *
+pack_validate_record(const gchar *data, goffset offset, goffset length)
+{
+	const PackRecord *record;
+	guint64 header_bytes;
+
+	if (offset + (goffset) sizeof(PackRecord) > length)
+		return NULL;
+
+	record = (const PackRecord *) (data + offset);
+
+	if (record->length < sizeof(PackRecord) || (record->length & 7) || offset + record->length > length)
+		return NULL;
+
+	header_bytes = sizeof(PackRecord) + (guint64) record->name_length + record->strings_length;
+	if (record->name_length == 0 || header_bytes > record->length)
+		return NULL;
+
+	if ((record->flags & PACK_RECORD_NO_THUMBNAIL) && record->thumb_width > 0)
+		return NULL;
+
+	if (record->thumb_width > 0)
+	{
+		if (record->thumb_channels != 3 && record->thumb_channels != 4)
+			return NULL;
+		if (record->thumb_rowstride < (guint32) record->thumb_width * record->thumb_channels)
+			return NULL;
+		if (record_pixels_offset(record) + (guint64) record->thumb_rowstride * record->thumb_height > record->length)
+			return NULL;
+	}
+
+	if (pack_checksum((const guchar *) &record->mtime, header_bytes - G_STRUCT_OFFSET(PackRecord, mtime)) != record->checksum)
+		return NULL;
+
+	return record;
+}
+
+/**
+ * Map the pack file, replacing any earlier mapping
+ * @note Must be called with pack->lock held
+ */
+static void
+pack_map(RSMetadataPack *pack)
+{
+	if (pack->map)
+		g_mapped_file_unref(pack->map);
+	pack->mapped_length = 0;
+
+	/* A private writable mapping makes pixbufs safe to modify, fall back to read-only */
+	pack->map = g_mapped_file_new(pack->path, TRUE, NULL);
+	if (!pack->map)
+		pack->map = g_mapped_file_new(pack->path, FALSE, NULL);
+	if (pack->map)
+		pack->mapped_length = g_mapped_file_get_length(pack->map);
+}
+
+/**
+ * Map the pack file and index all valid records
+ * @note Must be called with pack->lock held
+ */
+static void
+pack_scan(RSMetadataPack *pack)
+{
+	const PackHeader *header;
+	const PackRecord *record;
+	const gchar *data;
+	goffset offset;
+
+	g_hash_table_remove_all(pack->index);
+	pack->end = 0;
+	pack->live = 0;
+
+	pack_map(pack);
+	if (!pack->map || pack->mapped_length < (goffset) sizeof(PackHeader))
+		return;
+
+	data = g_mapped_file_get_contents(pack->map);
+	header = (const PackHeader *) data;
+	if (memcmp(header->magic, PACK_MAGIC, sizeof(header->magic)) != 0
+		|| header->version != PACK_VERSION
+		|| header->byte_order != PACK_BYTE_ORDER)
+		return;
+
+	offset = sizeof(PackHeader);
+	while ((record = pack_validate_record(data, offset, pack->mapped_length)))
+	{
+		gchar *name = g_strndup((const gchar *) (record + 1), record->name_length);
+		PackEntry *entry = g_hash_table_lookup(pack->index, name);
+
+		if (entry)
+			pack->live -= entry->length;
+
+		if (record->flags & PACK_RECORD_DELETED)
+		{
+			g_hash_table_remove(pack->index, name);
+			g_free(name);
+		}
+		else
+		{
+			entry = g_new(PackEntry, 1);
+			entry->offset = offset;
+			entry->length = record->length;
+			g_hash_table_replace(pack->index, name, entry);
+			pack->live += entry->length;
+		}
+
+		offset += record->length;
+	}
+
+	/* Anything after this is a torn write, it will be overwritten by the next append */
+	pack->end = offset;
+}
+
+/**
+ * Write a record at the end of the pack
+ * @note Must be called with pack->lock held
+ * @return The offset of the record or -1 on error
+ */
+static goffset
+pack_append(RSMetadataPack *pack, const gchar *buffer, gsize length)
+{
+	struct stat st;
+	goffset offset;
+	gint fd;
+
+	fd = g_open(pack->path, O_WRONLY | O_CREAT, 0666);
+	if (fd < 0)
+		return -1;
+
+	if (pack->end == 0)
+	{
+		PackHeader header;
+
+		memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+		header.version = PACK_VERSION;
+		header.byte_order = PACK_BYTE_ORDER;
+
+		if (ftruncate(fd, 0) != 0 || write(fd, &header, sizeof(header)) != sizeof(header))
+		{
+			close(fd);
+			return -1;
+		}
+		pack->end = sizeof(header);
+	}
+	else if (fstat(fd, &st) == 0 && st.st_size != pack->end)
+	{
+		/* Cut off a torn write */
+		if (ftruncate(fd, pack->end) != 0)
+		{
+			close(fd);
+			return -1;
+		}
+	}
+
+	offset = pack->end;
+	if (lseek(fd, offset, SEEK_SET) != offset || write(fd, buffer, length) != (gssize) length)
+	{
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	pack->end += length;
+
+	return offset;
+}
+
+/**
+ * Rewrite the pack without dead records
+ * @note Must be called with pack->lock held
+ */
+static void
+pack_compact(RSMetadataPack *pack)
+{
+	GHashTableIter iter;
+	PackEntry *entry;
+	const gchar *data = g_mapped_file_get_contents(pack->map);
+	gchar *temp = g_strdup_printf("%s.tmp", pack->path);
+	PackHeader header;
+	FILE *fp;
+	gboolean ok;
+
+	fp = g_fopen(temp, "wb");
+	if (!fp)
+	{
+		g_free(temp);
+		return;
+	}
+
+	memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+	header.version = PACK_VERSION;
+	header.byte_order = PACK_BYTE_ORDER;
+	ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+
+	g_hash_table_iter_init(&iter, pack->index);
+	while (ok && g_hash_table_iter_next(&iter, NULL, (gpointer *) &entry))
+		ok = (fwrite(data + entry->offset, entry->length, 1, fp) == 1);
+
+	ok = (fclose(fp) == 0) && ok;
+
+	/* Existing thumbnails keep the old file mapped, renaming is safe */
+	if (ok && g_rename(temp, pack->path) == 0)
+	{
+		RS_DEBUG(PERFORMANCE, "Compacted %s from %" G_GINT64_FORMAT " to %" G_GINT64_FORMAT " bytes",
+			pack->path, (gint64) pack->end, (gint64) (pack->live + sizeof(header)));
+		pack_scan(pack);
+	}
+	else
+		g_unlink(temp);
+
+	g_free(temp);
+}
+
+/**
+ * Unmap least recently used packs until at most PACK_CACHE_SIZE are left.
+ * Packs still in use are kept, two objects appending to the same file
+ * would corrupt it
+ * @note Must be called with packs_lock held
+ */
+static void
+packs_trim(void)
+{
+	GList *node = packs_lru.tail;
+
+	while (node && g_queue_get_length(&packs_lru) > PACK_CACHE_SIZE)
+	{
+		GList *prev = node->prev;
+		RSMetadataPack *pack = node->data;
+
+		if (pack->users == 0)
+		{
+			g_queue_delete_link(&packs_lru, node);
+			g_hash_table_remove(packs, pack->path);
+		}
+		node = prev;
+	}
+}
+
+RSMetadataPack *
+rs_metadata_pack_get(const gchar *filename)
+{
+	RSMetadataPack *pack;
+	gchar *dotdir;
+	gchar *path;
+
+	g_return_val_if_fail(filename != NULL, NULL);
+
+	dotdir = rs_dotdir_get(filename);
+	if (!dotdir)
+		return NULL;
+
+	path = g_build_filename(dotdir, DOTDIR_METAPACK, NULL);
+	g_free(dotdir);
+
+	g_mutex_lock(&packs_lock);
+	if (!packs)
+		packs = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_object_unref);
+
+	pack = g_hash_table_lookup(packs, path);
+	if (pack)
+	{
+		g_free(path);
+		g_queue_remove(&packs_lru, pack);
+		g_queue_push_head(&packs_lru, pack);
+	}
+	else
+	{
+		GTimer *gt = g_timer_new();
+
+		pack = g_object_new(RS_TYPE_METADATA_PACK, NULL);
+		pack->path = path;
+
+		g_mutex_lock(&pack->lock);
+		pack_scan(pack);
+		if (pack->end - pack->live > PACK_COMPACT_MIN && pack->live < pack->end / 2)
+			pack_compact(pack);
+		g_mutex_unlock(&pack->lock);
+
+		RS_DEBUG(PERFORMANCE, "Opened %s with %u entries in %.1fms", path,
+			g_hash_table_size(pack->index), g_timer_elapsed(gt, NULL) * 1000.0);
+		g_timer_destroy(gt);
+
+		g_hash_table_insert(packs, pack->path, pack);
+		g_queue_push_head(&packs_lru, pack);
+	}
+	pack->users++;
+	g_object_ref(pack);
+	packs_trim();
+	g_mutex_unlock(&packs_lock);
+
+	return pack;
+}
+
+void
+rs_metadata_pack_release(RSMetadataPack *pack)
+{
+	g_return_if_fail(RS_IS_METADATA_PACK(pack));
+
+	g_mutex_lock(&packs_lock);
+	g_warn_if_fail(pack->users > 0);
+	pack->users--;
+	packs_trim();
+	g_mutex_unlock(&packs_lock);
+
+	g_object_unref(pack);
+}
+
+static void
+pack_pixbuf_destroy(guchar *pixels, gpointer data)
+{
+	g_mapped_file_unref(data);
+}
+
+static const gchar *
+read_string(const gchar *strings, guint32 *pos, guint32 length, gchar **out)
+{
+	gint32 len;
+
+	if (*pos + sizeof(len) > length)
+		return NULL;
+	memcpy(&len, strings + *pos, sizeof(len));
+	*pos += sizeof(len);
+
+	if (len < 0 || *pos + len > length)
+		return NULL;
+
+	*out = g_strndup(strings + *pos, len);
+	*pos += len;
+
+	return *out;
+}
+
+static void
+write_string(GByteArray *strings, const gchar *str)
+{
+	gint32 len = str ? strlen(str) : -1;
+
+	g_byte_array_append(strings, (const guint8 *) &len, sizeof(len));
+	if (str)
+		g_byte_array_append(strings, (const guint8 *) str, len);
+}
+
+gboolean
+rs_metadata_pack_load(RSMetadataPack *pack, const gchar *filename, RSMetadata *metadata)
+{
+	const PackRecord *record;
+	const gchar *data;
+	const gchar *strings;
+	PackEntry *entry;
+	struct stat st;
+	gchar *name;
+	guint32 pos = 0;
+	gboolean ret = FALSE;
+
+	g_return_val_if_fail(RS_IS_METADATA_PACK(pack), FALSE);
+	g_return_val_if_fail(filename != NULL, FALSE);
+	g_return_val_if_fail(RS_IS_METADATA(metadata), FALSE);
+
+	if (g_stat(filename, &st) != 0)
+		return FALSE;
+
+	name = g_path_get_basename(filename);
+
+	g_mutex_lock(&pack->lock);
+	entry = g_hash_table_lookup(pack->index, name);
+	g_free(name);
+
+	/* Written after we mapped the file */
+	if (entry && entry->offset + entry->length > pack->mapped_length)
+		pack_map(pack);
+
+	if (!entry || entry->offset + entry->length > pack->mapped_length)
+		goto out;
+
+	data = g_mapped_file_get_contents(pack->map);
+	record = (const PackRecord *) (data + entry->offset);
+
+	if (record->mtime != st.st_mtime || record->size != st.st_size)
+		goto out;
+
+	/* A record without a thumbnail is only good if the photo has none */
+	if (record->thumb_width == 0 && !(record->flags & PACK_RECORD_NO_THUMBNAIL))
+		goto out;
+
+	metadata->make = record->make;
+	metadata->timestamp = record->timestamp;
+	metadata->orientation = record->orientation;
+	metadata->aperture = record->aperture;
+	metadata->exposurebias = record->exposurebias;
+	metadata->iso = record->iso;
+	metadata->shutterspeed = record->shutterspeed;
+	memcpy(metadata->cam_mul, record->cam_mul, sizeof(metadata->cam_mul));
+	metadata->contrast = record->contrast;
+	metadata->saturation = record->saturation;
+	metadata->color_tone = record->color_tone;
+	metadata->focallength = record->focallength;
+	metadata->lens_id = record->lens_id;
+	metadata->lens_min_focal = record->lens_min_focal;
+	metadata->lens_max_focal = record->lens_max_focal;
+	metadata->lens_min_aperture = record->lens_min_aperture;
+	metadata->lens_max_aperture = record->lens_max_aperture;
+
+	strings = (const gchar *) (record + 1) + record->name_length;
+	metadata->make_ascii = NULL;
+	metadata->model_ascii = NULL;
+	metadata->time_ascii = NULL;
+	metadata->fixed_lens_identifier = NULL;
+	read_string(strings, &pos, record->strings_length, &metadata->make_ascii);
+	read_string(strings, &pos, record->strings_length, &metadata->model_ascii);
+	read_string(strings, &pos, record->strings_length, &metadata->time_ascii);
+	read_string(strings, &pos, record->strings_length, &metadata->fixed_lens_identifier);
+
+	/* The pixbuf keeps the mapping alive */
+	if (record->thumb_width > 0)
+		metadata->thumbnail = gdk_pixbuf_new_from_data(
+			(const guchar *) record + record_pixels_offset(record),
+			GDK_COLORSPACE_RGB, record->thumb_has_alpha, 8,
+			record->thumb_width, record->thumb_height, record->thumb_rowstride,
+			pack_pixbuf_destroy, g_mapped_file_ref(pack->map));
+
+	ret = TRUE;
+out:
+	g_mutex_unlock(&pack->lock);
+
+	return ret;
+}
+
+/**
+ * Append a record and update the index
+ */
+static void
+pack_add_record(RSMetadataPack *pack, const gchar *name, PackRecord *record)
+{
+	PackEntry *entry;
+	goffset offset;
+
+	record->checksum = pack_checksum((const guchar *) &record->mtime,
+		sizeof(PackRecord) + record->name_length + record->strings_length - G_STRUCT_OFFSET(PackRecord, mtime));
+
+	g_mutex_lock(&pack->lock);
+	offset = pack_append(pack, (const gchar *) record, record->length);
+	if (offset >= 0)
+	{
+		entry = g_hash_table_lookup(pack->index, name);
+		if (entry)
+			pack->live -= entry->length;
+
+		if (record->flags & PACK_RECORD_DELETED)
+			g_hash_table_remove(pack->index, name);
+		else
+		{
+			entry = g_new(PackEntry, 1);
+			entry->offset = offset;
+			entry->length = record->length;
+			g_hash_table_replace(pack->index, g_strdup(name), entry);
+			pack->live += entry->length;
+		}
+	}
+	g_mutex_unlock(&pack->lock);
+}
+
+void
+rs_metadata_pack_save(RSMetadataPack *pack, const gchar *filename, RSMetadata *metadata)
+{
+	GdkPixbuf *thumbnail = NULL;
+	GByteArray *strings;
+	PackRecord *record;
+	struct stat st;
+	gchar *name;
+	guint64 pixels_offset, length;
+	gint width = 0, height = 0, channels = 0, row;
+
+	g_return_if_fail(RS_IS_METADATA_PACK(pack));
+	g_return_if_fail(filename != NULL);
+	g_return_if_fail(RS_IS_METADATA(metadata));
+
+	if (g_stat(filename, &st) != 0)
+		return;
+
+	if (metadata->thumbnail
+		&& gdk_pixbuf_get_colorspace(metadata->thumbnail) == GDK_COLORSPACE_RGB
+		&& gdk_pixbuf_get_bits_per_sample(metadata->thumbnail) == 8
+		&& gdk_pixbuf_get_width(metadata->thumbnail) <= G_MAXUINT16
+		&& gdk_pixbuf_get_height(metadata->thumbnail) <= G_MAXUINT16)
+	{
+		thumbnail = metadata->thumbnail;
+		width = gdk_pixbuf_get_width(thumbnail);
+		height = gdk_pixbuf_get_height(thumbnail);
+		channels = gdk_pixbuf_get_n_channels(thumbnail);
+	}
+
+	name = g_path_get_basename(filename);
+
+	strings = g_byte_array_new();
+	write_string(strings, metadata->make_ascii);
+	write_string(strings, metadata->model_ascii);
+	write_string(strings, metadata->time_ascii);
+	write_string(strings, metadata->fixed_lens_identifier);
+
+	pixels_offset = PACK_ALIGN(sizeof(PackRecord) + strlen(name) + strings->len);
+	length = PACK_ALIGN(pixels_offset + (guint64) width * channels * height);
+
+	if (length > G_MAXUINT32)
+	{
+		g_byte_array_free(strings, TRUE);
+		g_free(name);
+		return;
+	}
+
+	record = g_malloc0(length);
+	record->length = length;
+	record->mtime = st.st_mtime;
+	record->size = st.st_size;
+	memcpy(record->cam_mul, metadata->cam_mul, sizeof(record->cam_mul));
+	record->contrast = metadata->contrast;
+	record->saturation = metadata->saturation;
+	record->color_tone = metadata->color_tone;
+	record->lens_min_focal = metadata->lens_min_focal;
+	record->lens_max_focal = metadata->lens_max_focal;
+	record->lens_min_aperture = metadata->lens_min_aperture;
+	record->lens_max_aperture = metadata->lens_max_aperture;
+	record->make = metadata->make;
+	record->timestamp = metadata->timestamp;
+	record->aperture = metadata->aperture;
+	record->exposurebias = metadata->exposurebias;
+	record->shutterspeed = metadata->shutterspeed;
+	record->lens_id = metadata->lens_id;
+	record->name_length = strlen(name);
+	record->strings_length = strings->len;
+	record->orientation = metadata->orientation;
+	record->iso = metadata->iso;
+	record->focallength = metadata->focallength;
+	if (!metadata->thumbnail)
+		record->flags = PACK_RECORD_NO_THUMBNAIL;
+
+	memcpy(record + 1, name, record->name_length);
+	memcpy((gchar *) (record + 1) + record->name_length, strings->data, strings->len);
+
+	if (thumbnail)
+	{
+		const guchar *in = gdk_pixbuf_get_pixels(thumbnail);
+		const gint in_rowstride = gdk_pixbuf_get_rowstride(thumbnail);
+		guchar *out = (guchar *) record + pixels_offset;
+
+		record->thumb_width = width;
+		record->thumb_height = height;
+		record->thumb_channels = channels;
+		record->thumb_has_alpha = gdk_pixbuf_get_has_alpha(thumbnail);
+		record->thumb_rowstride = width * channels;
+
+		/* The last row of a pixbuf may be shorter than the rowstride */
+		for (row = 0; row < height; row++)
+			memcpy(out + row * record->thumb_rowstride, in + row * in_rowstride, record->thumb_rowstride);
+	}
+
+	pack_add_record(pack, name, record);
+
+	g_free(record);
+	g_byte_array_free(strings, TRUE);
+	g_free(name);
+}
+
+void
+rs_metadata_pack_remove(RSMetadataPack *pack, const gchar *filename)
+{
+	PackRecord *record;
+	gchar *name;
+	guint64 length;
+	gboolean known;
+
+	g_return_if_fail(RS_IS_METADATA_PACK(pack));
+	g_return_if_fail(filename != NULL);
+
+	name = g_path_get_basename(filename);
+
+	g_mutex_lock(&pack->lock);
+	known = (g_hash_table_lookup(pack->index, name) != NULL);
+	g_mutex_unlock(&pack->lock);
+
+	if (known)
+	{
+		length = PACK_ALIGN(sizeof(PackRecord) + strlen(name));
+		record = g_malloc0(length);
+		record->length = length;
+		record->flags = PACK_RECORD_DELETED;
+		record->name_length = strlen(name);
+		memcpy(record + 1, name, record->name_length);
+
+		pack_add_record(pack, name, record);
+
+		g_free(record);
+	}
+
+	g_free(name);
+}
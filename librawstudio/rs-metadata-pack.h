@@ -0,0 +1,93 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>, 
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RS_METADATA_PACK_H
+#define RS_METADATA_PACK_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define DOTDIR_METAPACK "metadata.pack"
+
+#define RS_TYPE_METADATA_PACK rs_metadata_pack_get_type()
+#define RS_METADATA_PACK(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), RS_TYPE_METADATA_PACK, RSMetadataPack))
+#define RS_METADATA_PACK_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), RS_TYPE_METADATA_PACK, RSMetadataPackClass))
+#define RS_IS_METADATA_PACK(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), RS_TYPE_METADATA_PACK))
+#define RS_IS_METADATA_PACK_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), RS_TYPE_METADATA_PACK))
+#define RS_METADATA_PACK_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), RS_TYPE_METADATA_PACK, RSMetadataPackClass))
+
+typedef struct _RSMetadataPack RSMetadataPack;
+
+typedef struct {
+	GObjectClass parent_class;
+} RSMetadataPackClass;
+
+GType rs_metadata_pack_get_type(void);
+
+/**
+ * Get the metadata pack holding cached metadata and thumbnails for all
+ * photos in a directory. Packs are shared, the most recently used ones stay
+ * mapped when no longer used
+ * @param filename A photo or a directory
+ * @return A RSMetadataPack to give back with rs_metadata_pack_release() or NULL if the directory has no usable dotdir
+ */
+extern RSMetadataPack *
+rs_metadata_pack_get(const gchar *filename);
+
+/**
+ * Give back a pack returned by rs_metadata_pack_get()
+ * @param pack A RSMetadataPack
+ */
+extern void
+rs_metadata_pack_release(RSMetadataPack *pack);
+
+/**
+ * Load cached metadata and thumbnail for a photo. The entry is only used
+ * if the size and modification time of the photo are unchanged. Photos
+ * saved without a thumbnail are loaded without one
+ * @param pack A RSMetadataPack
+ * @param filename The full path to the photo
+ * @param metadata A RSMetadata to fill
+ * @return TRUE if the entry was loaded, FALSE otherwise
+ */
+extern gboolean
+rs_metadata_pack_load(RSMetadataPack *pack, const gchar *filename, RSMetadata *metadata);
+
+/**
+ * Append metadata and thumbnail for a photo to the pack, replacing any
+ * earlier entry
+ * @param pack A RSMetadataPack
+ * @param filename The full path to the photo
+ * @param metadata The RSMetadata to save
+ */
+extern void
+rs_metadata_pack_save(RSMetadataPack *pack, const gchar *filename, RSMetadata *metadata);
+
+/**
+ * Forget a photo
+ * @param pack A RSMetadataPack
+ * @param filename The full path to the photo
+ */
+extern void
+rs_metadata_pack_remove(RSMetadataPack *pack, const gchar *filename);
+
+G_END_DECLS
+
+#endif /* RS_METADATA_PACK_H */
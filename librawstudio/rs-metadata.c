@@ -117,90 +117,51 @@ rs_metadata_new (void)
 	return g_object_new (RS_TYPE_METADATA, NULL);
 }
 
-#define METACACHEVERSION 11
-void
-rs_metadata_cache_save(RSMetadata *metadata, const gchar *filename)
+/**
+ * Delete the per-photo cache files used before metadata packs
+ */
+static void
+metadata_delete_legacy_cache(const gchar *filename)
 {
-	if (!filename)
-	  return;
-
 	gchar *cache_filename;
 	gchar *thumb_filename;
-	xmlTextWriterPtr writer;
-	static GMutex lock;
 
-	g_return_if_fail(RS_IS_METADATA(metadata));
+	cache_filename = rs_metadata_dotdir_helper(filename, DOTDIR_METACACHE);
+	g_unlink(cache_filename);
+	g_free(cache_filename);
 
-	g_mutex_lock(&lock);
+	thumb_filename = rs_metadata_dotdir_helper(filename, DOTDIR_THUMB);
+	g_unlink(thumb_filename);
+	g_free(thumb_filename);
+}
 
-	cache_filename = rs_metadata_dotdir_helper(filename, DOTDIR_METACACHE);
+void
+rs_metadata_cache_save(RSMetadata *metadata, const gchar *filename)
+{
+	RSMetadataPack *pack;
 
-	writer = xmlNewTextWriterFilename(cache_filename, 0);
-	if (writer)
-	{
-		xmlTextWriterSetIndent(writer, 1);
+	if (!filename)
+	  return;
 
-		xmlTextWriterStartDocument(writer, NULL, "ISO-8859-1", NULL);
-		xmlTextWriterStartElement(writer, BAD_CAST "rawstudio-metadata");
-		xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "version", "%d", METACACHEVERSION);
-		if (metadata->make != MAKE_UNKNOWN)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "make", "%d", metadata->make);
-		if (metadata->make_ascii)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "make_ascii","%s", metadata->make_ascii);
-		if (metadata->model_ascii)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "model_ascii", "%s", metadata->model_ascii);
-		if (metadata->time_ascii)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "time_ascii", "%s", metadata->time_ascii);
-		if (metadata->timestamp > -1)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "timestamp", "%d", metadata->timestamp);
-		/* Can we make orientation conditional? */
-		xmlTextWriterWriteFormatElement(writer, BAD_CAST "orientation", "%u", metadata->orientation);
-		if (metadata->aperture > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "aperture", "%f", metadata->aperture);
-		if (metadata->exposurebias != -999.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "exposurebias", "%f", metadata->exposurebias);
-		if (metadata->iso > 0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "iso", "%u", metadata->iso);
-		if (metadata->shutterspeed > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "shutterspeed", "%f", metadata->shutterspeed);
-		if (metadata->cam_mul[0] > 0.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "cam_mul", "%f %f %f %f", metadata->cam_mul[0], metadata->cam_mul[1], metadata->cam_mul[2], metadata->cam_mul[3]);
-		if (metadata->contrast > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "contrast", "%f", metadata->contrast);
-		if (metadata->saturation > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "saturation", "%f", metadata->saturation);
-		if (metadata->color_tone > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "color_tone", "%f", metadata->color_tone);
-		if (metadata->focallength > 0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "focallength", "%d", metadata->focallength);
-		if (metadata->lens_id > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "lens_id", "%d", metadata->lens_id);
-		if (metadata->lens_min_focal > -1)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "lens_min_focal", "%f", metadata->lens_min_focal);
-		if (metadata->lens_max_focal > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "lens_max_focal", "%f", metadata->lens_max_focal);
-		if (metadata->lens_min_aperture > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "lens_min_aperture", "%f", metadata->lens_min_aperture);
-		if (metadata->lens_max_aperture > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "lens_max_aperture", "%f", metadata->lens_max_aperture);
-		if (metadata->fixed_lens_identifier)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "fixed_lens_identifier", "%s", metadata->fixed_lens_identifier);
-		xmlTextWriterEndDocument(writer);
-		xmlFreeTextWriter(writer);
-	}
-	g_free(cache_filename);
-	g_mutex_unlock(&lock);
+	g_return_if_fail(RS_IS_METADATA(metadata));
 
-	if (metadata->thumbnail)
+	pack = rs_metadata_pack_get(filename);
+	if (pack)
 	{
-		thumb_filename = rs_metadata_dotdir_helper(filename, DOTDIR_THUMB);
-		gdk_pixbuf_save(metadata->thumbnail, thumb_filename, "jpeg", NULL, "quality", "90", NULL);
-		g_free(thumb_filename);
+		rs_metadata_pack_save(pack, filename, metadata);
+		rs_metadata_pack_release(pack);
+
+		/* The pack has replaced these, don't let them go stale */
+		metadata_delete_legacy_cache(filename);
 	}
 }
 
+#define METACACHEVERSION 11
+/**
+ * Load metadata from the per-photo XML and JPEG files written by older versions
+ */
 static gboolean
-rs_metadata_cache_load(RSMetadata *metadata, const gchar *filename)
+rs_metadata_cache_load_legacy(RSMetadata *metadata, const gchar *filename)
 {
 	if (!filename)
 	  return FALSE;
@@ -413,6 +374,34 @@ rs_metadata_cache_load(RSMetadata *metadata, const gchar *filename)
 }
 #undef METACACHEVERSION
 
+static gboolean
+rs_metadata_cache_load(RSMetadata *metadata, const gchar *filename)
+{
+	RSMetadataPack *pack;
+	gboolean ret = FALSE;
+
+	if (!filename)
+	  return FALSE;
+
+	g_return_val_if_fail(RS_IS_METADATA(metadata), FALSE);
+
+	pack = rs_metadata_pack_get(filename);
+	if (pack)
+	{
+		ret = rs_metadata_pack_load(pack, filename, metadata);
+		rs_metadata_pack_release(pack);
+	}
+
+	/* Migrate from the old cache files */
+	if (!ret && rs_metadata_cache_load_legacy(metadata, filename))
+	{
+		rs_metadata_cache_save(metadata, filename);
+		ret = TRUE;
+	}
+
+	return ret;
+}
+
 
 static void generate_lens_identifier(RSMetadata *meta)
 {
@@ -579,18 +568,43 @@ rs_metadata_delete_cache(const gchar *filename)
 {
 	g_return_if_fail(filename != NULL);
 
-	gchar *cache_filename;
+	RSMetadataPack *pack;
+
+	/* Forget the photo in the pack */
+	pack = rs_metadata_pack_get(filename);
+	if (pack)
+	{
+		rs_metadata_pack_remove(pack, filename);
+		rs_metadata_pack_release(pack);
+	}
+
+	metadata_delete_legacy_cache(filename);
+}
+
+/**
+ * Get a JPEG file holding the thumbnail of a photo, for use by external tools
+ * @param filename The full path to the photo
+ * @return The filename of the thumbnail, this must be freed with g_free()
+ */
+gchar *
+rs_metadata_get_thumbnail_filename(const gchar *filename)
+{
 	gchar *thumb_filename;
 
-	/* Delete the metadata cache itself */
-	cache_filename = rs_metadata_dotdir_helper(filename, DOTDIR_METACACHE);
-	g_unlink(cache_filename);
-	g_free(cache_filename);
+	g_return_val_if_fail(filename != NULL, NULL);
 
-	/* Delete the thumbnail */
 	thumb_filename = rs_metadata_dotdir_helper(filename, DOTDIR_THUMB);
-	g_unlink(thumb_filename);
-	g_free(thumb_filename);
+
+	/* Thumbnails live in the metadata pack, write a copy when needed */
+	if (!g_file_test(thumb_filename, G_FILE_TEST_IS_REGULAR))
+	{
+		RSMetadata *metadata = rs_metadata_new_from_file(filename);
+		if (metadata->thumbnail)
+			gdk_pixbuf_save(metadata->thumbnail, thumb_filename, "jpeg", NULL, "quality", "90", NULL);
+		g_object_unref(metadata);
+	}
+
+	return thumb_filename;
 }
 
 gchar *
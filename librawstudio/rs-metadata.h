@@ -112,7 +112,7 @@ extern GdkPixbuf *rs_metadata_get_thumbnail(RSMetadata *metadata);
 /* Attempts to load cached metadata first, then falls back to reading from file */
 extern gboolean rs_metadata_load(RSMetadata *metadata, const gchar *filename);
 
-/* Save metadata to cache xml file and sidecar thumbnail*/
+/* Save metadata and thumbnail to the metadata pack of the directory */
 extern void rs_metadata_cache_save(RSMetadata *metadata, const gchar *filename);
 
 /**
@@ -121,6 +121,13 @@ extern void rs_metadata_cache_save(RSMetadata *metadata, const gchar *filename);
  */
 extern void rs_metadata_delete_cache(const gchar *filename);
 
+/**
+ * Get a JPEG file holding the thumbnail of a photo, for use by external tools
+ * @param filename The full path to the photo
+ * @return The filename of the thumbnail, this must be freed with g_free()
+ */
+extern gchar *rs_metadata_get_thumbnail_filename(const gchar *filename);
+
 extern gchar * rs_metadata_dotdir_helper(const gchar *filename, const gchar *extension);
 
 G_END_DECLS
@@ -27,9 +27,24 @@ static void integer_changed(GtkAdjustment *adjustment, gpointer user_data);
 static void boolean_changed(GtkToggleButton *togglebutton, gpointer user_data);
 static void string_changed(GtkEditable *editable, gpointer user_data);
 
+static void
+rs_output_finalize(GObject *object)
+{
+	RSOutput *output = RS_OUTPUT(object);
+
+	if (output->preview)
+		g_object_unref(output->preview);
+
+	G_OBJECT_CLASS(rs_output_parent_class)->finalize(object);
+}
+
 static void
 rs_output_class_init(RSOutputClass *klass)
 {
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+	object_class->finalize = rs_output_finalize;
+
 	/* Some sane defaults */
 	klass->extension = "";
 	klass->display_name = "N/A";
@@ -38,6 +53,11 @@ rs_output_class_init(RSOutputClass *klass)
 static void
 rs_output_init(RSOutput *self)
 {
+	self->preview_size = 0;
+	self->preview = NULL;
+	self->streaming = FALSE;
+	self->width = 0;
+	self->height = 0;
 }
 
 /**
@@ -93,12 +113,480 @@ rs_output_execute(RSOutput *output, RSFilter *filter)
 	g_return_val_if_fail(RS_IS_OUTPUT(output), FALSE);
 	g_return_val_if_fail(RS_IS_FILTER(filter), FALSE);
 
+	if (output->preview)
+		g_object_unref(output->preview);
+	output->preview = NULL;
+
 	if (RS_OUTPUT_GET_CLASS(output)->execute)
-		return RS_OUTPUT_GET_CLASS(output)->execute(output, filter);
+	{
+		/* Writes should never hold back browsing or opening photos */
+		RSIoClass previous = rs_io_set_class(RS_IO_CLASS_EXPORT);
+		gboolean ret = RS_OUTPUT_GET_CLASS(output)->execute(output, filter);
+		rs_io_set_class(previous);
+		return ret;
+	}
 	else
 		return FALSE;
 }
 
+/**
+ * Ask a RSOutput to keep a downscaled copy of the image it saves
+ * @param output A RSOutput
+ * @param preview_size The bounding box of the preview or 0 to disable
+ */
+void
+rs_output_set_preview_size(RSOutput *output, gint preview_size)
+{
+	g_return_if_fail(RS_IS_OUTPUT(output));
+
+	output->preview_size = MAX(0, preview_size);
+}
+
+/**
+ * Get the preview made by the last rs_output_execute()
+ * @param output A RSOutput
+ * @return A GdkPixbuf that must be unreffed after use or NULL if none was made
+ */
+GdkPixbuf *
+rs_output_get_preview(RSOutput *output)
+{
+	g_return_val_if_fail(RS_IS_OUTPUT(output), NULL);
+
+	if (output->preview)
+		return g_object_ref(output->preview);
+
+	return NULL;
+}
+
+/**
+ * Make a preview from the final 8 bit image, called by RSOutput modules
+ * @param output A RSOutput
+ * @param pixbuf The rendered image about to be saved
+ */
+void
+rs_output_set_preview8(RSOutput *output, GdkPixbuf *pixbuf)
+{
+	gint width, height;
+
+	g_return_if_fail(RS_IS_OUTPUT(output));
+	g_return_if_fail(GDK_IS_PIXBUF(pixbuf));
+
+	if (output->preview_size < 1)
+		return;
+
+	width = gdk_pixbuf_get_width(pixbuf);
+	height = gdk_pixbuf_get_height(pixbuf);
+	rs_constrain_to_bounding_box(output->preview_size, output->preview_size, &width, &height);
+
+	if (output->preview)
+		g_object_unref(output->preview);
+	output->preview = gdk_pixbuf_scale_simple(pixbuf, MAX(1, width), MAX(1, height), GDK_INTERP_BILINEAR);
+}
+
+/**
+ * Make a preview from the final 16 bit image, called by RSOutput modules
+ * @param output A RSOutput
+ * @param image The rendered image about to be saved
+ */
+void
+rs_output_set_preview16(RSOutput *output, RS_IMAGE16 *image)
+{
+	gint width, height;
+	gint x, y, c;
+
+	g_return_if_fail(RS_IS_OUTPUT(output));
+	g_return_if_fail(RS_IS_IMAGE16(image));
+
+	if (output->preview_size < 1)
+		return;
+
+	width = image->w;
+	height = image->h;
+	rs_constrain_to_bounding_box(output->preview_size, output->preview_size, &width, &height);
+	width = MAX(1, width);
+	height = MAX(1, height);
+
+	if (output->preview)
+		g_object_unref(output->preview);
+	output->preview = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+
+	/* Point sampling is plenty for a preview this small */
+	for(y = 0; y < height; y++)
+	{
+		gushort *in = GET_PIXEL(image, 0, (y * image->h) / height);
+		guchar *out = GET_PIXBUF_PIXEL(output->preview, 0, y);
+		for(x = 0; x < width; x++)
+		{
+			gushort *pixel = in + ((x * image->w) / width) * image->pixelsize;
+			for(c = 0; c < 3; c++)
+				*out++ = pixel[MIN(c, image->channels-1)] >> 8;
+		}
+	}
+}
+
+/**
+ * Let a RSOutput render and save the image in horizontal strips. This
+ * overlaps rendering with encoding, but should only be enabled if every
+ * filter in the chain handles a ROI by itself. Strips are requested with
+ * the "roi-sized" parameter set, filters supporting it return buffers
+ * covering only the strip
+ * @param output A RSOutput
+ * @param streaming TRUE to render in strips, FALSE to render the whole image at once
+ */
+void
+rs_output_set_streaming(RSOutput *output, gboolean streaming)
+{
+	g_return_if_fail(RS_IS_OUTPUT(output));
+
+	output->streaming = streaming;
+}
+
+/**
+ * Get the size of the image being saved, called by RSOutput modules from
+ * a RSOutputStrip8Func or RSOutputStrip16Func
+ * @param output A RSOutput
+ * @param width The width of the whole image or NULL
+ * @param height The height of the whole image or NULL
+ */
+void
+rs_output_get_image_size(RSOutput *output, gint *width, gint *height)
+{
+	g_return_if_fail(RS_IS_OUTPUT(output));
+
+	if (width)
+		*width = output->width;
+	if (height)
+		*height = output->height;
+}
+
+/* Rows rendered per strip when streaming. Filters that need neighbouring
+ * pixels, like RSDenoise, render a margin around every strip */
+#define STRIP_HEIGHT 512
+/* Strips rendered ahead of the encoder */
+#define STRIPS_AHEAD 1
+
+typedef struct {
+	RSFilter *filter;
+	const RSFilterRequest *request;
+	gboolean want8;
+	gint width;
+	gint height;
+
+	GMutex lock;
+	GCond cond;
+	GQueue done;		/* Rendered RSFilterResponses in order */
+	gboolean stop;
+} StripRenderer;
+
+static gpointer
+strip_render_thread(gpointer data)
+{
+	StripRenderer *renderer = data;
+	RSFilterRequest *request = rs_filter_request_clone(renderer->request);
+	GdkRectangle roi;
+	gint y;
+
+	/* We only need the rows of the strip */
+	rs_filter_param_set_boolean(RS_FILTER_PARAM(request), "roi-sized", TRUE);
+
+	/* Same class as the thread running rs_output_execute() */
+	rs_io_set_class(RS_IO_CLASS_EXPORT);
+
+	for(y = 0; y < renderer->height; y += STRIP_HEIGHT)
+	{
+		RSFilterResponse *response;
+
+		/* Wait for the encoder to catch up */
+		g_mutex_lock(&renderer->lock);
+		while (!renderer->stop && g_queue_get_length(&renderer->done) > STRIPS_AHEAD)
+			g_cond_wait(&renderer->cond, &renderer->lock);
+		g_mutex_unlock(&renderer->lock);
+
+		if (renderer->stop)
+			break;
+
+		roi.x = 0;
+		roi.y = y;
+		roi.width = renderer->width;
+		roi.height = MIN(STRIP_HEIGHT, renderer->height - y);
+		rs_filter_request_set_roi(request, &roi);
+
+		if (renderer->want8)
+			response = rs_filter_get_image8(renderer->filter, request);
+		else
+			response = rs_filter_get_image(renderer->filter, request);
+
+		g_mutex_lock(&renderer->lock);
+		g_queue_push_tail(&renderer->done, response);
+		g_cond_broadcast(&renderer->cond);
+		g_mutex_unlock(&renderer->lock);
+	}
+
+	g_object_unref(request);
+
+	return NULL;
+}
+
+static RSFilterResponse *
+strip_renderer_pop(StripRenderer *renderer)
+{
+	RSFilterResponse *response;
+
+	g_mutex_lock(&renderer->lock);
+	while (g_queue_is_empty(&renderer->done))
+		g_cond_wait(&renderer->cond, &renderer->lock);
+	response = g_queue_pop_head(&renderer->done);
+	g_cond_broadcast(&renderer->cond);
+	g_mutex_unlock(&renderer->lock);
+
+	return response;
+}
+
+/**
+ * Point sample the preview rows covered by a strip
+ */
+static void
+preview_strip(RSOutput *output, GdkPixbuf *pixbuf, RS_IMAGE16 *image, gint y, gint height)
+{
+	gint width, preview_height;
+	gint px, py, c;
+
+	if (output->preview_size < 1)
+		return;
+
+	if (!output->preview)
+	{
+		width = output->width;
+		preview_height = output->height;
+		rs_constrain_to_bounding_box(output->preview_size, output->preview_size, &width, &preview_height);
+		output->preview = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, MAX(1, width), MAX(1, preview_height));
+	}
+
+	width = gdk_pixbuf_get_width(output->preview);
+	preview_height = gdk_pixbuf_get_height(output->preview);
+
+	for(py = 0; py < preview_height; py++)
+	{
+		gint sy = (py * output->height) / preview_height;
+		guchar *out = GET_PIXBUF_PIXEL(output->preview, 0, py);
+
+		if (sy < y || sy >= y + height)
+			continue;
+
+		for(px = 0; px < width; px++)
+		{
+			gint sx = (px * output->width) / width;
+			if (pixbuf)
+			{
+				guchar *pixel = GET_PIXBUF_PIXEL(pixbuf, sx, sy - y);
+				for(c = 0; c < 3; c++)
+					*out++ = pixel[c];
+			}
+			else
+			{
+				gushort *pixel = GET_PIXEL(image, sx, sy - y);
+				for(c = 0; c < 3; c++)
+					*out++ = pixel[MIN(c, image->channels-1)] >> 8;
+			}
+		}
+	}
+}
+
+/* Row offset of image row y in a strip response, -1 if the strip isn't covered */
+static gint
+strip_offset(RSFilterResponse *response, gint buffer_width, gint buffer_height, gint width, gint y, gint height)
+{
+	GdkRectangle *roi = rs_filter_response_get_roi(response);
+	gboolean roi_sized = FALSE;
+	gint offset = y;
+
+	rs_filter_param_get_boolean(RS_FILTER_PARAM(response), "roi-sized", &roi_sized);
+	if (roi_sized && roi)
+	{
+		if (roi->x != 0)
+			return -1;
+		offset = y - roi->y;
+	}
+
+	if (buffer_width != width || offset < 0 || offset + height > buffer_height)
+		return -1;
+
+	return offset;
+}
+
+static gboolean
+get_strips(RSOutput *output, RSFilter *filter, const RSFilterRequest *request, gboolean want8, RSOutputStrip8Func func8, RSOutputStrip16Func func16, gpointer user_data)
+{
+	StripRenderer renderer;
+	GThread *thread;
+	gboolean ret = TRUE;
+	gint y;
+
+	/* Render everything at once */
+	if (!output->streaming)
+	{
+		RSFilterResponse *response;
+
+		if (want8)
+		{
+			response = rs_filter_get_image8(filter, request);
+			GdkPixbuf *pixbuf = rs_filter_response_get_image8(response);
+			g_object_unref(response);
+			if (!pixbuf)
+				return FALSE;
+			output->width = gdk_pixbuf_get_width(pixbuf);
+			output->height = gdk_pixbuf_get_height(pixbuf);
+			rs_output_set_preview8(output, pixbuf);
+			ret = func8(output, pixbuf, 0, output->height, user_data);
+			g_object_unref(pixbuf);
+		}
+		else
+		{
+			response = rs_filter_get_image(filter, request);
+			RS_IMAGE16 *image = rs_filter_response_get_image(response);
+			g_object_unref(response);
+			if (!image)
+				return FALSE;
+			output->width = image->w;
+			output->height = image->h;
+			rs_output_set_preview16(output, image);
+			ret = func16(output, image, 0, output->height, user_data);
+			g_object_unref(image);
+		}
+		return ret;
+	}
+
+	renderer.filter = filter;
+	renderer.request = request;
+	renderer.want8 = want8;
+	renderer.stop = FALSE;
+	g_mutex_init(&renderer.lock);
+	g_cond_init(&renderer.cond);
+	g_queue_init(&renderer.done);
+	rs_filter_get_size_simple(filter, request, &renderer.width, &renderer.height);
+	output->width = renderer.width;
+	output->height = renderer.height;
+
+	RS_DEBUG(PERFORMANCE, "Saving %dx%d in strips of %d rows", renderer.width, renderer.height, STRIP_HEIGHT);
+
+	/* Next strip is rendered while we encode this one */
+	thread = g_thread_new("output strips", strip_render_thread, &renderer);
+
+	/* Filters not supporting "roi-sized" return the whole image, the strip
+	 * is then passed on as a view into it */
+	for(y = 0; ret && y < renderer.height; y += STRIP_HEIGHT)
+	{
+		RSFilterResponse *response = strip_renderer_pop(&renderer);
+		gint height = MIN(STRIP_HEIGHT, renderer.height - y);
+		gint offset;
+
+		if (want8)
+		{
+			GdkPixbuf *pixbuf = rs_filter_response_get_image8(response);
+			GdkPixbuf *strip = NULL;
+			if (pixbuf)
+			{
+				offset = strip_offset(response, gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf), renderer.width, y, height);
+				if (offset >= 0)
+					strip = gdk_pixbuf_new_subpixbuf(pixbuf, 0, offset, renderer.width, height);
+			}
+			if (strip)
+			{
+				preview_strip(output, strip, NULL, y, height);
+				ret = func8(output, strip, y, height, user_data);
+				g_object_unref(strip);
+			}
+			else
+				ret = FALSE;
+			if (pixbuf)
+				g_object_unref(pixbuf);
+		}
+		else
+		{
+			RS_IMAGE16 *image = rs_filter_response_get_image(response);
+			RS_IMAGE16 *strip = NULL;
+			if (image)
+			{
+				offset = strip_offset(response, image->w, image->h, renderer.width, y, height);
+				if (offset >= 0)
+				{
+					GdkRectangle rect = { 0, offset, renderer.width, height };
+					strip = rs_image16_new_subframe(image, &rect);
+				}
+			}
+			if (strip)
+			{
+				/* The view shares pixels with image, which is kept until we're done */
+				preview_strip(output, NULL, strip, y, height);
+				ret = func16(output, strip, y, height, user_data);
+				g_object_unref(strip);
+			}
+			else
+				ret = FALSE;
+			if (image)
+				g_object_unref(image);
+		}
+		g_object_unref(response);
+	}
+
+	g_mutex_lock(&renderer.lock);
+	renderer.stop = TRUE;
+	g_cond_broadcast(&renderer.cond);
+	g_mutex_unlock(&renderer.lock);
+	g_thread_join(thread);
+
+	g_queue_foreach(&renderer.done, (GFunc) g_object_unref, NULL);
+	g_queue_clear(&renderer.done);
+	g_mutex_clear(&renderer.lock);
+	g_cond_clear(&renderer.cond);
+
+	return ret;
+}
+
+/**
+ * Get the 8 bit image from a filter chain in strips, called by RSOutput modules.
+ * Unless streaming is enabled, @func is called once with the whole image. The
+ * preview is updated as well
+ * @param output A RSOutput
+ * @param filter A RSFilter to get image data from
+ * @param request A RSFilterRequest, a ROI will be set for each strip
+ * @param func A function to call for every strip
+ * @param user_data Data passed to @func
+ * @return TRUE if all strips were rendered and accepted by @func, FALSE otherwise
+ */
+gboolean
+rs_output_get_strips8(RSOutput *output, RSFilter *filter, const RSFilterRequest *request, RSOutputStrip8Func func, gpointer user_data)
+{
+	g_return_val_if_fail(RS_IS_OUTPUT(output), FALSE);
+	g_return_val_if_fail(RS_IS_FILTER(filter), FALSE);
+	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), FALSE);
+	g_return_val_if_fail(func != NULL, FALSE);
+
+	return get_strips(output, filter, request, TRUE, func, NULL, user_data);
+}
+
+/**
+ * Get the 16 bit image from a filter chain in strips, called by RSOutput modules.
+ * Unless streaming is enabled, @func is called once with the whole image. The
+ * preview is updated as well
+ * @param output A RSOutput
+ * @param filter A RSFilter to get image data from
+ * @param request A RSFilterRequest, a ROI will be set for each strip
+ * @param func A function to call for every strip
+ * @param user_data Data passed to @func
+ * @return TRUE if all strips were rendered and accepted by @func, FALSE otherwise
+ */
+gboolean
+rs_output_get_strips16(RSOutput *output, RSFilter *filter, const RSFilterRequest *request, RSOutputStrip16Func func, gpointer user_data)
+{
+	g_return_val_if_fail(RS_IS_OUTPUT(output), FALSE);
+	g_return_val_if_fail(RS_IS_FILTER(filter), FALSE);
+	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), FALSE);
+	g_return_val_if_fail(func != NULL, FALSE);
+
+	return get_strips(output, filter, request, FALSE, NULL, func, user_data);
+}
+
 static void
 integer_changed(GtkAdjustment *adjustment, gpointer user_data)
 {
@@ -75,8 +75,35 @@ typedef struct _RSOutputClass RSOutputClass;
 
 struct _RSOutput {
 	GObject parent;
+	gint preview_size;
+	GdkPixbuf *preview;
+	gboolean streaming;
+	gint width;
+	gint height;
 };
 
+/**
+ * Called by rs_output_get_strips8() for every strip of the image in order
+ * @param output The RSOutput
+ * @param pixbuf The strip, row 0 is row y of the image
+ * @param y The first row of the strip in the image
+ * @param height The number of rows in the strip
+ * @param user_data Data passed to rs_output_get_strips8()
+ * @return TRUE to continue, FALSE to stop rendering
+ */
+typedef gboolean (*RSOutputStrip8Func)(RSOutput *output, GdkPixbuf *pixbuf, gint y, gint height, gpointer user_data);
+
+/**
+ * Called by rs_output_get_strips16() for every strip of the image in order
+ * @param output The RSOutput
+ * @param image The strip, row 0 is row y of the image
+ * @param y The first row of the strip in the image
+ * @param height The number of rows in the strip
+ * @param user_data Data passed to rs_output_get_strips16()
+ * @return TRUE to continue, FALSE to stop rendering
+ */
+typedef gboolean (*RSOutputStrip16Func)(RSOutput *output, RS_IMAGE16 *image, gint y, gint height, gpointer user_data);
+
 struct _RSOutputClass {
 	GObjectClass parent_class;
 	gchar *extension;
@@ -111,6 +138,88 @@ rs_output_get_extension(RSOutput *output);
 extern gboolean
 rs_output_execute(RSOutput *output, RSFilter *filter);
 
+/**
+ * Ask a RSOutput to keep a downscaled copy of the image it saves
+ * @param output A RSOutput
+ * @param preview_size The bounding box of the preview or 0 to disable
+ */
+extern void
+rs_output_set_preview_size(RSOutput *output, gint preview_size);
+
+/**
+ * Get the preview made by the last rs_output_execute()
+ * @param output A RSOutput
+ * @return A GdkPixbuf that must be unreffed after use or NULL if none was made
+ */
+extern GdkPixbuf *
+rs_output_get_preview(RSOutput *output);
+
+/**
+ * Make a preview from the final 8 bit image, called by RSOutput modules
+ * @param output A RSOutput
+ * @param pixbuf The rendered image about to be saved
+ */
+extern void
+rs_output_set_preview8(RSOutput *output, GdkPixbuf *pixbuf);
+
+/**
+ * Make a preview from the final 16 bit image, called by RSOutput modules
+ * @param output A RSOutput
+ * @param image The rendered image about to be saved
+ */
+extern void
+rs_output_set_preview16(RSOutput *output, RS_IMAGE16 *image);
+
+/**
+ * Let a RSOutput render and save the image in horizontal strips. This
+ * overlaps rendering with encoding, but should only be enabled if every
+ * filter in the chain handles a ROI by itself. Strips are requested with
+ * the "roi-sized" parameter set, filters supporting it return buffers
+ * covering only the strip
+ * @param output A RSOutput
+ * @param streaming TRUE to render in strips, FALSE to render the whole image at once
+ */
+extern void
+rs_output_set_streaming(RSOutput *output, gboolean streaming);
+
+/**
+ * Get the size of the image being saved, called by RSOutput modules from
+ * a RSOutputStrip8Func or RSOutputStrip16Func
+ * @param output A RSOutput
+ * @param width The width of the whole image or NULL
+ * @param height The height of the whole image or NULL
+ */
+extern void
+rs_output_get_image_size(RSOutput *output, gint *width, gint *height);
+
+/**
+ * Get the 8 bit image from a filter chain in strips, called by RSOutput modules.
+ * Unless streaming is enabled, @func is called once with the whole image. The
+ * preview is updated as well
+ * @param output A RSOutput
+ * @param filter A RSFilter to get image data from
+ * @param request A RSFilterRequest, a ROI will be set for each strip
+ * @param func A function to call for every strip
+ * @param user_data Data passed to @func
+ * @return TRUE if all strips were rendered and accepted by @func, FALSE otherwise
+ */
+extern gboolean
+rs_output_get_strips8(RSOutput *output, RSFilter *filter, const RSFilterRequest *request, RSOutputStrip8Func func, gpointer user_data);
+
+/**
+ * Get the 16 bit image from a filter chain in strips, called by RSOutput modules.
+ * Unless streaming is enabled, @func is called once with the whole image. The
+ * preview is updated as well
+ * @param output A RSOutput
+ * @param filter A RSFilter to get image data from
+ * @param request A RSFilterRequest, a ROI will be set for each strip
+ * @param func A function to call for every strip
+ * @param user_data Data passed to @func
+ * @return TRUE if all strips were rendered and accepted by @func, FALSE otherwise
+ */
+extern gboolean
+rs_output_get_strips16(RSOutput *output, RSFilter *filter, const RSFilterRequest *request, RSOutputStrip16Func func, gpointer user_data);
+
 /**
  * Load parameters from config for a RSOutput
  * @param output A RSOutput
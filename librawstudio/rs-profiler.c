@@ -0,0 +1,233 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>, 
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <rawstudio.h>
+#include "rs-profiler.h"
+
+/* State for the filter currently running in a thread */
+typedef struct {
+	guint thread;
+	gint depth;
+	gint64 child;
+	gsize allocated;
+	RSProfilerCache cache;
+} ThreadState;
+
+static gint enabled = FALSE;
+static gint n_threads = 0;
+static GPrivate thread_state = G_PRIVATE_INIT(g_free);
+
+static GMutex ring_lock;
+static RSProfilerEvent ring[RS_PROFILER_RING_SIZE];
+static guint ring_head = 0; /* Next slot to write */
+static guint ring_count = 0;
+
+static const gchar *cache_names[] = { "none", "hit", "miss" };
+
+static inline gboolean
+is_enabled(void)
+{
+	return g_atomic_int_get(&enabled) || (rs_debug_flags & RS_DEBUG_PERFORMANCE);
+}
+
+static ThreadState *
+get_thread_state(void)
+{
+	ThreadState *state = g_private_get(&thread_state);
+
+	if (G_UNLIKELY(!state))
+	{
+		state = g_new0(ThreadState, 1);
+		state->thread = g_atomic_int_add(&n_threads, 1) + 1;
+		g_private_set(&thread_state, state);
+	}
+
+	return state;
+}
+
+void
+rs_profiler_set_enabled(gboolean _enabled)
+{
+	g_atomic_int_set(&enabled, !!_enabled);
+}
+
+gboolean
+rs_profiler_get_enabled(void)
+{
+	return is_enabled();
+}
+
+void
+rs_profiler_begin(RSProfilerFrame *frame)
+{
+	ThreadState *state;
+
+	frame->active = is_enabled();
+	if (!frame->active)
+		return;
+
+	state = get_thread_state();
+
+	/* Everything counted in this thread from now on belongs to this frame,
+	 * until a nested frame takes over */
+	frame->saved_child = state->child;
+	frame->saved_allocated = state->allocated;
+	frame->saved_cache = state->cache;
+	state->child = 0;
+	state->allocated = 0;
+	state->cache = RS_PROFILER_CACHE_NONE;
+	state->depth++;
+
+	frame->start = g_get_monotonic_time();
+}
+
+void
+rs_profiler_end(RSProfilerFrame *frame, const gchar *name, gconstpointer filter, gint width, gint height, gboolean image8)
+{
+	ThreadState *state;
+	RSProfilerEvent *event;
+	gint64 duration;
+	gint64 self;
+
+	if (!frame->active)
+		return;
+
+	duration = g_get_monotonic_time() - frame->start;
+	state = get_thread_state();
+	state->depth--;
+	self = MAX(0, duration - state->child);
+
+	g_mutex_lock(&ring_lock);
+	event = &ring[ring_head];
+	event->name = name;
+	event->filter = filter;
+	event->thread = state->thread;
+	event->depth = state->depth;
+	event->start = frame->start;
+	event->duration = duration;
+	event->self = self;
+	event->width = width;
+	event->height = height;
+	event->image8 = image8;
+	event->allocated = state->allocated;
+	event->cache = state->cache;
+	ring_head = (ring_head + 1) % RS_PROFILER_RING_SIZE;
+	ring_count = MIN(ring_count + 1, RS_PROFILER_RING_SIZE);
+	g_mutex_unlock(&ring_lock);
+
+	if (G_UNLIKELY(rs_debug_flags & RS_DEBUG_PERFORMANCE) && self > 1000)
+	{
+		printf("%s%s took: \033[32m%.0f\033[0mms", name, image8 ? " (8 bit)" : "", self / 1000.0);
+		if (width > 0 && height > 0)
+			printf(" [\033[33m%.01f\033[0mMpix/s] [w: %d, h: %d]", ((gdouble) width * height) / self, width, height);
+		if (state->allocated > 0)
+			printf(" [%" G_GSIZE_FORMAT " kB allocated]", state->allocated / 1024);
+		if (state->cache != RS_PROFILER_CACHE_NONE)
+			printf(" [cache %s]", cache_names[state->cache]);
+		printf("\n");
+	}
+	if (G_UNLIKELY(rs_debug_flags & RS_DEBUG_PERFORMANCE) && state->depth == 0 && duration > 1000)
+		printf("Complete chain took: \033[32m%.0f\033[0mms\n\n", duration / 1000.0);
+
+	/* Hand back to the calling filter */
+	state->child = frame->saved_child + duration;
+	state->allocated = frame->saved_allocated;
+	state->cache = frame->saved_cache;
+}
+
+void
+rs_profiler_add_allocation(gsize bytes)
+{
+	if (is_enabled())
+		get_thread_state()->allocated += bytes;
+}
+
+void
+rs_profiler_cache_lookup(gboolean hit)
+{
+	if (is_enabled())
+		get_thread_state()->cache = hit ? RS_PROFILER_CACHE_HIT : RS_PROFILER_CACHE_MISS;
+}
+
+RSProfilerEvent *
+rs_profiler_get_events(guint *n_events)
+{
+	RSProfilerEvent *events;
+	guint first, i;
+
+	g_return_val_if_fail(n_events != NULL, NULL);
+
+	g_mutex_lock(&ring_lock);
+	events = g_new(RSProfilerEvent, MAX(1, ring_count));
+	first = (ring_head + RS_PROFILER_RING_SIZE - ring_count) % RS_PROFILER_RING_SIZE;
+	for (i = 0; i < ring_count; i++)
+		events[i] = ring[(first + i) % RS_PROFILER_RING_SIZE];
+	*n_events = ring_count;
+	g_mutex_unlock(&ring_lock);
+
+	return events;
+}
+
+void
+rs_profiler_clear(void)
+{
+	g_mutex_lock(&ring_lock);
+	ring_head = 0;
+	ring_count = 0;
+	g_mutex_unlock(&ring_lock);
+}
+
+gboolean
+rs_profiler_save_chrome_trace(const gchar *filename, GError **error)
+{
+	RSProfilerEvent *events;
+	RSProfilerEvent *e;
+	GString *json;
+	gboolean ret;
+	guint n_events, i;
+
+	g_return_val_if_fail(filename != NULL, FALSE);
+
+	events = rs_profiler_get_events(&n_events);
+
+	json = g_string_new("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (i = 0; i < n_events; i++)
+	{
+		e = &events[i];
+		g_string_append_printf(json,
+			"{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+			"\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ",\"args\":{"
+			"\"filter\":\"%p\",\"self_us\":%" G_GINT64_FORMAT ",\"width\":%d,\"height\":%d,"
+			"\"mpix_per_s\":%.2f,\"allocated\":%" G_GSIZE_FORMAT ",\"cache\":\"%s\"}}%s\n",
+			e->name, e->image8 ? "image8" : "image", e->thread,
+			e->start, e->duration,
+			e->filter, e->self, e->width, e->height,
+			(e->self > 0) ? ((gdouble) e->width * e->height) / e->self : 0.0,
+			e->allocated, cache_names[e->cache],
+			(i + 1 < n_events) ? "," : "");
+	}
+	g_string_append(json, "]}\n");
+
+	ret = g_file_set_contents(filename, json->str, json->len, error);
+
+	g_string_free(json, TRUE);
+	g_free(events);
+
+	return ret;
+}
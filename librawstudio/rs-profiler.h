@@ -0,0 +1,135 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>, 
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RS_PROFILER_H
+#define RS_PROFILER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The number of events kept in the ring buffer, older events are overwritten */
+#define RS_PROFILER_RING_SIZE 8192
+
+typedef enum {
+	RS_PROFILER_CACHE_NONE = 0,
+	RS_PROFILER_CACHE_HIT,
+	RS_PROFILER_CACHE_MISS,
+} RSProfilerCache;
+
+/* One rs_filter_get_image() or rs_filter_get_image8() call */
+typedef struct {
+	const gchar *name;      /* Type name of the filter */
+	gconstpointer filter;   /* Only for identification, may be freed */
+	guint thread;           /* Small number identifying the calling thread */
+	gint depth;             /* Nesting depth, 0 is the end of the chain */
+	gint64 start;           /* Monotonic time in microseconds */
+	gint64 duration;        /* Including time spent in previous filters */
+	gint64 self;            /* Excluding time spent in previous filters */
+	gint width;             /* Width of the ROI or the image, 0 if none */
+	gint height;            /* Height of the ROI or the image, 0 if none */
+	gboolean image8;        /* TRUE for rs_filter_get_image8() */
+	gsize allocated;        /* Image bytes allocated by the filter itself */
+	RSProfilerCache cache;  /* Set by caching filters */
+} RSProfilerEvent;
+
+/* Lives on the stack of the instrumented function */
+typedef struct {
+	gboolean active;
+	gint64 start;
+	gint64 saved_child;
+	gsize saved_allocated;
+	RSProfilerCache saved_cache;
+} RSProfilerFrame;
+
+/**
+ * Enable or disable recording of events. Recording is also enabled when
+ * the "performance" debug flag is set, which will print every event as well
+ * @param enabled TRUE to enable recording
+ */
+extern void
+rs_profiler_set_enabled(gboolean enabled);
+
+/**
+ * Check if events are being recorded
+ * @return TRUE if events are recorded
+ */
+extern gboolean
+rs_profiler_get_enabled(void);
+
+/**
+ * Start measuring a filter call
+ * @param frame A RSProfilerFrame on the stack of the caller
+ */
+extern void
+rs_profiler_begin(RSProfilerFrame *frame);
+
+/**
+ * Stop measuring a filter call and record the event
+ * @param frame The RSProfilerFrame given to rs_profiler_begin()
+ * @param name The name of the filter
+ * @param filter The filter
+ * @param width The width of the processed area or 0
+ * @param height The height of the processed area or 0
+ * @param image8 TRUE if this was an 8 bit request
+ */
+extern void
+rs_profiler_end(RSProfilerFrame *frame, const gchar *name, gconstpointer filter, gint width, gint height, gboolean image8);
+
+/**
+ * Account an image allocation to the filter currently running in this thread
+ * @param bytes The number of bytes allocated
+ */
+extern void
+rs_profiler_add_allocation(gsize bytes);
+
+/**
+ * Record a cache lookup for the filter currently running in this thread
+ * @param hit TRUE if the request could be served from cache
+ */
+extern void
+rs_profiler_cache_lookup(gboolean hit);
+
+/**
+ * Get a copy of the recorded events
+ * @param n_events Will be set to the number of events returned
+ * @return An array of events, oldest first, this must be freed with g_free()
+ */
+extern RSProfilerEvent *
+rs_profiler_get_events(guint *n_events);
+
+/**
+ * Forget all recorded events
+ */
+extern void
+rs_profiler_clear(void);
+
+/**
+ * Save recorded events in the Chrome trace event format, this can be
+ * loaded in chrome://tracing or Perfetto
+ * @param filename The file to write
+ * @param error A return location for a GError or NULL
+ * @return TRUE on success
+ */
+extern gboolean
+rs_profiler_save_chrome_trace(const gchar *filename, GError **error);
+
+G_END_DECLS
+
+#endif /* RS_PROFILER_H */
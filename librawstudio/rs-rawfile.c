@@ -29,6 +29,9 @@
  #include <sys/mman.h>
 #endif
 #include <string.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <jpeglib.h>
 #include "rs-rawfile.h"
 
 struct _RAWFILE {
@@ -44,6 +47,7 @@ struct _RAWFILE {
 	gushort byteorder;
 	guint first_ifd_offset;
 	guint base;
+	guint64 device;
 };
 
 #if BYTE_ORDER == LITTLE_ENDIAN
@@ -290,6 +294,237 @@ raw_get_pixbuf(RAWFILE *rawfile, guint pos, guint length)
 	return(pixbuf);
 }
 
+/* Decoding embedded JPEG previews directly from the map */
+
+struct jpeg_map_error {
+	struct jpeg_error_mgr pub;
+	jmp_buf buf;
+};
+
+static void
+jpeg_map_error_exit(j_common_ptr cinfo)
+{
+	struct jpeg_map_error *error = (struct jpeg_map_error *) cinfo->err;
+	longjmp(error->buf, 1);
+}
+
+static void
+jpeg_map_output_message(j_common_ptr cinfo)
+{
+	/* Corrupt previews are common, don't spam stderr */
+}
+
+static void
+jpeg_map_init_source(j_decompress_ptr cinfo)
+{
+}
+
+static boolean
+jpeg_map_fill_input_buffer(j_decompress_ptr cinfo)
+{
+	/* Truncated data, insert a fake EOI like jdatasrc.c does */
+	static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+
+	cinfo->src->next_input_byte = eoi;
+	cinfo->src->bytes_in_buffer = 2;
+	return TRUE;
+}
+
+static void
+jpeg_map_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
+{
+	struct jpeg_source_mgr *src = cinfo->src;
+
+	if (num_bytes <= 0)
+		return;
+
+	if ((size_t) num_bytes > src->bytes_in_buffer)
+		jpeg_map_fill_input_buffer(cinfo);
+	else
+	{
+		src->next_input_byte += num_bytes;
+		src->bytes_in_buffer -= num_bytes;
+	}
+}
+
+static void
+jpeg_map_term_source(j_decompress_ptr cinfo)
+{
+}
+
+static gboolean
+raw_is_jpeg(RAWFILE *rawfile, guint pos, guint length)
+{
+	const guchar *data;
+
+	if ((length < 4) || ((rawfile->base+pos+length) > rawfile->size))
+		return FALSE;
+
+	data = (const guchar *) rawfile->map + rawfile->base + pos;
+	return (data[0] == 0xFF && data[1] == 0xD8);
+}
+
+/**
+ * Get the dimensions of an embedded JPEG image without decoding it
+ * @param rawfile A RAWFILE
+ * @param pos Position of the JPEG stream relative to the current base
+ * @param length Length of the JPEG stream
+ * @param width The image width will be written here
+ * @param height The image height will be written here
+ * @return TRUE if a JPEG frame header was found, FALSE otherwise
+ */
+gboolean
+raw_get_jpeg_size(RAWFILE *rawfile, guint pos, guint length, gint *width, gint *height)
+{
+	const guchar *data;
+	guint i = 2;
+
+	g_return_val_if_fail(rawfile != NULL, FALSE);
+
+	if (!raw_is_jpeg(rawfile, pos, length))
+		return FALSE;
+
+	data = (const guchar *) rawfile->map + rawfile->base + pos;
+
+	/* Walk the markers until we meet a Start Of Frame */
+	while ((i+9) < length)
+	{
+		guchar marker;
+		guint segment;
+
+		if (data[i] != 0xFF)
+			return FALSE;
+		marker = data[i+1];
+
+		/* Fill bytes */
+		if (marker == 0xFF)
+		{
+			i++;
+			continue;
+		}
+
+		/* SOFn, but not DHT (0xC4), JPG (0xC8) or DAC (0xCC) */
+		if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+		{
+			*height = (data[i+5]<<8) | data[i+6];
+			*width = (data[i+7]<<8) | data[i+8];
+			return (*width > 0 && *height > 0);
+		}
+
+		/* Start of scan or end of image without a frame header */
+		if (marker == 0xDA || marker == 0xD9)
+			return FALSE;
+
+		segment = (data[i+2]<<8) | data[i+3];
+		i += 2 + segment;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Decode an embedded image to a pixbuf no smaller than needed. JPEG images
+ * are downscaled by libjpeg while decoding (1/2, 1/4 or 1/8), which is much
+ * cheaper than decoding a full size preview and scaling it afterwards
+ * @param rawfile A RAWFILE
+ * @param pos Position of the image relative to the current base
+ * @param length Length of the image
+ * @param size The returned image will cover a size x size bounding box if possible
+ * @return A new GdkPixbuf or NULL
+ */
+GdkPixbuf *
+raw_get_pixbuf_scaled(RAWFILE *rawfile, guint pos, guint length, gint size)
+{
+	struct jpeg_decompress_struct cinfo;
+	struct jpeg_map_error jerr;
+	struct jpeg_source_mgr src;
+	GdkPixbuf * volatile pixbuf = NULL;
+	guchar * volatile line = NULL;
+	gint denom, long_edge;
+
+	g_return_val_if_fail(rawfile != NULL, NULL);
+
+	if (!raw_is_jpeg(rawfile, pos, length))
+		return raw_get_pixbuf(rawfile, pos, length);
+
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = jpeg_map_error_exit;
+	jerr.pub.output_message = jpeg_map_output_message;
+	jpeg_create_decompress(&cinfo);
+
+	if (setjmp(jerr.buf))
+	{
+		/* Let GdkPixbuf have a go at it */
+		jpeg_destroy_decompress(&cinfo);
+		g_free(line);
+		if (pixbuf)
+			g_object_unref(pixbuf);
+		return raw_get_pixbuf(rawfile, pos, length);
+	}
+
+	src.init_source = jpeg_map_init_source;
+	src.fill_input_buffer = jpeg_map_fill_input_buffer;
+	src.skip_input_data = jpeg_map_skip_input_data;
+	src.resync_to_restart = jpeg_resync_to_restart;
+	src.term_source = jpeg_map_term_source;
+	src.next_input_byte = (const JOCTET *) rawfile->map + rawfile->base + pos;
+	src.bytes_in_buffer = length;
+	cinfo.src = &src;
+
+	jpeg_read_header(&cinfo, TRUE);
+
+	/* Anything but plain RGB or grayscale is left to GdkPixbuf */
+	if (cinfo.num_components != 3 && cinfo.num_components != 1)
+		longjmp(jerr.buf, 1);
+
+	/* Find the largest reduction that still covers the bounding box */
+	long_edge = MAX(cinfo.image_width, cinfo.image_height);
+	for (denom = 8; denom > 1; denom /= 2)
+		if (long_edge / denom >= size)
+			break;
+
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = denom;
+	cinfo.out_color_space = (cinfo.num_components == 1) ? JCS_GRAYSCALE : JCS_RGB;
+	cinfo.dct_method = JDCT_IFAST;
+	cinfo.do_fancy_upsampling = FALSE;
+
+	jpeg_start_decompress(&cinfo);
+
+	pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, cinfo.output_width, cinfo.output_height);
+	if (!pixbuf)
+		longjmp(jerr.buf, 1);
+
+	if (cinfo.output_components == 1)
+		line = g_new(guchar, cinfo.output_width);
+
+	while (cinfo.output_scanline < cinfo.output_height)
+	{
+		guchar *out = gdk_pixbuf_get_pixels(pixbuf) + cinfo.output_scanline * gdk_pixbuf_get_rowstride(pixbuf);
+
+		if (line)
+		{
+			JSAMPROW row = line;
+			guint x;
+
+			jpeg_read_scanlines(&cinfo, &row, 1);
+			for (x = 0; x < cinfo.output_width; x++)
+				out[x*3] = out[x*3+1] = out[x*3+2] = line[x];
+		}
+		else
+		{
+			JSAMPROW row = out;
+			jpeg_read_scanlines(&cinfo, &row, 1);
+		}
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	g_free(line);
+
+	return pixbuf;
+}
+
 RAWFILE *
 raw_create_from_memory(void *memory, guint size, guint first_ifd_offset, gushort byteorder)
 {
@@ -305,6 +540,7 @@ raw_create_from_memory(void *memory, guint size, guint first_ifd_offset, gushort
 	rawfile->base = 0;
 	rawfile->byteorder = byteorder;
 	rawfile->first_ifd_offset = first_ifd_offset;
+	rawfile->device = 0;
 	return rawfile;
 }
 
@@ -323,6 +559,7 @@ raw_open_file(const gchar *filename)
 		return(NULL);
 	rawfile = g_malloc(sizeof(RAWFILE));
 	rawfile->size = st.st_size;
+	rawfile->device = st.st_dev;
 #ifdef G_OS_WIN32
 
 	rawfile->filehandle = CreateFile(filename, FILE_READ_DATA, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
@@ -466,3 +703,11 @@ raw_get_filesize(RAWFILE *rawfile)
 
 	return rawfile->size;
 }
+
+guint64
+raw_get_device(RAWFILE *rawfile)
+{
+	g_return_val_if_fail(rawfile != NULL, 0);
+
+	return rawfile->device;
+}
@@ -44,6 +44,8 @@ gboolean raw_strcmp(RAWFILE *rawfile, guint pos, const gchar *needle, gint len);
 gboolean raw_strcpy(RAWFILE *rawfile, guint pos, void *target, gint len);
 gchar *raw_strdup(RAWFILE *rawfile, guint pos, gint len);
 GdkPixbuf *raw_get_pixbuf(RAWFILE *rawfile, guint pos, guint length);
+GdkPixbuf *raw_get_pixbuf_scaled(RAWFILE *rawfile, guint pos, guint length, gint size);
+gboolean raw_get_jpeg_size(RAWFILE *rawfile, guint pos, guint length, gint *width, gint *height);
 void raw_close_file(RAWFILE *rawfile);
 void raw_reset_base(RAWFILE *rawfile);
 gint raw_get_base(RAWFILE *rawfile);
@@ -52,5 +54,6 @@ void raw_set_byteorder(RAWFILE *rawfile, gushort byteorder);
 guint get_first_ifd_offset(RAWFILE *rawfile);
 void *raw_get_map(RAWFILE *rawfile);
 guint raw_get_filesize(RAWFILE *rawfile);
+guint64 raw_get_device(RAWFILE *rawfile);
 
 #endif /* RAWFILE_H */
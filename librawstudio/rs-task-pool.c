@@ -0,0 +1,165 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>, 
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <rawstudio.h>
+#include "rs-task-pool.h"
+
+/* A batch of tasks submitted by one call to rs_task_pool_run(). Workers and
+ * the submitting thread grab task indices from it until it runs dry. */
+typedef struct {
+	GThreadFunc func;
+	guint8 *tasks;
+	gsize task_size;
+	gint n_tasks;
+	gint next;
+	gint remaining;
+	gint refcount;
+	GMutex lock;
+	GCond done_cond;
+} RSTaskBatch;
+
+static GThreadPool *pool = NULL;
+static guint n_workers = 0;
+
+static void
+batch_unref(RSTaskBatch *batch)
+{
+	if (g_atomic_int_dec_and_test(&batch->refcount))
+	{
+		g_mutex_clear(&batch->lock);
+		g_cond_clear(&batch->done_cond);
+		g_slice_free(RSTaskBatch, batch);
+	}
+}
+
+static void
+batch_process(RSTaskBatch *batch)
+{
+	gint i;
+
+	while ((i = g_atomic_int_add(&batch->next, 1)) < batch->n_tasks)
+	{
+		batch->func(batch->tasks + i * batch->task_size);
+
+		if (g_atomic_int_dec_and_test(&batch->remaining))
+		{
+			g_mutex_lock(&batch->lock);
+			g_cond_signal(&batch->done_cond);
+			g_mutex_unlock(&batch->lock);
+		}
+	}
+}
+
+static void
+task_worker(gpointer data, gpointer unused)
+{
+	RSTaskBatch *batch = data;
+
+	batch_process(batch);
+	batch_unref(batch);
+}
+
+static GThreadPool *
+get_pool(void)
+{
+	static gsize init = 0;
+
+	if (g_once_init_enter(&init))
+	{
+		n_workers = rs_get_number_of_processor_cores();
+		/* Exclusive threads are started right away and kept alive, so no
+		 * thread is ever created on the render path */
+		pool = g_thread_pool_new(task_worker, NULL, n_workers, TRUE, NULL);
+		g_once_init_leave(&init, 1);
+	}
+
+	return pool;
+}
+
+/**
+ * Get the number of workers in the shared task pool
+ * @return The number of worker threads, this is also the number of tasks
+ *         filters should split their work into
+ */
+guint
+rs_task_pool_get_n_workers(void)
+{
+	get_pool();
+
+	return n_workers;
+}
+
+/**
+ * Run a number of tasks on the shared task pool and wait for all of them
+ * to finish. The calling thread will help processing the tasks, so it is
+ * safe to call this function from within a task (nested filters).
+ * @note func must return normally, it must NOT call g_thread_exit()
+ * @param func The function to call for each task
+ * @param tasks An array of n_tasks structs of task_size bytes each, func
+ *              will be called with a pointer to each of them
+ * @param task_size The size of each struct in tasks
+ * @param n_tasks The number of structs in tasks
+ */
+void
+rs_task_pool_run(GThreadFunc func, gpointer tasks, gsize task_size, guint n_tasks)
+{
+	RSTaskBatch *batch;
+	guint i, helpers;
+	GThreadPool *thread_pool = get_pool();
+
+	g_return_if_fail(func != NULL);
+	g_return_if_fail(tasks != NULL);
+
+	if (n_tasks == 0)
+		return;
+
+	/* Nothing to share, don't bother the workers */
+	if (n_tasks == 1)
+	{
+		func(tasks);
+		return;
+	}
+
+	batch = g_slice_new(RSTaskBatch);
+	batch->func = func;
+	batch->tasks = tasks;
+	batch->task_size = task_size;
+	batch->n_tasks = n_tasks;
+	batch->next = 0;
+	batch->remaining = n_tasks;
+	g_mutex_init(&batch->lock);
+	g_cond_init(&batch->done_cond);
+
+	/* We process tasks ourselves as well, so one helper less is needed */
+	helpers = MIN(n_tasks - 1, n_workers);
+	batch->refcount = helpers + 1;
+	for (i = 0; i < helpers; i++)
+		g_thread_pool_push(thread_pool, batch, NULL);
+
+	/* If all workers are busy (we may be running inside a task ourselves),
+	 * this will simply process every task in this thread */
+	batch_process(batch);
+
+	g_mutex_lock(&batch->lock);
+	while (g_atomic_int_get(&batch->remaining) > 0)
+		g_cond_wait(&batch->done_cond, &batch->lock);
+	g_mutex_unlock(&batch->lock);
+
+	batch_unref(batch);
+}
@@ -0,0 +1,51 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>, 
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RS_TASK_POOL_H
+#define RS_TASK_POOL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Get the number of workers in the shared task pool
+ * @return The number of worker threads, this is also the number of tasks
+ *         filters should split their work into
+ */
+guint
+rs_task_pool_get_n_workers(void);
+
+/**
+ * Run a number of tasks on the shared task pool and wait for all of them
+ * to finish. The calling thread will help processing the tasks, so it is
+ * safe to call this function from within a task (nested filters).
+ * @note func must return normally, it must NOT call g_thread_exit()
+ * @param func The function to call for each task
+ * @param tasks An array of n_tasks structs of task_size bytes each, func
+ *              will be called with a pointer to each of them
+ * @param task_size The size of each struct in tasks
+ * @param n_tasks The number of structs in tasks
+ */
+void
+rs_task_pool_run(GThreadFunc func, gpointer tasks, gsize task_size, guint n_tasks);
+
+G_END_DECLS
+
+#endif /* RS_TASK_POOL_H */
@@ -208,6 +208,9 @@ rs_get_number_of_processor_cores(void)
 	return num;
 }
 
+/* Allows benchmarks to disable SIMD code paths */
+static gint cpu_features_mask = -1;
+
 #if defined (__i386__) || defined (__x86_64__)
 
 #define xgetbv(index,eax,edx)                                   \
@@ -230,15 +233,30 @@ rs_detect_cpu_features(void)
        : "=a" (eax), "=c" (ecx),  "=d" (edx) \
        : "0" (cmd) \
      ); \
+} while(0)
+/* Leaf 7 reports its flags in ebx, which may be the PIC register */
+#define cpuid_ebx(cmd, subcmd, ebx) \
+  do { \
+     guint _eax, _ecx = subcmd; \
+     asm ( \
+       "push %%"REG_b"\n\t"\
+       "cpuid\n\t" \
+       "mov %%ebx, %%esi\n\t" \
+       "pop %%"REG_b"\n\t" \
+       : "=a" (_eax), "=S" (ebx), "+c" (_ecx) \
+       : "0" (cmd) \
+       : "edx" \
+     ); \
 } while(0)
 	guint eax;
+	guint ebx;
 	guint edx;
 	guint ecx;
 	static GMutex lock;
 	static guint stored_cpuflags = -1;
 
 	if (stored_cpuflags != -1)
-		return stored_cpuflags;
+		return stored_cpuflags & (guint) g_atomic_int_get(&cpu_features_mask);
 
 	g_mutex_lock(&lock);
 	if (stored_cpuflags == -1)
@@ -270,9 +288,11 @@ rs_detect_cpu_features(void)
 		{
 			guint std_dsc;
 			guint ext_dsc;
+			guint max_level;
 
 			/* Get the standard level */
 			cpuid(0x00000000, std_dsc, ecx, edx);
+			max_level = std_dsc;
 
 			if (std_dsc)
 			{
@@ -302,6 +322,15 @@ rs_detect_cpu_features(void)
 						if ((eax & 0x6) == 0x6)
 							cpuflags |= RS_CPU_FLAG_AVX;
 				}
+				/* FMA and AVX2 use the AVX register state */
+				if ((cpuflags & RS_CPU_FLAG_AVX) && (ecx & 0x00001000))
+					cpuflags |= RS_CPU_FLAG_FMA;
+				if ((cpuflags & RS_CPU_FLAG_AVX) && max_level >= 7)
+				{
+					cpuid_ebx(0x00000007, 0, ebx);
+					if (ebx & 0x00000020)
+						cpuflags |= RS_CPU_FLAG_AVX2;
+				}
 			}
 
 			/* Is there extensions */
@@ -341,10 +370,13 @@ rs_detect_cpu_features(void)
 	report("SSE4.1",RS_CPU_FLAG_SSE4_1);
 	report("SSE4.2",RS_CPU_FLAG_SSE4_2);
 	report("AVX",RS_CPU_FLAG_AVX);
+	report("AVX2",RS_CPU_FLAG_AVX2);
+	report("FMA",RS_CPU_FLAG_FMA);
 #undef report
 
-	return(stored_cpuflags);
+	return(stored_cpuflags & (guint) g_atomic_int_get(&cpu_features_mask));
 #undef cpuid
+#undef cpuid_ebx
 }
 
 #else
@@ -355,6 +387,17 @@ rs_detect_cpu_features()
 }
 #endif /* __i386__ || __x86_64__ */
 
+/**
+ * Limit the cpu features reported by rs_detect_cpu_features(), this can be
+ * used to force filters to use plain C or older SIMD code paths
+ * @param mask A bitmask of @RSCpuFlags to allow, ~0 to allow all
+ */
+void
+rs_set_cpu_features_mask(guint mask)
+{
+	g_atomic_int_set(&cpu_features_mask, (gint) mask);
+}
+
 /**
  * Return a path to the current config directory for Rawstudio - this is the
  * .rawstudio direcotry in home
@@ -79,6 +79,14 @@ rs_get_number_of_processor_cores(void);
 guint
 rs_detect_cpu_features(void);
 
+/**
+ * Limit the cpu features reported by rs_detect_cpu_features(), this can be
+ * used to force filters to use plain C or older SIMD code paths
+ * @param mask A bitmask of @RSCpuFlags to allow, ~0 to allow all
+ */
+extern void
+rs_set_cpu_features_mask(guint mask);
+
 /**
  * Return a path to the current config directory for Rawstudio - this is the
  * .rawstudio direcotry in home
@@ -20,6 +20,7 @@
 /* Plugin tmpl version 4 */
 
 #include <rawstudio.h>
+#include <string.h> /* memcpy() */
 
 #if 0 /* Change to 1 to enable debugging info */
 #define filter_debug g_debug
@@ -32,9 +33,29 @@
 #define RS_CACHE_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), RS_TYPE_CACHE, RSCacheClass))
 #define RS_IS_CACHE(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), RS_TYPE_CACHE))
 
+/* Width and height of a cached tile */
+#define TILE_SIZE 256
+#define TILE_KEY(x, y) GINT_TO_POINTER(((y) << 16) | (x))
+
 typedef struct _RSCache RSCache;
 typedef struct _RSCacheClass RSCacheClass;
 
+typedef struct {
+	gint x;
+	gint y;
+	RS_IMAGE16 *image;
+	gboolean quick;
+	gsize size;
+	GList *link;
+} RSCacheTile;
+
+/* Full size image tiles are assembled into, reused once all images returned
+ * from it are gone */
+typedef struct {
+	RS_IMAGE16 *image;
+	gint refcount; /* The cache and every image returned using the pixels */
+} RSCacheOutput;
+
 struct _RSCache {
 	RSFilter parent;
 
@@ -44,6 +65,16 @@ struct _RSCache {
 	gboolean ignore_roi;
 	gint latency;
 	GMutex cache_mutex;
+
+	/* Tile cache for ROI requests, used when tile_memory is set */
+	gint tile_memory;
+	GHashTable *tiles;
+	GQueue tile_lru;
+	gsize tile_bytes;
+	gint tile_width;
+	gint tile_height;
+	RSFilterResponse *tile_response;
+	RSCacheOutput *tile_output;
 };
 
 struct _RSCacheClass {
@@ -55,7 +86,8 @@ RS_DEFINE_FILTER(rs_cache, RSCache)
 enum {
 	PROP_0,
 	PROP_LATENCY,
-	PROP_IGNORE_ROI
+	PROP_IGNORE_ROI,
+	PROP_TILE_MEMORY
 };
 
 static void finalize(GObject *object);
@@ -64,6 +96,8 @@ static void set_property (GObject *object, guint property_id, const GValue *valu
 static RSFilterResponse *get_image(RSFilter *filter, const RSFilterRequest *request);
 static RSFilterResponse *get_image8(RSFilter *filter, const RSFilterRequest *request);
 static void flush(RSCache *cache);
+static void flush_tiles(RSCache *cache);
+static void evict_tiles(RSCache *cache);
 static void previous_changed(RSFilter *filter, RSFilter *parent, RSFilterChangedMask mask);
 
 G_MODULE_EXPORT void
@@ -94,6 +128,12 @@ rs_cache_class_init(RSCacheClass *klass)
 			FALSE,
 			G_PARAM_READWRITE)
 	);
+	g_object_class_install_property(object_class,
+		PROP_TILE_MEMORY, g_param_spec_int(
+			"tile-memory", "tile-memory", "Memory in megabytes used for caching tiles of ROI requests, 0 caches a single image",
+			0, 65535, 0,
+			G_PARAM_READWRITE)
+	);
 
 	filter_class->name = "Listen for changes and caches image data";
 	filter_class->get_image = get_image;
@@ -109,6 +149,24 @@ rs_cache_init(RSCache *cache)
 	cache->latency = 0;
 	cache->cached_image = rs_filter_response_new();
 	g_mutex_init(&cache->cache_mutex);
+	cache->tile_memory = 0;
+	cache->tiles = g_hash_table_new(g_direct_hash, g_direct_equal);
+	g_queue_init(&cache->tile_lru);
+	cache->tile_bytes = 0;
+	cache->tile_response = NULL;
+	cache->tile_output = NULL;
+}
+
+static void
+output_unref(gpointer data)
+{
+	RSCacheOutput *output = data;
+
+	if (g_atomic_int_dec_and_test(&output->refcount))
+	{
+		g_object_unref(output->image);
+		g_free(output);
+	}
 }
 
 static void
@@ -116,6 +174,10 @@ finalize(GObject *object)
 {
 	RSCache *cache = RS_CACHE(object);
 	flush(cache);
+	flush_tiles(cache);
+	if (cache->tile_output)
+		output_unref(cache->tile_output);
+	g_hash_table_destroy(cache->tiles);
 	g_mutex_clear(&cache->cache_mutex);
 }
 
@@ -132,6 +194,9 @@ get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspe
 		case PROP_IGNORE_ROI:
 			g_value_set_boolean(value, cache->ignore_roi);
 			break;
+		case PROP_TILE_MEMORY:
+			g_value_set_int(value, cache->tile_memory);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
@@ -150,6 +215,12 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 		case PROP_IGNORE_ROI:
 			cache->ignore_roi = g_value_get_boolean(value);
 			break;
+		case PROP_TILE_MEMORY:
+			g_mutex_lock(&cache->cache_mutex);
+			cache->tile_memory = g_value_get_int(value);
+			evict_tiles(cache);
+			g_mutex_unlock(&cache->cache_mutex);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
@@ -223,6 +294,253 @@ set_roi_to_full(RSCache *cache) {
 	filter_debug("Cache[%p]: Saved   ROI x:%d, y:%d, w:%d, h:%d", cache, r->x, r->y, r->width, r->height);
 }
 
+static void
+tile_free(RSCacheTile *tile)
+{
+	g_object_unref(tile->image);
+	g_list_free_1(tile->link);
+	g_free(tile);
+}
+
+static void
+tile_remove(RSCache *cache, RSCacheTile *tile)
+{
+	g_hash_table_remove(cache->tiles, TILE_KEY(tile->x, tile->y));
+	g_queue_unlink(&cache->tile_lru, tile->link);
+	cache->tile_bytes -= tile->size;
+	tile_free(tile);
+}
+
+static void
+tile_copy(RS_IMAGE16 *dest, gint dest_x, gint dest_y, RS_IMAGE16 *src, gint src_x, gint src_y, gint width, gint height)
+{
+	gint row;
+
+	for (row = 0; row < height; row++)
+		memcpy(GET_PIXEL(dest, dest_x, dest_y + row), GET_PIXEL(src, src_x, src_y + row), width * src->pixelsize * sizeof(gushort));
+}
+
+/**
+ * Get a full size image to assemble tiles into. The pixels of the previous
+ * image are reused if nothing uses them anymore, so panning the preview
+ * doesn't allocate a full frame for every redraw
+ */
+static RS_IMAGE16 *
+output_get(RSCache *cache, gint width, gint height, gint channels, gint pixelsize)
+{
+	RSCacheOutput *output = cache->tile_output;
+
+	if (output && (output->image->w != width || output->image->h != height
+		|| output->image->channels != channels || output->image->pixelsize != pixelsize
+		|| g_atomic_int_get(&output->refcount) > 1))
+	{
+		output_unref(output);
+		output = cache->tile_output = NULL;
+	}
+
+	if (!output)
+	{
+		output = g_new(RSCacheOutput, 1);
+		output->image = rs_image16_new(width, height, channels, pixelsize);
+		output->refcount = 1;
+		cache->tile_output = output;
+	}
+	else
+		filter_debug("Cache[%p]: Reusing output image", cache);
+
+	g_atomic_int_inc(&output->refcount);
+	return rs_image16_new_from_buffer(width, height, channels, pixelsize,
+		output->image->pixels, output->image->rowstride, output_unref, output);
+}
+
+/* Drop the least recently used tiles until we are within budget */
+static void
+evict_tiles(RSCache *cache)
+{
+	gsize budget = (gsize) cache->tile_memory * 1024 * 1024;
+
+	while (cache->tile_bytes > budget && !g_queue_is_empty(&cache->tile_lru))
+		tile_remove(cache, g_queue_peek_tail(&cache->tile_lru));
+}
+
+static RSFilterResponse *
+get_image_tiled(RSCache *cache, const RSFilterRequest *request, GdkRectangle *roi)
+{
+	RSFilter *filter = RS_FILTER(cache);
+	RSFilterResponse *fr;
+	RSCacheTile *tile;
+	RS_IMAGE16 *output;
+	GdkRectangle area;
+	gint width, height;
+	gint x, y, x1, y1, x2, y2;
+	gint output_x = 0, output_y = 0;
+	gint missing_x1 = G_MAXINT, missing_y1 = G_MAXINT, missing_x2 = -1, missing_y2 = -1;
+	gboolean quick = rs_filter_request_get_quick(request);
+	gboolean response_quick = FALSE;
+	gboolean roi_sized = FALSE;
+
+	/* The caller accepts an image covering only the tiles of the ROI */
+	rs_filter_param_get_boolean(RS_FILTER_PARAM(request), "roi-sized", &roi_sized);
+
+	rs_filter_get_size_simple(filter->previous, request, &width, &height);
+	if (width != cache->tile_width || height != cache->tile_height)
+	{
+		flush_tiles(cache);
+		cache->tile_width = width;
+		cache->tile_height = height;
+	}
+
+	/* Nothing sensible to tile, let the previous filter handle it */
+	if (width < 1 || height < 1 || roi->x >= width || roi->y >= height || roi->x + roi->width <= 0 || roi->y + roi->height <= 0)
+		return rs_filter_get_image(filter->previous, request);
+
+	x1 = MAX(0, roi->x) / TILE_SIZE;
+	y1 = MAX(0, roi->y) / TILE_SIZE;
+	x2 = (MIN(width, roi->x + roi->width) - 1) / TILE_SIZE;
+	y2 = (MIN(height, roi->y + roi->height) - 1) / TILE_SIZE;
+
+	/* Find the tiles we need to render */
+	for (y = y1; y <= y2; y++)
+		for (x = x1; x <= x2; x++)
+		{
+			tile = g_hash_table_lookup(cache->tiles, TILE_KEY(x, y));
+			if (!tile || (tile->quick && !quick))
+			{
+				missing_x1 = MIN(missing_x1, x);
+				missing_y1 = MIN(missing_y1, y);
+				missing_x2 = MAX(missing_x2, x);
+				missing_y2 = MAX(missing_y2, y);
+			}
+		}
+
+	rs_profiler_cache_lookup(missing_x2 < 0);
+
+	/* Render all of them in one go and cut them into tiles */
+	if (missing_x2 >= 0)
+	{
+		RSFilterRequest *tile_request = rs_filter_request_clone(request);
+		RSFilterResponse *response;
+		RS_IMAGE16 *image;
+		gboolean usable = FALSE;
+		gboolean image_roi_sized = FALSE;
+		gint image_x = 0, image_y = 0;
+
+		area.x = missing_x1 * TILE_SIZE;
+		area.y = missing_y1 * TILE_SIZE;
+		area.width = MIN(width, (missing_x2 + 1) * TILE_SIZE) - area.x;
+		area.height = MIN(height, (missing_y2 + 1) * TILE_SIZE) - area.y;
+		rs_filter_request_set_roi(tile_request, &area);
+		rs_filter_param_set_boolean(RS_FILTER_PARAM(tile_request), "roi-sized", TRUE);
+		filter_debug("Cache[%p]: Rendering tiles x:%d, y:%d, w:%d, h:%d", cache, area.x, area.y, area.width, area.height);
+		response = rs_filter_get_image(filter->previous, tile_request);
+		g_object_unref(tile_request);
+
+		image = rs_filter_response_get_image(response);
+
+		/* Tiles can be cut from a full size image or one covering the area */
+		rs_filter_param_get_boolean(RS_FILTER_PARAM(response), "roi-sized", &image_roi_sized);
+		if (image && image_roi_sized)
+		{
+			GdkRectangle *image_roi = rs_filter_response_get_roi(response);
+			if (image_roi && image_roi->width == image->w && image_roi->height == image->h
+				&& rectangle_is_inside(image_roi, &area))
+			{
+				image_x = image_roi->x;
+				image_y = image_roi->y;
+				usable = TRUE;
+			}
+		}
+		else if (image)
+			usable = (image->w == width && image->h == height);
+
+		if (!usable)
+		{
+			if (image)
+				g_object_unref(image);
+			/* The area covers the ROI, so the response answers the request,
+			 * unless it is ROI sized and the caller can't handle that */
+			if (!image_roi_sized || roi_sized)
+				return response;
+			g_object_unref(response);
+			return rs_filter_get_image(filter->previous, request);
+		}
+
+		if (cache->tile_response)
+			g_object_unref(cache->tile_response);
+		cache->tile_response = rs_filter_response_clone(response);
+
+		for (y = missing_y1; y <= missing_y2; y++)
+			for (x = missing_x1; x <= missing_x2; x++)
+			{
+				tile = g_hash_table_lookup(cache->tiles, TILE_KEY(x, y));
+				if (tile && !(tile->quick && !quick))
+					continue;
+				if (tile)
+					tile_remove(cache, tile);
+
+				tile = g_new0(RSCacheTile, 1);
+				tile->x = x;
+				tile->y = y;
+				tile->quick = quick || rs_filter_response_get_quick(response);
+				tile->image = rs_image16_new(MIN(TILE_SIZE, width - x * TILE_SIZE), MIN(TILE_SIZE, height - y * TILE_SIZE), image->channels, image->pixelsize);
+				tile_copy(tile->image, 0, 0, image, x * TILE_SIZE - image_x, y * TILE_SIZE - image_y, tile->image->w, tile->image->h);
+				tile->size = tile->image->h * tile->image->rowstride * sizeof(gushort);
+				tile->link = g_list_alloc();
+				tile->link->data = tile;
+
+				g_hash_table_insert(cache->tiles, TILE_KEY(x, y), tile);
+				g_queue_push_head_link(&cache->tile_lru, tile->link);
+				cache->tile_bytes += tile->size;
+			}
+		g_object_unref(image);
+		g_object_unref(response);
+	}
+
+	area.x = x1 * TILE_SIZE;
+	area.y = y1 * TILE_SIZE;
+	area.width = MIN(width, (x2 + 1) * TILE_SIZE) - area.x;
+	area.height = MIN(height, (y2 + 1) * TILE_SIZE) - area.y;
+
+	/* Assemble the requested area from tiles, into an image covering only
+	 * those tiles if the caller accepts it */
+	tile = g_hash_table_lookup(cache->tiles, TILE_KEY(x1, y1));
+	if (roi_sized)
+	{
+		output = rs_image16_new(area.width, area.height, tile->image->channels, tile->image->pixelsize);
+		output_x = area.x;
+		output_y = area.y;
+	}
+	else
+		output = output_get(cache, width, height, tile->image->channels, tile->image->pixelsize);
+	for (y = y1; y <= y2; y++)
+		for (x = x1; x <= x2; x++)
+		{
+			tile = g_hash_table_lookup(cache->tiles, TILE_KEY(x, y));
+			tile_copy(output, x * TILE_SIZE - output_x, y * TILE_SIZE - output_y, tile->image, 0, 0, tile->image->w, tile->image->h);
+			response_quick |= tile->quick;
+
+			/* Mark as most recently used */
+			g_queue_unlink(&cache->tile_lru, tile->link);
+			g_queue_push_head_link(&cache->tile_lru, tile->link);
+		}
+
+	fr = rs_filter_response_new();
+	rs_filter_param_clone(RS_FILTER_PARAM(fr), RS_FILTER_PARAM(cache->tile_response));
+	rs_filter_param_delete(RS_FILTER_PARAM(fr), "roi-sized");
+	rs_filter_response_set_image(fr, output);
+	g_object_unref(output);
+
+	rs_filter_response_set_roi(fr, &area);
+	if (roi_sized)
+		rs_filter_param_set_boolean(RS_FILTER_PARAM(fr), "roi-sized", TRUE);
+	if (response_quick)
+		rs_filter_response_set_quick(fr);
+
+	evict_tiles(cache);
+
+	return fr;
+}
+
 static RSFilterResponse *
 get_image(RSFilter *filter, const RSFilterRequest *_request)
 {
@@ -240,6 +558,14 @@ get_image(RSFilter *filter, const RSFilterRequest *_request)
 		filter_debug("Cache[%p]: Disabling ROI for upward calls", filter);
 	}
 
+	if (roi && cache->tile_memory > 0)
+	{
+		RSFilterResponse *fr = get_image_tiled(cache, request, roi);
+		g_object_unref(request);
+		g_mutex_unlock(&cache->cache_mutex);
+		return fr;
+	}
+
 	if (rs_filter_response_has_image(cache->cached_image)) {
 
 		if (rs_filter_response_get_quick(cache->cached_image) && !rs_filter_request_get_quick(request))
@@ -285,6 +611,7 @@ get_image(RSFilter *filter, const RSFilterRequest *_request)
 		}
 	}
 
+	rs_profiler_cache_lookup(rs_filter_response_has_image(cache->cached_image));
 	if (!rs_filter_response_has_image(cache->cached_image))
 	{
 		filter_debug("Cache[%p]: Cached image NOT found", filter);
@@ -379,6 +706,7 @@ get_image8(RSFilter *filter, const RSFilterRequest *_request)
 			}
 	}
 
+	rs_profiler_cache_lookup(rs_filter_response_has_image8(cache->cached_image));
 	if (!rs_filter_response_has_image8(cache->cached_image))
 	{
 		filter_debug("Cache[%p]: Cached image8 NOT found", filter);
@@ -411,6 +739,17 @@ flush(RSCache *cache)
 	cache->cached_image = rs_filter_response_new();
 }
 
+static void
+flush_tiles(RSCache *cache)
+{
+	filter_debug("Cache[%p]: Tiles flushed", cache);
+	while (!g_queue_is_empty(&cache->tile_lru))
+		tile_remove(cache, g_queue_peek_tail(&cache->tile_lru));
+	if (cache->tile_response)
+		g_object_unref(cache->tile_response);
+	cache->tile_response = NULL;
+}
+
 static void
 previous_changed(RSFilter *filter, RSFilter *parent, RSFilterChangedMask mask)
 {
@@ -419,7 +758,10 @@ previous_changed(RSFilter *filter, RSFilter *parent, RSFilterChangedMask mask)
 	filter_debug("Cache[%p]: Previous Changed (%x)", filter, mask);
 	g_mutex_lock(&cache->cache_mutex);
 	if (mask & RS_FILTER_CHANGED_PIXELDATA)
+	{
 		flush(cache);
+		flush_tiles(cache);
+	}
 	g_mutex_unlock(&cache->cache_mutex);
 	rs_filter_changed(filter, mask);
 }
@@ -91,7 +91,55 @@ rs_colorspace_transform_init(RSColorspaceTransform *colorspace_transform)
 {
 	/* FIXME: unref this at some point */
 	colorspace_transform->cmm = rs_cmm_new();
-	rs_cmm_set_num_threads(colorspace_transform->cmm, rs_get_number_of_processor_cores());
+	rs_cmm_set_num_threads(colorspace_transform->cmm, rs_task_pool_get_n_workers());
+}
+
+/**
+ * Get a view on the part of the input covering the ROI, for requests with
+ * "roi-sized" set. The input may already be ROI sized itself. The view
+ * shares pixels with the input, which must be kept until the view is unreffed
+ * @param previous_response The response the input came from
+ * @param input The input image
+ * @param roi The ROI of the request
+ * @param area Set to the area of the whole image covered by the view
+ * @return A new RS_IMAGE16 or NULL if the input doesn't cover the ROI
+ */
+static RS_IMAGE16 *
+get_roi_view(RSFilterResponse *previous_response, RS_IMAGE16 *input, GdkRectangle *roi, GdkRectangle *area)
+{
+	GdkRectangle *input_roi;
+	GdkRectangle rect;
+	RS_IMAGE16 *view;
+	gboolean roi_sized = FALSE;
+	gint x = 0, y = 0;
+	gint offset;
+
+	rs_filter_param_get_boolean(RS_FILTER_PARAM(previous_response), "roi-sized", &roi_sized);
+	if (roi_sized && (input_roi = rs_filter_response_get_roi(previous_response)))
+	{
+		x = input_roi->x;
+		y = input_roi->y;
+	}
+
+	rect.x = roi->x - x;
+	rect.y = roi->y - y;
+	rect.width = roi->width;
+	rect.height = roi->height;
+	if (rect.x < 0 || rect.y < 0 || rect.x + rect.width > input->w || rect.y + rect.height > input->h)
+		return NULL;
+
+	view = rs_image16_new_subframe(input, &rect);
+	if (!view)
+		return NULL;
+
+	/* The view may start a bit further left for alignment */
+	offset = view->pixels - input->pixels;
+	area->x = x + (offset % input->rowstride) / input->pixelsize;
+	area->y = y + offset / input->rowstride;
+	area->width = view->w;
+	area->height = view->h;
+
+	return view;
 }
 
 static RSFilterResponse *
@@ -102,10 +150,14 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	RSFilterResponse *response;
 	RS_IMAGE16 *input;
 	RS_IMAGE16 *output = NULL;
+	RS_IMAGE16 *view = NULL;
 	GdkRectangle *roi;
+	GdkRectangle area;
+	gboolean roi_sized = FALSE;
 	int i;
 
 	roi = rs_filter_request_get_roi(request);
+	rs_filter_param_get_boolean(RS_FILTER_PARAM(request), "roi-sized", &roi_sized);
 	previous_response = rs_filter_get_image(filter->previous, request);
 	input = rs_filter_response_get_image(previous_response);
 	if (!RS_IS_IMAGE16(input))
@@ -126,9 +178,16 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 			colorspace_transform->has_premul = rs_filter_param_get_float4(RS_FILTER_PARAM(request), "premul", colorspace_transform->premul);
 		rs_cmm_set_premul(colorspace_transform->cmm, colorspace_transform->premul);
 
-		output = rs_image16_copy(input, FALSE);
+		/* Only allocate what the caller asked for */
+		if (roi && roi_sized)
+			view = get_roi_view(previous_response, input, roi, &area);
 
-		if (convert_colorspace16(colorspace_transform, input, output, input_space, output_space, roi))
+		if (view)
+			output = rs_image16_new(view->w, view->h, input->channels, input->pixelsize);
+		else
+			output = rs_image16_copy(input, FALSE);
+
+		if (convert_colorspace16(colorspace_transform, view ? view : input, output, input_space, output_space, view ? NULL : roi))
 		{
 			/* Image was converted */
 			response = rs_filter_response_clone(previous_response);
@@ -136,6 +195,12 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 			if (colorspace_transform->has_premul)
 				rs_filter_param_set_boolean(RS_FILTER_PARAM(response), "is-premultiplied", TRUE);
 			rs_filter_param_set_object(RS_FILTER_PARAM(response), "colorspace", output_space);
+			if (view)
+			{
+				rs_filter_response_set_roi(response, &area);
+				rs_filter_param_set_boolean(RS_FILTER_PARAM(response), "roi-sized", TRUE);
+				g_object_unref(view);
+			}
 			rs_filter_response_set_image(response, output);
 			g_object_unref(output);
 			g_object_unref(input);
@@ -143,6 +208,8 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		} else
 		{
 			/* No conversion was needed */
+			if (view)
+				g_object_unref(view);
 			g_object_unref(input);
 			g_object_unref(output);
 			return previous_response;
@@ -164,7 +231,10 @@ get_image8(RSFilter *filter, const RSFilterRequest *request)
 	RSFilterResponse *response;
 	RS_IMAGE16 *input;
 	GdkPixbuf *output = NULL;
+	RS_IMAGE16 *view = NULL;
 	GdkRectangle *roi;
+	GdkRectangle area;
+	gboolean roi_sized = FALSE;
 	int i;
 
 	previous_response = rs_filter_get_image(filter->previous, request);
@@ -197,10 +267,26 @@ get_image8(RSFilter *filter, const RSFilterRequest *request)
 	printf("\033[33m8 output_space: %s\n\033[0m", (output_space) ? G_OBJECT_TYPE_NAME(output_space) : "none");
 #endif
 
-	output = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, input->w, input->h);
+	/* Only allocate what the caller asked for */
+	rs_filter_param_get_boolean(RS_FILTER_PARAM(request), "roi-sized", &roi_sized);
+	if (roi && roi_sized)
+		view = get_roi_view(response, input, roi, &area);
 
-	/* Process output */
-	convert_colorspace8(colorspace_transform, input, output, input_space, output_space, roi);
+	if (view)
+	{
+		output = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, view->w, view->h);
+		convert_colorspace8(colorspace_transform, view, output, input_space, output_space, NULL);
+		rs_filter_response_set_roi(response, &area);
+		rs_filter_param_set_boolean(RS_FILTER_PARAM(response), "roi-sized", TRUE);
+		g_object_unref(view);
+	}
+	else
+	{
+		output = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, input->w, input->h);
+
+		/* Process output */
+		convert_colorspace8(colorspace_transform, input, output, input_space, output_space, roi);
+	}
 
 	rs_filter_response_set_image8(response, output);
 	rs_filter_param_set_object(RS_FILTER_PARAM(response), "colorspace", output_space);
@@ -497,7 +583,7 @@ convert_colorspace8(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *inp
 
 		gint i;
 		guint y_offset, y_per_thread, threaded_h;
-		guint threads = rs_get_number_of_processor_cores();
+		guint threads = rs_task_pool_get_n_workers();
 		if (roi->height * roi->width < 200*200)
 			threads = 1;
 		
@@ -522,16 +608,10 @@ convert_colorspace8(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *inp
 			t[i].end_y = y_offset;
 			t[i].matrix = &mat;
 			t[i].table8 = NULL;
-			t[i].single_thread = (threads == 1);
-			if (threads == 1)
-				start_single_cs8_transform_thread(&t[0]);
-			else
-				t[i].threadid = g_thread_new("RSColorspaceTransform worker", start_single_cs8_transform_thread, &t[i]);
 		}
 
-		/* Wait for threads to finish */
-		for(i = 0; threads > 1 && i < threads; i++)
-			g_thread_join(t[i].threadid);
+		/* Run on the shared pool and wait for all bands to finish */
+		rs_task_pool_run(start_single_cs8_transform_thread, t, sizeof(ThreadInfo), threads);
 
 		g_free(t);
 	}
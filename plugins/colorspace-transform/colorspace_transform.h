@@ -40,7 +40,6 @@ typedef struct _RSColorspaceTransformClass RSColorspaceTransformClass;
 
 typedef struct {
 	RSColorspaceTransform *cst;
-	GThread *threadid;
 	gint start_x;
 	gint start_y;
 	gint end_x;
@@ -58,7 +57,6 @@ typedef struct {
 	GCond* transform_finished;
 	GMutex* transform_finished_mutex;
 	gboolean do_run_transform;
-	gboolean single_thread;
 } ThreadInfo;
 
 /* SSE2 optimized functions */
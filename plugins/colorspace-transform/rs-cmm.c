@@ -65,7 +65,6 @@ static GMutex is_profile_gamma_22_corrected_linear_lock;
 
 typedef struct {
 	RSCmm *cmm;
-	GThread *threadid;
 	gint start_y;
 	gint end_y;
 	gint start_x;
@@ -313,13 +312,10 @@ rs_cmm_transform(RSCmm *cmm, RS_IMAGE16 *input, void *output, gboolean sixteen_t
 		y_offset += y_per_thread;
 		y_offset = MIN(input->h, y_offset);
 		t[i].end_y = y_offset;
-
-		t[i].threadid = g_thread_new("RSCmm worker", start_single_transform_thread, &t[i]);
 	}
 
-	/* Wait for threads to finish */
-	for(i = 0; i < threads; i++)
-		g_thread_join(t[i].threadid);
+	/* Run on the shared pool and wait for all bands to finish */
+	rs_task_pool_run(start_single_transform_thread, t, sizeof(ThreadInfo), threads);
 
 	g_free(t);
 }
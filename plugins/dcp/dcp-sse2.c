@@ -675,7 +675,7 @@ gboolean
 render_SSE2(ThreadInfo* t)
 {
 	RS_IMAGE16 *image = t->tmp;
-	RSDcp *dcp = t->dcp;
+	RSDcpRender *dcp = t->dcp;
 	gint x, y;
 	__m128 h, s, v;
 	__m128i p1,p2;
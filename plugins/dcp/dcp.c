@@ -45,13 +45,15 @@ static RS_xy_COORD neutral_to_xy(RSDcp *dcp, const RS_VECTOR3 *neutral);
 static RS_MATRIX3 find_xyz_to_camera(RSDcp *dcp, const RS_xy_COORD *white_xy, RS_MATRIX3 *forward_matrix);
 static void set_white_xy(RSDcp *dcp, const RS_xy_COORD *xy);
 static void precalc(RSDcp *dcp);
-static void pre_cache_tables(RSDcp *dcp);
+static void pre_cache_tables(RSDcpRender *dcp);
 static void render(ThreadInfo* t);
 static void read_profile(RSDcp *dcp, RSDcpFile *dcp_file);
 static void free_dcp_profile(RSDcp *dcp);
 static void set_prophoto_wb(RSDcp *dcp, gfloat warmth, gfloat tint);
 static void calculate_huesat_maps(RSDcp *dcp, gfloat temp);
-static GRecMutex dcp_mutex;
+static RSDcpRender *render_context_get(RSDcp *dcp);
+static void render_context_unref(RSDcpRender *render);
+static void render_context_invalidate(RSDcp *dcp);
 
 G_MODULE_EXPORT void
 rs_plugin_load(RSPlugin *plugin)
@@ -64,6 +66,7 @@ finalize(GObject *object)
 {
 	RSDcp *dcp = RS_DCP(object);
 
+	render_context_invalidate(dcp);
 	if (dcp->curve_samples)
 		free(dcp->curve_samples);
 	g_free(dcp->_huesatmap_precalc_unaligned);
@@ -79,6 +82,7 @@ finalize(GObject *object)
 	dcp->settings_signal_id = 0;
 	dcp->settings = NULL;
 	dcp->read_out_curve = NULL;
+	g_rec_mutex_clear(&dcp->lock);
 }
 
 static void
@@ -124,6 +128,8 @@ settings_changed(RSSettings *settings, RSSettingsMask mask, RSDcp *dcp)
 {
 	gboolean changed = FALSE;
 
+	g_rec_mutex_lock(&dcp->lock);
+
 	if (mask & MASK_EXPOSURE)
 	{
 		g_object_get(settings, "exposure", &dcp->exposure, NULL);
@@ -289,6 +295,10 @@ settings_changed(RSSettings *settings, RSSettingsMask mask, RSDcp *dcp)
 		changed = TRUE;
 	}
 
+	if (changed)
+		render_context_invalidate(dcp);
+	g_rec_mutex_unlock(&dcp->lock);
+
 	if (changed)
 	{
 		rs_filter_changed(RS_FILTER(dcp), RS_FILTER_CHANGED_PIXELDATA);
@@ -340,6 +350,8 @@ static void
 rs_dcp_init(RSDcp *dcp)
 {
 	RSDcpClass *klass = RS_DCP_GET_CLASS(dcp);
+	g_rec_mutex_init(&dcp->lock);
+	dcp->render = NULL;
 	g_assert(0 == posix_memalign((void**)&dcp->curve_samples, 16, sizeof(gfloat)*2*257));
 	dcp->huesatmap_interpolated = NULL;
 	dcp->use_profile = FALSE;
@@ -366,7 +378,7 @@ rs_dcp_init(RSDcp *dcp)
 #undef ALIGNTO16
 
 static void
-init_exposure(RSDcp *dcp)
+init_exposure(RSDcpRender *dcp)
 {
 	/* Adobe applies negative exposure to the tone curve instead */
 	
@@ -390,6 +402,115 @@ init_exposure(RSDcp *dcp)
 }
 
 
+static PrecalcHSM *
+precalc_copy(const PrecalcHSM *src, const RSHuesatMap *map)
+{
+	PrecalcHSM *dst;
+
+	g_assert(0 == posix_memalign((void**)&dst, 16, sizeof(PrecalcHSM)));
+	*dst = *src;
+	dst->lookups = NULL;
+
+	if (src->lookups && map)
+	{
+		gsize size = src->valStep[0] * (map->val_divisions + 1) * 4 * sizeof(gfloat);
+		g_assert(0 == posix_memalign((void**)&dst->lookups, 16, size));
+		memcpy(dst->lookups, src->lookups, size);
+	}
+	return dst;
+}
+
+static void
+precalc_free(PrecalcHSM *precalc)
+{
+	if (precalc->lookups)
+		free(precalc->lookups);
+	free(precalc);
+}
+
+/**
+ * Get the render context for the current settings, building it if needed.
+ * Must be called with dcp->lock held
+ * @param dcp A RSDcp
+ * @return A new reference to a RSDcpRender, release with render_context_unref()
+ */
+static RSDcpRender *
+render_context_get(RSDcp *dcp)
+{
+	RSDcpRender *render = dcp->render;
+
+	if (!render)
+	{
+		render = g_new0(RSDcpRender, 1);
+		render->ref_count = 1;
+
+		render->exposure = dcp->exposure;
+		render->saturation = dcp->saturation;
+		render->contrast = dcp->contrast;
+		render->hue = dcp->hue;
+		render->channelmixer_red = dcp->channelmixer_red;
+		render->channelmixer_green = dcp->channelmixer_green;
+		render->channelmixer_blue = dcp->channelmixer_blue;
+		render->use_profile = dcp->use_profile;
+		render->camera_white = dcp->camera_white;
+		render->camera_to_prophoto = dcp->camera_to_prophoto;
+		render->read_out_curve = dcp->read_out_curve;
+
+		render->curve_is_flat = dcp->curve_is_flat;
+		g_assert(0 == posix_memalign((void**)&render->curve_samples, 16, sizeof(gfloat)*2*257));
+		memcpy(render->curve_samples, dcp->curve_samples, sizeof(gfloat)*2*257);
+
+		if (dcp->tone_curve_lut)
+		{
+			g_assert(0 == posix_memalign((void**)&render->tone_curve_lut, 16, sizeof(gfloat)*2*1025));
+			memcpy(render->tone_curve_lut, dcp->tone_curve_lut, sizeof(gfloat)*2*1025);
+		}
+
+		/* The maps themselves are never modified once loaded, a reference is enough */
+		if (dcp->huesatmap)
+			render->huesatmap = g_object_ref(dcp->huesatmap);
+		if (dcp->looktable)
+			render->looktable = g_object_ref(dcp->looktable);
+		render->huesatmap_precalc = precalc_copy(dcp->huesatmap_precalc, dcp->huesatmap);
+		render->looktable_precalc = precalc_copy(dcp->looktable_precalc, dcp->looktable);
+
+		init_exposure(render);
+
+		dcp->render = render;
+	}
+
+	g_atomic_int_inc(&render->ref_count);
+	return render;
+}
+
+static void
+render_context_unref(RSDcpRender *render)
+{
+	if (!g_atomic_int_dec_and_test(&render->ref_count))
+		return;
+
+	free(render->curve_samples);
+	if (render->tone_curve_lut)
+		free(render->tone_curve_lut);
+	if (render->huesatmap)
+		g_object_unref(render->huesatmap);
+	if (render->looktable)
+		g_object_unref(render->looktable);
+	precalc_free(render->huesatmap_precalc);
+	precalc_free(render->looktable_precalc);
+	g_free(render);
+}
+
+/* Drop the cached render context, renders in flight keep their own reference.
+ * Must be called with dcp->lock held */
+static void
+render_context_invalidate(RSDcp *dcp)
+{
+	if (dcp->render)
+		render_context_unref(dcp->render);
+	dcp->render = NULL;
+}
+
 static void
 get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspec)
 {
@@ -437,25 +558,32 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 			g_object_weak_ref(G_OBJECT(dcp->settings), settings_weak_notify, dcp);
 			break;
 		case PROP_PROFILE:
-			g_rec_mutex_lock(&dcp_mutex);
+			g_rec_mutex_lock(&dcp->lock);
 			read_profile(dcp, g_value_get_object(value));
+			render_context_invalidate(dcp);
 			changed = TRUE;
-			g_rec_mutex_unlock(&dcp_mutex);
+			g_rec_mutex_unlock(&dcp->lock);
 			break;
 		case PROP_READ_OUT_CURVE:
+			g_rec_mutex_lock(&dcp->lock);
 			temp = g_value_get_object(value);
 			if (temp != dcp->read_out_curve)
+			{
+				render_context_invalidate(dcp);
 				changed = TRUE;
+			}
 			dcp->read_out_curve = temp;
+			g_rec_mutex_unlock(&dcp->lock);
 			break;
 		case PROP_USE_PROFILE:
-			g_rec_mutex_lock(&dcp_mutex);
+			g_rec_mutex_lock(&dcp->lock);
 			dcp->use_profile = g_value_get_boolean(value);
 			if (!dcp->use_profile)
 				free_dcp_profile(dcp);
 			else
 				precalc(dcp);
-			g_rec_mutex_unlock(&dcp_mutex);
+			render_context_invalidate(dcp);
+			g_rec_mutex_unlock(&dcp->lock);
 			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -519,10 +647,7 @@ start_single_dcp_thread(gpointer _thread_info)
 	else
 		render(t);
 
-	if (!t->single_thread)
-		g_thread_exit(NULL);
-
-	return NULL; /* Make the compiler shut up - we'll never return */
+	return NULL;
 }
 
 static inline void 
@@ -555,25 +680,38 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	RS_IMAGE16 *output;
 	RS_IMAGE16 *tmp;
 
+	RSDcpRender *render;
 	gint j;
 
 	RSFilterRequest *request_clone = rs_filter_request_clone(request);
 
+	/* Take everything we need from the settings now, after this the render
+	 * runs without the lock and settings can change under us */
+	g_rec_mutex_lock(&dcp->lock);
 	if (!dcp->use_profile)
 	{
 		gfloat premul[4] = {dcp->pre_mul.x, dcp->pre_mul.y, dcp->pre_mul.z, 1.0};
 		rs_filter_param_set_float4(RS_FILTER_PARAM(request_clone), "premul", premul);
 	}
+	render = render_context_get(dcp);
+	g_rec_mutex_unlock(&dcp->lock);
 
 	rs_filter_param_set_object(RS_FILTER_PARAM(request_clone), "colorspace", klass->prophoto);
 	previous_response = rs_filter_get_image(filter->previous, request_clone);
 	g_object_unref(request_clone);
 
 	if (!RS_IS_FILTER(filter->previous))
+	{
+		render_context_unref(render);
 		return previous_response;
+	}
 
 	input = rs_filter_response_get_image(previous_response);
-	if (!input) return previous_response;
+	if (!input)
+	{
+		render_context_unref(render);
+		return previous_response;
+	}
 	response = rs_filter_response_clone(previous_response);
 
 	/* We always deliver in ProPhoto */
@@ -600,11 +738,8 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	rs_filter_response_set_image(response, output);
 	g_object_unref(output);
 
-	g_rec_mutex_lock(&dcp_mutex);
-	init_exposure(dcp);
-
 	guint i, y_offset, y_per_thread, threaded_h;
-	guint threads = rs_get_number_of_processor_cores();
+	guint threads = rs_task_pool_get_n_workers();
 	if (tmp->h * tmp->w < 200*200)
 		threads = 1;
 
@@ -619,36 +754,28 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		t[i].tmp = tmp;
 		t[i].start_y = y_offset;
 		t[i].start_x = 0;
-		t[i].dcp = dcp;
+		t[i].dcp = render;
 		y_offset += y_per_thread;
 		y_offset = MIN(tmp->h, y_offset);
 		t[i].end_y = y_offset;
 		for(j = 0; j < 256; j++)
 			t[i].curve_input_values[j] = 0;
-		t[i].single_thread = (threads == 1);
-		if (threads == 1)
-			start_single_dcp_thread(&t[0]);
-		else	
-			t[i].threadid = g_thread_new("RSDcp worker", start_single_dcp_thread, &t[i]);
 	}
 
-	/* Wait for threads to finish */
-	for(i = 0; threads > 1 && i < threads; i++)
-		g_thread_join(t[i].threadid);
-
-	/* Settings can change now */
-	g_rec_mutex_unlock(&dcp_mutex);
+	/* Run on the shared pool and wait for all bands to finish */
+	rs_task_pool_run(start_single_dcp_thread, t, sizeof(ThreadInfo), threads);
 
 	/* If we must deliver histogram data, do it now */
-	if (dcp->read_out_curve)
+	if (render->read_out_curve)
 	{
 		gint *values = g_malloc0(256*sizeof(gint));
 		for(i = 0; i < threads; i++)
 			for(j = 0; j < 256; j++)
 				values[j] += t[i].curve_input_values[j];
-		rs_curve_set_histogram_data(RS_CURVE_WIDGET(dcp->read_out_curve), values);
+		rs_curve_set_histogram_data(RS_CURVE_WIDGET(render->read_out_curve), values);
 		g_free(values);
 	}
+	render_context_unref(render);
 	g_free(t);
 	g_object_unref(tmp);
 
@@ -724,7 +851,7 @@ RGBtoHSV(gfloat r, gfloat g, gfloat b, gfloat *h, gfloat *s, gfloat *v)
 }
 
 inline gfloat
-exposure_ramp (RSDcp *dcp, gfloat x)
+exposure_ramp (RSDcpRender *dcp, gfloat x)
 {
 	if (x <= dcp->exposure_black - dcp->exposure_radius)
 		return 0.0;
@@ -1035,7 +1162,7 @@ rgb_tone(gfloat *_r, gfloat *_g, gfloat *_b, const gfloat * const tone_lut)
 }
 
 static void 
-pre_cache_tables(RSDcp *dcp)
+pre_cache_tables(RSDcpRender *dcp)
 {
 	int i;
 	gfloat unused = 0;
@@ -1101,7 +1228,7 @@ static void
 render(ThreadInfo* t)
 {
 	RS_IMAGE16 *image = t->tmp;
-	RSDcp *dcp = t->dcp;
+	RSDcpRender *dcp = t->dcp;
 
 	gint x, y;
 	gfloat h, s, v;
@@ -1458,14 +1585,12 @@ precalc(RSDcp *dcp)
 	}};
 
 	/* Camera to ProPhoto */
-	g_rec_mutex_lock(&dcp_mutex);
 	if (dcp->use_profile)
 		matrix3_multiply(&xyz_to_prophoto, &dcp->camera_to_pcs, &dcp->camera_to_prophoto); /* verified by SDK */
 	if (dcp->huesatmap && (rs_detect_cpu_features() & RS_CPU_FLAG_SSE2))
 		calc_hsm_constants(dcp->huesatmap, dcp->huesatmap_precalc); 
 	if (dcp->looktable && (rs_detect_cpu_features() & RS_CPU_FLAG_SSE2))
 		calc_hsm_constants(dcp->looktable, dcp->looktable_precalc); 
-	g_rec_mutex_unlock(&dcp_mutex);
 }
 
 static void
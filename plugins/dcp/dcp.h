@@ -41,9 +41,47 @@ typedef struct {
 	gfloat* lookups;
 } PrecalcHSM;
 
+/* Immutable snapshot of everything the render threads read. It is built
+ * from the filter state at request time and shared between requests until
+ * the settings change, so renders never need to hold the filter lock. */
+typedef struct {
+	gint ref_count;
+
+	gfloat exposure;
+	gfloat saturation;
+	gfloat contrast;
+	gfloat hue;
+	gfloat channelmixer_red;
+	gfloat channelmixer_green;
+	gfloat channelmixer_blue;
+
+	gboolean use_profile;
+	gboolean curve_is_flat;
+	gfloat *curve_samples;
+	gfloat *tone_curve_lut;
+
+	RS_VECTOR3 camera_white;
+	RS_MATRIX3 camera_to_prophoto;
+
+	gfloat exposure_slope;
+	gfloat exposure_black;
+	gfloat exposure_radius;
+	gfloat exposure_qscale;
+
+	RSHuesatMap *huesatmap;
+	RSHuesatMap *looktable;
+	PrecalcHSM *huesatmap_precalc;
+	PrecalcHSM *looktable_precalc;
+
+	RSCurveWidget *read_out_curve;
+	gfloat junk_value;
+} RSDcpRender;
+
 
 struct _RSDcp {
 	RSFilter parent;
+	GRecMutex lock;
+	RSDcpRender *render;
 	gulong settings_signal_id;
 	RSSettings *settings;
 
@@ -94,16 +132,10 @@ struct _RSDcp {
 	RS_VECTOR3 camera_white;
 	RS_MATRIX3 camera_to_prophoto;
 
-	gfloat exposure_slope;
-	gfloat exposure_black;
-	gfloat exposure_radius;
-	gfloat exposure_qscale;
-
 	PrecalcHSM *huesatmap_precalc;
 	PrecalcHSM *looktable_precalc;
 	void* _huesatmap_precalc_unaligned;
 	void* _looktable_precalc_unaligned;
-	gfloat junk_value;
 	RSCurveWidget* read_out_curve;
 };
 
@@ -114,14 +146,12 @@ struct _RSDcpClass {
 };
 
 typedef struct {
-	RSDcp *dcp;
-	GThread *threadid;
+	RSDcpRender *dcp;
 	gint start_x;
 	gint start_y;
 	gint end_y;
 	RS_IMAGE16 *tmp;
 	guint curve_input_values[256];
-	gboolean single_thread;
 } ThreadInfo;
 
 gboolean render_SSE2(ThreadInfo* t);
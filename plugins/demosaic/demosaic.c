@@ -27,13 +27,16 @@
 #define RS_DEMOSAIC_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), RS_TYPE_DEMOSAIC, RSDemosaicClass))
 #define RS_IS_DEMOSAIC(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), RS_TYPE_DEMOSAIC))
 
+/* Border needed around a requested ROI for hotpixel detection and PPG */
+#define ROI_MARGIN 8
+
 typedef struct {
 	gint start_y;
 	gint end_y;
+	const GdkRectangle *area;	/* Part of the image to interpolate */
 	RS_IMAGE16 *image;
 	RS_IMAGE16 *output;
 	guint filters;
-	GThread *threadid;
 } ThreadInfo;
 
 typedef enum {
@@ -58,6 +61,7 @@ struct _RSDemosaic {
 
 	RS_DEMOSAIC method;
 	gboolean allow_half;
+	gboolean force_half;
 };
 
 struct _RSDemosaicClass {
@@ -70,6 +74,7 @@ enum {
 	PROP_0,
 	PROP_METHOD,
 	PROP_ALLOW_HALF, 
+	PROP_FORCE_HALF,
 };
 
 static void get_property (GObject *object, guint property_id, GValue *value, GParamSpec *pspec);
@@ -77,9 +82,9 @@ static void set_property (GObject *object, guint property_id, const GValue *valu
 static RSFilterResponse *get_image(RSFilter *filter, const RSFilterRequest *request);
 static inline int fc_INDI (const unsigned int filters, const int row, const int col);
 static void border_interpolate_INDI (const ThreadInfo* t, int colors, int border);
-static void lin_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const unsigned int filters, const int colors);
-static void ppg_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const unsigned int filters, const int colors);
-static void none_interpolate_INDI(RS_IMAGE16 *in, RS_IMAGE16 *out, const unsigned int filters, const int colors, gboolean half_size);
+static void lin_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const GdkRectangle *area, const unsigned int filters, const int colors);
+static void ppg_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const GdkRectangle *area, const unsigned int filters, const int colors);
+static void none_interpolate_INDI(RS_IMAGE16 *in, RS_IMAGE16 *out, const GdkRectangle *area, const unsigned int filters, const int colors, gboolean half_size);
 static void hotpixel_detect(const ThreadInfo* t);
 static void expand_cfa_data(const ThreadInfo* t);
 
@@ -115,6 +120,12 @@ rs_demosaic_class_init(RSDemosaicClass *klass)
 			FALSE, G_PARAM_READWRITE)
 	);
 
+	g_object_class_install_property(object_class,
+		PROP_FORCE_HALF, g_param_spec_boolean(
+			"demosaic-force-downscale", "demosaic-force-downscale", "Return half size image, even for full quality requests",
+			FALSE, G_PARAM_READWRITE)
+	);
+
 	filter_class->name = "Demosaic filter";
 	filter_class->get_image = get_image;
 }
@@ -138,6 +149,9 @@ get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspe
 		case PROP_ALLOW_HALF:
 			g_value_set_boolean(value, demosaic->allow_half);
 			break;			
+		case PROP_FORCE_HALF:
+			g_value_set_boolean(value, demosaic->force_half);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
@@ -163,6 +177,9 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 		case PROP_ALLOW_HALF:
 			demosaic->allow_half = g_value_get_boolean(value);
 			break;
+		case PROP_FORCE_HALF:
+			demosaic->force_half = g_value_get_boolean(value);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
@@ -186,8 +203,11 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	RSFilterResponse *response;
 	RS_IMAGE16 *input;
 	RS_IMAGE16 *output = NULL;
+	GdkRectangle *roi;
+	GdkRectangle area;
 	guint filters;
 	RS_DEMOSAIC method;
+	gboolean half;
 
 	previous_response = rs_filter_get_image(filter->previous, request);
 
@@ -211,15 +231,26 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 
 	gint fuji_width;
 	if (rs_filter_param_get_integer(RS_FILTER_PARAM(response), "fuji-width", &fuji_width) && (fuji_width > 0))
+	{
 		demosaic->allow_half = FALSE;
+		demosaic->force_half = FALSE;
+	}
 
 	method = demosaic->method;
+	half = demosaic->allow_half;
 	if (rs_filter_request_get_quick(request))
 	{
 		method = RS_DEMOSAIC_NONE;
 		rs_filter_response_set_quick(response);
 	}
 
+	/* Binning 2x2 blocks is as good as a full demosaic followed by a 50% downscale */
+	if (demosaic->force_half)
+	{
+		method = RS_DEMOSAIC_NONE;
+		half = TRUE;
+	}
+
 	/* Magic - Ask Dave ;) */
 	filters = input->filters;
 	filters &= ~((filters & 0x55555555) << 1);
@@ -233,7 +264,7 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 
 	if (method == RS_DEMOSAIC_NONE)
 	{
-		if (demosaic->allow_half)
+		if (half)
 		{
 			output = rs_image16_new(input->w/2, input->h/2, 3, 4);
 			rs_filter_param_set_boolean(RS_FILTER_PARAM(response), "half-size", TRUE);
@@ -249,21 +280,35 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	
 	rs_filter_response_set_image(response, output);
 	g_object_unref(output);
-		
+
+	/* Only interpolate the requested area. The output keeps the full size,
+	 * like other ROI aware filters, so CFA positions are left untouched */
+	area.x = 0;
+	area.y = 0;
+	area.width = output->w;
+	area.height = output->h;
+	roi = rs_filter_request_get_roi(request);
+	if (roi && method != RS_DEMOSAIC_NONE_HALF)
+	{
+		area.x = CLAMP(roi->x - ROI_MARGIN, 0, output->w);
+		area.y = CLAMP(roi->y - ROI_MARGIN, 0, output->h);
+		area.width = CLAMP(roi->x + roi->width + ROI_MARGIN, area.x, output->w) - area.x;
+		area.height = CLAMP(roi->y + roi->height + ROI_MARGIN, area.y, output->h) - area.y;
+	}
 
 	switch (method)
 	{
 	  case RS_DEMOSAIC_BILINEAR:
-			lin_interpolate_INDI(input, output, filters, 3);
+			lin_interpolate_INDI(input, output, &area, filters, 3);
 			break;
 	  case RS_DEMOSAIC_PPG:
-			ppg_interpolate_INDI(input,output, filters, 3);
+			ppg_interpolate_INDI(input, output, &area, filters, 3);
 			break;
 		case RS_DEMOSAIC_NONE:
-			none_interpolate_INDI(input, output, filters, 3, FALSE);
+			none_interpolate_INDI(input, output, &area, filters, 3, FALSE);
 			break;
 		case RS_DEMOSAIC_NONE_HALF:
-			none_interpolate_INDI(input, output, filters, 3, TRUE);
+			none_interpolate_INDI(input, output, &area, filters, 3, TRUE);
 			break;
 		default:
 			/* Do nothing */
@@ -319,12 +364,18 @@ border_interpolate_INDI (const ThreadInfo* t, int colors, int border)
 	int row, col, y, x, f, c, sum[8];
 	RS_IMAGE16* image = t->output;
 	guint filters = t->filters;
+	const gint end_x = t->area->x + t->area->width;
 
 	for (row=t->start_y; row < t->end_y; row++)
-		for (col=0; col < image->w; col++)
+		for (col=t->area->x; col < end_x; col++)
 		{
-			if (col==border && row >= border && row < image->h-border)
+			/* Skip the interior of the image */
+			if (col >= border && col < image->w-border && row >= border && row < image->h-border)
+			{
 				col = image->w-border;
+				if (col >= end_x)
+					break;
+			}
 			memset (sum, 0, sizeof sum);
 			for (y=row-1; y != row+2; y++)
 				for (x=col-1; x != col+2; x++)
@@ -342,14 +393,15 @@ border_interpolate_INDI (const ThreadInfo* t, int colors, int border)
 }
 
 static void
-lin_interpolate_INDI(RS_IMAGE16 *input, RS_IMAGE16 *output, const unsigned int filters, const int colors) /*UF*/
+lin_interpolate_INDI(RS_IMAGE16 *input, RS_IMAGE16 *output, const GdkRectangle *area, const unsigned int filters, const int colors) /*UF*/
 {
 	ThreadInfo *t = g_new(ThreadInfo, 1);
 	t->image = input;
 	t->output = output;
+	t->area = area;
 	t->filters = filters;
-	t->start_y = 0;
-	t->end_y = input->w;
+	t->start_y = area->y;
+	t->end_y = area->y + area->height;
 
 	expand_cfa_data(t);
 	RS_IMAGE16* image = output;
@@ -379,8 +431,8 @@ lin_interpolate_INDI(RS_IMAGE16 *input, RS_IMAGE16 *output, const unsigned int f
 	  *ip++ = 256 / sum[c];
 	}
     }
-  for (row=1; row < image->h-1; row++)
-    for (col=1; col < image->w-1; col++) {
+  for (row=MAX(1, area->y); row < MIN(image->h-1, area->y+area->height); row++)
+    for (col=MAX(1, area->x); col < MIN(image->w-1, area->x+area->width); col++) {
       pix = GET_PIXEL(image, col, row);
       ip = code[row & 15][col & 15];
       memset (sum, 0, sizeof sum);
@@ -389,6 +441,7 @@ lin_interpolate_INDI(RS_IMAGE16 *input, RS_IMAGE16 *output, const unsigned int f
       for (i=colors; --i; ip+=2)
 	pix[ip[0]] = sum[ip[0]] * ip[1] >> 8;
     }
+  g_free(t);
 }
 
 static void
@@ -398,13 +451,14 @@ expand_cfa_data(const ThreadInfo* t) {
 	RS_IMAGE16* output = t->output;
 	guint filters = t->filters;
 	guint col, row;
+	const guint end_x = t->area->x + t->area->width;
 
 	/* Populate new image with bayer data */
 	for(row=t->start_y; row<t->end_y; row++)
 	{
-		gushort* src = GET_PIXEL(input, 0, row);
-		gushort* dest = GET_PIXEL(output, 0, row);
-		for(col=0;col<output->w;col++)
+		gushort* src = GET_PIXEL(input, t->area->x, row);
+		gushort* dest = GET_PIXEL(output, t->area->x, row);
+		for(col=t->area->x;col<end_x;col++)
 		{
 			dest[fc_INDI(filters, row, col)] = *src;
 			dest += output->pixelsize;
@@ -426,10 +480,16 @@ interpolate_INDI_part(ThreadInfo *t)
 {
   RS_IMAGE16 *image = t->output;
   const unsigned int filters = t->filters;
+  const GdkRectangle *area = t->area;
   
   /* Subtract 3 from top and bottom  */
-  const int start_y = MAX(3, t->start_y);
-  const int end_y = MIN(image->h-3, t->end_y);
+  const int start_y = MAX(area->y+3, t->start_y);
+  const int end_y = MIN(area->y+area->height-3, t->end_y);
+  /* Red and blue are calculated 2 lines into the neighbouring bands */
+  const int rb_start_y = MAX(area->y+1, start_y-2);
+  const int rb_end_y = MIN(area->y+area->height-1, end_y+2);
+  const int start_x = area->x;
+  const int end_x = area->x+area->width;
   int row, col, c, d;
 	int diffA, diffB, guessA, guessB;
 	int p = image->pitch;
@@ -439,7 +499,7 @@ interpolate_INDI_part(ThreadInfo *t)
   {
 /*  Fill in the green layer with gradients and pattern recognition: */
   for (row=start_y; row < end_y; row++)
-    for (col=3+(FC(row,3) & 1), c=FC(row,col); col < image->w-3; col+=2) {
+    for (col=start_x+3+(FC(row,start_x+3) & 1), c=FC(row,col); col < end_x-3; col+=2) {
       pix = (gushort (*)[4])GET_PIXEL(image, col, row);
 
 	guessA = (pix[-1][1] + pix[0][c] + pix[1][1]) * 2
@@ -464,8 +524,8 @@ interpolate_INDI_part(ThreadInfo *t)
 			pix[0][1] = ULIM(guessA >> 2, pix[1][1], pix[-1][1]);
     }
 /*  Calculate red and blue for each green pixel:		*/
-  for (row=start_y-2; row < end_y+2; row++)
-    for (col=1+(FC(row,2) & 1), c=FC(row,col+1); col < image->w-1; col+=2) {
+  for (row=rb_start_y; row < rb_end_y; row++)
+    for (col=start_x+1+(FC(row,start_x+2) & 1), c=FC(row,col+1); col < end_x-1; col+=2) {
       pix = (gushort (*)[4])GET_PIXEL(image, col, row);
       pix[0][c] = CLIP((pix[-1][c] + pix[1][c] + 2*pix[0][1]
           - pix[-1][1] - pix[1][1]) >> 1);
@@ -476,8 +536,8 @@ interpolate_INDI_part(ThreadInfo *t)
     }
 
 /*  Calculate blue for red pixels and vice versa:		*/
-	for (row=start_y-2; row < end_y+2; row++)
-		for (col=1+(FC(row,1) & 1), c=2-FC(row,col); col < image->w-1; col+=2) {
+	for (row=rb_start_y; row < rb_end_y; row++)
+		for (col=start_x+1+(FC(row,start_x+1) & 1), c=2-FC(row,col); col < end_x-1; col+=2) {
 			pix = (gushort (*)[4])GET_PIXEL(image, col, row);
 			d = 1 + p;
 			diffA = ABS(pix[-d][c] - pix[d][c]) +
@@ -509,38 +569,35 @@ start_interp_thread(gpointer _thread_info)
 	expand_cfa_data(t);
 	border_interpolate_INDI (t, 3, 3);
 	interpolate_INDI_part(t);
-	g_thread_exit(NULL);
 
-	return NULL; /* Make the compiler shut up - we'll never return */
+	return NULL;
 }
 
 static void
-ppg_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const unsigned int filters, const int colors)
+ppg_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const GdkRectangle *area, const unsigned int filters, const int colors)
 {
 	guint i, y_offset, y_per_thread, threaded_h;
-	const guint threads = rs_get_number_of_processor_cores();
+	const guint threads = rs_task_pool_get_n_workers();
 	ThreadInfo *t = g_new(ThreadInfo, threads);
 
-	threaded_h = image->h;
+	threaded_h = area->height;
 	y_per_thread = (threaded_h + threads-1)/threads;
-	y_offset = 0;
+	y_offset = area->y;
 
 	for (i = 0; i < threads; i++)
 	{
 		t[i].image = image;
 		t[i].output = output;
+		t[i].area = area;
 		t[i].filters = filters;
 		t[i].start_y = y_offset;
 		y_offset += y_per_thread;
-		y_offset = MIN(image->h, y_offset);
+		y_offset = MIN(area->y + area->height, y_offset);
 		t[i].end_y = y_offset;
-
-		t[i].threadid = g_thread_new("RSDemosaic worker (ppg)", start_interp_thread, &t[i]);
 	}
 
-	/* Wait for threads to finish */
-	for(i = 0; i < threads; i++)
-		g_thread_join(t[i].threadid);
+	/* Run on the shared pool and wait for all bands to finish */
+	rs_task_pool_run(start_interp_thread, t, sizeof(ThreadInfo), threads);
 
 	g_free(t);
 }
@@ -621,9 +678,8 @@ start_none_thread(gpointer _thread_info)
 			memcpy(GET_PIXEL(t->output, 0, 0), GET_PIXEL(t->output, 0, 1), t->output->rowstride * 2);
 		}
 	}
-	g_thread_exit(NULL);
 
-	return NULL; /* Make the compiler shut up - we'll never return */
+	return NULL;
 }
 
 
@@ -671,43 +727,41 @@ start_none_thread_half(gpointer _thread_info)
 		}
 
 	}
-	g_thread_exit(NULL);
 
-	return NULL; /* Make the compiler shut up - we'll never return */
+	return NULL;
 }
 
 
 static void
-none_interpolate_INDI(RS_IMAGE16 *in, RS_IMAGE16 *out, const unsigned int filters, const int colors, gboolean half_size)
+none_interpolate_INDI(RS_IMAGE16 *in, RS_IMAGE16 *out, const GdkRectangle *area, const unsigned int filters, const int colors, gboolean half_size)
 {
-	guint i, y_offset, y_per_thread, threaded_h;
-	const guint threads = rs_get_number_of_processor_cores();
+	guint i, y_offset, y_per_thread, threaded_h, end_y;
+	const guint threads = rs_task_pool_get_n_workers();
 	ThreadInfo *t = g_new(ThreadInfo, threads);
 
 	/* Subtract 1 from bottom  */
-	threaded_h = out->h-1;
+	end_y = MIN(out->h-1, area->y + area->height);
+	threaded_h = end_y - area->y;
 	y_per_thread = (threaded_h + threads-1)/threads;
-	y_offset = 0;
+	y_offset = area->y;
 
 	for (i = 0; i < threads; i++)
 	{
 		t[i].image = in;
 		t[i].filters = filters;
 		t[i].start_y = y_offset;
+		t[i].area = area;
 		t[i].output = out;
 		y_offset += y_per_thread;
-		y_offset = MIN(out->h-1, y_offset);
+		y_offset = MIN(end_y, y_offset);
 		t[i].end_y = y_offset;
-
-		if (half_size)
-			t[i].threadid = g_thread_new("RSDemosaic worker (none) (half-size)", start_none_thread_half, &t[i]);
-		else
-			t[i].threadid = g_thread_new("RSDemosaic worker (none)", start_none_thread, &t[i]);
 	}
 
-	/* Wait for threads to finish */
-	for(i = 0; i < threads; i++)
-		g_thread_join(t[i].threadid);
+	/* Run on the shared pool and wait for all bands to finish */
+	if (half_size)
+		rs_task_pool_run(start_none_thread_half, t, sizeof(ThreadInfo), threads);
+	else
+		rs_task_pool_run(start_none_thread, t, sizeof(ThreadInfo), threads);
 
 	g_free(t);
 }
@@ -724,11 +778,11 @@ hotpixel_detect(const ThreadInfo* t)
 
 	for(; y < end_y; y++)
 	{
-		gint col_end = image->w - 4;
+		gint col_end = MIN(t->area->x + t->area->width, image->w - 4);
 		gushort* img = GET_PIXEL(image, 0, y);
 		gint p = image->rowstride * 2;
 		gint p_one = image->rowstride;
-		for (x = 4; x < col_end ; x++) {
+		for (x = MAX(4, t->area->x); x < col_end ; x++) {
 			/* Calculate minimum difference to surrounding pixels */
 			gint left = (int)img[x - 2];
 			gint c = (int)img[x];
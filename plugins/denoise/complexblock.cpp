@@ -31,13 +31,23 @@ ComplexBlock::ComplexBlock(int _w, int _h): w(_w), h(_h)
   pitch = w * sizeof(fftwf_complex);
   g_assert(0 == posix_memalign((void**)&complex, 16, pitch*h));
   g_assert(complex);
+  ownAlloc = true;
+  temp = new FloatImagePlane(256,1);
+  temp->allocateImage();
+}
+
+ComplexBlock::ComplexBlock(int _w, int _h, fftwf_complex* data): complex(data), w(_w), h(_h)
+{
+  pitch = w * sizeof(fftwf_complex);
+  ownAlloc = false;
   temp = new FloatImagePlane(256,1);
   temp->allocateImage();
 }
 
 ComplexBlock::~ComplexBlock(void)
 {
-  free(complex);
+  if (ownAlloc)
+    free(complex);
   complex = 0;
   delete temp;
 }
@@ -31,6 +31,7 @@ class ComplexBlock
 {
 public:
   ComplexBlock(int w, int h);
+  ComplexBlock(int w, int h, fftwf_complex* data);  // Uses data, which must outlive the block
   ~ComplexBlock(void);
   fftwf_complex* complex;
   FloatImagePlane *temp;
@@ -38,6 +39,7 @@ public:
   const int h;
 private:
   int pitch;
+  gboolean ownAlloc;
 };
 
 }} // namespace RawStudio::FFTFilter
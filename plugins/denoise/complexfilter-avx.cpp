@@ -0,0 +1,209 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>, 
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* 256 bit versions of the complex filters. This file is compiled twice,
+ * with -mavx for the AVX versions and with -mavx -mfma and
+ * COMPLEXFILTER_FMA defined for the FMA versions. */
+
+#include "complexfilter.h"
+#include <math.h>
+#include "fftwindow.h"
+
+#if defined(COMPLEXFILTER_FMA)
+#define KERNEL(name) name##FMA
+#define KERNEL_(name) name##_FMA
+#else
+#define KERNEL(name) name##AVX
+#define KERNEL_(name) name##_AVX
+#endif
+
+#if defined (__AVX__) && (!defined(COMPLEXFILTER_FMA) || defined(__FMA__))
+#include <immintrin.h>
+
+#if defined(COMPLEXFILTER_FMA)
+#define madd(a, b, c) _mm256_fmadd_ps(a, b, c)
+#else
+#define madd(a, b, c) _mm256_add_ps(_mm256_mul_ps(a, b), c)
+#endif
+
+namespace RawStudio {
+namespace FFTFilter {
+
+/* Four complex values are processed at a time, as re0 im0 re1 im1 | re2 im2 re3 im3 */
+
+/* Power spectrum density of each complex value, in both its real and imaginary slot */
+static inline __m256
+psd_avx(__m256 re_im)
+{
+  __m256 sq = _mm256_mul_ps(re_im, re_im);
+  return _mm256_add_ps(_mm256_add_ps(sq, _mm256_permute_ps(sq, _MM_SHUFFLE(2,3,0,1))), _mm256_set1_ps(1e-15f));
+}
+
+/* Load four sharpen weights, each duplicated for real and imaginary part */
+static inline __m256
+load_sharpen_avx(const float *wsharpen)
+{
+  __m128 w = _mm_loadu_ps(wsharpen);
+  __m256 lo = _mm256_castps128_ps256(_mm_unpacklo_ps(w, w));
+  return _mm256_insertf128_ps(lo, _mm_unpackhi_ps(w, w), 1);
+}
+
+/* 1 + wsharpen*sqrt(psd*smax/((psd + smin)*(psd + smax))) */
+static inline __m256
+sharpen_factor_avx(__m256 psd, __m256 wsharpen, __m256 smin, __m256 smax)
+{
+  __m256 num = _mm256_mul_ps(psd, smax);
+  __m256 den = _mm256_mul_ps(_mm256_add_ps(psd, smin), _mm256_add_ps(psd, smax));
+  return madd(wsharpen, _mm256_sqrt_ps(_mm256_div_ps(num, den)), _mm256_set1_ps(1.0f));
+}
+
+void DeGridComplexFilter::KERNEL(processSharpenOnly)(ComplexBlock* block)
+{
+  fftwf_complex* outcur = block->complex;
+  fftwf_complex* gridsample = grid->complex;
+  float gridfraction = degrid*outcur[0][0]/gridsample[0][0];
+  const __m256 gf = _mm256_set1_ps(gridfraction);
+  const __m256 smin = _mm256_set1_ps(sigmaSquaredSharpenMin);
+  const __m256 smax = _mm256_set1_ps(sigmaSquaredSharpenMax);
+  const int vw = bw & ~3;
+
+  for (int y = 0; y < bh; y++) {
+    float *wsharpen = sharpenWindow->getLine(y);
+    int x;
+    for (x = 0; x < vw; x += 4) {
+      __m256 grid = _mm256_mul_ps(gf, _mm256_loadu_ps(&gridsample[x][0]));
+      __m256 c = _mm256_sub_ps(_mm256_loadu_ps(&outcur[x][0]), grid);
+      __m256 sfact = sharpen_factor_avx(psd_avx(c), load_sharpen_avx(&wsharpen[x]), smin, smax);
+      _mm256_storeu_ps(&outcur[x][0], madd(c, sfact, grid));
+    }
+    for (; x < bw; x++) {
+      float gridcorrection0 = gridfraction*gridsample[x][0];
+      float re = outcur[x][0] - gridcorrection0;
+      float gridcorrection1 = gridfraction*gridsample[x][1];
+      float im = outcur[x][1] - gridcorrection1;
+      float psd = (re*re + im*im) + 1e-15f;
+      float sfact = (1 + wsharpen[x]*sqrtf( psd*sigmaSquaredSharpenMax/((psd + sigmaSquaredSharpenMin)*(psd + sigmaSquaredSharpenMax)) ));
+      outcur[x][0] = re*sfact + gridcorrection0;
+      outcur[x][1] = im*sfact + gridcorrection1;
+    }
+    gridsample += bw;
+    outcur += bw;
+  }
+  _mm256_zeroupper();
+}
+
+void ComplexWienerFilterDeGrid::KERNEL_(processNoSharpen)(ComplexBlock* block)
+{
+  fftwf_complex* outcur = block->complex;
+  fftwf_complex* gridsample = grid->complex;
+  float gridfraction = degrid*outcur[0][0]/gridsample[0][0];
+  const __m256 gf = _mm256_set1_ps(gridfraction);
+  const __m256 sigma = _mm256_set1_ps(sigmaSquaredNoiseNormed);
+  const __m256 low = _mm256_set1_ps(lowlimit);
+  const int size = bw*bh;
+  int i;
+
+  /* Rows are consecutive, so the block is one long line */
+  for (i = 0; i < (size & ~3); i += 4) {
+    __m256 grid = _mm256_mul_ps(gf, _mm256_loadu_ps(&gridsample[i][0]));
+    __m256 c = _mm256_sub_ps(_mm256_loadu_ps(&outcur[i][0]), grid);
+    __m256 psd = psd_avx(c);
+    __m256 wiener = _mm256_max_ps(_mm256_div_ps(_mm256_sub_ps(psd, sigma), psd), low);
+    _mm256_storeu_ps(&outcur[i][0], madd(c, wiener, grid));
+  }
+  for (; i < size; i++) {
+    float gridcorrection0 = gridfraction*gridsample[i][0];
+    float corrected0 = outcur[i][0] - gridcorrection0;
+    float gridcorrection1 = gridfraction*gridsample[i][1];
+    float corrected1 = outcur[i][1] - gridcorrection1;
+    float psd = (corrected0*corrected0 + corrected1*corrected1 ) + 1e-15f;
+    float WienerFactor = MAX((psd - sigmaSquaredNoiseNormed)/psd, lowlimit);
+    outcur[i][0] = corrected0*WienerFactor + gridcorrection0;
+    outcur[i][1] = corrected1*WienerFactor + gridcorrection1;
+  }
+  _mm256_zeroupper();
+}
+
+void ComplexWienerFilterDeGrid::KERNEL_(processSharpen)(ComplexBlock* block)
+{
+  fftwf_complex* outcur = block->complex;
+  fftwf_complex* gridsample = grid->complex;
+  float gridfraction = degrid*outcur[0][0]/gridsample[0][0];
+  const __m256 gf = _mm256_set1_ps(gridfraction);
+  const __m256 sigma = _mm256_set1_ps(sigmaSquaredNoiseNormed);
+  const __m256 low = _mm256_set1_ps(lowlimit);
+  const __m256 smin = _mm256_set1_ps(sigmaSquaredSharpenMin);
+  const __m256 smax = _mm256_set1_ps(sigmaSquaredSharpenMax);
+  const int vw = bw & ~3;
+
+  for (int y = 0; y < bh; y++) {
+    float *wsharpen = sharpenWindow->getLine(y);
+    int x;
+    for (x = 0; x < vw; x += 4) {
+      __m256 grid = _mm256_mul_ps(gf, _mm256_loadu_ps(&gridsample[x][0]));
+      __m256 c = _mm256_sub_ps(_mm256_loadu_ps(&outcur[x][0]), grid);
+      __m256 psd = psd_avx(c);
+      __m256 wiener = _mm256_max_ps(_mm256_div_ps(_mm256_sub_ps(psd, sigma), psd), low);
+      wiener = _mm256_mul_ps(wiener, sharpen_factor_avx(psd, load_sharpen_avx(&wsharpen[x]), smin, smax));
+      _mm256_storeu_ps(&outcur[x][0], madd(c, wiener, grid));
+    }
+    for (; x < bw; x++) {
+      float gridcorrection0 = gridfraction*gridsample[x][0];
+      float corrected0 = outcur[x][0] - gridcorrection0;
+      float gridcorrection1 = gridfraction*gridsample[x][1];
+      float corrected1 = outcur[x][1] - gridcorrection1;
+      float psd = (corrected0*corrected0 + corrected1*corrected1 ) + 1e-15f;
+      float WienerFactor = MAX((psd - sigmaSquaredNoiseNormed)/psd, lowlimit);
+      WienerFactor *= 1 + wsharpen[x]*sqrtf( psd*sigmaSquaredSharpenMax/((psd + sigmaSquaredSharpenMin)*(psd + sigmaSquaredSharpenMax)) );
+      outcur[x][0] = corrected0*WienerFactor + gridcorrection0;
+      outcur[x][1] = corrected1*WienerFactor + gridcorrection1;
+    }
+    outcur += bw;
+    gridsample += bw;
+  }
+  _mm256_zeroupper();
+}
+
+}}// namespace RawStudio::FFTFilter
+
+#elif defined (__i386__) || defined (__x86_64__)
+
+/* The compiler cannot generate AVX code, use the SSE3 versions */
+
+namespace RawStudio {
+namespace FFTFilter {
+
+void DeGridComplexFilter::KERNEL(processSharpenOnly)(ComplexBlock* block)
+{
+  processSharpenOnlySSE3(block);
+}
+
+void ComplexWienerFilterDeGrid::KERNEL_(processNoSharpen)(ComplexBlock* block)
+{
+  processNoSharpen_SSE3(block);
+}
+
+void ComplexWienerFilterDeGrid::KERNEL_(processSharpen)(ComplexBlock* block)
+{
+  processSharpen_SSE3(block);
+}
+
+}}// namespace RawStudio::FFTFilter
+
+#endif
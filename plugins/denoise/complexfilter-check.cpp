@@ -0,0 +1,163 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Checks the AVX and FMA versions of the complex filters against the C
+ * versions on fixed blocks. Run by "make check", the exit status is 1 if
+ * any coefficient differs by more than CHECK_TOLERANCE of the largest input
+ * coefficient, and 77 (skipped) if the cpu has no AVX. */
+
+#include "complexfilter.h"
+#include "fftwindow.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+using namespace RawStudio::FFTFilter;
+
+#define CHECK_BLOCK_SIZE 128
+#define CHECK_OVERLAP 24
+#define CHECK_BLOCKS 4
+#define CHECK_TOLERANCE 1e-5f
+#define CHECK_SKIPPED 77
+
+typedef struct {
+  const char *name;
+  float sigma;     // Zero makes processSharpen() use processSharpenOnly()
+  float sharpen;
+} FilterCase;
+
+static const FilterCase cases[] = {
+  { "processNoSharpen", 1.5f, 0.0f },
+  { "processSharpen", 1.5f, 0.75f },
+  { "processSharpenOnly", 0.0f, 0.75f },
+};
+
+typedef struct {
+  const char *name;
+  guint mask;      // Cpu features allowed while running the filter
+  guint required;
+} CheckVariant;
+
+static const CheckVariant variants[] = {
+  { "avx", ~(guint) RS_CPU_FLAG_FMA, RS_CPU_FLAG_AVX },
+  { "fma", ~0U, RS_CPU_FLAG_AVX | RS_CPU_FLAG_FMA },
+};
+
+/* Fill a block with the spectrum of a gradient with deterministic noise, in
+ * the square root domain the denoiser works in */
+static void
+fill_block(ComplexBlock *block, FloatImagePlane *plane, fftwf_plan plan, guint32 seed)
+{
+  for (int y = 0; y < plane->h; y++) {
+    float *line = plane->getLine(y);
+    for (int x = 0; x < plane->w; x++) {
+      seed = seed * 1664525 + 1013904223;
+      line[x] = sqrtf((float)(((x + y) * 30000) / (plane->w + plane->h) + 2000 + (seed >> 22)));
+    }
+  }
+  fftwf_execute_dft_r2c(plan, plane->data, block->complex);
+
+  // The real transform fills the first half, the filters process all of it
+  int used = plane->h * (plane->w / 2 + 1);
+  int total = block->w * block->h;
+  for (int i = used; i < total; i++) {
+    block->complex[i][0] = block->complex[i - used][0];
+    block->complex[i][1] = block->complex[i - used][1];
+  }
+}
+
+/* Run a filter on a copy of input using only the allowed cpu features */
+static void
+run_filter(ComplexFilter *filter, guint mask, ComplexBlock *input, ComplexBlock *output)
+{
+  memcpy(output->complex, input->complex, sizeof(fftwf_complex) * input->w * input->h);
+  rs_set_cpu_features_mask(mask);
+  filter->process(output);
+  rs_set_cpu_features_mask(~0U);
+}
+
+int
+main(void)
+{
+  const int bs = CHECK_BLOCK_SIZE;
+  guint cpu = rs_detect_cpu_features();
+  gboolean failed = FALSE;
+  gboolean checked = FALSE;
+
+  FloatImagePlane plane(bs, bs);
+  plane.allocateImage();
+  ComplexBlock input(bs, bs);
+  ComplexBlock reference(bs, bs);
+  ComplexBlock output(bs, bs);
+  fftwf_plan plan = fftwf_plan_dft_r2c_2d(bs, bs, plane.data, input.complex, FFTW_ESTIMATE);
+
+  FFTWindow window(bs, bs);
+  window.createHalfCosineWindow(CHECK_OVERLAP, CHECK_OVERLAP);
+
+  for (unsigned int c = 0; c < G_N_ELEMENTS(cases); c++) {
+    const FilterCase *fc = &cases[c];
+    float beta = 1.0f + fc->sigma * 0.015f;
+    float sharpenMin = MAX(fc->sigma, 1.5f);
+
+    // The degrid filter builds its grid block with the forward plan
+    ComplexFilter *filter = new ComplexWienerFilterDeGrid(bs, bs, beta, fc->sigma, 1.0f, plan, &window);
+    filter->setSharpen(fc->sharpen, sharpenMin, sharpenMin + fc->sharpen * 3.0f, 0.1f);
+
+    for (unsigned int v = 0; v < G_N_ELEMENTS(variants); v++) {
+      const CheckVariant *cv = &variants[v];
+      if ((cpu & cv->required) != cv->required)
+        continue;
+
+      float max_error = 0.0f;
+      for (guint32 b = 0; b < CHECK_BLOCKS; b++) {
+        fill_block(&input, &plane, plan, 42 + b);
+        run_filter(filter, 0, &input, &reference);
+        run_filter(filter, cv->mask, &input, &output);
+
+        float max_input = 0.0f;
+        float max_diff = 0.0f;
+        for (int i = 0; i < bs * bs; i++) {
+          for (int j = 0; j < 2; j++) {
+            float diff = fabsf(output.complex[i][j] - reference.complex[i][j]);
+            max_input = MAX(max_input, fabsf(input.complex[i][j]));
+            // NaN must fail as well
+            if (!(diff <= max_diff))
+              max_diff = isnan(diff) ? INFINITY : diff;
+          }
+        }
+        max_error = MAX(max_error, (max_input > 0.0f) ? max_diff / max_input : max_diff);
+      }
+
+      gboolean ok = (max_error <= CHECK_TOLERANCE);
+      printf("%-20s %-4s max-error %.3g (tolerance %.3g) %s\n",
+        fc->name, cv->name, max_error, CHECK_TOLERANCE, ok ? "ok" : "FAILED");
+      failed |= !ok;
+      checked = TRUE;
+    }
+    delete filter;
+  }
+
+  fftwf_destroy_plan(plan);
+
+  if (!checked) {
+    printf("The cpu has no AVX, nothing to check\n");
+    return CHECK_SKIPPED;
+  }
+  return failed ? 1 : 0;
+}
@@ -125,7 +125,11 @@ void DeGridComplexFilter::processSharpenOnly(ComplexBlock* block) {
 
 #if defined (__i386__) || defined (__x86_64__)
     guint cpu = rs_detect_cpu_features();
-    if (cpu & RS_CPU_FLAG_SSE3) 
+    if (cpu & RS_CPU_FLAG_FMA)
+      return processSharpenOnlyFMA(block);
+    else if (cpu & RS_CPU_FLAG_AVX)
+      return processSharpenOnlyAVX(block);
+    else if (cpu & RS_CPU_FLAG_SSE3) 
       return processSharpenOnlySSE3(block);
     else if (cpu & RS_CPU_FLAG_SSE)
       return processSharpenOnlySSE(block);
@@ -305,7 +309,11 @@ void ComplexWienerFilterDeGrid::processNoSharpen( ComplexBlock* block )
 
 #if defined (__i386__) || defined (__x86_64__)
   guint cpu = rs_detect_cpu_features();
-  if (cpu & RS_CPU_FLAG_SSE3) 
+  if (cpu & RS_CPU_FLAG_FMA)
+    return processNoSharpen_FMA(block);
+  else if (cpu & RS_CPU_FLAG_AVX)
+    return processNoSharpen_AVX(block);
+  else if (cpu & RS_CPU_FLAG_SSE3) 
     return processNoSharpen_SSE3(block);
   else if (cpu & RS_CPU_FLAG_SSE) 
     return processNoSharpen_SSE(block);
@@ -345,7 +353,11 @@ void ComplexWienerFilterDeGrid::processSharpen( ComplexBlock* block )
 
 #if defined (__i386__) || defined (__x86_64__)
   guint cpu = rs_detect_cpu_features();
-  if (cpu & RS_CPU_FLAG_SSE3) 
+  if (cpu & RS_CPU_FLAG_FMA)
+    return processSharpen_FMA(block);
+  else if (cpu & RS_CPU_FLAG_AVX)
+    return processSharpen_AVX(block);
+  else if (cpu & RS_CPU_FLAG_SSE3) 
     return processSharpen_SSE3(block);
   else if (cpu & RS_CPU_FLAG_SSE) 
     return processSharpen_SSE(block);
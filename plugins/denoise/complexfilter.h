@@ -59,6 +59,8 @@ protected:
 #if defined (__i386__) || defined (__x86_64__)
   void processSharpenOnlySSE(ComplexBlock* block);
   void processSharpenOnlySSE3(ComplexBlock* block);
+  void processSharpenOnlyAVX(ComplexBlock* block);
+  void processSharpenOnlyFMA(ComplexBlock* block);
 #endif
   const float degrid;
   FFTWindow *window;
@@ -91,6 +93,10 @@ protected:
   virtual void processSharpen_SSE(ComplexBlock* block);
   virtual void processNoSharpen_SSE(ComplexBlock* block);
   virtual void processNoSharpen_SSE3(ComplexBlock* block);
+  virtual void processSharpen_AVX(ComplexBlock* block);
+  virtual void processNoSharpen_AVX(ComplexBlock* block);
+  virtual void processSharpen_FMA(ComplexBlock* block);
+  virtual void processNoSharpen_FMA(ComplexBlock* block);
 #endif
   float sigmaSquaredNoiseNormed;
   FFTWindow *window;
@@ -30,6 +30,14 @@
 #define RS_DENOISE_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), RS_TYPE_DENOISE, RSDenoiseClass))
 #define RS_IS_DENOISE(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), RS_TYPE_DENOISE))
 
+#define QUICK_BUDGET_MS 33.0   /* Quick previews should render within a frame at 30 fps */
+#define QUICK_RETEST_TIME (5*G_USEC_PER_SEC) /* Skipped levels are measured again after this */
+#define QUICK_RETEST_MARGIN 2.0 /* Skipped levels slower than this times the budget are not retested */
+#define QUICK_LEVELS 2
+
+/* Quick request qualities, best first */
+static const DenoiseQuality quick_quality[QUICK_LEVELS] = { QUALITY_QUICK, QUALITY_QUICK_LUMA };
+
 typedef struct _RSDenoise RSDenoise;
 typedef struct _RSDenoiseClass RSDenoiseClass;
 
@@ -43,6 +51,8 @@ struct _RSDenoise {
 	gint sharpen;
 	gint denoise_luma;
 	gint denoise_chroma;
+	gdouble quick_cost[QUICK_LEVELS]; /* Measured milliseconds per megapixel, 0 if unknown */
+	gint64 quick_measured[QUICK_LEVELS]; /* Monotonic time of the last measurement */
 };
 
 struct _RSDenoiseClass {
@@ -144,11 +154,18 @@ settings_changed(RSSettings *settings, RSSettingsMask mask, RSDenoise *denoise)
 static void
 rs_denoise_init(RSDenoise *denoise)
 {
+	gint i;
+
 	denoise->info.processMode = PROCESS_YUV;
 	initDenoiser(&denoise->info);
 	denoise->sharpen = 0;
 	denoise->denoise_luma = 0;
 	denoise->denoise_chroma = 0;
+	for (i = 0; i < QUICK_LEVELS; i++)
+	{
+		denoise->quick_cost[i] = 0.0;
+		denoise->quick_measured[i] = 0;
+	}
 }
 
 static void
@@ -224,65 +241,145 @@ bit_blt(char* dstp, int dst_pitch, const char* srcp, int src_pitch, int row_size
 }
 
 
+/**
+ * Select the best quick level expected to render within QUICK_BUDGET_MS.
+ * A level measured over budget is only tried again once QUICK_RETEST_TIME
+ * has passed since its last measurement, and never if it would blow the
+ * budget by more than QUICK_RETEST_MARGIN, so a drag keeps its frame rate
+ * @param denoise A RSDenoise
+ * @param mpix The size of the image to denoise in megapixels
+ * @return The level to use, or -1 if even the cheapest level is too slow
+ */
+static gint
+quick_level(RSDenoise *denoise, gdouble mpix)
+{
+	gint64 now = g_get_monotonic_time();
+	gdouble ms;
+	gint level;
+
+	for (level = 0; level < QUICK_LEVELS; level++)
+	{
+		ms = denoise->quick_cost[level] * mpix;
+		if (ms <= QUICK_BUDGET_MS)
+			return level;
+		if (ms <= QUICK_BUDGET_MS * QUICK_RETEST_MARGIN
+			&& now - denoise->quick_measured[level] >= QUICK_RETEST_TIME)
+			return level;
+	}
+	return -1;
+}
+
 static RSFilterResponse *
 get_image(RSFilter *filter, const RSFilterRequest *request)
 {
 	RSDenoise *denoise = RS_DENOISE(filter);
 	GdkRectangle *roi;
+	GdkRectangle area;
+	RSFilterRequest *area_request;
 	RSFilterResponse *previous_response;
 	RSFilterResponse *response;
 	RS_IMAGE16 *input;
 	RS_IMAGE16 *output;
 	RS_IMAGE16 *tmp;
-
-	previous_response = rs_filter_get_image(filter->previous, request);
+	GTimer *gt;
+	gdouble mpix, ms;
+	gint width, height, margin, align;
+	gint level = -1;
+	gboolean quick = rs_filter_request_get_quick(request);
+	gboolean roi_sized = FALSE;
 
 	if (!RS_IS_FILTER(filter->previous))
-		return previous_response;
+		return rs_filter_get_image(filter->previous, request);
 
 	if ((denoise->sharpen + denoise->denoise_luma + denoise->denoise_chroma) == 0)
-		return previous_response;
+		return rs_filter_get_image(filter->previous, request);
+
+	rs_filter_get_size_simple(filter->previous, request, &width, &height);
+	roi = rs_filter_request_get_roi(request);
+	if (roi)
+		mpix = (roi->width * roi->height) / 1000000.0;
+	else
+		mpix = (width * height) / 1000000.0;
+
+	/* Quick requests get a cheaper approximation, if one fits the budget */
+	if (quick)
+	{
+		level = quick_level(denoise, mpix);
+		if (level < 0)
+		{
+			previous_response = rs_filter_get_image(filter->previous, request);
+			response = rs_filter_response_clone(previous_response);
+			g_object_unref(previous_response);
+			rs_filter_response_set_quick(response);
+			return response;
+		}
+		denoise->info.quality = quick_quality[level];
+	}
+	else
+	{
+		/* The full pass runs when the user is idle. Let levels measured way
+		 * over budget long ago be tried again by the next quick request, the
+		 * measurement may have been a hiccup */
+		gint64 now = g_get_monotonic_time();
+		for (level = 0; level < QUICK_LEVELS; level++)
+			if (mpix > 0.0 && now - denoise->quick_measured[level] >= QUICK_RETEST_TIME)
+				denoise->quick_cost[level] = MIN(denoise->quick_cost[level], QUICK_BUDGET_MS * QUICK_RETEST_MARGIN / mpix);
+		level = -1;
+		denoise->info.quality = QUALITY_FULL;
+	}
+
+	if (roi)
+	{
+		/* Every block touching the ROI must see the same pixels as it would
+		 * when denoising the whole image, or ROIs rendered side by side
+		 * will show seams. The input is always requested in full size */
+		getRoiMargin(&denoise->info, &margin, &align);
+		area.x = MAX(0, roi->x - margin);
+		area.y = MAX(0, roi->y - margin);
+		area.x -= area.x % align;
+		area.y -= area.y % align;
+		area.width = MIN(width, roi->x + roi->width + margin) - area.x;
+		area.height = MIN(height, roi->y + roi->height + margin) - area.y;
+
+		area_request = rs_filter_request_clone(request);
+		rs_filter_request_set_roi(area_request, &area);
+		rs_filter_param_delete(RS_FILTER_PARAM(area_request), "roi-sized");
+		previous_response = rs_filter_get_image(filter->previous, area_request);
+		g_object_unref(area_request);
+
+		rs_filter_param_get_boolean(RS_FILTER_PARAM(request), "roi-sized", &roi_sized);
+	}
+	else
+		previous_response = rs_filter_get_image(filter->previous, request);
 
 	input = rs_filter_response_get_image(previous_response);
-	
+
 	if (!input)
 		return previous_response;
 
-	response = rs_filter_response_clone(previous_response);
-	g_object_unref(previous_response);
-
-	/* If the request is marked as "quick", bail out, we're slow */
-	if (rs_filter_request_get_quick(request))
+	if (roi && (input->w < area.x + area.width || input->h < area.y + area.height))
 	{
-		rs_filter_response_set_image(response, input);
-		rs_filter_response_set_quick(response);
 		g_object_unref(input);
-		return response;
+		return previous_response;
 	}
-	
+
+	response = rs_filter_response_clone(previous_response);
+	g_object_unref(previous_response);
+	if (quick)
+		rs_filter_response_set_quick(response);
+
 	gfloat scale = 1.0;
 	rs_filter_get_recursive(RS_FILTER(denoise), "scale", &scale, NULL);
 
-	if ((roi = rs_filter_request_get_roi(request)))
+	/* Denoise the area around the ROI in a buffer of its own */
+	if (roi)
 	{
-		/* Align so we start at even pixel counts */
-		roi->width += (roi->x&1);
-		roi->x -= (roi->x&1);
-		roi->width = MIN(input->w - roi->x, roi->width);
-		output = rs_image16_copy(input, FALSE);
-		tmp = rs_image16_new_subframe(output, roi);
-		bit_blt((char*)GET_PIXEL(tmp,0,0), tmp->rowstride * 2, 
-			(const char*)GET_PIXEL(input,roi->x,roi->y), input->rowstride * 2, tmp->w * tmp->pixelsize * 2, tmp->h);
+		tmp = rs_image16_new(area.width, area.height, input->channels, input->pixelsize);
+		bit_blt((char*)GET_PIXEL(tmp,0,0), tmp->rowstride * 2,
+			(const char*)GET_PIXEL(input,area.x,area.y), input->rowstride * 2, tmp->w * tmp->pixelsize * 2, tmp->h);
 	}
 	else
-	{
-		output = rs_image16_copy(input, TRUE);
-		tmp = g_object_ref(output);
-	}
-
-	g_object_unref(input);
-	rs_filter_response_set_image(response, output);
-	g_object_unref(output);
+		tmp = rs_image16_copy(input, TRUE);
 
 	denoise->info.image = tmp;
 	denoise->info.sigmaLuma = ((float) denoise->denoise_luma * scale) / 3.0;
@@ -297,8 +394,45 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	denoise->info.redCorrection = 1.0f;
 	denoise->info.blueCorrection = 1.0f;
 
+	gt = g_timer_new();
 	denoiseImage(&denoise->info);
+	ms = g_timer_elapsed(gt, NULL) * 1000.0;
+	g_timer_destroy(gt);
+
+	if (level >= 0 && mpix > 0.0)
+	{
+		/* Average with earlier measurements to smooth out hiccups */
+		if (denoise->quick_cost[level] > 0.0)
+			denoise->quick_cost[level] = (denoise->quick_cost[level] + ms / mpix) * 0.5;
+		else
+			denoise->quick_cost[level] = ms / mpix;
+		denoise->quick_measured[level] = g_get_monotonic_time();
+		RS_DEBUG(PERFORMANCE, "Quick denoise level %d: %.1fms for %.2f megapixels", level, ms, mpix);
+	}
+
+	if (!roi)
+		output = g_object_ref(tmp);
+	else if (roi_sized)
+	{
+		/* The caller only wants the ROI, see rs_output_get_strips8() */
+		output = rs_image16_new(roi->width, roi->height, input->channels, input->pixelsize);
+		bit_blt((char*)GET_PIXEL(output,0,0), output->rowstride * 2,
+			(const char*)GET_PIXEL(tmp,roi->x - area.x,roi->y - area.y), tmp->rowstride * 2, output->w * output->pixelsize * 2, output->h);
+		rs_filter_response_set_roi(response, roi);
+		rs_filter_param_set_boolean(RS_FILTER_PARAM(response), "roi-sized", TRUE);
+	}
+	else
+	{
+		/* Only the ROI is rendered in the full size image */
+		output = rs_image16_copy(input, FALSE);
+		bit_blt((char*)GET_PIXEL(output,roi->x,roi->y), output->rowstride * 2,
+			(const char*)GET_PIXEL(tmp,roi->x - area.x,roi->y - area.y), tmp->rowstride * 2, roi->width * output->pixelsize * 2, roi->height);
+	}
+
 	g_object_unref(tmp);
+	g_object_unref(input);
+	rs_filter_response_set_image(response, output);
+	g_object_unref(output);
 
 	return response;
 }
@@ -0,0 +1,99 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>, 
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "denoisearena.h"
+#include <stdlib.h>  /* posix_memalign() */
+
+#define ARENA_ALIGN 64
+
+namespace RawStudio {
+namespace FFTFilter {
+
+DenoiseArena::DenoiseArena(void) : used(0), total(0)
+{
+}
+
+DenoiseArena::~DenoiseArena(void)
+{
+  freeChunks();
+}
+
+void* DenoiseArena::alloc(size_t size)
+{
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  if (chunks.empty() || used + size > chunks.back().size) {
+    addChunk(MAX(size, DENOISE_ARENA_CHUNK));
+    used = 0;
+  }
+  void *p = &chunks.back().data[used];
+  used += size;
+  total += size;
+  return p;
+}
+
+void DenoiseArena::reset()
+{
+  // A single chunk is simply reused. If the last image needed more,
+  // replace all chunks by one that holds everything, so the next image
+  // of the same size is allocated without touching the heap.
+  if (chunks.size() > 1) {
+    size_t needed = total;
+    freeChunks();
+    if (needed <= DENOISE_ARENA_KEEP)
+      addChunk(needed);
+  } else if (!chunks.empty() && chunks.back().size > DENOISE_ARENA_KEEP) {
+    freeChunks();
+  }
+  used = 0;
+  total = 0;
+}
+
+void DenoiseArena::trim()
+{
+  // Called when an image is done, so a large export doesn't keep its
+  // planes allocated until the next image
+  size_t size = 0;
+  for (guint i = 0; i < chunks.size(); i++)
+    size += chunks[i].size;
+
+  if (size > DENOISE_ARENA_KEEP) {
+    freeChunks();
+    used = 0;
+    total = 0;
+  }
+}
+
+void DenoiseArena::addChunk(size_t size)
+{
+  ArenaChunk c;
+  c.size = size;
+  g_assert(0 == posix_memalign((void**)&c.data, ARENA_ALIGN, size));
+  g_assert(c.data);
+  chunks.push_back(c);
+}
+
+void DenoiseArena::freeChunks()
+{
+  for (guint i = 0; i < chunks.size(); i++)
+    free(chunks[i].data);
+  chunks.clear();
+}
+
+}}// namespace RawStudio::FFTFilter
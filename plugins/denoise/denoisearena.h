@@ -0,0 +1,70 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>, 
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef denoisearena_h__
+#define denoisearena_h__
+#include <rawstudio.h>
+#include <vector>
+
+namespace RawStudio {
+namespace FFTFilter {
+
+#define DENOISE_ARENA_CHUNK (1024*1024)        // Minimum size of each chunk in bytes
+#define DENOISE_ARENA_KEEP (128*1024*1024)     // Memory kept after an image, larger arenas are released
+
+using namespace std;
+
+// Bump allocator for everything the denoiser needs while processing one
+// image: image planes, slices, slice views and jobs. Objects allocated
+// here are never freed individually, and their destructors are not run.
+// Not thread safe, only the thread calling denoiseImage allocates.
+class DenoiseArena
+{
+public:
+  DenoiseArena(void);
+  virtual ~DenoiseArena(void);
+  void* alloc(size_t size);  // Returns cache line aligned memory, valid until reset() or trim().
+  void reset();  // Frees everything allocated, keeps the memory for the next image.
+  void trim();   // Releases the memory if it is larger than DENOISE_ARENA_KEEP.
+private:
+  typedef struct {
+    guchar *data;
+    size_t size;
+  } ArenaChunk;
+  void addChunk(size_t size);
+  void freeChunks();
+  vector<ArenaChunk> chunks;
+  size_t used;    // Bytes used in the last chunk
+  size_t total;   // Bytes used in all chunks since the last reset
+};
+
+// Trims an arena when it goes out of scope. Declare it before anything
+// allocated from the arena, so it runs after their destructors.
+class DenoiseArenaTrim
+{
+public:
+  DenoiseArenaTrim(DenoiseArena *_arena) : arena(_arena) {}
+  ~DenoiseArenaTrim(void) { arena->trim(); }
+private:
+  DenoiseArena *arena;
+};
+
+}} // namespace RawStudio::FFTFilter
+
+#endif // denoisearena_h__
@@ -34,8 +34,15 @@ typedef enum {
   PROCESS_RGB, PROCESS_YUV, PROCESS_PATTERN_RGB, PROCESS_PATTERN_YUV
 } InitDenoiseMode;
 
+typedef enum {
+  QUALITY_FULL,       // Full block overlap on all planes.
+  QUALITY_QUICK,      // Reduced block overlap, for interactive previews.
+  QUALITY_QUICK_LUMA  // Reduced block overlap, chroma is left untouched. Same as QUALITY_QUICK in RGB mode.
+} DenoiseQuality;
+
 typedef struct {
   InitDenoiseMode processMode;  // Set this before initializing, DO NOT modify after that.
+  DenoiseQuality quality;       // Can be changed for every image. (default: QUALITY_FULL)
   RS_IMAGE16* image;            // This will be input and output
   float sigmaLuma;              // In RGB mode this is used for all planes, YUV mode only luma.
   float sigmaChroma;            // Used only in YUV mode.
@@ -61,6 +68,10 @@ void initDenoiser(FFTDenoiseInfo* info);
 void denoiseImage(FFTDenoiseInfo* info);
 void destroyDenoiser(FFTDenoiseInfo* info);
 void abortDenoiser(FFTDenoiseInfo* info);
+// Denoising a ROI grown by margin on all sides, with the top left corner
+// moved down to a multiple of align, gives the same result within the ROI
+// as denoising the whole image. Depends on info->quality.
+void getRoiMargin(FFTDenoiseInfo* info, int* margin, int* align);
 
 #ifdef _unix_
 G_END_DECLS
@@ -38,6 +38,9 @@ void *StartDenoiseThread(void *_this) {
 DenoiseThread::DenoiseThread(void) {
   complex = 0;
   input_plane = 0;
+  waiting = 0;
+  index = 0;
+  generation = 0;
   exitThread = false;
   threadExited = false;
   pthread_mutex_init(&run_thread_mutex, NULL);
@@ -59,19 +62,26 @@ DenoiseThread::~DenoiseThread(void) {
   pthread_join(thread_id, NULL);
   pthread_mutex_destroy(&run_thread_mutex);
   pthread_cond_destroy(&run_thread);
-  if (complex)
+  if (complex) {
+    for (int i = 0; i < FFT_BATCH_SIZE; i++)
+      delete complex_slot[i];
     delete complex;
+  }
   complex = 0;
-  if (input_plane)
+  if (input_plane) {
+    for (int i = 0; i < FFT_BATCH_SIZE; i++)
+      delete input_slot[i];
     delete input_plane;
+  }
   input_plane = 0;
 }
 
-void DenoiseThread::addJobs( JobQueue *_waiting, JobQueue *_finished )
+void DenoiseThread::addJobs( JobQueue *_waiting, int _index )
 {
   pthread_mutex_lock(&run_thread_mutex);
   waiting = _waiting;
-  finished = _finished;
+  index = _index;
+  generation++;
   pthread_cond_signal(&run_thread);
   pthread_mutex_unlock(&run_thread_mutex);
 }
@@ -80,25 +90,31 @@ void DenoiseThread::jobsEnded()
 {
   pthread_mutex_lock(&run_thread_mutex);
   waiting = 0;
-  finished = 0;
   pthread_mutex_unlock(&run_thread_mutex);
 }
 
 void DenoiseThread::runDenoise() {
+  int seen = 0;
   pthread_mutex_lock(&run_thread_mutex);
   while (!exitThread) {
-    pthread_cond_wait(&run_thread,&run_thread_mutex); // Wait for jobs
-    vector<Job*> jobs;
-    if (waiting)
-      jobs = waiting->getJobsPercent(10);
-    while (!exitThread && !jobs.empty()) {
-      Job* j = jobs[0];
-      jobs.erase(jobs.begin());
-
-      switch (j->type) {
-        case JOB_FFT:
-          procesFFT((FFTJob*)j);
-          break;
+    // Wait for jobs, they may have been added before we got here
+    while (!exitThread && (!waiting || generation == seen))
+      pthread_cond_wait(&run_thread,&run_thread_mutex);
+    if (exitThread)
+      break;
+    seen = generation;
+    Job* jobs[FFT_BATCH_SIZE];
+    int n, done = 0;
+    while (!exitThread && (n = waiting->getJobs(index, jobs, FFT_BATCH_SIZE))) {
+      // FFT jobs are transformed together
+      FFTJob* fft[FFT_BATCH_SIZE];
+      int nfft = 0;
+      for (int i = 0; i < n; i++) {
+        Job* j = jobs[i];
+        switch (j->type) {
+          case JOB_FFT:
+            fft[nfft++] = (FFTJob*)j;
+            break;
           case JOB_CONVERT_FROMFLOAT_YUV:
             {
               ImgConvertJob *job = (ImgConvertJob*)j;
@@ -111,54 +127,84 @@ void DenoiseThread::runDenoise() {
               job->img->unpackInterleavedYUV(job);
               break;
             }
-        default:
-          break;
+          default:
+            break;
+        }
       }
-      finished->addJob(j);
-      if (jobs.empty())
-        jobs = waiting->getJobsPercent(10);
-      
+      if (nfft)
+        procesFFT(fft, nfft);
+      for (int i = 0; i < n; i++)
+        Job::release(jobs[i]);
+      done += n;
     }
+    // Report all our jobs at once, the queue only needs to know when everything is done
+    if (done)
+      waiting->jobsDone(done);
   }
   pthread_mutex_unlock(&run_thread_mutex);
 }
 
-void DenoiseThread::procesFFT( FFTJob* j )
+void DenoiseThread::procesFFT( FFTJob** jobs, int n )
 {
-  FloatImagePlane* input = j->p->in;
-  g_assert(j->p->filter);
-
-  if (j->p->filter->skipBlock()) {
-    j->outPlane->applySlice(j->p);
-    return;
+  FloatImagePlane* input = jobs[0]->p->in;
+  FFTJob* blocks[FFT_BATCH_SIZE];
+  int nBlocks = 0;
+  int i;
+
+  if (!complex) {
+    complex = new ComplexBlock(input->w, input->h * FFT_BATCH_SIZE);
+    for (i = 0; i < FFT_BATCH_SIZE; i++)
+      complex_slot[i] = new ComplexBlock(input->w, input->h, &complex->complex[i * input->w * input->h]);
   }
 
-  if (!complex)
-    complex = new ComplexBlock(input->w, input->h);
-
   if (!input_plane) {
-    input_plane = new FloatImagePlane(input->w, input->h);
+    input_plane = new FloatImagePlane(input->w, input->h * FFT_BATCH_SIZE);
     input_plane->allocateImage();
+    for (i = 0; i < FFT_BATCH_SIZE; i++)
+      input_slot[i] = input_plane->getSlice(0, i * input->h, input->w, input->h);
   }
 
-  j->p->window->applyAnalysisWindow(input, input_plane);
-
-  fftwf_execute_dft_r2c(forward, input_plane->data, complex->complex);
-
-  j->p->filter->process(complex);
+  for (i = 0; i < n; i++) {
+    FFTJob *j = jobs[i];
+    g_assert(j->p->filter);
+    g_assert(j->p->in->w == input->w && j->p->in->h == input->h);
 
-  fftwf_execute_dft_c2r(reverse, complex->complex, input_plane->data);
-
-  j->p->setOut(input_plane);
-
-  // Currently not used, as no overlapped data is used.
-  //j->p->window->applySynthesisWindow(j->p->out);
-
-	if (j->outPlane->plane_id == 0)
-		j->outPlane->applySliceLimited(j->p, input);
-	else
-		j->outPlane->applySlice(j->p);
+    if (j->p->filter->skipBlock()) {
+      j->outPlane->applySlice(j->p);
+      continue;
+    }
+    j->p->window->applyAnalysisWindow(j->p->in, input_slot[nBlocks]);
+    blocks[nBlocks++] = j;
+  }
 
+  // A full batch is transformed by a single plan
+  if (nBlocks == FFT_BATCH_SIZE)
+    fftwf_execute_dft_r2c(forward_batch, input_plane->data, complex->complex);
+  else
+    for (i = 0; i < nBlocks; i++)
+      fftwf_execute_dft_r2c(forward, input_slot[i]->data, complex_slot[i]->complex);
+
+  for (i = 0; i < nBlocks; i++)
+    blocks[i]->p->filter->process(complex_slot[i]);
+
+  if (nBlocks == FFT_BATCH_SIZE)
+    fftwf_execute_dft_c2r(reverse_batch, complex->complex, input_plane->data);
+  else
+    for (i = 0; i < nBlocks; i++)
+      fftwf_execute_dft_c2r(reverse, complex_slot[i]->complex, input_slot[i]->data);
+
+  for (i = 0; i < nBlocks; i++) {
+    FFTJob *j = blocks[i];
+    j->p->setOut(input_slot[i]);
+
+    // Currently not used, as no overlapped data is used.
+    //j->p->window->applySynthesisWindow(j->p->out);
+
+    if (j->outPlane->plane_id == 0)
+      j->outPlane->applySliceLimited(j->p, j->p->in);
+    else
+      j->outPlane->applySlice(j->p);
+  }
 }
 
 }}// namespace RawStudio::FFTFilter
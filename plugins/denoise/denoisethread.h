@@ -29,18 +29,24 @@
 namespace RawStudio {
 namespace FFTFilter {
 
+#define FFT_BATCH_SIZE 4    // Number of neighbouring blocks transformed by one FFTW call
+
 class DenoiseThread
 {
 public:
   DenoiseThread(void);
   virtual ~DenoiseThread(void);
-  void addJobs(JobQueue *waiting, JobQueue *finished);
+  void addJobs(JobQueue *waiting, int index);
   void jobsEnded();
   void runDenoise();
   fftwf_plan forward;
   fftwf_plan reverse;
-  ComplexBlock *complex;
-  FloatImagePlane *input_plane;
+  fftwf_plan forward_batch;   // Transforms FFT_BATCH_SIZE blocks at once
+  fftwf_plan reverse_batch;
+  ComplexBlock *complex;      // FFT_BATCH_SIZE blocks after each other
+  ComplexBlock *complex_slot[FFT_BATCH_SIZE];
+  FloatImagePlane *input_plane;   // FFT_BATCH_SIZE blocks above each other
+  FloatImagePlane *input_slot[FFT_BATCH_SIZE];
   pthread_t thread_id;
   pthread_cond_t run_thread;
   pthread_mutex_t run_thread_mutex;
@@ -48,8 +54,9 @@ public:
   gboolean threadExited;
 private:
   JobQueue *waiting;
-  JobQueue *finished;
-  void procesFFT(FFTJob* job);
+  int index;              // Which range of the queue this thread starts on
+  int generation;         // Incremented for every set of jobs
+  void procesFFT(FFTJob** jobs, int n);
 
 };
 
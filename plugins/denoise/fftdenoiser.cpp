@@ -20,6 +20,11 @@
 #include "fftdenoiser.h"
 #include "complexblock.h"
 #include "fftdenoiseryuv.h"
+#include <stdio.h>
+#include <pthread.h>
+extern "C" {
+#include "conf_interface.h"
+}
 
 #ifdef WIN32
 int rs_get_number_of_processor_cores(){return 4;}
@@ -28,9 +33,51 @@ int rs_get_number_of_processor_cores(){return 4;}
 namespace RawStudio {
 namespace FFTFilter {
 
+// The FFTW planner is not thread safe
+static pthread_mutex_t planner_mutex = PTHREAD_MUTEX_INITIALIZER;
+static gboolean wisdom_loaded = false;
+
+// Wisdom is only valid for the machine it was measured on
+static gchar *
+wisdom_filename(void)
+{
+  gchar *name = g_strdup_printf("fftw-wisdom-%s", g_get_host_name());
+  gchar *filename = g_build_filename(rs_confdir_get(), name, NULL);
+  g_free(name);
+  return filename;
+}
+
+static gboolean
+load_wisdom(void)
+{
+  gchar *filename = wisdom_filename();
+  FILE *file = fopen(filename, "r");
+  gboolean ret = false;
+
+  if (file) {
+    ret = fftwf_import_wisdom_from_file(file);
+    fclose(file);
+  }
+  g_free(filename);
+  return ret;
+}
+
+static void
+save_wisdom(void)
+{
+  gchar *filename = wisdom_filename();
+  FILE *file = fopen(filename, "w");
+
+  if (file) {
+    fftwf_export_wisdom_to_file(file);
+    fclose(file);
+  }
+  g_free(filename);
+}
 
 FFTDenoiser::FFTDenoiser(void)
 {
+  quality = QUALITY_FULL;
   nThreads = rs_get_number_of_processor_cores();
   threads = new DenoiseThread[nThreads];
   initializeFFT();
@@ -40,17 +87,24 @@ FFTDenoiser::FFTDenoiser(void)
 FFTDenoiser::~FFTDenoiser(void)
 {
   delete[] threads;
+  pthread_mutex_lock(&planner_mutex);
   fftwf_destroy_plan(plan_forward);
   fftwf_destroy_plan(plan_reverse); 
+  fftwf_destroy_plan(plan_forward_batch);
+  fftwf_destroy_plan(plan_reverse_batch);
+  pthread_mutex_unlock(&planner_mutex);
 }
 
 void FFTDenoiser::denoiseImage( RS_IMAGE16* image )
 {
+  arena.reset();
+  DenoiseArenaTrim trim(&arena);
   FloatPlanarImage img;
+  img.arena = &arena;
   img.bw = FFT_BLOCK_SIZE;
   img.bh = FFT_BLOCK_SIZE;
-  img.ox = FFT_BLOCK_OVERLAP;
-  img.oy = FFT_BLOCK_OVERLAP;
+  img.ox = getOverlap(quality);
+  img.oy = getOverlap(quality);
 
   if ((image->w < FFT_BLOCK_SIZE) || (image->h < FFT_BLOCK_SIZE))
      return;   // Image too small to denoise
@@ -96,83 +150,76 @@ void FFTDenoiser::processJobs(FloatPlanarImage &img, FloatPlanarImage &outImg)
   // Prepare for reassembling the image
   outImg.allocate_planes();
   // Split input image
-  JobQueue* waiting_jobs = img.getJobs(outImg);
-  JobQueue* finished_jobs = new JobQueue();
-
-  // Count waiting jobs
-  gint njobs = waiting_jobs->jobsLeft();
-
-  for (guint i = 0; i < nThreads; i++) {
-    threads[i].addJobs(waiting_jobs,finished_jobs);
-  }
-
-
-  gint jobs_added  = 0;
-  while (jobs_added < njobs) {
-    Job *_j = finished_jobs->waitForJob();
-
-    if (_j->type == JOB_FFT) {
-      delete _j;
-      jobs_added++;
-      if (abort) {
-        jobs_added += waiting_jobs->removeRemaining();
-        jobs_added += finished_jobs->removeRemaining();
-      }
-    }
-  }
-
-  for (guint i = 0; i < nThreads; i++)
-    threads[i].jobsEnded();
-
-  delete finished_jobs;
-  delete waiting_jobs;
+  waitForJobs(img.getJobs(outImg));
 }
 
 void FFTDenoiser::waitForJobs(JobQueue *waiting_jobs)
 {
-  JobQueue* finished_jobs = new JobQueue();
-
-  gint njobs = waiting_jobs->jobsLeft();
+  waiting_jobs->start(nThreads, &abort);
 
   for (guint i = 0; i < nThreads; i++) {
-    threads[i].addJobs(waiting_jobs,finished_jobs);
+    threads[i].addJobs(waiting_jobs, i);
   }
 
-  gint jobs_added  = 0;
-  while (jobs_added < njobs) {
-    Job *j = finished_jobs->waitForJob();
-    delete j;
-    jobs_added++;
-  }
+  waiting_jobs->waitForJobs();
 
   for (guint i = 0; i < nThreads; i++)
     threads[i].jobsEnded();
-  
+
   delete waiting_jobs;
-  delete finished_jobs;
 }
 
 gboolean FFTDenoiser::initializeFFT()
 {
-  // Create dummy block
-  FloatImagePlane plane(FFT_BLOCK_SIZE,FFT_BLOCK_SIZE);
+  // Create dummy blocks
+  FloatImagePlane plane(FFT_BLOCK_SIZE,FFT_BLOCK_SIZE*FFT_BATCH_SIZE);
   plane.allocateImage();
-  ComplexBlock complex(FFT_BLOCK_SIZE,FFT_BLOCK_SIZE);
+  ComplexBlock complex(FFT_BLOCK_SIZE,FFT_BLOCK_SIZE*FFT_BATCH_SIZE);
   int dim[2];
   dim[0] = FFT_BLOCK_SIZE;
   dim[1] = FFT_BLOCK_SIZE;
-  plan_forward = fftwf_plan_dft_r2c(2, dim, plane.data, complex.complex,FFTW_MEASURE|FFTW_DESTROY_INPUT);
-  plan_reverse = fftwf_plan_dft_c2r(2, dim, complex.complex, plane.data,FFTW_MEASURE|FFTW_DESTROY_INPUT);
+  int dist = FFT_BLOCK_SIZE*FFT_BLOCK_SIZE;
+  unsigned flags = FFTW_MEASURE;
+  gboolean patient = false;
+  gboolean save = false;
+
+  pthread_mutex_lock(&planner_mutex);
+
+  // Plans are measured once per machine and reused from the wisdom file
+  if (!wisdom_loaded) {
+    wisdom_loaded = load_wisdom();
+    rs_conf_get_boolean_with_default(CONF_DENOISE_FFTW_PATIENT, &patient, DEFAULT_CONF_DENOISE_FFTW_PATIENT);
+    if (!wisdom_loaded && patient)
+      flags = FFTW_PATIENT;
+    save = !wisdom_loaded;
+  }
+
+  plan_forward = fftwf_plan_dft_r2c(2, dim, plane.data, complex.complex,flags|FFTW_DESTROY_INPUT);
+  plan_reverse = fftwf_plan_dft_c2r(2, dim, complex.complex, plane.data,flags|FFTW_DESTROY_INPUT);
+  plan_forward_batch = fftwf_plan_many_dft_r2c(2, dim, FFT_BATCH_SIZE,
+    plane.data, NULL, 1, dist, complex.complex, NULL, 1, dist, flags|FFTW_DESTROY_INPUT);
+  plan_reverse_batch = fftwf_plan_many_dft_c2r(2, dim, FFT_BATCH_SIZE,
+    complex.complex, NULL, 1, dist, plane.data, NULL, 1, dist, flags|FFTW_DESTROY_INPUT);
+
+  if (save) {
+    save_wisdom();
+    wisdom_loaded = true;
+  }
+  pthread_mutex_unlock(&planner_mutex);
+
   for (guint i = 0; i < nThreads; i++) {
     threads[i].forward = plan_forward;
     threads[i].reverse = plan_reverse;
+    threads[i].forward_batch = plan_forward_batch;
+    threads[i].reverse_batch = plan_reverse_batch;
   }
-  return (plan_forward && plan_reverse);
+  return (plan_forward && plan_reverse && plan_forward_batch && plan_reverse_batch);
 }
 
 
 void FFTDenoiser::setParameters( FFTDenoiseInfo *info )
 {
+  quality = info->quality;
   sigma = info->sigmaLuma *SIGMA_FACTOR;
   beta = max(1.0f, info->betaLuma);
   sharpen = info->sharpenLuma;
@@ -201,6 +248,7 @@ extern "C" {
     }
     info->_this = t;
     // Initialize parameters to default
+    info->quality = QUALITY_FULL;
     info->betaLuma = 1.0f;
 	info->betaChroma = 1.0f;
 	info->sigmaLuma = 1.0f;
@@ -229,6 +277,14 @@ extern "C" {
     delete t;
   }
 
+  void getRoiMargin(FFTDenoiseInfo* info, int* margin, int* align) {
+    // The block grid repeats every "align" pixels from the image edge.
+    // A block reaches FFT_BLOCK_SIZE pixels, so with this margin the
+    // blocks covering the ROI never see the mirrored edges.
+    *margin = FFT_BLOCK_SIZE;
+    *align = FFT_BLOCK_SIZE - RawStudio::FFTFilter::FFTDenoiser::getOverlap(info->quality) * 2;
+  }
+
   void abortDenoiser(FFTDenoiseInfo* info) {
     RawStudio::FFTFilter::FFTDenoiser *t = (RawStudio::FFTFilter::FFTDenoiser*)info->_this;
     t->abort = true;
@@ -23,12 +23,14 @@
 #include "floatplanarimage.h"
 #include "denoisethread.h"
 #include "denoiseinterface.h"
+#include "denoisearena.h"
 
 namespace RawStudio {
 namespace FFTFilter {
 
 #define FFT_BLOCK_SIZE 128       // Preferable able to be factorized into primes, must be divideable by 4.
 #define FFT_BLOCK_OVERLAP 24    // Must be dividable by 4 (OVERLAP * 2 must be < SIZE)
+#define FFT_QUICK_OVERLAP 8     // Overlap for quick previews, needs about half the blocks
 #define SIGMA_FACTOR 0.25f;    // Amount to multiply sigma by to give reasonable amount
 
 class FFTDenoiser
@@ -40,13 +42,18 @@ public:
   virtual void setParameters( FFTDenoiseInfo *info);
   virtual void denoiseImage(RS_IMAGE16* image);
   gboolean abort;
+  static int getOverlap(DenoiseQuality q) { return q == QUALITY_FULL ? FFT_BLOCK_OVERLAP : FFT_QUICK_OVERLAP; };
 protected:
   virtual void processJobs(FloatPlanarImage &img, FloatPlanarImage &outImg);
   void waitForJobs(JobQueue *waiting_jobs);
   guint nThreads;
   DenoiseThread *threads;
+  DenoiseArena arena;      // Per image allocations, reset by denoiseImage
   fftwf_plan plan_forward;
   fftwf_plan plan_reverse;
+  fftwf_plan plan_forward_batch;
+  fftwf_plan plan_reverse_batch;
+  DenoiseQuality quality;
   float sigma;
   float beta;
   float sharpen;           
@@ -33,11 +33,14 @@ FFTDenoiserYUV::~FFTDenoiserYUV(void)
 
 void FFTDenoiserYUV::denoiseImage( RS_IMAGE16* image )
 {
+  arena.reset();
+  DenoiseArenaTrim trim(&arena);
   FloatPlanarImage img;
+  img.arena = &arena;
   img.bw = FFT_BLOCK_SIZE;
   img.bh = FFT_BLOCK_SIZE;
-  img.ox = FFT_BLOCK_OVERLAP;
-  img.oy = FFT_BLOCK_OVERLAP;
+  img.ox = getOverlap(quality);
+  img.oy = getOverlap(quality);
 
   img.redCorrection = redCorrection;
   img.blueCorrection = blueCorrection;
@@ -62,19 +65,27 @@ void FFTDenoiserYUV::denoiseImage( RS_IMAGE16* image )
   filter->setSharpen(sharpen, sharpenMinSigma, sharpenMaxSigma, sharpenCutoff);
   img.setFilter(0,filter,&window);
 
-  filter = new ComplexWienerFilterDeGrid(img.bw, img.bh, betaChroma, sigmaChroma, 1.0, plan_forward, &window);
-  filter->setSharpen(sharpenChroma, sharpenMinSigmaChroma, sharpenMaxSigmaChroma, sharpenCutoffChroma);
-  img.setFilter(1,filter,&window);
+  // Quick luma-only previews leave chroma untouched
+  if (quality != QUALITY_QUICK_LUMA) {
+    filter = new ComplexWienerFilterDeGrid(img.bw, img.bh, betaChroma, sigmaChroma, 1.0, plan_forward, &window);
+    filter->setSharpen(sharpenChroma, sharpenMinSigmaChroma, sharpenMaxSigmaChroma, sharpenCutoffChroma);
+    img.setFilter(1,filter,&window);
 
-  filter = new ComplexWienerFilterDeGrid(img.bw, img.bh, betaChroma, sigmaChroma, 1.0, plan_forward, &window);
-  filter->setSharpen(sharpenChroma, sharpenMinSigmaChroma, sharpenMaxSigmaChroma, sharpenCutoffChroma);
-  img.setFilter(2,filter,&window);
+    filter = new ComplexWienerFilterDeGrid(img.bw, img.bh, betaChroma, sigmaChroma, 1.0, plan_forward, &window);
+    filter->setSharpen(sharpenChroma, sharpenMinSigmaChroma, sharpenMaxSigmaChroma, sharpenCutoffChroma);
+    img.setFilter(2,filter,&window);
+  }
 
   FloatPlanarImage outImg(img);
 
   processJobs(img, outImg);
   if (abort) return;
 
+  // Planes without a filter are copied unchanged
+  for (int i = 0; i < img.nPlanes; i++)
+    if (!img.p[i]->filter)
+      img.p[i]->blitOnto(outImg.p[i]);
+
   // Convert back
   waitForJobs(outImg.getPackInterleavedYUVJobs(image));
 }
@@ -22,6 +22,7 @@
 #include "math.h"   /* min / max */
 #include <string.h>
 #include <stdlib.h>  /* posix_memalign() */
+#include <new>
 
 #ifdef __SSE2__
 #include <emmintrin.h>
@@ -51,11 +52,15 @@ FloatImagePlane::~FloatImagePlane(void)
   allocated = 0;
 }
 
-void FloatImagePlane::allocateImage()
+void FloatImagePlane::allocateImage(DenoiseArena *arena)
 {
   if (allocated)
     return;
   pitch = ((w+3)/4)*4;
+  if (arena) {
+    data = (gfloat*)arena->alloc(pitch*h*sizeof(gfloat));
+    return;
+  }
   g_assert(0 == posix_memalign((void**)&allocated, 16, pitch*h*sizeof(gfloat)));
   g_assert(allocated);
   data = allocated;
@@ -89,7 +94,8 @@ void FloatImagePlane::mirrorEdges( int mirror_x, int mirror_y ) {
   }
 }
 
-void FloatImagePlane::addJobs(JobQueue *jobs, int bw, int bh, int ox, int oy, FloatImagePlane *outPlane) {
+// With an arena, slices, views and jobs are placed in it and must not be deleted.
+void FloatImagePlane::addJobs(JobQueue *jobs, int bw, int bh, int ox, int oy, FloatImagePlane *outPlane, DenoiseArena *arena) {
   int start_y = 0;
   gboolean endy = false;
 
@@ -97,15 +103,25 @@ void FloatImagePlane::addJobs(JobQueue *jobs, int bw, int bh, int ox, int oy, Fl
     int start_x = 0;
     gboolean endx = false;
     while (!endx) {
-      PlanarImageSlice *s = new PlanarImageSlice();
-      s->in = getSlice(start_x, start_y, bw, bh);
+      PlanarImageSlice *s;
+      if (arena)
+        s = new (arena->alloc(sizeof(PlanarImageSlice))) PlanarImageSlice();
+      else
+        s = new PlanarImageSlice();
+      s->in = getSlice(start_x, start_y, bw, bh, arena);
       s->offset_x = start_x;
       s->offset_y = start_y;
       s->overlap_x = ox;
       s->overlap_y = oy;
       s->filter = filter;
       s->window = window;
-      FFTJob *j = new FFTJob(s);
+      FFTJob *j;
+      if (arena) {
+        j = new (arena->alloc(sizeof(FFTJob))) FFTJob(s);
+        j->inArena = true;
+      } else {
+        j = new FFTJob(s);
+      }
       j->outPlane = outPlane;
       jobs->addJob(j);
       if (start_x + bw*2 - ox*2 >= w) {  //Will next block be out of frame?
@@ -126,13 +142,17 @@ void FloatImagePlane::addJobs(JobQueue *jobs, int bw, int bh, int ox, int oy, Fl
   }//end while y
 }
 
-FloatImagePlane* FloatImagePlane::getSlice( int x, int y,int new_w, int new_h )
+FloatImagePlane* FloatImagePlane::getSlice( int x, int y,int new_w, int new_h, DenoiseArena *arena )
 {
   g_assert(x+new_w<=w);
   g_assert(y+new_h<=h);
   g_assert(x>=0);
   g_assert(x>=0);
-  FloatImagePlane* s = new FloatImagePlane(new_w, new_h, plane_id);
+  FloatImagePlane* s;
+  if (arena)
+    s = new (arena->alloc(sizeof(FloatImagePlane))) FloatImagePlane(new_w, new_h, plane_id);
+  else
+    s = new FloatImagePlane(new_w, new_h, plane_id);
   s->data = getAt(x,y);
   s->pitch = pitch;
   return s;
@@ -23,6 +23,7 @@
 #include <rawstudio.h>
 #include <vector>
 #include "complexfilter.h"
+#include "denoisearena.h"
 
 namespace RawStudio {
 namespace FFTFilter {
@@ -37,14 +38,14 @@ public:
   FloatImagePlane(int _w, int _h, int id = -1);
   FloatImagePlane(const FloatImagePlane& p);
   virtual ~FloatImagePlane(void);
-  void allocateImage(); 
+  void allocateImage(DenoiseArena *arena = 0);  // Memory from an arena is not freed by the plane.
   void mirrorEdges(int mirror_x, int mirror_y);
   gfloat* getLine(int y);
   gfloat* getAt(int x, int y);
-  FloatImagePlane* getSlice(int x,int y,int new_w, int new_h);
+  FloatImagePlane* getSlice(int x,int y,int new_w, int new_h, DenoiseArena *arena = 0);
   void blitOnto(FloatImagePlane *dst);
   void multiply(float mul);
-  void addJobs(JobQueue *jobs, int bw, int bh, int ox, int oy, FloatImagePlane *outPlane);
+  void addJobs(JobQueue *jobs, int bw, int bh, int ox, int oy, FloatImagePlane *outPlane, DenoiseArena *arena = 0);
   void applySlice(PlanarImageSlice *p);
   void applySliceLimited( PlanarImageSlice *p, FloatImagePlane *org_plane );
   const int w;
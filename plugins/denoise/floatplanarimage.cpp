@@ -30,6 +30,7 @@ FloatPlanarImage::FloatPlanarImage(void) {
   p = 0;
   redCorrection = blueCorrection = 1.0f;
   nPlanes = 0;
+  arena = 0;
 }
 
 FloatPlanarImage::FloatPlanarImage( const FloatPlanarImage &img )
@@ -46,6 +47,7 @@ FloatPlanarImage::FloatPlanarImage( const FloatPlanarImage &img )
 
   redCorrection = img.redCorrection;
   blueCorrection = img.blueCorrection;
+  arena = img.arena;
 }
 
 FloatPlanarImage::~FloatPlanarImage(void) {
@@ -64,7 +66,7 @@ FloatPlanarImage::~FloatPlanarImage(void) {
 
 void FloatPlanarImage::allocate_planes() {
   for (int i = 0; i < nPlanes; i++)
-    p[i]->allocateImage();
+    p[i]->allocateImage(arena);
 }
 
 void FloatPlanarImage::mirrorEdges()
@@ -278,7 +280,8 @@ JobQueue* FloatPlanarImage::getJobs(FloatPlanarImage &outImg) {
   JobQueue *jobs = new JobQueue();
 
   for (int i = 0; i < nPlanes; i++)
-    p[i]->addJobs(jobs, bw, bh, ox, oy, outImg.p[i]);
+    if (p[i]->filter)
+      p[i]->addJobs(jobs, bw, bh, ox, oy, outImg.p[i], arena);
   
   return jobs;
 }
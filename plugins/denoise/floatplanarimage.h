@@ -43,6 +43,7 @@ public:
   void mirrorEdges();  
   FloatImagePlane **p;
   int nPlanes;
+  DenoiseArena *arena;  // Planes, slices and jobs are allocated here when set.
   void unpackInterleaved(const RS_IMAGE16* image);
   void packInterleaved( RS_IMAGE16* image );
   void setFilter( int plane, ComplexFilter *f, FFTWindow *window);
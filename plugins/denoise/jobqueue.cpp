@@ -23,6 +23,13 @@
 namespace RawStudio {
 namespace FFTFilter {
 
+void Job::release( Job *j ) {
+  // Arena jobs only point to other arena objects, so skipping
+  // their destructors leaks nothing.
+  if (!j->inArena)
+    delete j;
+}
+
 FFTJob::FFTJob( PlanarImageSlice *s ) : Job(JOB_FFT), p(s) {
 }
 
@@ -31,103 +38,147 @@ FFTJob::~FFTJob( void ) {
     delete(p);
 }
 
-JobQueue::JobQueue(void)
+JobQueue::JobQueue(void) : ranges(0), nRanges(0), abort(0), done(0)
 {
-  pthread_mutex_init(&job_mutex, NULL);
-  pthread_cond_init(&job_added_notify, NULL);
+  pthread_mutex_init(&done_mutex, NULL);
+  pthread_cond_init(&done_notify, NULL);
 }
 
 JobQueue::~JobQueue(void)
 {
-  pthread_mutex_lock(&job_mutex);
-  pthread_mutex_unlock(&job_mutex);
-  pthread_mutex_destroy(&job_mutex);
-  pthread_cond_destroy(&job_added_notify);
+  removeRemaining();
+  for (int i = 0; i < nRanges; i++)
+    pthread_mutex_destroy(&ranges[i].lock);
+  delete[] ranges;
+  pthread_mutex_destroy(&done_mutex);
+  pthread_cond_destroy(&done_notify);
 }
 
-Job* JobQueue::getJob()
+void JobQueue::addJob( Job* job)
 {
-  Job *j;
-  pthread_mutex_lock(&job_mutex);
-  if (jobs.empty())
-    j = 0; 
-  else {
-    j = jobs[0];
-    jobs.erase(jobs.begin());
+  g_assert(!ranges);
+  jobs.push_back(job);
+}
+
+int JobQueue::jobsLeft(void) {
+  if (!ranges)
+    return jobs.size();
+
+  int size = 0;
+  for (int i = 0; i < nRanges; i++) {
+    pthread_mutex_lock(&ranges[i].lock);
+    size += ranges[i].end - ranges[i].begin;
+    pthread_mutex_unlock(&ranges[i].lock);
   }
-  pthread_mutex_unlock(&job_mutex);
-  return j;
+  return size;
 }
 
-vector<Job*> JobQueue::getJobs(int n)
+/* Jobs are added row by row, so every thread gets a consecutive run of
+ * neighbouring blocks. Threads running dry steal from the others. */
+void JobQueue::start(int nThreads, gboolean *_abort)
 {
-  vector<Job*> j;
-  pthread_mutex_lock(&job_mutex);
-  n = MIN(n,(int)jobs.size());
-  for (int i = 0; i < n; i++) {
-    j.push_back(jobs[0]);
-    jobs.erase(jobs.begin());
+  g_assert(!ranges);
+  abort = _abort;
+  nRanges = MAX(1, nThreads);
+  ranges = new JobRange[nRanges];
+  int n = jobs.size();
+  for (int i = 0; i < nRanges; i++) {
+    ranges[i].begin = n * i / nRanges;
+    ranges[i].end = n * (i + 1) / nRanges;
+    pthread_mutex_init(&ranges[i].lock, NULL);
   }
-  pthread_mutex_unlock(&job_mutex);
-  return j;
 }
 
-vector<Job*> JobQueue::getJobsPercent( int percent )
+Job* JobQueue::getJob(int thread)
 {
-  vector<Job*> j;
-  pthread_mutex_lock(&job_mutex);
-  if (jobs.empty()) {
-    pthread_mutex_unlock(&job_mutex);
+  Job *j;
+  if (getJobs(thread, &j, 1))
     return j;
-  }
-  // Ensure that we get at least 1 job, otherwise respect percentage
-  int n = MAX(1, percent * jobs.size() / 100);
-  for (int i = 0; i < n; i++) {
-    j.push_back(jobs[0]);
-    jobs.erase(jobs.begin());
-  }
-  pthread_mutex_unlock(&job_mutex);
-  return j;
+  return 0;
 }
-void JobQueue::addJob( Job* job)
+
+int JobQueue::getJobs(int thread, Job** out, int max)
 {
-  pthread_mutex_lock(&job_mutex);
-  jobs.push_back(job);
-  pthread_cond_signal(&job_added_notify);
-  pthread_mutex_unlock(&job_mutex);
+  int n = 0;
+  JobRange *own = &ranges[thread % nRanges];
+
+  if (abort && *abort) {
+    removeRemaining();
+    return 0;
+  }
+
+  pthread_mutex_lock(&own->lock);
+  while (n < max && own->begin < own->end)
+    out[n++] = jobs[own->begin++];
+  pthread_mutex_unlock(&own->lock);
+  if (n)
+    return n;
+
+  // Steal the last half of the first non-empty range
+  for (int i = 1; i < nRanges && !n; i++) {
+    JobRange *victim = &ranges[(thread + i) % nRanges];
+    int begin, end = 0;
+
+    pthread_mutex_lock(&victim->lock);
+    int left = victim->end - victim->begin;
+    if (left > 0) {
+      end = victim->end;
+      victim->end -= (left + 1) / 2;
+      begin = victim->end;
+    }
+    pthread_mutex_unlock(&victim->lock);
+
+    if (end) {
+      pthread_mutex_lock(&own->lock);
+      while (n < max && begin < end)
+        out[n++] = jobs[begin++];
+      own->begin = begin;
+      own->end = end;
+      pthread_mutex_unlock(&own->lock);
+    }
+  }
+  return n;
 }
 
-int JobQueue::jobsLeft(void) {
-  int size;
-  pthread_mutex_lock(&job_mutex);
-  size = jobs.size();
-  pthread_mutex_unlock(&job_mutex);
-  return size;
+void JobQueue::jobsDone(int n)
+{
+  pthread_mutex_lock(&done_mutex);
+  done += n;
+  if (done >= (int)jobs.size())
+    pthread_cond_signal(&done_notify);
+  pthread_mutex_unlock(&done_mutex);
 }
 
-Job* JobQueue::waitForJob()
+void JobQueue::waitForJobs()
 {
-  Job *j;
-  pthread_mutex_lock(&job_mutex);
-  if (jobs.empty())
-    pthread_cond_wait(&job_added_notify, &job_mutex);
-  
-  j = jobs[0];
-  jobs.erase(jobs.begin());
-
-  pthread_mutex_unlock(&job_mutex);
-  return j;
+  pthread_mutex_lock(&done_mutex);
+  while (done < (int)jobs.size())
+    pthread_cond_wait(&done_notify, &done_mutex);
+  pthread_mutex_unlock(&done_mutex);
 }
 
 int JobQueue::removeRemaining()
 {
-  pthread_mutex_lock(&job_mutex);
-  int n = jobs.size();
-  for (int i = 0; i < n; i++) {
-    delete jobs[i];
+  int n = 0;
+
+  if (!ranges) {
+    n = jobs.size();
+    for (int i = 0; i < n; i++)
+      Job::release(jobs[i]);
+    jobs.clear();
+    return n;
+  }
+
+  for (int i = 0; i < nRanges; i++) {
+    pthread_mutex_lock(&ranges[i].lock);
+    for (int k = ranges[i].begin; k < ranges[i].end; k++)
+      Job::release(jobs[k]);
+    n += ranges[i].end - ranges[i].begin;
+    ranges[i].begin = ranges[i].end;
+    pthread_mutex_unlock(&ranges[i].lock);
   }
-  jobs.clear();
-  pthread_mutex_unlock(&job_mutex);
+  if (n)
+    jobsDone(n);
   return n;
 }
 
@@ -38,9 +38,11 @@ typedef enum {
 class Job 
 {
 public:
-  Job(JobType _type) : type(_type) {};
+  Job(JobType _type) : type(_type), inArena(false) {};
   virtual ~Job(void) {};
+  static void release(Job *j);  // Deletes the job, unless it lives in a DenoiseArena.
   JobType type;
+  gboolean inArena;
 };
 
 class FFTJob : public Job
@@ -63,22 +65,36 @@ public:
   int end_y;
 };
 
+// A range of jobs owned by one thread. Padded to keep the locks of
+// different threads on separate cache lines.
+typedef struct {
+  int begin;
+  int end;
+  pthread_mutex_t lock;
+  char padding[64];
+} JobRange;
+
 class JobQueue
 {
 public:
   JobQueue(void);
   virtual ~JobQueue(void);
-  Job* getJob();
   void addJob(Job*);
-  int removeRemaining();  // Removes remaining jobs, and returns the number of deleted jobs.
   int jobsLeft();
-  Job* waitForJob();
-  vector<Job*> getJobs(int n);
-  vector<Job*> getJobsPercent(int percent);
+  void start(int nThreads, gboolean *abort);  // Split jobs between threads, call when all jobs are added.
+  Job* getJob(int thread);  // Returns 0 when no jobs are left. Claimed jobs are released by the caller.
+  int getJobs(int thread, Job** out, int max);  // Claims up to max neighbouring jobs, returns the number claimed.
+  void jobsDone(int n);
+  void waitForJobs();      // Wait until all jobs are done or removed.
+  int removeRemaining();  // Removes remaining jobs, and returns the number of released jobs.
 private:
-  vector<Job*> jobs;      // Requires a mutex, so private.
-  pthread_mutex_t job_mutex;
-  pthread_cond_t job_added_notify;
+  vector<Job*> jobs;      // Not modified after start().
+  JobRange *ranges;
+  int nRanges;
+  gboolean *abort;
+  int done;
+  pthread_mutex_t done_mutex;
+  pthread_cond_t done_notify;
 };
 
 }} // namespace RawStudio::FFTFilter
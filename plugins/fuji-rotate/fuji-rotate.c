@@ -181,8 +181,25 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	RSFilterResponse *response;
 	RS_IMAGE16 *input;
 	RS_IMAGE16 *output = NULL;
+	gint fuji_width = 0;
+
+	/* A ROI in rotated coordinates means nothing to the filters before us */
+	if (rs_filter_request_get_roi(request))
+	{
+		RSFilterResponse *size_response = rs_filter_get_size(filter->previous, request);
+		rs_filter_param_get_integer(RS_FILTER_PARAM(size_response), "fuji-width", &fuji_width);
+		g_object_unref(size_response);
+	}
 
-	previous_response = rs_filter_get_image(filter->previous, request);
+	if (fuji_width > 0)
+	{
+		RSFilterRequest *new_request = rs_filter_request_clone(request);
+		rs_filter_request_set_roi(new_request, NULL);
+		previous_response = rs_filter_get_image(filter->previous, new_request);
+		g_object_unref(new_request);
+	}
+	else
+		previous_response = rs_filter_get_image(filter->previous, request);
 
 	if (!rs_filter_param_get_integer(RS_FILTER_PARAM(previous_response), "fuji-width", &fuji_rotate->fuji_width) || (fuji_rotate->fuji_width == 0))
 		return previous_response;
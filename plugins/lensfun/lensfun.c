@@ -41,8 +41,6 @@ typedef struct _RSLensfunClass RSLensfunClass;
 struct _RSLensfun {
 	RSFilter parent;
 
-	lfDatabase *ldb;
-
 	gchar *make;
 	gchar *model;
 	RSLens *lens;
@@ -116,9 +114,6 @@ finalize(GObject *object)
 	}
 	lensfun->settings_signal_id = 0;
 	lensfun->settings = NULL;
-	if (lensfun->ldb)
-		lf_db_destroy(lensfun->ldb);
-	lensfun->ldb = NULL;
 	g_free(lensfun->model);
 	g_free(lensfun->make);
 	if (lensfun->lens)
@@ -211,9 +206,7 @@ rs_lensfun_init(RSLensfun *lensfun)
 	lensfun->settings_signal_id = 0;
 	lensfun->settings = NULL;
 
-	/* Initialize Lensfun database */
-	lensfun->ldb = lf_db_new ();
-	lf_db_load (lensfun->ldb);
+	/* The Lensfun database is shared, see lensfun_get_db() */
 }
 
 static void
@@ -349,13 +342,48 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 	}
 }
 
+/* Modifiers kept around for reuse */
+#define MODIFIER_CACHE_SIZE 4
+/* Memory for distortion/TCA coordinate maps of all modifiers, cached or in use */
+#define MODIFIER_CACHE_MAX_BYTES (128*1024*1024)
+
+/* Everything that goes into lf_modifier_new() and lf_modifier_initialize() */
+typedef struct {
+	gchar *camera;
+	gchar *lens_maker;
+	gchar *lens_model;
+	gfloat crop;
+	gfloat focal;
+	gfloat aperture;
+	gfloat tca_kr;
+	gfloat tca_kb;
+	gfloat vignetting;
+	gboolean defish;
+	gint width;
+	gint height;
+} ModifierKey;
+
+typedef struct {
+	ModifierKey key;
+	lfModifier *mod;
+	gint effective_flags;
+	gfloat *map;		/* Subpixel coordinates for every pixel (6 floats) or NULL */
+	gboolean *map_rows;	/* Rows of map already computed */
+	gsize map_bytes;	/* Reserved for map and map_rows */
+	gboolean in_use;	/* Only one get_image() can use an entry at a time */
+} ModifierCacheEntry;
+
+static GMutex modifier_cache_lock;
+static GQueue modifier_cache = G_QUEUE_INIT; /* Most recently used first */
+static gsize modifier_cache_bytes = 0; /* Reserved by all maps */
+
 typedef struct {
 	gint start_y;
 	gint end_y;
 	lfModifier *mod;
+	ModifierCacheEntry *entry;
 	RS_IMAGE16 *input;
 	RS_IMAGE16 *output;
-	GThread *threadid;
 	gint effective_flags;
 	GdkRectangle *roi;
 	gint stage;
@@ -396,9 +424,25 @@ thread_func(gpointer _thread_info)
 		for(y = t->start_y; y < t->end_y; y++)
 		{
 			gushort *target;
-			lf_modifier_apply_subpixel_geometry_distortion(t->mod, t->roi->x, (gfloat) y, t->roi->width, 1, pos);
+			gfloat* l_pos;
+
+			if (t->entry && t->entry->map)
+			{
+				/* Rows are owned by one thread, so no locking is needed */
+				gfloat *map_row = t->entry->map + (gsize) y * t->input->w * 6;
+				if (!t->entry->map_rows[y])
+				{
+					lf_modifier_apply_subpixel_geometry_distortion(t->mod, 0.0, (gfloat) y, t->input->w, 1, map_row);
+					t->entry->map_rows[y] = TRUE;
+				}
+				l_pos = map_row + t->roi->x * 6;
+			}
+			else
+			{
+				lf_modifier_apply_subpixel_geometry_distortion(t->mod, t->roi->x, (gfloat) y, t->roi->width, 1, pos);
+				l_pos = pos;
+			}
 			target = GET_PIXEL(t->output, t->roi->x, y);
-			gfloat* l_pos = pos;
 
 			if (avx_available)
 			{
@@ -443,6 +487,195 @@ thread_func(gpointer _thread_info)
 }
 
 
+/**
+ * Get the process wide Lensfun database, it will be loaded on first use
+ */
+static gpointer
+lensfun_db_load(gpointer data)
+{
+	lfDatabase *ldb = lf_db_new();
+
+	if (ldb && lf_db_load(ldb) != LF_NO_ERROR)
+		g_warning("Lensfun: Failed to load database");
+
+	return ldb;
+}
+
+static lfDatabase *
+lensfun_get_db(void)
+{
+	static GOnce once = G_ONCE_INIT;
+
+	g_once(&once, lensfun_db_load, NULL);
+
+	return once.retval;
+}
+
+static gboolean
+modifier_key_equal(const ModifierKey *a, const ModifierKey *b)
+{
+	return (a->crop == b->crop)
+		&& (a->focal == b->focal)
+		&& (a->aperture == b->aperture)
+		&& (a->tca_kr == b->tca_kr)
+		&& (a->tca_kb == b->tca_kb)
+		&& (a->vignetting == b->vignetting)
+		&& (a->defish == b->defish)
+		&& (a->width == b->width)
+		&& (a->height == b->height)
+		&& (g_strcmp0(a->camera, b->camera) == 0)
+		&& (g_strcmp0(a->lens_maker, b->lens_maker) == 0)
+		&& (g_strcmp0(a->lens_model, b->lens_model) == 0);
+}
+
+static void
+modifier_cache_entry_free(ModifierCacheEntry *entry)
+{
+	g_free(entry->key.camera);
+	g_free(entry->key.lens_maker);
+	g_free(entry->key.lens_model);
+	if (entry->mod)
+		lf_modifier_destroy(entry->mod);
+	g_free(entry->map);
+	g_free(entry->map_rows);
+	g_free(entry);
+}
+
+/**
+ * Evict least recently used entries not in use until the cache holds at most
+ * max_entries and leaves room for extra_bytes. Must be called with
+ * modifier_cache_lock held
+ * @return TRUE if extra_bytes fit in the budget
+ */
+static gboolean
+modifier_cache_trim(guint max_entries, gsize extra_bytes)
+{
+	GList *node = modifier_cache.tail;
+
+	while (node && (g_queue_get_length(&modifier_cache) > max_entries
+		|| modifier_cache_bytes + extra_bytes > MODIFIER_CACHE_MAX_BYTES))
+	{
+		GList *prev = node->prev;
+		ModifierCacheEntry *old = node->data;
+		if (!old->in_use)
+		{
+			modifier_cache_bytes -= old->map_bytes;
+			g_queue_delete_link(&modifier_cache, node);
+			modifier_cache_entry_free(old);
+		}
+		node = prev;
+	}
+
+	return modifier_cache_bytes + extra_bytes <= MODIFIER_CACHE_MAX_BYTES;
+}
+
+/**
+ * Allocate a coordinate map for an entry not yet in the cache, if it fits in
+ * the budget. Entries in use are never evicted, so this may leave entry
+ * without a map
+ */
+static void
+modifier_cache_alloc_map(ModifierCacheEntry *entry, gint width, gint height)
+{
+	gsize bytes = (gsize) width * height * 6 * sizeof(gfloat) + height * sizeof(gboolean);
+	gboolean fits;
+
+	/* Don't empty the cache for a map that can never fit */
+	if (bytes > MODIFIER_CACHE_MAX_BYTES)
+		return;
+
+	g_mutex_lock(&modifier_cache_lock);
+	fits = modifier_cache_trim(MODIFIER_CACHE_SIZE, bytes);
+	if (fits)
+		modifier_cache_bytes += bytes;
+	g_mutex_unlock(&modifier_cache_lock);
+
+	if (!fits)
+	{
+		RS_DEBUG(PERFORMANCE, "Lensfun: No room for a %" G_GSIZE_FORMAT " byte coordinate map", bytes);
+		return;
+	}
+
+	entry->map = g_try_new(gfloat, (gsize) width * height * 6);
+	if (entry->map)
+	{
+		entry->map_rows = g_new0(gboolean, height);
+		entry->map_bytes = bytes;
+	}
+	else
+	{
+		g_mutex_lock(&modifier_cache_lock);
+		modifier_cache_bytes -= bytes;
+		g_mutex_unlock(&modifier_cache_lock);
+	}
+}
+
+/**
+ * Find an unused modifier matching key, the returned entry must be given
+ * back with modifier_cache_release()
+ * @return A cache entry or NULL
+ */
+static ModifierCacheEntry *
+modifier_cache_acquire(const ModifierKey *key)
+{
+	ModifierCacheEntry *found = NULL;
+	GList *node;
+
+	g_mutex_lock(&modifier_cache_lock);
+	for (node = modifier_cache.head; node; node = node->next)
+	{
+		ModifierCacheEntry *entry = node->data;
+		if (!entry->in_use && modifier_key_equal(&entry->key, key))
+		{
+			found = entry;
+			found->in_use = TRUE;
+			g_queue_unlink(&modifier_cache, node);
+			g_queue_push_head_link(&modifier_cache, node);
+			break;
+		}
+	}
+	g_mutex_unlock(&modifier_cache_lock);
+
+	return found;
+}
+
+/**
+ * Add a new entry to the cache, the entry will be marked as in use
+ */
+static void
+modifier_cache_insert(ModifierCacheEntry *entry)
+{
+	entry->in_use = TRUE;
+
+	g_mutex_lock(&modifier_cache_lock);
+	g_queue_push_head(&modifier_cache, entry);
+	modifier_cache_trim(MODIFIER_CACHE_SIZE, 0);
+	g_mutex_unlock(&modifier_cache_lock);
+}
+
+/**
+ * Give back an entry, entries skipped by eviction while in use are evicted
+ * now if the cache is over its limits
+ */
+static void
+modifier_cache_release(ModifierCacheEntry *entry)
+{
+	g_mutex_lock(&modifier_cache_lock);
+	entry->in_use = FALSE;
+	modifier_cache_trim(MODIFIER_CACHE_SIZE, 0);
+	g_mutex_unlock(&modifier_cache_lock);
+}
+
+/* Expand ROI by 25% in each direction for vignetting correction */
+static void
+expand_roi(const GdkRectangle *roi, gint width, gint height, GdkRectangle *expanded)
+{
+	expanded->x = MAX(0, roi->x - ((roi->width+4) / 4));
+	expanded->y = MAX(0, roi->y - ((roi->height+4) / 4));
+	expanded->width = MIN(width - expanded->x, roi->width + ((roi->width + 2) / 2));
+	expanded->height = MIN(height - expanded->y, roi->height + ((roi->height + 2) / 2));
+}
+
 static RSFilterResponse *
 get_image(RSFilter *filter, const RSFilterRequest *request)
 {
@@ -455,8 +688,23 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	const gchar *model = NULL;
 	GdkRectangle *roi, *vign_roi;
 
-
-	previous_response = rs_filter_get_image(filter->previous, request);
+	roi = rs_filter_request_get_roi(request);
+	if (roi && !rs_filter_request_get_quick(request))
+	{
+		/* Distortion correction can read from anywhere in the image, TCA and
+		 * vignetting only needs the border we vignette-correct below */
+		gboolean distort = lensfun->lens && (rs_lens_get_lensfun_enabled(lensfun->lens) || rs_lens_get_lensfun_defish(lensfun->lens));
+		gint previous_width, previous_height;
+		GdkRectangle previous_roi;
+		RSFilterRequest *new_request = rs_filter_request_clone(request);
+		rs_filter_get_size_simple(filter->previous, request, &previous_width, &previous_height);
+		expand_roi(roi, previous_width, previous_height, &previous_roi);
+		rs_filter_request_set_roi(new_request, distort ? NULL : &previous_roi);
+		previous_response = rs_filter_get_image(filter->previous, new_request);
+		g_object_unref(new_request);
+	}
+	else
+		previous_response = rs_filter_get_image(filter->previous, request);
 	input = rs_filter_response_get_image(previous_response);
 	response = rs_filter_response_clone(previous_response);
 	g_object_unref(previous_response);
@@ -476,8 +724,9 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		return response;
 
 	gint i;
+	lfDatabase *ldb = lensfun_get_db();
 
-	if (!lensfun->ldb)
+	if (!ldb)
 	{
 		g_warning ("Failed to create database");
 		rs_filter_response_set_image(response, input);
@@ -496,7 +745,7 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		lensfun->selected_lens = NULL;
 
 		if (lensfun->make && lensfun->model)
-			cameras = lf_db_find_cameras(lensfun->ldb, lensfun->make, lensfun->model);
+			cameras = lf_db_find_cameras(ldb, lensfun->make, lensfun->model);
 
 		if (cameras)
 		{
@@ -508,7 +757,7 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 			{
 				model = rs_lens_get_lensfun_model(lensfun->lens);
 				make = rs_lens_get_lensfun_make(lensfun->lens);
-				lenses = lf_db_find_lenses_hd(lensfun->ldb, lensfun->selected_camera, make, model, 0);
+				lenses = lf_db_find_lenses_hd(ldb, lensfun->selected_camera, make, model, 0);
 				if (lenses)
 				{
 					lensfun->selected_lens = lf_lens_new();
@@ -521,7 +770,7 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		{
 			g_debug("Lensfun: Camera not found. Using camera from same manufacturer.");
 			/* Try same manufacturer to be able to use CA-correction and vignetting */
-			cameras = lf_db_find_cameras(lensfun->ldb, lensfun->make, NULL);
+			cameras = lf_db_find_cameras(ldb, lensfun->make, NULL);
 			if (cameras)
 			{
 				lensfun->selected_camera = cameras [0];
@@ -567,73 +816,107 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		destroy_roi = TRUE;
 	}
 	
-	/* Expand ROI by 25% in each direction for vignetting correction */
 	vign_roi =  g_new(GdkRectangle, 1);
-	vign_roi->x = MAX(0, roi->x - ((roi->width+4) / 4));
-	vign_roi->y = MAX(0, roi->y - ((roi->height+4) / 4));
-	vign_roi->width = MIN(input->w - vign_roi->x, roi->width + ((roi->width + 2) / 2));
-	vign_roi->height = MIN(input->h - vign_roi->y, roi->height + ((roi->height + 2) / 2));
+	expand_roi(roi, input->w, input->h, vign_roi);
 
 	/* Proceed if we got everything */
 	if (lensfun->selected_lens && lf_lens_check((lfLens *) lensfun->selected_lens))
 	{
 		gint effective_flags;
-		/* Set TCA */
-		if (ABS(lensfun->tca_kr) > 0.01f || ABS(lensfun->tca_kb) > 0.01f) 
+		ModifierKey key;
+		ModifierCacheEntry *entry;
+		lfModifier *mod;
+
+		key.camera = lensfun->selected_camera->Model;
+		key.lens_maker = lensfun->selected_lens->Maker;
+		key.lens_model = lensfun->selected_lens->Model;
+		key.crop = lensfun->selected_camera->CropFactor;
+		key.focal = lensfun->focal;
+		key.aperture = lensfun->aperture;
+		key.tca_kr = lensfun->tca_kr;
+		key.tca_kb = lensfun->tca_kb;
+		key.vignetting = lensfun->vignetting;
+		key.defish = lensfun->defish;
+		key.width = input->w;
+		key.height = input->h;
+
+		entry = modifier_cache_acquire(&key);
+		if (!entry)
 		{
-			lfLensCalibTCA tca;
-			tca.Model = LF_TCA_MODEL_LINEAR;
-			if (rs_lf_version < 0x00020500)
+			/* Set TCA */
+			if (ABS(lensfun->tca_kr) > 0.01f || ABS(lensfun->tca_kb) > 0.01f) 
 			{
-			    /* Lensfun < 0.2.5.0 */
-			    tca.Terms[0] = (lensfun->tca_kr/100)+1;
-			    tca.Terms[1] = (lensfun->tca_kb/100)+1;
+				lfLensCalibTCA tca;
+				tca.Model = LF_TCA_MODEL_LINEAR;
+				if (rs_lf_version < 0x00020500)
+				{
+				    /* Lensfun < 0.2.5.0 */
+				    tca.Terms[0] = (lensfun->tca_kr/100)+1;
+				    tca.Terms[1] = (lensfun->tca_kb/100)+1;
+				}
+				else
+				{
+				    /* Lensfun >= 0.2.5.0 */
+				    tca.Terms[0] = 1.0f/(((lensfun->tca_kr/100))+1);
+				    tca.Terms[1] = 1.0f/(((lensfun->tca_kb/100))+1);
+				}
+				lf_lens_add_calib_tca((lfLens *) lensfun->selected_lens, (lfLensCalibTCA *) &tca);
+			} else
+			{
+				lf_lens_remove_calib_tca(lensfun->selected_lens, 0);
+				lf_lens_remove_calib_tca(lensfun->selected_lens, 1);
 			}
-			else
+
+			/* Set vignetting */
+			if (ABS(lensfun->vignetting) > 0.01f)
+			{
+				lfLensCalibVignetting vignetting;
+				vignetting.Model = LF_VIGNETTING_MODEL_PA;
+				vignetting.Distance = 1.0;
+				vignetting.Focal = lensfun->focal;
+				vignetting.Aperture = lensfun->aperture;
+				gfloat vign = -lensfun->vignetting * 1.5;
+				if (vign > 0.0f)
+					vign *= 4.0f;
+				vignetting.Terms[0] = vign * 0.5;
+				vignetting.Terms[1] = vign * 0.03;
+				vignetting.Terms[2] = vign * 0.005;
+				lf_lens_add_calib_vignetting((lfLens *) lensfun->selected_lens, &vignetting);
+			} else
 			{
-			    /* Lensfun >= 0.2.5.0 */
-			    tca.Terms[0] = 1.0f/(((lensfun->tca_kr/100))+1);
-			    tca.Terms[1] = 1.0f/(((lensfun->tca_kb/100))+1);
+				lf_lens_remove_calib_vignetting(lensfun->selected_lens, 0);
+				lf_lens_remove_calib_vignetting(lensfun->selected_lens, 1);
+				lf_lens_remove_calib_vignetting(lensfun->selected_lens, 2);
 			}
-			lf_lens_add_calib_tca((lfLens *) lensfun->selected_lens, (lfLensCalibTCA *) &tca);
-		} else
-		{
-			lf_lens_remove_calib_tca(lensfun->selected_lens, 0);
-			lf_lens_remove_calib_tca(lensfun->selected_lens, 1);
-		}
 
-		/* Set vignetting */
-		if (ABS(lensfun->vignetting) > 0.01f)
-		{
-			lfLensCalibVignetting vignetting;
-			vignetting.Model = LF_VIGNETTING_MODEL_PA;
-			vignetting.Distance = 1.0;
-			vignetting.Focal = lensfun->focal;
-			vignetting.Aperture = lensfun->aperture;
-			gfloat vign = -lensfun->vignetting * 1.5;
-			if (vign > 0.0f)
-				vign *= 4.0f;
-			vignetting.Terms[0] = vign * 0.5;
-			vignetting.Terms[1] = vign * 0.03;
-			vignetting.Terms[2] = vign * 0.005;
-			lf_lens_add_calib_vignetting((lfLens *) lensfun->selected_lens, &vignetting);
-		} else
-		{
-			lf_lens_remove_calib_vignetting(lensfun->selected_lens, 0);
-			lf_lens_remove_calib_vignetting(lensfun->selected_lens, 1);
-			lf_lens_remove_calib_vignetting(lensfun->selected_lens, 2);
+			entry = g_new0(ModifierCacheEntry, 1);
+			entry->key = key;
+			entry->key.camera = g_strdup(key.camera);
+			entry->key.lens_maker = g_strdup(key.lens_maker);
+			entry->key.lens_model = g_strdup(key.lens_model);
+
+			entry->mod = lf_modifier_new (lensfun->selected_lens, lensfun->selected_camera->CropFactor, input->w, input->h);
+			entry->effective_flags = lf_modifier_initialize (entry->mod, lensfun->selected_lens,
+				LF_PF_U16, /* lfPixelFormat */
+				lensfun->focal, /* focal */
+				lensfun->aperture, /* aperture */
+				1.0, /* distance */
+				0.0, /* scale */
+				lensfun->defish ? LF_RECTILINEAR : LF_UNKNOWN, /* lfLensType targeom, */
+				LF_MODIFY_ALL, /* flags */ /* FIXME: ? */
+				FALSE); /* reverse */
+
+			/* Coordinates are filled in by thread_func() as rows are needed */
+			if (entry->effective_flags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY))
+				modifier_cache_alloc_map(entry, input->w, input->h);
+
+			modifier_cache_insert(entry);
 		}
+		else
+			RS_DEBUG(PERFORMANCE, "Lensfun: Reusing modifier");
 
-		lfModifier *mod = lf_modifier_new (lensfun->selected_lens, lensfun->selected_camera->CropFactor, input->w, input->h);
-		effective_flags = lf_modifier_initialize (mod, lensfun->selected_lens,
-			LF_PF_U16, /* lfPixelFormat */
-			lensfun->focal, /* focal */
-			lensfun->aperture, /* aperture */
-			1.0, /* distance */
-			0.0, /* scale */
-			lensfun->defish ? LF_RECTILINEAR : LF_UNKNOWN, /* lfLensType targeom, */
-			LF_MODIFY_ALL, /* flags */ /* FIXME: ? */
-			FALSE); /* reverse */
+		mod = entry->mod;
+		effective_flags = entry->effective_flags;
 #if 0
 		/* Print flags used */
 		g_debug("defish:%d", (int)lensfun->defish);
@@ -657,13 +940,14 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 			
 		if (effective_flags > 0)
 		{
-			const guint threads = rs_get_number_of_processor_cores();
+			const guint threads = rs_task_pool_get_n_workers();
 			ThreadInfo *t = g_new(ThreadInfo, threads);
 
 			/* Set up job description for individual threads */
 			for (i = 0; i < threads; i++)
 			{
 				t[i].mod = mod;
+				t[i].entry = entry;
 				t[i].effective_flags = effective_flags;
 			}
 
@@ -686,12 +970,10 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 					y_offset += y_per_thread;
 					y_offset = MIN(vign_roi->y + vign_roi->height, y_offset);
 					t[i].end_y = y_offset;
-					t[i].threadid = g_thread_new("RSLensfun worker (phase 2)", thread_func, &t[i]);
 				}
 				
-				/* Wait for threads to finish */
-				for(i = 0; i < threads; i++)
-					g_thread_join(t[i].threadid);
+				/* Run on the shared pool and wait for all bands to finish */
+				rs_task_pool_run(thread_func, t, sizeof(ThreadInfo), threads);
 
 				input = output;
 			}
@@ -715,12 +997,10 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 					y_offset = MIN(roi->y + roi->height, y_offset);
 					t[i].end_y = y_offset;
 					t[i].stage = 3;
-					t[i].threadid = g_thread_new("RSLensfun worker (phase 1+3)", thread_func, &t[i]);
 				}
 				
-				/* Wait for threads to finish */
-				for(i = 0; i < threads; i++)
-					g_thread_join(t[i].threadid);
+				/* Run on the shared pool and wait for all bands to finish */
+				rs_task_pool_run(thread_func, t, sizeof(ThreadInfo), threads);
 			}
 			else
 			{
@@ -733,7 +1013,7 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		else
 			rs_filter_response_set_image(response, input);
 
-		lf_modifier_destroy(mod);
+		modifier_cache_release(entry);
 	}
 	else
 	{
@@ -17,6 +17,10 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 #include <rawstudio.h>
+#ifndef G_OS_WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 #include "StdAfx.h"
 #include "FileReader.h"
 #include "RawParser.h"
@@ -28,6 +32,50 @@
 
 using namespace RawSpeed;
 
+/* RawSpeed may read a few bytes beyond the end of the file data */
+#define MAP_MARGIN 64
+
+/* Single channel images decoded and how many of them had to be copied */
+static gint raw_images_decoded = 0;
+static gint raw_images_copied = 0;
+
+/* Release a RawImage adopted by a RS_IMAGE16 */
+static void
+release_raw_image(gpointer data)
+{
+	delete (RawImage *) data;
+}
+
+/* Map the file instead of reading it, this is only safe if the last page has
+ * room for RawSpeed to read beyond the end of the file */
+static GMappedFile *
+map_file(const gchar *filename)
+{
+#ifdef G_OS_WIN32
+	return NULL;
+#else
+	GMappedFile *mapped = g_mapped_file_new(filename, TRUE, NULL);
+	if (!mapped)
+		return NULL;
+
+	gsize length = g_mapped_file_get_length(mapped);
+	gsize pagesize = sysconf(_SC_PAGESIZE);
+	gsize slack = pagesize - (length % pagesize);
+
+	if (length == 0 || length > G_MAXUINT32 || slack == pagesize || slack < MAP_MARGIN)
+	{
+		g_mapped_file_unref(mapped);
+		return NULL;
+	}
+
+	/* Let the kernel read ahead while we decode */
+	posix_madvise(g_mapped_file_get_contents(mapped), length, POSIX_MADV_SEQUENTIAL);
+	posix_madvise(g_mapped_file_get_contents(mapped), length, POSIX_MADV_WILLNEED);
+
+	return mapped;
+#endif
+}
+
 extern "C" {
 
 RSFilterResponse*
@@ -60,6 +108,7 @@ load_rawspeed(const gchar *filename)
 	FileReader f((LPCWSTR) filename);
 	RawDecoder *d = 0;
 	FileMap* m = 0;
+	GMappedFile *mapped = NULL;
 
 #ifdef TIME_LOAD
 		GTimer *gt = g_timer_new();
@@ -68,19 +117,27 @@ load_rawspeed(const gchar *filename)
 
 	try
 	{
-		rs_io_lock();
-		m = f.readFile();
+		rs_io_lock_file(filename);
+		mapped = map_file(filename);
+		if (mapped)
+			m = new FileMap((uchar8 *) g_mapped_file_get_contents(mapped), g_mapped_file_get_length(mapped));
+		else
+			m = f.readFile();
 		rs_io_unlock();
 	}
 	catch (FileIOException &e)
 	{
 		rs_io_unlock();
+		if (mapped)
+			g_mapped_file_unref(mapped);
 		printf("RawSpeed: File IO Exception: %s\n", e.what());
 		return rs_filter_response_new();
 	}
 	catch (...)
 	{
 		rs_io_unlock();
+		if (mapped)
+			g_mapped_file_unref(mapped);
 		printf("RawSpeed: Exception when reading file\n");
 		return rs_filter_response_new();
 	}
@@ -99,6 +156,7 @@ load_rawspeed(const gchar *filename)
 			d = t.getDecoder();
 			gint col, row;
 			gint cpp;
+			gboolean adopted = FALSE;
 
 #ifdef TIME_LOAD
 			gt = g_timer_new();
@@ -113,6 +171,9 @@ load_rawspeed(const gchar *filename)
 			RawImage r = d->mRaw;
 			delete d; d = NULL;
 			delete m; m = NULL;
+			if (mapped)
+				g_mapped_file_unref(mapped);
+			mapped = NULL;
 
       r->scaleBlackWhite();
 
@@ -121,11 +182,8 @@ load_rawspeed(const gchar *filename)
       g_timer_destroy(gt);
 #endif
 			cpp = r->getCpp();
-			if (cpp == 1) 
-				image = rs_image16_new(r->dim.x, r->dim.y, cpp, cpp);
-			else if (cpp == 3) 
-				image = rs_image16_new(r->dim.x, r->dim.y, 3, 4);
-			else {
+			if (cpp != 1 && cpp != 3)
+			{
 				g_warning("RawSpeed: Unsupported component per pixel count\n");
 				return rs_filter_response_new();
 			}
@@ -136,11 +194,47 @@ load_rawspeed(const gchar *filename)
 				return rs_filter_response_new();
 			}
 
+			/* Single channel images can use the RawSpeed buffer as is, the
+			 * RawImage reference is released with the image */
+			if (cpp == 1)
+			{
+				RawImage *keep = new RawImage(r);
+				image = rs_image16_new_from_buffer(r->dim.x, r->dim.y, 1, 1,
+					(gushort *) r->getData(0,0), r->pitch/2, release_raw_image, keep);
+				if (image)
+					adopted = TRUE;
+				else
+					delete keep;
+			}
+
+			if (cpp == 1)
+			{
+				gint decoded = g_atomic_int_add(&raw_images_decoded, 1) + 1;
+				gint copied = g_atomic_int_get(&raw_images_copied);
+				if (!adopted)
+					copied = g_atomic_int_add(&raw_images_copied, 1) + 1;
+				RS_DEBUG(PERFORMANCE, "RawSpeed: %s decoded buffer (pitch %d bytes), %d of %d images copied",
+					adopted ? "Using" : "Copying", r->pitch, copied, decoded);
+			}
+
+			if (adopted)
+			{
+				/* Nothing to allocate */
+			}
+			else if (cpp == 1)
+				image = rs_image16_new(r->dim.x, r->dim.y, cpp, cpp);
+			else
+				image = rs_image16_new(r->dim.x, r->dim.y, 3, 4);
+
 			if (r->isCFA)
 				image->filters = r->cfa.getDcrawFilter();
 
 
-      if (cpp == 1) 
+      if (adopted)
+      {
+        /* Nothing to copy */
+      }
+      else if (cpp == 1) 
       {
         BitBlt((uchar8 *)(GET_PIXEL(image,0,0)),image->pitch*2,
           r->getData(0,0), r->pitch, r->getBpp()*r->dim.x, r->dim.y);
@@ -176,6 +270,7 @@ load_rawspeed(const gchar *filename)
 
 	if (d) delete d;
 	if (m) delete m;
+	if (mapped) g_mapped_file_unref(mapped);
 
 	RSFilterResponse* response = rs_filter_response_new();
 	if (image)
@@ -119,7 +119,7 @@ mrw_load_meta(const gchar *service, RAWFILE *rawfile, guint offset, RSMetadata *
 	GdkPixbuf *pixbuf=NULL, *pixbuf2=NULL;
 	guint start=0, length=0;
 
-	rs_io_lock();
+	rs_io_lock_rawfile(rawfile);
 	raw_mrw_walker(rawfile, offset, meta);
 	rs_io_unlock();
 
@@ -140,7 +140,7 @@ mrw_load_meta(const gchar *service, RAWFILE *rawfile, guint offset, RSMetadata *
 		gdouble ratio;
 		GdkPixbufLoader *pl;
 
-		pixbuf = raw_get_pixbuf(rawfile, start, length);
+		pixbuf = raw_get_pixbuf_scaled(rawfile, start, length, 128);
 
 		/* Some Minolta's replace byte 0 with something else than 0xff */
 		if (!pixbuf)
@@ -149,7 +149,7 @@ mrw_load_meta(const gchar *service, RAWFILE *rawfile, guint offset, RSMetadata *
 
 			thumbbuffer = g_malloc(length);
 			thumbbuffer[0] = '\xff';
-			rs_io_lock();
+			rs_io_lock_rawfile(rawfile);
 			raw_strcpy(rawfile, start+1, thumbbuffer+1, length-1);
 			rs_io_unlock();
 			pl = gdk_pixbuf_loader_new();
@@ -94,8 +94,8 @@ rs_raf_load_thumb(RAWFILE *rawfile)
 	{
 		raw_get_uint(rawfile, 84, &start);
 		raw_get_uint(rawfile, 88, &length);
-		rs_io_lock();
-		pixbuf = raw_get_pixbuf(rawfile, start, length);
+		rs_io_lock_rawfile(rawfile);
+		pixbuf = raw_get_pixbuf_scaled(rawfile, start, length, 128);
 		rs_io_unlock();
 	}
 
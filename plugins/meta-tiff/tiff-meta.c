@@ -35,6 +35,9 @@
  * 8h seems to be reasonable, even for astronomists with extra battery packs */
 #define EXPO_TIME_MAXVAL (8*60.0*60.0)
 
+/* Bounding box of thumbnails in pixels */
+#define THUMBNAIL_SIZE 128
+
 typedef struct {
 	RSMetadata meta;
 	gint sony_offset;
@@ -81,6 +84,7 @@ static void sony_decrypt(SonyMeta *sony, guint *data, gint len);
 static gboolean private_sony(RAWFILE *rawfile, guint offset, RSMetadata *meta);
 static gboolean exif_reader(RAWFILE *rawfile, guint offset, RSMetadata *meta);
 static gboolean ifd_reader(RAWFILE *rawfile, guint offset, RSMetadata *meta);
+static gboolean thumbnail_prefer_preview(RAWFILE *rawfile, RSMetadata *meta);
 static gboolean thumbnail_reader(const gchar *service, RAWFILE *rawfile, guint offset, guint length, RSMetadata *meta);
 static gboolean thumbnail_store(GdkPixbuf *pixbuf, RSMetadata *meta);
 static GdkPixbuf* raw_thumbnail_reader(const gchar *service, RSMetadata *meta);
@@ -1831,7 +1835,7 @@ tiff_load_meta(const gchar *service, RAWFILE *rawfile, guint offset, RSMetadata
 	gushort ifd_num = 0;
 	guchar version;
 
-	rs_io_lock();
+	rs_io_lock_rawfile(rawfile);
 
 	version = raw_init_file_tiff(rawfile, offset);
 
@@ -1888,18 +1892,70 @@ tif_load_meta(const gchar *service, RAWFILE *rawfile, guint offset, RSMetadata *
 	if ((meta->make == MAKE_PHASEONE) || (meta->make == MAKE_SAMSUNG))
 		meta->preview_planar_config = 1;
 
-	/* Load thumbnail - try thumbnail first - then preview image - then decode the RAW image*/
-	if (!thumbnail_reader(service, rawfile, meta->thumbnail_start, meta->thumbnail_length, meta))
+	/* Load thumbnail - try the smallest embedded image covering the thumbnail size
+	 * first - then the other one - then decode the RAW image*/
+	if (thumbnail_prefer_preview(rawfile, meta))
+	{
+		if (!thumbnail_reader(service, rawfile, meta->preview_start, meta->preview_length, meta))
+			if (!thumbnail_reader(service, rawfile, meta->thumbnail_start, meta->thumbnail_length, meta))
+				thumbnail_store(raw_thumbnail_reader(service, meta), meta);
+	}
+	else if (!thumbnail_reader(service, rawfile, meta->thumbnail_start, meta->thumbnail_length, meta))
 		if (!thumbnail_reader(service, rawfile, meta->preview_start, meta->preview_length, meta))
 			thumbnail_store(raw_thumbnail_reader(service, meta), meta);
 
 	return TRUE;
 }
 
+/**
+ * Get the longest edge of an embedded JPEG image
+ * @return The longest edge in pixels or 0 if unknown
+ */
+static gint
+embedded_jpeg_size(RAWFILE *rawfile, guint offset, guint length)
+{
+	gint width, height;
+
+	if ((offset>0) && (length>0) && raw_get_jpeg_size(rawfile, offset, length, &width, &height))
+		return MAX(width, height);
+
+	return 0;
+}
+
+/**
+ * Decide if the preview image is a better thumbnail source than the thumbnail
+ * image. Both are found while walking the IFD chain, the smallest one that
+ * still covers THUMBNAIL_SIZE is preferred
+ */
+static gboolean
+thumbnail_prefer_preview(RAWFILE *rawfile, RSMetadata *meta)
+{
+	gint thumbnail_size, preview_size;
+
+	rs_io_lock_rawfile(rawfile);
+	thumbnail_size = embedded_jpeg_size(rawfile, meta->thumbnail_start, meta->thumbnail_length);
+	preview_size = embedded_jpeg_size(rawfile, meta->preview_start, meta->preview_length);
+	rs_io_unlock();
+
+	/* Don't know, keep the old order */
+	if (thumbnail_size == 0 || preview_size == 0)
+		return FALSE;
+
+	/* Thumbnail too small to be used without upscaling */
+	if (thumbnail_size < THUMBNAIL_SIZE && preview_size > thumbnail_size)
+		return TRUE;
+
+	/* Both covers the size, use the cheapest */
+	if (preview_size >= THUMBNAIL_SIZE && preview_size < thumbnail_size)
+		return TRUE;
+
+	return FALSE;
+}
+
 static gboolean
 thumbnail_reader(const gchar *service, RAWFILE *rawfile, guint offset, guint length, RSMetadata *meta)
 {
-	rs_io_lock();
+	rs_io_lock_rawfile(rawfile);
 	GdkPixbuf *pixbuf=NULL;
 	if ((offset>0) && (length>0) && (length<5000000))
 	{
@@ -1932,8 +1988,8 @@ thumbnail_reader(const gchar *service, RAWFILE *rawfile, guint offset, guint len
 					meta->preview_width, meta->preview_height,
 					meta->preview_width * 3, NULL, NULL);
 			else
-				/* Try to guess file format based on contents (JPEG previews) */
-			pixbuf = raw_get_pixbuf(rawfile, offset, length);
+				/* Try to guess file format based on contents (JPEG previews are scaled while decoding) */
+			pixbuf = raw_get_pixbuf_scaled(rawfile, offset, length, THUMBNAIL_SIZE);
 	}
 	rs_io_unlock();
 
@@ -1959,12 +2015,12 @@ thumbnail_store(GdkPixbuf *pixbuf, RSMetadata *meta)
 			pixbuf = pixbuf2;
 		}
 
-		/* Scale to a bounding box of 128x128 pixels */
+		/* Scale to a bounding box of THUMBNAIL_SIZE x THUMBNAIL_SIZE pixels */
 		ratio = ((gdouble) gdk_pixbuf_get_width(pixbuf))/((gdouble) gdk_pixbuf_get_height(pixbuf));
 		if (ratio>1.0)
-			pixbuf2 = gdk_pixbuf_scale_simple(pixbuf, 128, (gint) (128.0/ratio), GDK_INTERP_BILINEAR);
+			pixbuf2 = gdk_pixbuf_scale_simple(pixbuf, THUMBNAIL_SIZE, (gint) (((gdouble) THUMBNAIL_SIZE)/ratio), GDK_INTERP_BILINEAR);
 		else
-			pixbuf2 = gdk_pixbuf_scale_simple(pixbuf, (gint) (128.0*ratio), 128, GDK_INTERP_BILINEAR);
+			pixbuf2 = gdk_pixbuf_scale_simple(pixbuf, (gint) (((gdouble) THUMBNAIL_SIZE)*ratio), THUMBNAIL_SIZE, GDK_INTERP_BILINEAR);
 		g_object_unref(pixbuf);
 		pixbuf = pixbuf2;
 
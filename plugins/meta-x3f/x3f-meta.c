@@ -126,7 +126,7 @@ x3f_load_meta(const gchar *service, RAWFILE *rawfile, guint offset, RSMetadata *
 		return FALSE;
 	}
 
-	rs_io_lock();
+	rs_io_lock_rawfile(rawfile);
 
 	raw_set_byteorder(rawfile, 0x4949); /* x3f is always little endian */
 
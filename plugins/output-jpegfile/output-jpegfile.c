@@ -25,6 +25,7 @@
 #endif
 #include <jpeglib.h>
 #include <gettext.h>
+#include <string.h> /* memchr() */
 
 /* stat() */
 #include <sys/types.h>
@@ -217,39 +218,91 @@ rs_jpeg_write_icc_profile(j_compress_ptr cinfo, const JOCTET *icc_data_ptr, guin
 	return;
 }
 
-static gboolean
-execute(RSOutput *output, RSFilter *filter)
-{
-	RSJpegfile *jpegfile = RS_JPEGFILE(output);
+/* Images smaller than this are not worth splitting into bands */
+#define PARALLEL_MIN_PIXELS (2*1024*1024)
+#define MEM_DEST_BUFFER_SIZE (64*1024)
+
+#define MARKER_SOI 0xd8
+#define MARKER_SOF0 0xc0
+#define MARKER_SOS 0xda
+
+typedef struct {
+	RSJpegfile *jpegfile;
 	struct jpeg_compress_struct cinfo;
-	struct jpeg_error_mgr jerr;
-	FILE * outfile;
-	JSAMPROW row_pointer[1];
-	gint x,y;
-	
-	
-	RSFilterRequest *request = rs_filter_request_new();
-	rs_filter_request_set_quick(RS_FILTER_REQUEST(request), FALSE);
-	rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", jpegfile->color_space);
-	RSFilterResponse *response = rs_filter_get_image8(filter, request);
-	
-	g_object_unref(request);
-	GdkPixbuf *pixbuf = rs_filter_response_get_image8(response);
-	g_object_unref(response);
+	guchar *line;
+	gboolean started;
+
+	/* Parallel encoding */
+	gboolean parallel;
+	FILE *outfile;
+	gint width;
+	gint height;
+	gint mcu_height;
+	gboolean header_written;
+	guint restart;
+} JpegStrips;
+
+/* A horizontal band encoded as a standalone JPEG */
+typedef struct {
+	JpegStrips *strips;
+	GdkPixbuf *pixbuf;
+	gint pixbuf_y;		/* Image row of the first row in pixbuf */
+	gint y;
+	gint height;
+	GByteArray *data;
+} JpegBand;
+
+typedef struct {
+	struct jpeg_destination_mgr pub;
+	GByteArray *data;
+	JOCTET buffer[MEM_DEST_BUFFER_SIZE];
+} MemDestination;
+
+static void
+mem_init_destination(j_compress_ptr cinfo)
+{
+	MemDestination *dest = (MemDestination *) cinfo->dest;
+
+	dest->pub.next_output_byte = dest->buffer;
+	dest->pub.free_in_buffer = MEM_DEST_BUFFER_SIZE;
+}
+
+static boolean
+mem_empty_output_buffer(j_compress_ptr cinfo)
+{
+	MemDestination *dest = (MemDestination *) cinfo->dest;
+
+	g_byte_array_append(dest->data, dest->buffer, MEM_DEST_BUFFER_SIZE);
+	dest->pub.next_output_byte = dest->buffer;
+	dest->pub.free_in_buffer = MEM_DEST_BUFFER_SIZE;
+
+	return TRUE;
+}
+
+static void
+mem_term_destination(j_compress_ptr cinfo)
+{
+	MemDestination *dest = (MemDestination *) cinfo->dest;
+
+	g_byte_array_append(dest->data, dest->buffer, MEM_DEST_BUFFER_SIZE - dest->pub.free_in_buffer);
+}
+
+static void
+set_defaults(JpegStrips *strips, struct jpeg_compress_struct *cinfo, gint width, gint height)
+{
+	cinfo->image_width = width;
+	cinfo->image_height = height;
+	cinfo->input_components = 3;
+	cinfo->in_color_space = JCS_RGB;
+	jpeg_set_defaults(cinfo);
+	jpeg_set_quality(cinfo, strips->jpegfile->quality, TRUE);
+}
+
+static void
+write_icc_profile(JpegStrips *strips, struct jpeg_compress_struct *cinfo)
+{
+	RSJpegfile *jpegfile = strips->jpegfile;
 
-	cinfo.err = jpeg_std_error(&jerr);
-	jpeg_create_compress(&cinfo);
-	if ((outfile = fopen(jpegfile->filename, "wb")) == NULL)
-		return(FALSE);
-	jpeg_stdio_dest(&cinfo, outfile);
-	cinfo.image_width = gdk_pixbuf_get_width(pixbuf);
-	cinfo.image_height = gdk_pixbuf_get_height(pixbuf);
-	cinfo.input_components = 3;
-	cinfo.in_color_space = JCS_RGB;
-	jpeg_set_defaults(&cinfo);
-	jpeg_set_quality(&cinfo, jpegfile->quality, TRUE);
-	rs_io_lock();
-	jpeg_start_compress(&cinfo, TRUE);
 	if (jpegfile->color_space && !g_str_equal(G_OBJECT_TYPE_NAME(jpegfile->color_space), "RSSrgb"))
 	{
 		const RSIccProfile *profile = rs_color_space_get_icc_profile(jpegfile->color_space, FALSE);
@@ -258,39 +311,284 @@ execute(RSOutput *output, RSFilter *filter)
 			gchar *data;
 			gsize data_length;
 			rs_icc_profile_get_data(profile, &data, &data_length);
-			rs_jpeg_write_icc_profile(&cinfo, (guchar *) data, data_length);
+			rs_jpeg_write_icc_profile(cinfo, (guchar *) data, data_length);
 			g_free(data);
 		}
 	}
+}
+
+static inline guchar *
+get_rgb_line(GdkPixbuf *pixbuf, gint row, guchar *line)
+{
+	guchar *in = GET_PIXBUF_PIXEL(pixbuf, 0, row);
+	gint x;
 
+	/* Pixbufs with alpha are converted one line at a time */
 	if (gdk_pixbuf_get_n_channels(pixbuf) == 4)
 	{
-		GdkPixbuf *out = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, cinfo.image_width, cinfo.image_height);
-		for( y = 0; y < cinfo.image_height; y++){
-			gint* in = (gint*)GET_PIXBUF_PIXEL(pixbuf, 0, y);
-			guchar* o = GET_PIXBUF_PIXEL(out, 0, y);
-			for( x = 0; x < cinfo.image_width ; x++) {
-				guint i = *in++;
-				o[0] = i&0xff;
-				o[1] = (i>>8)&0xff;
-				o[2] = (i>>16)&0xff;
-				o+=3;
-			}
+		guchar *o = line;
+		for(x = 0; x < gdk_pixbuf_get_width(pixbuf); x++)
+		{
+			o[0] = in[0];
+			o[1] = in[1];
+			o[2] = in[2];
+			o += 3;
+			in += 4;
 		}
-		g_object_unref(pixbuf);
-		pixbuf = out;
+		return line;
 	}
+	return in;
+}
+
+static gpointer
+encode_band(gpointer data)
+{
+	JpegBand *band = data;
+	JpegStrips *strips = band->strips;
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	MemDestination dest;
+	JSAMPROW row_pointer[1];
+	guchar *line = g_new(guchar, strips->width * 3);
+	gint row;
+
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+
+	dest.pub.init_destination = mem_init_destination;
+	dest.pub.empty_output_buffer = mem_empty_output_buffer;
+	dest.pub.term_destination = mem_term_destination;
+	dest.data = band->data;
+	cinfo.dest = &dest.pub;
+
+	/* Every MCU row is a restart interval, so the bands can be joined
+	 * without carrying the DC predictions across */
+	set_defaults(strips, &cinfo, strips->width, band->height);
+	cinfo.restart_in_rows = 1;
+	jpeg_start_compress(&cinfo, TRUE);
 
-	while (cinfo.next_scanline < cinfo.image_height)
+	/* Only the header of the first band ends up in the file */
+	if (band->y == 0)
+		write_icc_profile(strips, &cinfo);
+
+	for(row = band->y; row < band->y + band->height; row++)
 	{
-		row_pointer[0] = GET_PIXBUF_PIXEL(pixbuf, 0, cinfo.next_scanline);
-		if (jpeg_write_scanlines(&cinfo, row_pointer, 1) != 1)
-			break;
+		row_pointer[0] = get_rgb_line(band->pixbuf, row - band->pixbuf_y, line);
+		jpeg_write_scanlines(&cinfo, row_pointer, 1);
 	}
+
 	jpeg_finish_compress(&cinfo);
-	fclose(outfile);
 	jpeg_destroy_compress(&cinfo);
-	g_object_unref(pixbuf);
+	g_free(line);
+
+	return NULL;
+}
+
+/* Append the entropy coded segment of a band to the file, the restart
+ * markers are renumbered to continue from the previous band */
+static gboolean
+write_band(JpegStrips *strips, GByteArray *data)
+{
+	const guchar *buf = data->data;
+	const guchar *p, *end, *ff;
+	gsize pos = 2;
+	gsize sof = 0;
+
+	if (data->len < 4 || buf[0] != 0xff || buf[1] != MARKER_SOI || buf[data->len-2] != 0xff || buf[data->len-1] != JPEG_EOI)
+		return FALSE;
+
+	/* Find the start of the scan */
+	while (pos + 4 <= data->len && buf[pos] == 0xff && buf[pos+1] != MARKER_SOS)
+	{
+		if (buf[pos+1] == MARKER_SOF0)
+			sof = pos;
+		pos += 2 + ((buf[pos+2] << 8) | buf[pos+3]);
+	}
+	if (pos + 4 > data->len || buf[pos] != 0xff || sof == 0)
+		return FALSE;
+	pos += 2 + ((buf[pos+2] << 8) | buf[pos+3]);
+
+	if (!strips->header_written)
+	{
+		/* The header is taken from the first band, with the full height */
+		data->data[sof+5] = strips->height >> 8;
+		data->data[sof+6] = strips->height & 0xff;
+		fwrite(buf, 1, pos, strips->outfile);
+		strips->header_written = TRUE;
+	}
+	else
+	{
+		fputc(0xff, strips->outfile);
+		fputc(JPEG_RST0 + (strips->restart++ & 7), strips->outfile);
+	}
+
+	p = buf + pos;
+	end = buf + data->len - 2;
+	while ((ff = memchr(p, 0xff, end - p)) && ff + 1 < end)
+	{
+		fwrite(p, 1, ff - p + 1, strips->outfile);
+		if (ff[1] >= JPEG_RST0 && ff[1] <= JPEG_RST0 + 7)
+			fputc(JPEG_RST0 + (strips->restart++ & 7), strips->outfile);
+		else
+			fputc(ff[1], strips->outfile);
+		p = ff + 2;
+	}
+	fwrite(p, 1, end - p, strips->outfile);
+
+	return !ferror(strips->outfile);
+}
+
+static gboolean
+write_strip_parallel(JpegStrips *strips, GdkPixbuf *pixbuf, gint y, gint height)
+{
+	const gint n_workers = rs_task_pool_get_n_workers();
+	gint band_height, n_bands, i;
+	gboolean ret = TRUE;
+
+	band_height = (height + n_workers - 1) / n_workers;
+	band_height = ((band_height + strips->mcu_height - 1) / strips->mcu_height) * strips->mcu_height;
+	n_bands = (height + band_height - 1) / band_height;
+
+	JpegBand *bands = g_new(JpegBand, n_bands);
+	for(i = 0; i < n_bands; i++)
+	{
+		bands[i].strips = strips;
+		bands[i].pixbuf = pixbuf;
+		bands[i].pixbuf_y = y;
+		bands[i].y = y + i * band_height;
+		bands[i].height = MIN(band_height, y + height - bands[i].y);
+		bands[i].data = g_byte_array_new();
+	}
+
+	rs_task_pool_run(encode_band, bands, sizeof(JpegBand), n_bands);
+
+	rs_io_lock_file(strips->jpegfile->filename);
+	for(i = 0; i < n_bands; i++)
+	{
+		if (ret)
+			ret = write_band(strips, bands[i].data);
+		g_byte_array_free(bands[i].data, TRUE);
+	}
+	rs_io_unlock();
+	g_free(bands);
+
+	return ret;
+}
+
+static gboolean
+write_strip(RSOutput *output, GdkPixbuf *pixbuf, gint y, gint height, gpointer user_data)
+{
+	JpegStrips *strips = user_data;
+	RSJpegfile *jpegfile = strips->jpegfile;
+	struct jpeg_compress_struct *cinfo = &strips->cinfo;
+	JSAMPROW row_pointer[1];
+	gint c;
+
+	if (!strips->started)
+	{
+		rs_output_get_image_size(output, &strips->width, &strips->height);
+		set_defaults(strips, cinfo, strips->width, strips->height);
+
+		strips->mcu_height = 0;
+		for(c = 0; c < cinfo->num_components; c++)
+			strips->mcu_height = MAX(strips->mcu_height, cinfo->comp_info[c].v_samp_factor * DCTSIZE);
+
+		/* Large images are split in bands that are encoded on all cores,
+		 * every band but the last must cover whole MCU rows */
+		strips->parallel = rs_task_pool_get_n_workers() > 1
+			&& (strips->width * strips->height) >= PARALLEL_MIN_PIXELS
+			&& strips->height <= JPEG_MAX_DIMENSION
+			&& (height == strips->height || (height % strips->mcu_height) == 0);
+
+		RS_DEBUG(PERFORMANCE, "Encoding %dx%d JPEG %s", strips->width, strips->height, strips->parallel ? "in parallel" : "serially");
+
+		if (!strips->parallel)
+		{
+			rs_io_lock_file(jpegfile->filename);
+			jpeg_start_compress(cinfo, TRUE);
+			write_icc_profile(strips, cinfo);
+			rs_io_unlock();
+
+			strips->line = g_new(guchar, cinfo->image_width * 3);
+		}
+		strips->started = TRUE;
+	}
+
+	if (strips->parallel)
+		return write_strip_parallel(strips, pixbuf, y, height);
+
+	rs_io_lock_file(jpegfile->filename);
+	while (cinfo->next_scanline < y + height)
+	{
+		row_pointer[0] = get_rgb_line(pixbuf, cinfo->next_scanline - y, strips->line);
+
+		if (jpeg_write_scanlines(cinfo, row_pointer, 1) != 1)
+			break;
+	}
+	rs_io_unlock();
+
+	return (cinfo->next_scanline == y + height);
+}
+
+static gboolean
+execute(RSOutput *output, RSFilter *filter)
+{
+	RSJpegfile *jpegfile = RS_JPEGFILE(output);
+	struct jpeg_error_mgr jerr;
+	JpegStrips strips;
+	FILE * outfile;
+	gboolean ret;
+
+	strips.jpegfile = jpegfile;
+	strips.line = NULL;
+	strips.started = FALSE;
+	strips.parallel = FALSE;
+	strips.header_written = FALSE;
+	strips.restart = 0;
+
+	strips.cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&strips.cinfo);
+	if ((outfile = fopen(jpegfile->filename, "wb")) == NULL)
+	{
+		jpeg_destroy_compress(&strips.cinfo);
+		return(FALSE);
+	}
+	jpeg_stdio_dest(&strips.cinfo, outfile);
+	strips.outfile = outfile;
+
+	RSFilterRequest *request = rs_filter_request_new();
+	rs_filter_request_set_quick(RS_FILTER_REQUEST(request), FALSE);
+	rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", jpegfile->color_space);
+
+	/* Encode strips as they are rendered */
+	ret = rs_output_get_strips8(output, filter, request, write_strip, &strips);
+	g_object_unref(request);
+
+	rs_io_lock_file(jpegfile->filename);
+	if (strips.started && strips.parallel)
+	{
+		if (ret)
+		{
+			fputc(0xff, outfile);
+			fputc(JPEG_EOI, outfile);
+		}
+	}
+	else if (strips.started)
+	{
+		if (ret)
+			jpeg_finish_compress(&strips.cinfo);
+		else
+			jpeg_abort_compress(&strips.cinfo);
+	}
+	fclose(outfile);
+	jpeg_destroy_compress(&strips.cinfo);
+	g_free(strips.line);
+
+	if (!ret || !strips.started)
+	{
+		rs_io_unlock();
+		return(FALSE);
+	}
 
 	gchar *input_filename = NULL;
 	rs_filter_get_recursive(filter, "filename", &input_filename, NULL);
@@ -175,11 +175,82 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 	}
 }
 
+typedef struct {
+	RSPngfile *pngfile;
+	png_structp png_ptr;
+	png_infop info_ptr;
+	gboolean started;
+} PngStrips;
+
+/* Write the header before the first row */
+static void
+start_png(PngStrips *strips, gint width, gint height, gint bit_depth, gint n_channels)
+{
+	png_set_IHDR(strips->png_ptr, strips->info_ptr, width, height,
+		bit_depth, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+		PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+	rs_io_lock_file(strips->pngfile->filename);
+	png_write_info(strips->png_ptr, strips->info_ptr);
+	rs_io_unlock();
+
+	if (n_channels == 4)
+		png_set_filler(strips->png_ptr, 0, PNG_FILLER_AFTER);
+#ifdef G_BIG_ENDIAN
+	if (bit_depth == 16)
+		png_set_swap(strips->png_ptr);
+#endif
+	strips->started = TRUE;
+}
+
+static gboolean
+write_strip16(RSOutput *output, RS_IMAGE16 *image, gint y, gint height, gpointer user_data)
+{
+	PngStrips *strips = user_data;
+	gint width, image_height;
+	gint row;
+
+	if (!strips->started)
+	{
+		rs_output_get_image_size(output, &width, &image_height);
+		start_png(strips, width, image_height, 16, image->pixelsize);
+	}
+
+	rs_io_lock_file(strips->pngfile->filename);
+	for(row = 0; row < height; row++)
+		png_write_row(strips->png_ptr, (png_bytep) GET_PIXEL(image, 0, row));
+	rs_io_unlock();
+
+	return TRUE;
+}
+
+static gboolean
+write_strip8(RSOutput *output, GdkPixbuf *pixbuf, gint y, gint height, gpointer user_data)
+{
+	PngStrips *strips = user_data;
+	gint width, image_height;
+	gint row;
+
+	if (!strips->started)
+	{
+		rs_output_get_image_size(output, &width, &image_height);
+		start_png(strips, width, image_height, 8, gdk_pixbuf_get_n_channels(pixbuf));
+	}
+
+	rs_io_lock_file(strips->pngfile->filename);
+	for(row = 0; row < height; row++)
+		png_write_row(strips->png_ptr, (png_bytep) GET_PIXBUF_PIXEL(pixbuf, 0, row));
+	rs_io_unlock();
+
+	return TRUE;
+}
+
 static gboolean
 execute(RSOutput *output, RSFilter *filter)
 {
 	RSPngfile *pngfile = RS_PNGFILE(output);
-	png_bytep *row_pointers;
+	PngStrips strips;
+	gboolean ret;
 	FILE *fp = fopen(pngfile->filename, "wb");
 	if (!fp)
 	  return FALSE;
@@ -217,76 +288,33 @@ execute(RSOutput *output, RSFilter *filter)
 			png_set_gAMA(png_ptr, info_ptr, 1.0);
 	}
 
-	RSFilterResponse *response;
 	RSFilterRequest *request = rs_filter_request_new();
 	rs_filter_request_set_quick(RS_FILTER_REQUEST(request), pngfile->quick);
 	rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", pngfile->color_space);
 
-	if (pngfile->save16bit)
-	{
-		response = rs_filter_get_image(filter, request);
-		RS_IMAGE16 *image = rs_filter_response_get_image(response);
-
-		gint n_channels = image->pixelsize;
-		gint width = image->w;
-		gint height = image->h;
-
-		png_set_IHDR(png_ptr, info_ptr, width, height,
-					16, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
-					PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-
-		png_write_info(png_ptr, info_ptr);
+	strips.pngfile = pngfile;
+	strips.png_ptr = png_ptr;
+	strips.info_ptr = info_ptr;
+	strips.started = FALSE;
 
-		row_pointers = g_malloc(sizeof(png_bytep*)*height);
-		gint i;
-		for( i = 0; i < height; i++)
-			row_pointers[i] = (png_bytep)GET_PIXEL(image, 0, i);
-
-		if (n_channels == 4)
-			png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
-#ifdef G_BIG_ENDIAN
-		png_set_swap(png_ptr);
-#endif
-		rs_io_lock();
-		png_write_image(png_ptr, row_pointers);
-		g_object_unref(image);
-	}
-	else  // 8 bit
-	{
-		response = rs_filter_get_image8(filter, request);
-		GdkPixbuf *pixbuf = rs_filter_response_get_image8(response);
-
-		gint n_channels = gdk_pixbuf_get_n_channels (pixbuf);
-		gint width = gdk_pixbuf_get_width (pixbuf);
-		gint height = gdk_pixbuf_get_height (pixbuf);
-		gint rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-		guchar* pixels = gdk_pixbuf_get_pixels (pixbuf);
-
-		png_set_IHDR(png_ptr, info_ptr, width, height,
-			8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
-			PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-
-		png_write_info(png_ptr, info_ptr);
-
-		row_pointers = g_malloc(sizeof(png_bytep*)*height);
-		gint i;
-		for( i = 0; i < height; i++)
-			row_pointers[i] = (png_bytep)(pixels + i * rowstride);
-
-		if (n_channels == 4)
-			png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
-		
-		rs_io_lock();
-		png_write_image(png_ptr, row_pointers);
-		g_object_unref(pixbuf);
-	}
+	/* Encode strips as they are rendered */
+	if (pngfile->save16bit)
+		ret = rs_output_get_strips16(output, filter, request, write_strip16, &strips);
+	else
+		ret = rs_output_get_strips8(output, filter, request, write_strip8, &strips);
 
-	png_write_end(png_ptr, NULL);
+	rs_io_lock_file(pngfile->filename);
+	if (ret && strips.started)
+		png_write_end(png_ptr, NULL);
 	png_destroy_write_struct(&png_ptr, &info_ptr);
 	fclose(fp);
 	g_object_unref(request);
-	g_object_unref(response);
-	g_free(row_pointers);
+
+	if (!ret || !strips.started)
+	{
+		rs_io_unlock();
+		return FALSE;
+	}
 
 	gchar *input_filename = NULL;
 	rs_filter_get_recursive(filter, "filename", &input_filename, NULL);
@@ -208,87 +208,127 @@ rs_tiff_generic_init(TIFF *output, guint w, guint h, const guint samples_per_pix
 	TIFFSetField(output, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(output, 0));
 }
 
+typedef struct {
+	RSTifffile *tifffile;
+	TIFF *tiff;
+	const RSIccProfile *profile;
+	gpointer line;
+	gboolean started;
+} TiffStrips;
+
+static gboolean
+write_strip16(RSOutput *output, RS_IMAGE16 *image, gint y, gint height, gpointer user_data)
+{
+	TiffStrips *strips = user_data;
+	gushort *line;
+	gint image_height;
+	gint row, col;
+
+	g_return_val_if_fail(image->channels == 3, FALSE);
+	g_return_val_if_fail(image->pixelsize == 4, FALSE);
+
+	if (!strips->started)
+	{
+		rs_output_get_image_size(output, NULL, &image_height);
+		rs_tiff_generic_init(strips->tiff, image->w, image_height, 3, strips->profile, strips->tifffile->uncompressed);
+		TIFFSetField(strips->tiff, TIFFTAG_BITSPERSAMPLE, 16);
+		strips->line = g_new(gushort, image->w*3);
+		strips->started = TRUE;
+	}
+	line = strips->line;
+
+	rs_io_lock_file(strips->tifffile->filename);
+	for(row=y;row<y+height;row++)
+	{
+		gushort *buf = GET_PIXEL(image, 0, row - y);
+		for(col=0;col<image->w; col++)
+		{
+			line[col*3 + R] = buf[col*4 + R];
+			line[col*3 + G] = buf[col*4 + G];
+			line[col*3 + B] = buf[col*4 + B];
+		}
+		TIFFWriteScanline(strips->tiff, line, row, 0);
+	}
+	rs_io_unlock();
+
+	return TRUE;
+}
+
+static gboolean
+write_strip8(RSOutput *output, GdkPixbuf *pixbuf, gint y, gint height, gpointer user_data)
+{
+	TiffStrips *strips = user_data;
+	gint width = gdk_pixbuf_get_width(pixbuf);
+	gint input_channels = gdk_pixbuf_get_n_channels(pixbuf);
+	gchar *line;
+	gint image_height;
+	gint row, col;
+
+	if (!strips->started)
+	{
+		rs_output_get_image_size(output, NULL, &image_height);
+		rs_tiff_generic_init(strips->tiff, width, image_height, 3, strips->profile, strips->tifffile->uncompressed);
+		TIFFSetField(strips->tiff, TIFFTAG_BITSPERSAMPLE, 8);
+		strips->line = g_new(gchar, width * 3);
+		strips->started = TRUE;
+	}
+	line = strips->line;
+
+	rs_io_lock_file(strips->tifffile->filename);
+	for(row=y;row<y+height;row++)
+	{
+		guchar *buf = GET_PIXBUF_PIXEL(pixbuf, 0, row - y);
+		for(col=0; col<width; col++)
+		{
+			line[col*3 + R] = buf[col*input_channels + R];
+			line[col*3 + G] = buf[col*input_channels + G];
+			line[col*3 + B] = buf[col*input_channels + B];
+		}
+		TIFFWriteScanline(strips->tiff, line, row, 0);
+	}
+	rs_io_unlock();
+
+	return TRUE;
+}
+
 static gboolean
 execute(RSOutput *output, RSFilter *filter)
 {
-	RSFilterResponse *response;
 	RSTifffile *tifffile = RS_TIFFFILE(output);
-	const RSIccProfile *profile = NULL;
-	TIFF *tiff;
-	gint row;
+	TiffStrips strips;
+	gboolean ret;
+
+	strips.tifffile = tifffile;
+	strips.profile = NULL;
+	strips.line = NULL;
+	strips.started = FALSE;
 
-	if((tiff = TIFFOpen(tifffile->filename, "w")) == NULL)
+	if((strips.tiff = TIFFOpen(tifffile->filename, "w")) == NULL)
 		return(FALSE);
 
 	if (tifffile->color_space)
-		profile = rs_color_space_get_icc_profile(tifffile->color_space, tifffile->save16bit);
+		strips.profile = rs_color_space_get_icc_profile(tifffile->color_space, tifffile->save16bit);
 
 	RSFilterRequest *request = rs_filter_request_new();
 	rs_filter_request_set_quick(request, FALSE);
 	rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", tifffile->color_space);
 
+	/* Encode strips as they are rendered */
 	if (tifffile->save16bit)
-	{
-		gint col;
-		response = rs_filter_get_image(filter, request);
-		RS_IMAGE16 *image = rs_filter_response_get_image(response);
-		rs_tiff_generic_init(tiff, image->w, image->h, 3, profile, tifffile->uncompressed);
-		gushort *line = g_new(gushort, image->w*3);
-
-		g_return_val_if_fail(image->channels == 3, FALSE);
-		g_return_val_if_fail(image->pixelsize == 4, FALSE);
-
-		TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 16);
-		printf("pixelsize: %d\n", image->pixelsize);
-		rs_io_lock();
-		for(row=0;row<image->h;row++)
-		{
-			gushort *buf = GET_PIXEL(image, 0, row);
-			for(col=0;col<image->w; col++)
-			{
-				line[col*3 + R] = buf[col*4 + R];
-				line[col*3 + G] = buf[col*4 + G];
-				line[col*3 + B] = buf[col*4 + B];
-			}
-			TIFFWriteScanline(tiff, line, row, 0);
-		}
-
-		g_object_unref(image);
-		g_object_unref(response);
-		g_free(line);
-	}
+		ret = rs_output_get_strips16(output, filter, request, write_strip16, &strips);
 	else
-	{
-		gint col;
-		response = rs_filter_get_image8(filter, request);
-		GdkPixbuf *pixbuf = rs_filter_response_get_image8(response);
-		gint width = gdk_pixbuf_get_width(pixbuf);
-		gint height = gdk_pixbuf_get_height(pixbuf);
-		gint input_channels = gdk_pixbuf_get_n_channels(pixbuf);
-		rs_tiff_generic_init(tiff, width, height, 3, profile, tifffile->uncompressed);
-		gchar *line = g_new(gchar, width * 3);
-
-		TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 8);
-		rs_io_lock();
-		for(row=0;row<height;row++)
-		{
-			guchar *buf = GET_PIXBUF_PIXEL(pixbuf, 0, row);
-			for(col=0; col<width; col++)
-			{
-				line[col*3 + R] = buf[col*input_channels + R];
-				line[col*3 + G] = buf[col*input_channels + G];
-				line[col*3 + B] = buf[col*input_channels + B];
-			}
-			TIFFWriteScanline(tiff, line, row, 0);
-		}
-
-		g_free(line);
-		g_object_unref(pixbuf);
-		g_object_unref(response);
-	}
+		ret = rs_output_get_strips8(output, filter, request, write_strip8, &strips);
 	g_object_unref(request);
+	g_free(strips.line);
+
+	rs_io_lock_file(tifffile->filename);
+	TIFFClose(strips.tiff);
 
-	TIFFClose(tiff);
+	if (!ret || !strips.started)
+	{
+		rs_io_unlock();
+		return(FALSE);
+	}
 
 	gchar *input_filename = NULL;
 	rs_filter_get_recursive(filter, "filename", &input_filename, NULL);
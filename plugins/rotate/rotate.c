@@ -60,7 +60,6 @@ typedef struct {
 	RS_IMAGE16 *output;			/* Output Image*/
 	gint start_y;
 	gint end_y;
-	GThread *threadid;
 	gboolean use_straight;
 	RSRotate* rotate;
 	gboolean use_fast;		/* Use nearest neighbour resampler */
@@ -273,7 +272,7 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 
 	/* Prepare threads */
 	guint i, y_offset, y_per_thread, threaded_h;
-	const guint threads = rs_get_number_of_processor_cores();
+	const guint threads = rs_task_pool_get_n_workers();
 	ThreadInfo *t = g_new(ThreadInfo, threads);
 
 	threaded_h = output->h;
@@ -292,13 +291,10 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		t[i].end_y = y_offset;
 		t[i].rotate = rotate;
 		t[i].use_fast = use_fast;
-
-		t[i].threadid = g_thread_new("RSRotate worker", start_rotate_thread, &t[i]);
 	}
 
-	/* Wait for threads to finish */
-	for(i = 0; i < threads; i++)
-		g_thread_join(t[i].threadid);
+	/* Run on the shared pool and wait for all bands to finish */
+	rs_task_pool_run(start_rotate_thread, t, sizeof(ThreadInfo), threads);
 
 	g_free(t);
 	g_object_unref(input);
@@ -320,7 +316,6 @@ start_rotate_thread(gpointer _thread_info)
 
 	if (t->use_straight) {
 		turn_right_angle(input, output, t->start_y, t->end_y, rotate->orientation);
-		g_thread_exit(NULL);
 		return NULL;
 	}
 
@@ -346,9 +341,7 @@ start_rotate_thread(gpointer _thread_info)
 		}
 	}
 
-	g_thread_exit(NULL);
-
-	return NULL; /* Make the compiler shut up - we'll never return */
+	return NULL;
 }
 
 
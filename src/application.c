@@ -124,10 +124,13 @@ rs_photo_save(RS_PHOTO *photo, RSFilter *prior_to_resample, RSOutput *output, gi
 	g_return_val_if_fail(RS_IS_FILTER(prior_to_resample), FALSE);
 	g_return_val_if_fail(RS_IS_OUTPUT(output), FALSE);
 
-	RSFilter *ftransform_input = rs_filter_new("RSColorspaceTransform", prior_to_resample);
+	/* Crop is done before DCP, so a small output can be scaled down before
+	 * any colour work is done */
+	RSFilter *fcrop = rs_filter_new("RSCrop", prior_to_resample);
+	RSFilter *fprescale = rs_filter_new("RSResample", fcrop);
+	RSFilter *ftransform_input = rs_filter_new("RSColorspaceTransform", fprescale);
 	RSFilter *fdcp = rs_filter_new("RSDcp", ftransform_input);
-	RSFilter *fcrop = rs_filter_new("RSCrop", fdcp);
-	RSFilter *fresample= rs_filter_new("RSResample", fcrop);
+	RSFilter *fresample= rs_filter_new("RSResample", fdcp);
 	RSFilter *fdenoise= rs_filter_new("RSDenoise", fresample);
 	RSFilter *ftransform_display = rs_filter_new("RSColorspaceTransform", fdenoise);
 	RSFilter *fend = ftransform_display;
@@ -141,6 +144,11 @@ rs_photo_save(RS_PHOTO *photo, RSFilter *prior_to_resample, RSOutput *output, gi
 	rs_photo_apply_to_filters(photo, filters, snapshot);
 	g_list_free(filters);
 
+	/* The demosaic in front of us is shared with the preview, so only the
+	 * prescaler is used here */
+	if (0 < width && 0 < height)
+		rs_export_plan_downscale(NULL, fprescale, fcrop, width, height, FALSE, rs_export_plan_get_oversample(output, NULL));
+
 	/* actually save */
 	gboolean exported = rs_output_execute(output, fend);
 
@@ -150,6 +158,8 @@ rs_photo_save(RS_PHOTO *photo, RSFilter *prior_to_resample, RSOutput *output, gi
 	/* Set the exported flag */
 	rs_store_set_flags(NULL, photo->filename, NULL, NULL, &photo->exported, &photo->enfuse);
 
+	g_object_unref(fcrop);
+	g_object_unref(fprescale);
 	g_object_unref(ftransform_input);
 	g_object_unref(ftransform_display);
 	g_object_unref(fresample);
@@ -207,6 +217,7 @@ RS_BLOB *
 rs_new(void)
 {
 	RS_BLOB *rs;
+	gint tile_memory = DEFAULT_CONF_PREVIEW_TILE_MEMORY;
 	rs = g_malloc(sizeof(RS_BLOB));
 	rs->settings_buffer = NULL;
 	rs->photo = NULL;
@@ -222,8 +233,9 @@ rs_new(void)
 	rs->filter_fuji_rotate = rs_filter_new("RSFujiRotate", rs->filter_demosaic);
 	rs->filter_demosaic_cache = rs_filter_new("RSCache", rs->filter_fuji_rotate);
 
-	/* We need this for 100% zoom */
-	g_object_set(rs->filter_demosaic_cache, "ignore-roi", TRUE, NULL);
+	/* Keep demosaiced tiles around, so panning at 100% only renders new areas */
+	rs_conf_get_integer(CONF_PREVIEW_TILE_MEMORY, &tile_memory);
+	g_object_set(rs->filter_demosaic_cache, "tile-memory", MAX(0, tile_memory), NULL);
 
 	rs_filter_set_recursive(rs->filter_input, "color-space", rs_color_space_new_singleton("RSProphoto"), NULL);
 	rs->filter_end = rs->filter_demosaic_cache;
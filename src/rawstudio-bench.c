@@ -0,0 +1,424 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>, 
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Filter chain benchmark. Renders synthetic Bayer images and optionally
+ * real files through the standard export chain once for every SIMD code
+ * path the cpu supports, and reports per-filter and end-to-end throughput
+ * as JSON or CSV, so results can be compared between releases. The output
+ * of every SIMD code path is checked against the C code path. */
+
+#include <rawstudio.h>
+#include <glib.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <config.h>
+#include "application.h"
+#include "rs-photo.h"
+
+typedef struct {
+	const gchar *name;
+	guint flags; /* Allowed cpu features */
+	guint required; /* Skip variant if the cpu lacks these */
+} BenchVariant;
+
+#define FLAGS_SSE2 (RS_CPU_FLAG_MMX | RS_CPU_FLAG_SSE | RS_CPU_FLAG_CMOV | RS_CPU_FLAG_AMD_ISSE | RS_CPU_FLAG_SSE2)
+#define FLAGS_SSE4 (FLAGS_SSE2 | RS_CPU_FLAG_SSE3 | RS_CPU_FLAG_SSSE3 | RS_CPU_FLAG_SSE4_1 | RS_CPU_FLAG_SSE4_2)
+#define FLAGS_AVX (FLAGS_SSE4 | RS_CPU_FLAG_AVX)
+#define FLAGS_FMA (FLAGS_AVX | RS_CPU_FLAG_AVX2 | RS_CPU_FLAG_FMA)
+
+static const BenchVariant variants[] = {
+	{ "c", 0, 0 },
+	{ "sse2", FLAGS_SSE2, RS_CPU_FLAG_SSE2 },
+	{ "sse4", FLAGS_SSE4, RS_CPU_FLAG_SSE4_1 },
+	{ "avx", FLAGS_AVX, RS_CPU_FLAG_AVX },
+	{ "fma", FLAGS_FMA, RS_CPU_FLAG_FMA },
+};
+
+/* Filters in the benchmarked chain, in order */
+static const gchar *chain[] = {
+	"RSInputImage16",
+	"RSDemosaic",
+	"RSLensfun",
+	"RSRotate",
+	"RSCrop",
+	"RSColorspaceTransform",
+	"RSDcp",
+	"RSResample",
+	"RSDenoise",
+};
+
+typedef struct {
+	const gchar *name;
+	gint64 self;
+	gint64 pixels;
+	gsize allocated;
+} BenchFilter;
+
+typedef struct {
+	gchar *input;
+	const gchar *variant;
+	gint width;
+	gint height;
+	gint64 total; /* Best end-to-end time in microseconds */
+	gint max_diff; /* Largest difference to the output of the C code path, -1 if not compared */
+	BenchFilter filters[G_N_ELEMENTS(chain)];
+} BenchResult;
+
+/**
+ * Create a photo with a synthetic RGGB image. The content is a smooth gradient
+ * with deterministic noise, so denoise and demosaic have something to chew on
+ */
+static RS_PHOTO *
+bench_synthetic_photo(gint width, gint height)
+{
+	RS_PHOTO *photo = rs_photo_new();
+	RS_IMAGE16 *image = rs_image16_new(width, height, 1, 1);
+	GRand *rand = g_rand_new_with_seed(42);
+	RS_RECT crop;
+	gint x, y;
+
+	image->filters = 0x94949494;
+	for (y = 0; y < height; y++)
+	{
+		gushort *pixel = GET_PIXEL(image, 0, y);
+		for (x = 0; x < width; x++)
+			pixel[x] = (gushort) (((x + y) * 30000) / (width + height) + 2000 + g_rand_int_range(rand, 0, 1024));
+	}
+	g_rand_free(rand);
+
+	photo->filename = g_strdup_printf("synthetic-%dx%d", width, height);
+	photo->input = image;
+	photo->input_response = rs_filter_response_new();
+	rs_filter_response_set_image(photo->input_response, image);
+
+	/* Make sure rotate, crop, lensfun and denoise have work to do */
+	crop.x1 = width / 20;
+	crop.y1 = height / 20;
+	crop.x2 = width - width / 20;
+	crop.y2 = height - height / 20;
+	rs_photo_set_crop(photo, &crop);
+	rs_photo_rotate(photo, 0, 1.5);
+	g_object_set(photo->settings[0],
+		"tca_kr", 0.1,
+		"vignetting", 0.3,
+		"denoise_luma", 20.0,
+		"denoise_chroma", 20.0,
+		NULL);
+
+	return photo;
+}
+
+static void
+bench_collect(BenchResult *result)
+{
+	RSProfilerEvent *events;
+	guint n_events, i, f;
+
+	events = rs_profiler_get_events(&n_events);
+	memset(result->filters, 0, sizeof(result->filters));
+	for (f = 0; f < G_N_ELEMENTS(chain); f++)
+		result->filters[f].name = chain[f];
+
+	for (i = 0; i < n_events; i++)
+		for (f = 0; f < G_N_ELEMENTS(chain); f++)
+			if (g_str_equal(events[i].name, chain[f]))
+			{
+				result->filters[f].self += events[i].self;
+				result->filters[f].pixels += (gint64) events[i].width * events[i].height;
+				result->filters[f].allocated += events[i].allocated;
+				/* The same type can appear twice, the first match is upstream */
+				break;
+			}
+
+	g_free(events);
+}
+
+/**
+ * Compare the output of a SIMD code path to the C code path
+ * @return The largest difference of any sample, or -1 if the sizes differ
+ */
+static gint
+bench_compare(RS_IMAGE16 *reference, RS_IMAGE16 *image)
+{
+	gint x, y, max_diff = 0;
+
+	if (reference->w != image->w || reference->h != image->h || reference->channels != image->channels)
+		return -1;
+
+	for (y = 0; y < image->h; y++)
+	{
+		gushort *a = GET_PIXEL(reference, 0, y);
+		gushort *b = GET_PIXEL(image, 0, y);
+		for (x = 0; x < image->w * image->pixelsize; x++)
+			if (x % image->pixelsize < image->channels)
+				max_diff = MAX(max_diff, ABS((gint) a[x] - (gint) b[x]));
+	}
+
+	return max_diff;
+}
+
+static void
+bench_run(RS_PHOTO *photo, const BenchVariant *variant, gint iterations, RS_IMAGE16 **reference, GPtrArray *results)
+{
+	RSFilter *filters[G_N_ELEMENTS(chain)];
+	RSFilter *previous = NULL;
+	RSFilterRequest *request;
+	RSFilterResponse *response;
+	RS_IMAGE16 *image = NULL;
+	BenchResult best;
+	BenchResult *result;
+	gint64 start, elapsed;
+	gint width, height, i;
+	guint f;
+
+	for (f = 0; f < G_N_ELEMENTS(chain); f++)
+		previous = filters[f] = rs_filter_new(chain[f], previous);
+
+	GList *list = g_list_append(NULL, previous);
+	rs_photo_apply_to_filters(photo, list, 0);
+	g_list_free(list);
+
+	rs_filter_set_recursive(previous,
+		"image", photo->input_response,
+		"filename", photo->filename,
+		NULL);
+
+	/* Synthetic photos have no lens metadata, use a camera lensfun knows */
+	if (g_str_has_prefix(photo->filename, "synthetic-"))
+		rs_filter_set_recursive(previous, "make", "Canon", "model", "Canon EOS 5D Mark II", NULL);
+
+	/* Exercise the resampler with a typical 50% export */
+	rs_filter_get_size_simple(filters[4] /* RSCrop */, RS_FILTER_REQUEST_QUICK, &width, &height);
+	rs_filter_set_recursive(previous, "width", MAX(6, width / 2), "height", MAX(6, height / 2), NULL);
+
+	request = rs_filter_request_new();
+	rs_filter_request_set_quick(request, FALSE);
+
+	rs_set_cpu_features_mask(variant->flags);
+
+	memset(&best, 0, sizeof(best));
+	for (i = -1; i < iterations; i++)
+	{
+		BenchResult current;
+
+		rs_profiler_clear();
+		start = g_get_monotonic_time();
+		response = rs_filter_get_image(previous, request);
+		elapsed = g_get_monotonic_time() - start;
+		if (i == iterations - 1)
+			image = rs_filter_response_get_image(response);
+		g_object_unref(response);
+
+		/* First round is warm up */
+		if (i < 0)
+			continue;
+
+		bench_collect(&current);
+		if (best.total == 0 || elapsed < best.total)
+		{
+			best = current;
+			best.total = elapsed;
+		}
+	}
+
+	rs_set_cpu_features_mask(~0);
+
+	result = g_new(BenchResult, 1);
+	*result = best;
+	result->input = g_path_get_basename(photo->filename);
+	result->variant = variant->name;
+	result->width = photo->input->w;
+	result->height = photo->input->h;
+	result->max_diff = -1;
+	g_ptr_array_add(results, result);
+
+	/* The C code path is the reference for the others */
+	if (image && variant->flags == 0 && !*reference)
+		*reference = image;
+	else if (image)
+	{
+		if (*reference)
+			result->max_diff = bench_compare(*reference, image);
+		g_object_unref(image);
+	}
+
+	g_object_unref(request);
+	for (f = 0; f < G_N_ELEMENTS(chain); f++)
+		g_object_unref(filters[f]);
+}
+
+static gdouble
+mpix_per_s(gint64 pixels, gint64 usecs)
+{
+	return (usecs > 0) ? ((gdouble) pixels) / usecs : 0.0;
+}
+
+static void
+bench_print_json(FILE *out, GPtrArray *results, guint cpu_flags)
+{
+	guint i, f;
+
+	fprintf(out, "{\n  \"version\": \"%s\",\n  \"cpu-flags\": %u,\n  \"threads\": %u,\n  \"results\": [\n",
+		VERSION, cpu_flags, rs_task_pool_get_n_workers());
+	for (i = 0; i < results->len; i++)
+	{
+		BenchResult *r = g_ptr_array_index(results, i);
+		fprintf(out, "    {\"input\": \"%s\", \"variant\": \"%s\", \"width\": %d, \"height\": %d, "
+			"\"total-ms\": %.2f, \"mpix-per-s\": %.2f, \"max-diff\": %d, \"filters\": [\n",
+			r->input, r->variant, r->width, r->height,
+			r->total / 1000.0, mpix_per_s((gint64) r->width * r->height, r->total), r->max_diff);
+		for (f = 0; f < G_N_ELEMENTS(chain); f++)
+			fprintf(out, "      {\"name\": \"%s\", \"ms\": %.2f, \"mpix-per-s\": %.2f, \"allocated\": %" G_GSIZE_FORMAT "}%s\n",
+				r->filters[f].name, r->filters[f].self / 1000.0,
+				mpix_per_s(r->filters[f].pixels, r->filters[f].self),
+				r->filters[f].allocated,
+				(f + 1 < G_N_ELEMENTS(chain)) ? "," : "");
+		fprintf(out, "    ]}%s\n", (i + 1 < results->len) ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+}
+
+static void
+bench_print_csv(FILE *out, GPtrArray *results)
+{
+	guint i, f;
+
+	fprintf(out, "input,variant,width,height,filter,ms,mpix_per_s,allocated,max_diff\n");
+	for (i = 0; i < results->len; i++)
+	{
+		BenchResult *r = g_ptr_array_index(results, i);
+		for (f = 0; f < G_N_ELEMENTS(chain); f++)
+			fprintf(out, "%s,%s,%d,%d,%s,%.2f,%.2f,%" G_GSIZE_FORMAT ",\n",
+				r->input, r->variant, r->width, r->height, r->filters[f].name,
+				r->filters[f].self / 1000.0, mpix_per_s(r->filters[f].pixels, r->filters[f].self),
+				r->filters[f].allocated);
+		fprintf(out, "%s,%s,%d,%d,total,%.2f,%.2f,0,%d\n",
+			r->input, r->variant, r->width, r->height,
+			r->total / 1000.0, mpix_per_s((gint64) r->width * r->height, r->total), r->max_diff);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	gchar *size = NULL;
+	gchar *format = NULL;
+	gchar *output = NULL;
+	gchar *only = NULL;
+	gint iterations = 3;
+	gint width = 6000, height = 4000;
+	gboolean no_synthetic = FALSE;
+	GPtrArray *photos;
+	GPtrArray *results;
+	guint cpu_flags;
+	FILE *out = stdout;
+	guint i, v;
+
+	GError *error = NULL;
+	GOptionContext *option_context;
+	const GOptionEntry option_entries[] = {
+		{ "size", 's', 0, G_OPTION_ARG_STRING, &size, "Size of the synthetic image (default: 6000x4000)", "WxH" },
+		{ "iterations", 'i', 0, G_OPTION_ARG_INT, &iterations, "Number of measured renders per chain (default: 3)", "N" },
+		{ "variant", 'v', 0, G_OPTION_ARG_STRING, &only, "Only run one code path: c, sse2, sse4, avx or fma", "variant" },
+		{ "no-synthetic", 'n', 0, G_OPTION_ARG_NONE, &no_synthetic, "Only benchmark the files given", NULL },
+		{ "format", 'f', 0, G_OPTION_ARG_STRING, &format, "Output format: json or csv (default: json)", "format" },
+		{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Write results to file instead of stdout", "file" },
+		{ NULL }
+	};
+
+	option_context = g_option_context_new("[FILE...] - benchmark the filter chain");
+	g_option_context_add_main_entries(option_context, option_entries, NULL);
+
+	if (!g_option_context_parse(option_context, &argc, &argv, &error))
+	{
+		g_printerr("option parsing failed: %s\n", error->message);
+		exit(1);
+	}
+	g_option_context_free(option_context);
+
+	if (size && (sscanf(size, "%dx%d", &width, &height) != 2 || width < 64 || height < 64))
+	{
+		g_printerr("Invalid size \"%s\".\n", size);
+		exit(1);
+	}
+
+#if ! GLIB_CHECK_VERSION(2,36,0)
+	g_type_init();
+#endif
+
+	rs_filetype_init();
+	rs_plugin_manager_load_all_plugins();
+	rs_lens_fix_init();
+	rs_profiler_set_enabled(TRUE);
+	cpu_flags = rs_detect_cpu_features();
+
+	photos = g_ptr_array_new_with_free_func(g_object_unref);
+	if (!no_synthetic)
+		g_ptr_array_add(photos, bench_synthetic_photo(width, height));
+	for (i = 1; i < (guint) argc; i++)
+	{
+		RS_PHOTO *photo = rs_photo_load_from_file(argv[i]);
+		if (photo)
+			g_ptr_array_add(photos, photo);
+		else
+			g_printerr("Could not load %s, skipping.\n", argv[i]);
+	}
+
+	results = g_ptr_array_new();
+	for (i = 0; i < photos->len; i++)
+	{
+		RS_IMAGE16 *reference = NULL;
+		for (v = 0; v < G_N_ELEMENTS(variants); v++)
+		{
+			if ((variants[v].required & cpu_flags) != variants[v].required)
+				continue;
+			if (only && !g_str_equal(only, variants[v].name))
+				continue;
+			g_printerr("Benchmarking %s (%s)...\n", RS_PHOTO(g_ptr_array_index(photos, i))->filename, variants[v].name);
+			bench_run(g_ptr_array_index(photos, i), &variants[v], MAX(1, iterations), &reference, results);
+		}
+		if (reference)
+			g_object_unref(reference);
+	}
+
+	if (output && !(out = fopen(output, "w")))
+	{
+		g_printerr("Could not open %s for writing.\n", output);
+		exit(1);
+	}
+
+	if (format && g_str_equal(format, "csv"))
+		bench_print_csv(out, results);
+	else
+		bench_print_json(out, results, cpu_flags);
+
+	if (out != stdout)
+		fclose(out);
+
+	for (i = 0; i < results->len; i++)
+	{
+		g_free(((BenchResult *) g_ptr_array_index(results, i))->input);
+		g_free(g_ptr_array_index(results, i));
+	}
+	g_ptr_array_free(results, TRUE);
+	g_ptr_array_free(photos, TRUE);
+
+	return 0;
+}
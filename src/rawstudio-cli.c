@@ -0,0 +1,286 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>, 
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Headless batch renderer. This links against librawstudio and the photo
+ * and settings handling from Rawstudio, but never initializes GTK+, so it
+ * can run on machines without a display. */
+
+#include <rawstudio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <config.h>
+#include "application.h"
+#include "rs-photo.h"
+#include "rs-cache.h"
+
+typedef struct {
+	GAsyncQueue *files;
+	const gchar *output_type;
+	const gchar *output_dir;
+	gint width;
+	gint height;
+	gint quality;
+	gint snapshot;
+	gint failed;
+	GMutex print_lock;
+} CliContext;
+
+static gchar *
+cli_output_filename(CliContext *ctx, const gchar *input, RSOutput *output)
+{
+	gchar *basename = g_path_get_basename(input);
+	gchar *dot = g_strrstr(basename, ".");
+	gchar *name, *ret;
+
+	if (dot)
+		*dot = '\0';
+
+	name = g_strdup_printf("%s_%c.%s", basename, 'A' + ctx->snapshot, rs_output_get_extension(output));
+	ret = g_build_filename(ctx->output_dir, name, NULL);
+
+	g_free(name);
+	g_free(basename);
+
+	return ret;
+}
+
+static gboolean
+cli_render(CliContext *ctx, RSFilter *fend, RSFilter *fdemosaic, RSFilter *fcrop, RSFilter *fprescale, RSOutput *output, const gchar *input)
+{
+	RS_PHOTO *photo;
+	gchar *output_filename;
+	gboolean exported;
+
+	/* This will also load sidecar settings through rs_cache_load() */
+	photo = rs_photo_load_from_file(input);
+	if (!photo)
+		return FALSE;
+
+	GList *filters = g_list_append(NULL, fend);
+	rs_photo_apply_to_filters(photo, filters, ctx->snapshot);
+	g_list_free(filters);
+
+	rs_filter_set_recursive(fend,
+		"image", photo->input_response,
+		"filename", photo->filename,
+		"bounding-box", TRUE,
+		"width", (ctx->width > 0) ? ctx->width : 65535,
+		"height", (ctx->height > 0) ? ctx->height : 65535,
+		NULL);
+
+	/* Downscale before DCP and denoise when the output is small */
+	rs_export_plan_downscale(fdemosaic, fprescale, fcrop,
+		(ctx->width > 0) ? ctx->width : 65535,
+		(ctx->height > 0) ? ctx->height : 65535,
+		TRUE, rs_export_plan_get_oversample(output, NULL));
+
+	output_filename = cli_output_filename(ctx, input, output);
+	g_object_set(output, "filename", output_filename, NULL);
+	if (ctx->quality > 0 && g_object_class_find_property(G_OBJECT_GET_CLASS(output), "quality"))
+		g_object_set(output, "quality", ctx->quality, NULL);
+
+	exported = rs_output_execute(output, fend);
+
+	g_mutex_lock(&ctx->print_lock);
+	if (exported)
+		g_print("%s -> %s\n", input, output_filename);
+	g_mutex_unlock(&ctx->print_lock);
+
+	g_free(output_filename);
+	g_object_unref(photo);
+
+	return exported;
+}
+
+static gpointer
+cli_worker(gpointer data)
+{
+	CliContext *ctx = data;
+	gchar *input;
+
+	RSOutput *output = rs_output_new(ctx->output_type);
+	RSFilter *finput = rs_filter_new("RSInputImage16", NULL);
+	RSFilter *fdemosaic = rs_filter_new("RSDemosaic", finput);
+	RSFilter *ffujirotate = rs_filter_new("RSFujiRotate", fdemosaic);
+	RSFilter *flensfun = rs_filter_new("RSLensfun", ffujirotate);
+	RSFilter *frotate = rs_filter_new("RSRotate", flensfun);
+	RSFilter *fcrop = rs_filter_new("RSCrop", frotate);
+	RSFilter *fprescale = rs_filter_new("RSResample", fcrop);
+	RSFilter *ftransform_input = rs_filter_new("RSColorspaceTransform", fprescale);
+	RSFilter *fdcp = rs_filter_new("RSDcp", ftransform_input);
+	RSFilter *fresample = rs_filter_new("RSResample", fdcp);
+	RSFilter *fdenoise = rs_filter_new("RSDenoise", fresample);
+	RSFilter *ftransform_display = rs_filter_new("RSColorspaceTransform", fdenoise);
+	RSFilter *fend = ftransform_display;
+
+	while ((input = g_async_queue_try_pop(ctx->files)))
+	{
+		if (!cli_render(ctx, fend, fdemosaic, fcrop, fprescale, output, input))
+		{
+			g_mutex_lock(&ctx->print_lock);
+			g_printerr("Could not export %s\n", input);
+			ctx->failed++;
+			g_mutex_unlock(&ctx->print_lock);
+		}
+		g_free(input);
+	}
+
+	g_object_unref(output);
+	g_object_unref(finput);
+	g_object_unref(fdemosaic);
+	g_object_unref(ffujirotate);
+	g_object_unref(flensfun);
+	g_object_unref(frotate);
+	g_object_unref(fcrop);
+	g_object_unref(fprescale);
+	g_object_unref(ftransform_input);
+	g_object_unref(fdcp);
+	g_object_unref(fresample);
+	g_object_unref(fdenoise);
+	g_object_unref(ftransform_display);
+
+	return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+	CliContext ctx;
+	gchar *output_dir = NULL;
+	gchar *format = NULL;
+	gint threads = 0;
+	gint width = -1, height = -1, quality = -1, snapshot = 0;
+	gboolean print_version = FALSE;
+	gchar *debug = NULL;
+	gchar *trace = NULL;
+	GThread **workers;
+	gint i;
+
+	GError *error = NULL;
+	GOptionContext *option_context;
+	const GOptionEntry option_entries[] = {
+		{ "output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &output_dir, "Directory to write output files to", "directory" },
+		{ "format", 'f', 0, G_OPTION_ARG_STRING, &format, "Output format: jpeg, png or tiff (default: jpeg)", "format" },
+		{ "width", 'W', 0, G_OPTION_ARG_INT, &width, "Maximum output width", "pixels" },
+		{ "height", 'H', 0, G_OPTION_ARG_INT, &height, "Maximum output height", "pixels" },
+		{ "quality", 'q', 0, G_OPTION_ARG_INT, &quality, "JPEG quality", "10-100" },
+		{ "snapshot", 's', 0, G_OPTION_ARG_INT, &snapshot, "Snapshot to render, 0=A, 1=B, 2=C (default: 0)", "snapshot" },
+		{ "threads", 'j', 0, G_OPTION_ARG_INT, &threads, "Number of photos to render concurrently (default: 1)", "N" },
+		{ "debug", 'd', 0, G_OPTION_ARG_STRING, &debug, "Debug flags to use", "flags" },
+		{ "trace", 't', 0, G_OPTION_ARG_FILENAME, &trace, "Save filter timings as Chrome trace JSON", "file" },
+		{ "version", 'V', 0, G_OPTION_ARG_NONE, &print_version, "Output version information and exit", NULL },
+		{ NULL }
+	};
+
+	option_context = g_option_context_new("FILE... - render photos without a display");
+	g_option_context_add_main_entries(option_context, option_entries, NULL);
+
+	if (!g_option_context_parse(option_context, &argc, &argv, &error))
+	{
+		g_printerr("option parsing failed: %s\n", error->message);
+		exit(1);
+	}
+	g_option_context_free(option_context);
+
+	if (print_version)
+	{
+		g_print("%s\n", VERSION);
+		return 0;
+	}
+
+	if (argc < 2)
+	{
+		g_printerr("You must specify at least one input file.\n");
+		exit(1);
+	}
+
+	if (debug)
+		rs_debug_setup(debug);
+
+	if (trace)
+		rs_profiler_set_enabled(TRUE);
+
+#if ! GLIB_CHECK_VERSION(2,36,0)
+	/* Make sure the GType system is initialized */
+	g_type_init();
+#endif
+
+	ctx.output_dir = output_dir ? output_dir : ".";
+	ctx.width = width;
+	ctx.height = height;
+	ctx.quality = quality;
+	ctx.snapshot = CLAMP(snapshot, 0, 2);
+	ctx.failed = 0;
+	g_mutex_init(&ctx.print_lock);
+
+	if (!format || g_str_equal(format, "jpeg") || g_str_equal(format, "jpg"))
+		ctx.output_type = "RSJpegfile";
+	else if (g_str_equal(format, "png"))
+		ctx.output_type = "RSPngfile";
+	else if (g_str_equal(format, "tiff") || g_str_equal(format, "tif"))
+		ctx.output_type = "RSTifffile";
+	else
+	{
+		g_printerr("Unknown output format \"%s\".\n", format);
+		exit(1);
+	}
+
+	if (g_mkdir_with_parents(ctx.output_dir, 00755))
+	{
+		g_printerr("Could not create output directory \"%s\".\n", ctx.output_dir);
+		exit(1);
+	}
+
+	rs_filetype_init();
+	rs_plugin_manager_load_all_plugins();
+	rs_lens_fix_init();
+
+	/* Rawstudio wants absolute paths everywhere */
+	gchar *cwd = g_get_current_dir();
+	ctx.files = g_async_queue_new();
+	for (i = 1; i < argc; i++)
+	{
+		if (g_path_is_absolute(argv[i]))
+			g_async_queue_push(ctx.files, g_strdup(argv[i]));
+		else
+			g_async_queue_push(ctx.files, g_build_filename(cwd, argv[i], NULL));
+	}
+	g_free(cwd);
+
+	threads = CLAMP(threads, 1, argc - 1);
+	workers = g_new(GThread *, threads);
+	for (i = 0; i < threads; i++)
+		workers[i] = g_thread_new("rawstudio-cli worker", cli_worker, &ctx);
+	for (i = 0; i < threads; i++)
+		g_thread_join(workers[i]);
+	g_free(workers);
+
+	g_async_queue_unref(ctx.files);
+	g_mutex_clear(&ctx.print_lock);
+
+	if (trace && !rs_profiler_save_chrome_trace(trace, &error))
+	{
+		g_printerr("Could not save trace: %s\n", error->message);
+		g_error_free(error);
+	}
+
+	return (ctx.failed > 0) ? 1 : 0;
+}
@@ -413,6 +413,9 @@ ACTION(quit)
 			GUI_CATCHUP();
 		}
 	}
+
+	/* Cancelled metadata jobs never end the batch of a directory load */
+	rs_library_flush(rs_library_get_singleton());
 	gtk_main_quit();
 }
 
@@ -1573,7 +1576,7 @@ get_thumbnails_from_list(GList *files)
   for(i=0; i<num_selected; i++) 
     {
       name = (gchar*) g_list_nth_data(files, i);
-      thumbnails = g_list_append(thumbnails, rs_metadata_dotdir_helper(name, DOTDIR_THUMB));
+      thumbnails = g_list_append(thumbnails, rs_metadata_get_thumbnail_filename(name));
     }
 
   return thumbnails;
@@ -20,6 +20,8 @@
 #include <rawstudio.h>
 #include <glib.h>
 #include <stdio.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
 #include <gtk/gtk.h>
 #include <config.h>
 #include <libxml/encoding.h>
@@ -371,25 +373,384 @@ cancel_clicked(GtkButton *button, gpointer user_data)
 	return;
 }
 
-void
-rs_batch_process(RS_QUEUE *queue)
+/* One photo travelling through the batch pipeline */
+typedef struct {
+	gchar *filename_in;
+	gint setting_id;
+	gchar *parsed_filename;
+	RS_PHOTO *photo;
+	gboolean loaded;
+	gsize memory;
+	GdkPixbuf *preview;
+	gboolean exported;
+} BatchJob;
+
+/* State shared by all stages of a running batch */
+typedef struct {
+	RS_QUEUE *queue;
+	gint preview_size;
+	GThreadPool *decode_pool;
+	GAsyncQueue *develop_queue;
+	GAsyncQueue *done_queue;
+	GMutex lock;
+	gsize memory_in_use;
+	gsize memory_estimate;
+	gboolean abort_render;
+} BatchContext;
+
+/* A develop/encode worker, every worker owns a complete filter chain and
+ * output, so workers never share any state while rendering */
+typedef struct {
+	BatchContext *ctx;
+	GThread *thread;
+	RSOutput *output;
+	RSFilter *finput;
+	RSFilter *fdemosaic;
+	RSFilter *ffujirotate;
+	RSFilter *flensfun;
+	RSFilter *frotate;
+	RSFilter *fcrop;
+	RSFilter *fprescale;
+	RSFilter *ftransform_input;
+	RSFilter *fdcp;
+	RSFilter *fcache;
+	RSFilter *fresample;
+	RSFilter *fdenoise;
+	RSFilter *ftransform_display;
+	RSFilter *fend;
+} BatchWorker;
+
+/* Pushed to the develop queue once for each worker to make it quit */
+static BatchJob batch_quit_job;
+
+static void
+batch_job_free(BatchJob *job)
+{
+	g_free(job->filename_in);
+	g_free(job->parsed_filename);
+	if (job->photo)
+		g_object_unref(job->photo);
+	if (job->preview)
+		g_object_unref(job->preview);
+	g_free(job);
+}
+
+/**
+ * Estimate how much memory developing a photo will need. This is the input
+ * image plus a few full size intermediate images in the filter chain
+ * @param photo A loaded RS_PHOTO
+ * @return Estimated number of bytes
+ */
+static gsize
+batch_estimate_memory(RS_PHOTO *photo)
+{
+	if (!photo->input)
+		return 0;
+
+	return (gsize) photo->input->h * photo->input->rowstride * sizeof(gushort) * 6;
+}
+
+/* Bytes of decoded image per byte of file. Compressed raws store about one
+ * byte per pixel, batch_estimate_memory() counts 12 per single channel pixel */
+#define BATCH_FILE_EXPANSION 12
+
+/**
+ * Guess how much memory developing a photo will need before it is decoded
+ * @param filename The photo to develop
+ * @return Estimated number of bytes
+ */
+static gsize
+batch_estimate_file_memory(const gchar *filename)
+{
+	struct stat st;
+
+	if (g_stat(filename, &st) != 0)
+		return 0;
+
+	return (gsize) st.st_size * BATCH_FILE_EXPANSION;
+}
+
+/**
+ * Decode stage, runs on the decode pool
+ */
+static void
+batch_decode(gpointer data, gpointer user_data)
+{
+	BatchJob *job = data;
+	BatchContext *ctx = user_data;
+	gsize memory = 0;
+
+	if (!ctx->abort_render)
+	{
+		job->photo = rs_photo_load_from_file(job->filename_in);
+		job->loaded = (job->photo != NULL);
+		if (job->photo)
+		{
+			rs_metadata_load_from_file(job->photo->metadata, job->filename_in);
+			rs_cache_load(job->photo);
+			memory = batch_estimate_memory(job->photo);
+		}
+	}
+
+	/* Replace the memory reserved when the job was dispatched by the estimate */
+	g_mutex_lock(&ctx->lock);
+	ctx->memory_in_use = ctx->memory_in_use - job->memory + memory;
+	ctx->memory_estimate = MAX(ctx->memory_estimate, memory);
+	job->memory = memory;
+	g_mutex_unlock(&ctx->lock);
+
+	g_async_queue_push(ctx->develop_queue, job);
+}
+
+/**
+ * Develop and encode a single photo on the chain of a worker
+ */
+static void
+batch_develop(BatchWorker *worker, BatchJob *job)
 {
-	RS_PHOTO *photo = NULL;
+	BatchContext *ctx = worker->ctx;
+	RS_QUEUE *queue = ctx->queue;
+	RS_PHOTO *photo = job->photo;
+	gint width = 65535, height = 65535;
+	gdouble scale;
+
+	GList *filters = g_list_append(NULL, worker->fend);
+	rs_photo_apply_to_filters(photo, filters, job->setting_id);
+	g_list_free(filters);
+
+	rs_filter_set_recursive(worker->fend,
+		"image", photo->input_response,
+		"filename", photo->filename,
+		"bounding-box", TRUE,
+		NULL);
+
+	/* Calculate new size */
+	switch (queue->size_lock)
+	{
+		case LOCK_SCALE:
+			scale = queue->scale/100.0;
+			rs_filter_get_size_simple(worker->fcrop, RS_FILTER_REQUEST_QUICK, &width, &height);
+			width = (gint) (((gdouble) width) * scale);
+			height = (gint) (((gdouble) height) * scale);
+			break;
+		case LOCK_WIDTH:
+			width = queue->width;
+			break;
+		case LOCK_HEIGHT:
+			height = queue->height;
+			break;
+		case LOCK_BOUNDING_BOX:
+			width = queue->width;
+			height = queue->height;
+			break;
+	}
+	rs_filter_set_recursive(worker->fend,
+		"width", width,
+		"height", height,
+		NULL);
+
+	/* Move downscaling in front of DCP and denoise if the output is small */
+	rs_export_plan_downscale(worker->fdemosaic, worker->fprescale, worker->fcrop,
+		width, height, TRUE, rs_export_plan_get_oversample(worker->output, "batch"));
+
+	/* Save the image */
+	if (g_object_class_find_property(G_OBJECT_GET_CLASS(worker->output), "filename"))
+		g_object_set(worker->output, "filename", job->parsed_filename, NULL);
+
+	rs_output_set_from_conf(worker->output, "batch");
+
+	g_assert(RS_IS_OUTPUT(worker->output));
+	g_assert(RS_IS_FILTER(worker->fend));
+
+	/* The output leaves a downscaled copy of the saved image behind for
+	 * the progress window, so every photo is only developed once */
+	rs_output_set_preview_size(worker->output, ctx->preview_size);
+
+	/* Everything after the cache handles a ROI, unless the final resampler
+	 * has to scale - then every strip would resample the whole image */
+	gint cache_width, cache_height, end_width, end_height;
+	rs_filter_get_size_simple(worker->fcache, RS_FILTER_REQUEST_QUICK, &cache_width, &cache_height);
+	rs_filter_get_size_simple(worker->fresample, RS_FILTER_REQUEST_QUICK, &end_width, &end_height);
+	gboolean streaming = (cache_width == end_width) && (cache_height == end_height);
+	rs_output_set_streaming(worker->output, streaming);
+
+	/* The stages before the cache don't handle a ROI, they are rendered once
+	 * and hold a full frame. Every strip is taken from the cached image, the
+	 * stages after the cache only allocate buffers the size of a strip */
+	g_object_set(worker->fcache, "ignore-roi", streaming, NULL);
+
+	job->exported = rs_output_execute(worker->output, worker->fend);
+	job->preview = rs_output_get_preview(worker->output);
+
+	/* We're done with the input, release it as early as possible */
+	g_object_unref(job->photo);
+	job->photo = NULL;
+}
+
+static gpointer
+batch_develop_worker(gpointer data)
+{
+	BatchWorker *worker = data;
+	BatchContext *ctx = worker->ctx;
+	BatchJob *job;
+
+	while ((job = g_async_queue_pop(ctx->develop_queue)) != &batch_quit_job)
+	{
+		if (job->photo && !ctx->abort_render)
+			batch_develop(worker, job);
+
+		g_async_queue_push(ctx->done_queue, job);
+	}
+
+	return NULL;
+}
+
+static BatchWorker *
+batch_worker_new(BatchContext *ctx)
+{
+	BatchWorker *worker = g_new0(BatchWorker, 1);
+
+	worker->ctx = ctx;
+	worker->output = rs_output_new(G_OBJECT_TYPE_NAME(ctx->queue->output));
+	worker->finput = rs_filter_new("RSInputImage16", NULL);
+	worker->fdemosaic = rs_filter_new("RSDemosaic", worker->finput);
+	worker->ffujirotate = rs_filter_new("RSFujiRotate", worker->fdemosaic);
+	worker->flensfun = rs_filter_new("RSLensfun", worker->ffujirotate);
+	worker->frotate = rs_filter_new("RSRotate", worker->flensfun);
+	worker->fcrop = rs_filter_new("RSCrop", worker->frotate);
+	worker->fprescale = rs_filter_new("RSResample", worker->fcrop);
+	worker->ftransform_input = rs_filter_new("RSColorspaceTransform", worker->fprescale);
+	worker->fdcp = rs_filter_new("RSDcp", worker->ftransform_input);
+	worker->fcache = rs_filter_new("RSCache", worker->fdcp);
+	worker->fresample = rs_filter_new("RSResample", worker->fcache);
+	worker->fdenoise = rs_filter_new("RSDenoise", worker->fresample);
+	worker->ftransform_display = rs_filter_new("RSColorspaceTransform", worker->fdenoise);
+	worker->fend = worker->ftransform_display;
+
+	worker->thread = g_thread_new("batch develop", batch_develop_worker, worker);
+
+	return worker;
+}
+
+static void
+batch_worker_free(BatchWorker *worker)
+{
+	g_thread_join(worker->thread);
+
+	g_object_unref(worker->output);
+	g_object_unref(worker->finput);
+	g_object_unref(worker->fdemosaic);
+	g_object_unref(worker->ffujirotate);
+	g_object_unref(worker->flensfun);
+	g_object_unref(worker->frotate);
+	g_object_unref(worker->fcrop);
+	g_object_unref(worker->fprescale);
+	g_object_unref(worker->fcache);
+	g_object_unref(worker->fresample);
+	g_object_unref(worker->fdcp);
+	g_object_unref(worker->fdenoise);
+	g_object_unref(worker->ftransform_input);
+	g_object_unref(worker->ftransform_display);
+	g_free(worker);
+}
+
+/**
+ * Find the first entry in the queue not yet handed to the pipeline
+ * @note Must be called with the GDK lock held
+ * @param ctx A BatchContext
+ * @param dispatched Keys of all entries handed to the pipeline so far
+ * @return A new BatchJob or NULL if no more entries are waiting
+ */
+static BatchJob *
+batch_next_job(BatchContext *ctx, GHashTable *dispatched)
+{
+	RS_QUEUE *queue = ctx->queue;
+	BatchJob *job = NULL;
 	GtkTreeIter iter;
 	gchar *filename_in;
 	gint setting_id;
-	GtkWidget *preview = gtk_image_new();
-	GdkPixbuf *pixbuf = NULL;
-	gint width = -1, height = -1;
-	gdouble scale = -1.0;
-	gchar *parsed_filename, *basename, *parsed_dir;
+
+	if (!gtk_tree_model_get_iter_first(queue->list, &iter))
+		return NULL;
+
+	do
+	{
+		gtk_tree_model_get(queue->list, &iter,
+			RS_QUEUE_ELEMENT_FILENAME, &filename_in,
+			RS_QUEUE_ELEMENT_SETTING_ID, &setting_id,
+			-1);
+		gchar *key = g_strdup_printf("%d:%s", setting_id, filename_in);
+		if (!g_hash_table_lookup(dispatched, key))
+		{
+			g_hash_table_insert(dispatched, key, GINT_TO_POINTER(TRUE));
+			job = g_new0(BatchJob, 1);
+			job->filename_in = filename_in;
+			job->setting_id = setting_id;
+		}
+		else
+		{
+			g_free(key);
+			g_free(filename_in);
+		}
+	} while (!job && gtk_tree_model_iter_next(queue->list, &iter));
+
+	if (!job)
+		return NULL;
+
+	/* Build new filename */
 	GString *filename;
+	if (NULL == g_strrstr(queue->filename, "%p"))
+	{
+		filename = g_string_new(queue->directory);
+		g_string_append(filename, G_DIR_SEPARATOR_S);
+		g_string_append(filename, queue->filename);
+	}
+	else
+		filename = g_string_new(queue->filename);
+
+	g_string_append(filename, ".");
+	g_string_append(filename, rs_output_get_extension(queue->output));
+	job->parsed_filename = filename_parse(filename->str, job->filename_in, job->setting_id, TRUE);
+	g_string_free(filename, TRUE);
+
+	/* Create directory, if it doesn't exist */
+	gchar *parsed_dir = g_path_get_dirname(job->parsed_filename);
+	if (FALSE == g_file_test(parsed_dir, G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR))
+		if (g_mkdir_with_parents(parsed_dir, 0x1ff))
+		{
+			gui_status_notify(_("Could not create output directory."));
+			ctx->abort_render = TRUE;
+			batch_job_free(job);
+			job = NULL;
+		}
+	g_free(parsed_dir);
+
+	return job;
+}
+
+/**
+ * Process the batch queue. Photos are decoded on a small decode pool and
+ * handed through a bounded queue to a number of develop workers, each
+ * rendering and saving on its own filter chain. The number of workers is
+ * read from CONF_BATCH_THREADS and the amount of decoded photos in flight
+ * is limited by CONF_BATCH_MAX_MEMORY (in megabytes).
+ * @param queue A RS_QUEUE
+ */
+void
+rs_batch_process(RS_QUEUE *queue)
+{
+	BatchContext *ctx;
+	BatchJob *job;
+	BatchJob *pending = NULL;
+	GPtrArray *workers;
+	GHashTable *dispatched;
+	GtkWidget *preview = gtk_image_new();
+	gchar *basename;
 	GString *status = g_string_new(NULL);
 	GtkWidget *window;
 	GtkWidget *label = gtk_label_new(NULL);
 	GtkWidget *vbox = gtk_vbox_new(FALSE, 4);
 	GtkWidget *cancel;
-	gboolean abort_render = FALSE;
 	GTimeVal start_time;
 	GTimeVal now_time = {0,0};
 	gint time, eta;
@@ -397,21 +758,26 @@ rs_batch_process(RS_QUEUE *queue)
 	gchar *eta_text, *title_text;
 	gint h = 0, m = 0, s = 0;
 	gint done = 0, left = 0;
-	RSFilter *finput = rs_filter_new("RSInputImage16", NULL);
-	RSFilter *fdemosaic = rs_filter_new("RSDemosaic", finput);
-	RSFilter *ffujirotate = rs_filter_new("RSFujiRotate", fdemosaic);
-	RSFilter *flensfun = rs_filter_new("RSLensfun", ffujirotate);
-	RSFilter *frotate = rs_filter_new("RSRotate", flensfun);
-	RSFilter *fcrop = rs_filter_new("RSCrop", frotate);
-	RSFilter *ftransform_input = rs_filter_new("RSColorspaceTransform", fcrop);
-	RSFilter *fdcp= rs_filter_new("RSDcp", ftransform_input);
-	RSFilter *fcache = rs_filter_new("RSCache", fdcp);
-	RSFilter *fresample= rs_filter_new("RSResample", fcache);
-	RSFilter *fdenoise= rs_filter_new("RSDenoise", fresample);
-	RSFilter *ftransform_display = rs_filter_new("RSColorspaceTransform", fdenoise);
-	RSFilter *fend = ftransform_display;
-	RSFilterResponse *filter_response;
-	RSColorSpace *display_color_space;
+	gint in_flight = 0;
+	gint threads = DEFAULT_CONF_BATCH_THREADS;
+	gint max_memory = DEFAULT_CONF_BATCH_MAX_MEMORY;
+	gboolean show_preview;
+	gsize memory_ceiling;
+	guint i;
+
+	rs_conf_get_integer(CONF_BATCH_THREADS, &threads);
+	rs_conf_get_integer(CONF_BATCH_MAX_MEMORY, &max_memory);
+	rs_conf_get_boolean_with_default(CONF_BATCH_SHOW_PREVIEW, &show_preview, DEFAULT_CONF_BATCH_SHOW_PREVIEW);
+	threads = CLAMP(threads, 1, rs_get_number_of_processor_cores());
+	memory_ceiling = (gsize) MAX(max_memory, 1) * 1024 * 1024;
+
+	ctx = g_new0(BatchContext, 1);
+	ctx->queue = queue;
+	ctx->preview_size = show_preview ? 250 : 0;
+	ctx->abort_render = FALSE;
+	g_mutex_init(&ctx->lock);
+	ctx->develop_queue = g_async_queue_new();
+	ctx->done_queue = g_async_queue_new();
 
 	gdk_threads_enter();
 	window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -419,14 +785,15 @@ rs_batch_process(RS_QUEUE *queue)
 	gtk_window_set_position(GTK_WINDOW(window), GTK_WIN_POS_CENTER_ON_PARENT);
 	gtk_window_set_destroy_with_parent(GTK_WINDOW(window), TRUE);
 	gtk_window_resize(GTK_WINDOW(window), 250, 250);
-	g_signal_connect((gpointer) window, "delete_event", G_CALLBACK(window_destroy), &abort_render);
+	g_signal_connect((gpointer) window, "delete_event", G_CALLBACK(window_destroy), &ctx->abort_render);
 
 	cancel = gtk_button_new_with_label(_("Cancel"));
 	g_signal_connect (G_OBJECT(cancel), "clicked",
-		G_CALLBACK(cancel_clicked), &abort_render);
+		G_CALLBACK(cancel_clicked), &ctx->abort_render);
 
 	gtk_container_add (GTK_CONTAINER (window), vbox);
-	gtk_box_pack_start (GTK_BOX (vbox), gui_framed(preview, _("Last image:"), GTK_SHADOW_IN), TRUE, TRUE, 0);
+	if (show_preview)
+		gtk_box_pack_start (GTK_BOX (vbox), gui_framed(preview, _("Last image:"), GTK_SHADOW_IN), TRUE, TRUE, 0);
 	gtk_box_pack_start (GTK_BOX (vbox), label, FALSE, FALSE, 0);
 	gtk_box_pack_start (GTK_BOX (vbox), eta_label, FALSE, FALSE, 0);
 	gtk_box_pack_start (GTK_BOX (vbox), cancel, FALSE, FALSE, 0);
@@ -435,18 +802,60 @@ rs_batch_process(RS_QUEUE *queue)
 	gtk_widget_show_all(window);
 	while (gtk_events_pending()) gtk_main_iteration();
 
-	display_color_space = rs_get_display_profile(GTK_WIDGET(window));
 	g_mkdir_with_parents(queue->directory, 00755);
 
+	/* Start the pipeline */
+	ctx->decode_pool = g_thread_pool_new(batch_decode, ctx, MIN(threads, 2), TRUE, NULL);
+	workers = g_ptr_array_new();
+	for (i = 0; i < threads; i++)
+		g_ptr_array_add(workers, batch_worker_new(ctx));
+	dispatched = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
 	g_get_current_time(&start_time);
 
-	while(gtk_tree_model_get_iter_first(queue->list, &iter) && (!abort_render))
+	while (in_flight > 0 || !ctx->abort_render)
 	{
+		/* Keep the pipeline filled, but never decode more photos than the
+		 * workers can keep up with or than fits below the memory ceiling.
+		 * Memory is reserved when a photo is dispatched, guessed from the
+		 * file size until a photo has been decoded */
+		while (!ctx->abort_render && in_flight < threads * 2)
+		{
+			gboolean fits;
+			gsize reserve;
+
+			if (!pending)
+				pending = batch_next_job(ctx, dispatched);
+			if (!pending)
+				break;
+
+			reserve = batch_estimate_file_memory(pending->filename_in);
+			g_mutex_lock(&ctx->lock);
+			reserve = MAX(reserve, ctx->memory_estimate);
+			fits = (in_flight == 0) || (ctx->memory_in_use + reserve <= memory_ceiling);
+			if (fits)
+			{
+				pending->memory = reserve;
+				ctx->memory_in_use += reserve;
+			}
+			g_mutex_unlock(&ctx->lock);
+			if (!fits)
+				break;
+
+			in_flight++;
+			g_thread_pool_push(ctx->decode_pool, pending, NULL);
+			pending = NULL;
+		}
+
+		/* Nothing left to do */
+		if (in_flight == 0)
+			break;
+
 		left = rs_batch_num_entries(queue);
 		if (done > 0 && now_time.tv_sec > 0)
 		{
 			time = (gint) (now_time.tv_sec-start_time.tv_sec);
-			eta = (time/done)*left;
+			eta = (time*left)/done;
 			h = (eta/3600);
 			eta %= 3600;
 			m = (eta/60);
@@ -466,169 +875,71 @@ rs_batch_process(RS_QUEUE *queue)
 		gtk_label_set_text(GTK_LABEL(eta_label), eta_text);
 		g_free(eta_text);
 		g_free(title_text);
-		done++;
-
-		gtk_tree_model_get(queue->list, &iter,
-			RS_QUEUE_ELEMENT_FILENAME, &filename_in,
-			RS_QUEUE_ELEMENT_SETTING_ID, &setting_id,
-			-1);
-		basename = g_path_get_basename(filename_in);
-		g_string_printf(status, _("Loading %s ..."), basename);
-		gtk_label_set_text(GTK_LABEL(label), status->str);
 		while (gtk_events_pending()) gtk_main_iteration();
-		g_free(basename);
 
+		/* Wait for the next photo to leave the pipeline */
 		gdk_threads_leave();
-		photo = rs_photo_load_from_file(filename_in);
-		if (photo)
-		{
-			rs_metadata_load_from_file(photo->metadata, filename_in);
-			rs_cache_load(photo);
+		job = g_async_queue_timeout_pop(ctx->done_queue, 100000);
+		gdk_threads_enter();
 
-			/* Build new filename */
-			if (NULL == g_strrstr(queue->filename, "%p"))
-			{
-				filename = g_string_new(queue->directory);
-				g_string_append(filename, G_DIR_SEPARATOR_S);
-				g_string_append(filename, queue->filename);
-			} 
-			else
-				filename = g_string_new(queue->filename);
-			
-			g_string_append(filename, ".");
-			g_string_append(filename, rs_output_get_extension(queue->output));
-			parsed_filename = filename_parse(filename->str, filename_in, setting_id, TRUE);
-			
-			/* Create directory, if it doesn't exist */
-			parsed_dir = g_path_get_dirname(parsed_filename);
-			if (FALSE == g_file_test(parsed_dir, G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR))
-				if (g_mkdir_with_parents(parsed_dir, 0x1ff))
-				{
-					gdk_threads_enter();
-					gui_status_notify(_("Could not create output directory."));
-					break;
-				}
+		if (!job)
+			continue;
 
-			GList *filters = g_list_append(NULL, fend);
-			rs_photo_apply_to_filters(photo, filters, setting_id);
-			g_list_free(filters);
-
-			rs_filter_set_recursive(fend,
-				"image", photo->input_response,
-				"filename", photo->filename,
-				"bounding-box", TRUE,
-				"width", 250,
-				"height", 250,
-				NULL);
-
-			/* Render preview image */
-			RSFilterRequest *request = rs_filter_request_new();
-			rs_filter_request_set_quick(RS_FILTER_REQUEST(request), FALSE);
-			/* FIXME: Should be set to output colorspace, not forced to sRGB */
-
-			rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", display_color_space);	
-			filter_response = rs_filter_get_image8(fend, request);
-			pixbuf = rs_filter_response_get_image8(filter_response);
-			gdk_threads_enter();
-			if (pixbuf)
-			{
-				gtk_image_set_from_pixbuf(GTK_IMAGE(preview), pixbuf);
-				g_object_unref(pixbuf);
-			}
-			g_object_unref(request);
-			g_object_unref(filter_response);
+		in_flight--;
+		g_mutex_lock(&ctx->lock);
+		ctx->memory_in_use -= job->memory;
+		g_mutex_unlock(&ctx->lock);
 
-			if (left > 1)
-			{
-				GtkTreeIter iter2 = iter;
-				if (gtk_tree_model_iter_next (queue->list, &iter2))
-				{
-					gtk_tree_model_get(queue->list, &iter2, RS_QUEUE_ELEMENT_FILENAME, &filename_in, -1);
-					rs_io_idle_prefetch_file(filename_in, 0xC01A);
-				}
-			}
-			/* Build text for small preview-window */
-			basename = g_path_get_basename(parsed_filename);
-			g_string_printf(status, _("Saving %s ..."), basename);
-			gtk_label_set_text(GTK_LABEL(label), status->str);
-			while (gtk_events_pending())
-				gtk_main_iteration();
-			g_free(basename);
-			gdk_threads_leave();
-
-			width = 65535;
-			height = 65535;
-			/* Calculate new size */
-			switch (queue->size_lock)
-			{
-				case LOCK_SCALE:
-					scale = queue->scale/100.0;
-					rs_filter_get_size_simple(fcrop, RS_FILTER_REQUEST_QUICK, &width, &height);
-					width = (gint) (((gdouble) width) * scale);
-					height = (gint) (((gdouble) height) * scale);
-					break;
-				case LOCK_WIDTH:
-					width = queue->width;
-					break;
-				case LOCK_HEIGHT:
-					height = queue->height;
-					break;
-				case LOCK_BOUNDING_BOX:
-					width = queue->width;
-					height = queue->height;
-					break;
-			}
-			rs_filter_set_recursive(fend,
-				"width", width,
-				"height", height,
-				NULL);
-
-			/* Save the image */
-			if (g_object_class_find_property(G_OBJECT_GET_CLASS(queue->output), "filename"))
-				g_object_set(queue->output, "filename", parsed_filename, NULL);
-
-			rs_output_set_from_conf(queue->output, "batch");
+		if (job->preview)
+			gtk_image_set_from_pixbuf(GTK_IMAGE(preview), job->preview);
 
-			g_assert(RS_IS_OUTPUT(queue->output));
-			g_assert(RS_IS_FILTER(fend));
+		if (job->exported)
+		{
+			rs_store_set_flags(NULL, job->filename_in, NULL, NULL, &job->exported, NULL);
 
-			gboolean exported = rs_output_execute(queue->output, fend);
-			gdk_threads_enter();
-			if (exported)
-				rs_store_set_flags(NULL, photo->filename, NULL, NULL, &exported, NULL);
-			else
-			{
-				gui_status_notify(_("Could not export photo."));
-				break;
-			}
+			basename = g_path_get_basename(job->parsed_filename);
+			g_string_printf(status, _("Saved %s"), basename);
+			gtk_label_set_text(GTK_LABEL(label), status->str);
+			g_free(basename);
 
-			g_free(parsed_filename);
-			g_string_free(filename, TRUE);
-			g_object_unref(photo);
-			photo = NULL;
+			rs_batch_remove_from_queue(queue, job->filename_in, job->setting_id);
+			done++;
+		}
+		else if (job->loaded && !ctx->abort_render)
+		{
+			gui_status_notify(_("Could not export photo."));
+			ctx->abort_render = TRUE;
 		}
-		gtk_list_store_remove(GTK_LIST_STORE(queue->list), &iter);
-		batch_queue_save(queue);
+		/* Photos we cannot load are removed from the queue */
+		else if (!job->loaded && !ctx->abort_render)
+			rs_batch_remove_from_queue(queue, job->filename_in, job->setting_id);
 
+		batch_job_free(job);
 		g_get_current_time(&now_time);
 	}
+	if (pending)
+		batch_job_free(pending);
 	gtk_widget_destroy(window);
+	if (!show_preview)
+		gtk_widget_destroy(preview);
 
 	batch_queue_update_sensivity(queue);
 	gdk_threads_leave();
 
-	g_object_unref(finput);
-	g_object_unref(fdemosaic);
-	g_object_unref(ffujirotate);
-	g_object_unref(flensfun);
-	g_object_unref(frotate);
-	g_object_unref(fcrop);
-	g_object_unref(fcache);
-	g_object_unref(fresample);
-	g_object_unref(fdcp);
-	g_object_unref(fdenoise);
-	g_object_unref(ftransform_input);
-	g_object_unref(ftransform_display);
+	/* Tear down the pipeline */
+	g_thread_pool_free(ctx->decode_pool, FALSE, TRUE);
+	for (i = 0; i < workers->len; i++)
+		g_async_queue_push(ctx->develop_queue, &batch_quit_job);
+	for (i = 0; i < workers->len; i++)
+		batch_worker_free(g_ptr_array_index(workers, i));
+	g_ptr_array_free(workers, TRUE);
+	g_hash_table_destroy(dispatched);
+
+	g_async_queue_unref(ctx->develop_queue);
+	g_async_queue_unref(ctx->done_queue);
+	g_mutex_clear(&ctx->lock);
+	g_free(ctx);
+	g_string_free(status, TRUE);
 }
 
 static void
@@ -23,7 +23,6 @@
 #include <libxml/xmlwriter.h>
 #include "rs-camera-db.h"
 #include "rs-photo.h"
-#include "rs-toolbox.h"
 #include "rs-cache.h"
 
 /* FIXME: Make this thread safe! */
@@ -411,69 +410,3 @@ save_db(RSCameraDb *camera_db)
 
 	return;
 }
-
-static void
-icon_func(GtkTreeViewColumn *tree_column, GtkCellRenderer *cell, GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
-{
-	/* This will always be called from the GTK+ main thread, we should be safe */
-	static GdkPixbuf *pixbuf = NULL;
-
-	if (!pixbuf)
-		pixbuf = gdk_pixbuf_new_from_file(PACKAGE_DATA_DIR G_DIR_SEPARATOR_S "pixmaps" G_DIR_SEPARATOR_S PACKAGE G_DIR_SEPARATOR_S "camera-photo.png", NULL);
-
-	g_object_set(cell, "pixbuf", pixbuf, NULL);
-}
-
-GtkWidget *
-rs_camera_db_editor_new(RSCameraDb *camera_db)
-{
-	GtkWidget *dialog = NULL;
-
-	if (dialog)
-		return dialog;
-
-	dialog = gtk_dialog_new();
-
-	gtk_window_set_title(GTK_WINDOW(dialog), _("Camera defaults editor"));
-	gtk_window_set_type_hint(GTK_WINDOW(dialog), GDK_WINDOW_TYPE_HINT_DIALOG);
-	gtk_window_set_destroy_with_parent(GTK_WINDOW(dialog), TRUE);
-
-	/* Is this wise? */
-	g_signal_connect_swapped(dialog, "delete_event", G_CALLBACK (gtk_widget_hide), dialog);
-	g_signal_connect_swapped(dialog, "response", G_CALLBACK (gtk_widget_hide), dialog);
-
-	GtkWidget *vbox = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
-
-	GtkWidget *camera_selector = gtk_tree_view_new_with_model(GTK_TREE_MODEL(camera_db->cameras));
-
-    GtkCellRenderer *renderer;
-    GtkTreeViewColumn *column;
-	
-	column = gtk_tree_view_column_new();
-	gtk_tree_view_column_set_title (column, _("Model"));
-
-	/* Icon */
-	renderer = gtk_cell_renderer_pixbuf_new();
-	gtk_tree_view_column_pack_start (column, renderer, FALSE);
-	gtk_tree_view_column_set_cell_data_func(column, renderer, icon_func, NULL, NULL);
-
-	/* Model */
-	renderer = gtk_cell_renderer_text_new();
-	gtk_tree_view_column_pack_start(column, renderer, TRUE);
-	gtk_tree_view_column_set_attributes(column, renderer, "text", COLUMN_MODEL, NULL);
-
-	gtk_tree_view_append_column(GTK_TREE_VIEW(camera_selector), column);
-
-	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(camera_db->cameras), COLUMN_MODEL, GTK_SORT_ASCENDING);
-
-	GtkWidget *hbox = gtk_hbox_new(FALSE, 4);
-
-	gtk_box_pack_start(GTK_BOX(hbox), camera_selector, FALSE, FALSE, 3);
-
-	GtkWidget *toolbox = rs_toolbox_new();
-	gtk_box_pack_start(GTK_BOX(hbox), toolbox, TRUE, TRUE, 3);
-
-	gtk_box_pack_start(GTK_BOX(vbox), hbox, TRUE, TRUE, 3);
-
-	return dialog;
-}
@@ -49,6 +49,15 @@
 
 #define DROPSHADOWOFFSET 6
 
+/* Threads walking directories while loading */
+#define SCAN_THREADS 4
+/* Files a scanner collects before handing them to the store */
+#define SCAN_BATCH 256
+/* How often found files are added and visible thumbnails prioritized, in ms */
+#define SCAN_FLUSH_INTERVAL 100
+/* I/O priority of metadata for thumbnails on screen, see rs_io_idle_read_metadata() */
+#define VISIBLE_METADATA_PRIORITY 5
+
 /* Overlay icons */
 static GdkPixbuf *icon_priority_1 = NULL;
 static GdkPixbuf *icon_priority_2 = NULL;
@@ -79,6 +88,8 @@ enum {
 	RS_STORE_TYPE_GROUP_MEMBER
 };
 
+typedef struct _DirectoryScan DirectoryScan;
+
 struct _RSStore
 {
 	GtkHBox parent;
@@ -95,10 +106,30 @@ struct _RSStore
 	GString *tooltip_text;
 	GtkTreePath *tooltip_last_path;
 	volatile gint jobs_to_do;
+	volatile gint library_batch;	/* TRUE while imported photos are batched in the library */
 	gboolean counter_blocked;		/* Only access when thread has gdk lock */
 	gint open_selected;  /* Contains status message ID, if enabled, 0 otherwise */
 	gchar *next_file;
 	gulong delay_load;
+
+	DirectoryScan *scan;		/* Directory scan in progress or NULL */
+	guint load_timer;
+	GMutex pending_lock;
+	GHashTable *pending;		/* Row -> WORKER_JOB waiting for metadata */
+	gchar *select_pending;		/* Photo to select when the scan finds it */
+	gboolean select_pending_deselect;
+};
+
+/* A directory walk shared by the scanner threads and the store */
+struct _DirectoryScan {
+	gint ref_count;
+	GThreadPool *pool;
+	GMutex lock;
+	gboolean cancelled;
+	gboolean recursive;
+	gint pending_dirs;		/* Directories queued or being read */
+	GPtrArray *found;		/* Files not yet added to the store */
+	gint items;
 };
 
 /* Define the boiler plate stuff using the predefined macro */
@@ -118,6 +149,7 @@ typedef struct _worker_job {
 	GtkTreeIter iter;
 	gchar *name;
 	GtkTreeModel *model;
+	const RSIoJob *io_job;
 } WORKER_JOB;
 
 /* FIXME: Remember to remove stores from this too! */
@@ -165,6 +197,7 @@ void store_get_type(GtkListStore *store, GtkTreeIter *iter, gint *type);
 void store_get_fullname(GtkListStore *store, GtkTreeIter *iter, gchar **fullname);
 void store_set_members(GtkListStore *store, GtkTreeIter *iter, GList *members);
 void got_metadata(RSMetadata *metadata, gpointer user_data);
+static void store_job_done(RSStore *store);
 static gboolean button(GtkWidget *widget, GdkEventButton *event, RSStore *store);
 
 /**
@@ -221,6 +254,8 @@ rs_store_init(RSStore *store)
 
 	store->counter_blocked = FALSE;
 	store->open_selected = 0;
+	g_mutex_init(&store->pending_lock);
+	store->pending = g_hash_table_new(g_direct_hash, g_direct_equal);
 	store->notebook = GTK_NOTEBOOK(gtk_notebook_new());
 	store->store = gtk_list_store_new (NUM_COLUMNS,
 		GDK_TYPE_PIXBUF,
@@ -1202,6 +1237,265 @@ tree_find_filename(GtkTreeModel *store, const gchar *filename, GtkTreeIter *iter
 	return ret;
 }
 
+static void
+scan_unref(DirectoryScan *scan)
+{
+	if (g_atomic_int_dec_and_test(&scan->ref_count))
+	{
+		g_ptr_array_free(scan->found, TRUE);
+		g_mutex_clear(&scan->lock);
+		g_free(scan);
+	}
+}
+
+/**
+ * Queue a directory for scanning
+ * @note Must be called with scan->lock held
+ */
+static void
+scan_push_unlocked(DirectoryScan *scan, gchar *path)
+{
+	scan->pending_dirs++;
+	g_atomic_int_inc(&scan->ref_count);
+	g_thread_pool_push(scan->pool, path, NULL);
+}
+
+/**
+ * Hand a batch of found files to the store
+ */
+static void
+scan_flush_batch(DirectoryScan *scan, GPtrArray *batch)
+{
+	guint i;
+
+	g_mutex_lock(&scan->lock);
+	for (i = 0; i < batch->len; i++)
+		g_ptr_array_add(scan->found, g_ptr_array_index(batch, i));
+	g_mutex_unlock(&scan->lock);
+
+	g_ptr_array_set_size(batch, 0);
+}
+
+/**
+ * Read a single directory, run by the scanner threads
+ */
+static void
+scan_directory(gpointer data, gpointer user_data)
+{
+	gchar *path = data;
+	DirectoryScan *scan = user_data;
+	GPtrArray *batch = g_ptr_array_new();
+	const gchar *name;
+	gchar *fullname;
+	gchar *path_normalized;
+	GDir *dir = NULL;
+
+	path_normalized = rs_normalize_path(path);
+
+	if (path_normalized && !g_atomic_int_get(&scan->cancelled))
+	{
+		rs_io_idle_restore_tags(path_normalized, RESTORE_TAGS_CLASS);
+
+		rs_io_lock_file(path_normalized);
+		dir = g_dir_open(path_normalized, 0, NULL);
+	}
+
+	while (dir && (name = g_dir_read_name(dir)) && !g_atomic_int_get(&scan->cancelled))
+	{
+		/* Ignore "hidden" files and directories */
+		if (name[0] == '.')
+			continue;
+
+		fullname = g_build_filename(path, name, NULL);
+
+		if (rs_filetype_can_load(fullname))
+		{
+			g_ptr_array_add(batch, fullname);
+			if (batch->len >= SCAN_BATCH)
+				scan_flush_batch(scan, batch);
+			continue;
+		}
+		else if (scan->recursive && g_file_test(fullname, G_FILE_TEST_IS_DIR))
+		{
+			g_mutex_lock(&scan->lock);
+			if (!scan->cancelled)
+			{
+				scan_push_unlocked(scan, fullname);
+				fullname = NULL;
+			}
+			g_mutex_unlock(&scan->lock);
+		}
+
+		g_free(fullname);
+	}
+
+	if (dir)
+	{
+		g_dir_close(dir);
+		rs_io_unlock();
+	}
+
+	scan_flush_batch(scan, batch);
+	g_ptr_array_free(batch, TRUE);
+
+	g_mutex_lock(&scan->lock);
+	scan->pending_dirs--;
+	g_mutex_unlock(&scan->lock);
+
+	g_free(path_normalized);
+	g_free(path);
+	scan_unref(scan);
+}
+
+/**
+ * Stop a directory scan, the scanner threads finish on their own
+ */
+static void
+store_scan_cancel(RSStore *store)
+{
+	DirectoryScan *scan = store->scan;
+
+	if (!scan)
+		return;
+
+	store->scan = NULL;
+
+	/* No scanner will push to the pool after this */
+	g_mutex_lock(&scan->lock);
+	scan->cancelled = TRUE;
+	g_mutex_unlock(&scan->lock);
+	g_thread_pool_free(scan->pool, FALSE, FALSE);
+
+	g_free(store->select_pending);
+	store->select_pending = NULL;
+
+	scan_unref(scan);
+
+	/* Release the job held for the scan */
+	store_job_done(store);
+}
+
+/**
+ * Give thumbnails on screen a head start in the I/O queue
+ */
+static void
+store_prioritize_visible(RSStore *store)
+{
+	GtkIconView *iconview = GTK_ICON_VIEW(store->current_iconview);
+	GtkTreeModel *model = gtk_icon_view_get_model(iconview);
+	GtkTreePath *start, *end;
+	GtkTreeIter iter, child;
+	WORKER_JOB *job;
+
+	if (!model || !gtk_icon_view_get_visible_range(iconview, &start, &end))
+		return;
+
+	g_mutex_lock(&store->pending_lock);
+	if (g_hash_table_size(store->pending) > 0 && gtk_tree_model_get_iter(model, &iter, start))
+	{
+		do {
+			gtk_tree_model_filter_convert_iter_to_child_iter(GTK_TREE_MODEL_FILTER(model), &child, &iter);
+			job = g_hash_table_lookup(store->pending, child.user_data);
+			if (job && job->io_job)
+			{
+				rs_io_idle_set_priority(job->io_job, VISIBLE_METADATA_PRIORITY);
+				g_hash_table_remove(store->pending, child.user_data);
+			}
+
+			gtk_tree_path_next(start);
+		} while (gtk_tree_path_compare(start, end) <= 0 && gtk_tree_model_iter_next(model, &iter));
+	}
+	g_mutex_unlock(&store->pending_lock);
+
+	gtk_tree_path_free(start);
+	gtk_tree_path_free(end);
+}
+
+/**
+ * Add files found by the scan in chunks and keep visible thumbnails ahead
+ * of the rest. Runs with the GDK lock held
+ */
+static gboolean
+store_load_tick(gpointer data)
+{
+	RSStore *store = RS_STORE(data);
+	DirectoryScan *scan = store->scan;
+	gboolean keep_going;
+
+	if (scan)
+	{
+		GPtrArray *found;
+		gboolean finished;
+		guint i;
+
+		g_mutex_lock(&scan->lock);
+		found = scan->found;
+		scan->found = g_ptr_array_new();
+		finished = (scan->pending_dirs == 0);
+		g_mutex_unlock(&scan->lock);
+
+		for (i = 0; i < found->len; i++)
+		{
+			rs_store_load_file(store, g_ptr_array_index(found, i));
+			g_free(g_ptr_array_index(found, i));
+		}
+		scan->items += found->len;
+
+		if (found->len > 0)
+			rs_store_set_iconview_size(store, scan->items);
+		g_ptr_array_free(found, TRUE);
+
+		if (finished)
+		{
+			store->scan = NULL;
+			g_thread_pool_free(scan->pool, FALSE, FALSE);
+
+			/* Sort the store */
+			rs_store_set_sort_method(store, store->sort_method);
+
+			RS_DEBUG(PERFORMANCE, "Directory scan found %d files", scan->items);
+			scan_unref(scan);
+
+			/* Release the job held for the scan */
+			store_job_done(store);
+
+			/* Start the preloader */
+			predict_preload(store, TRUE);
+		}
+
+		/* Try again, rs_store_set_selected_name() will put it back if not found yet */
+		if (store->select_pending)
+		{
+			gchar *name = store->select_pending;
+			store->select_pending = NULL;
+			rs_store_set_selected_name(store, name, store->select_pending_deselect);
+			g_free(name);
+		}
+	}
+
+	store_prioritize_visible(store);
+
+	g_mutex_lock(&store->pending_lock);
+	keep_going = (store->scan || g_hash_table_size(store->pending) > 0);
+	if (!keep_going)
+		store->load_timer = 0;
+	g_mutex_unlock(&store->pending_lock);
+
+	return keep_going;
+}
+
+/**
+ * Make sure store_load_tick() is running
+ */
+static void
+store_load_tick_start(RSStore *store)
+{
+	g_mutex_lock(&store->pending_lock);
+	if (!store->load_timer)
+		store->load_timer = gdk_threads_add_timeout(SCAN_FLUSH_INTERVAL, store_load_tick, store);
+	g_mutex_unlock(&store->pending_lock);
+}
+
 void
 rs_store_load_file(RSStore *store, gchar *fullname)
 {
@@ -1249,53 +1543,24 @@ rs_store_load_file(RSStore *store, gchar *fullname)
 	job->filename = g_strdup(fullname);
 	job->name = g_strdup(name);
 	job->model = g_object_ref(GTK_TREE_MODEL(store->store));
-
-	rs_io_idle_read_metadata(job->filename, METADATA_CLASS, got_metadata, job);
+	job->io_job = NULL;
 
 	g_atomic_int_inc(&store->jobs_to_do);
-}
-
-static gint
-load_directory(RSStore *store, const gchar *path, RSLibrary *library, const gboolean load_8bit, const gboolean load_recursive)
-{
-	const gchar *name;
-	gchar *fullname;
-	GDir *dir;
-	gint count = 0;
 
-	gchar *path_normalized = rs_normalize_path(path);
-
-	if (!path_normalized)
-		return 0;
-
-	rs_io_idle_restore_tags(path_normalized, RESTORE_TAGS_CLASS);
-
-	dir = g_dir_open(path_normalized, 0, NULL); /* FIXME: check errors */
-
-	while((dir != NULL) && (name = g_dir_read_name(dir)))
-	{
-		/* Ignore "hidden" files and directories */
-		if (name[0] == '.')
-			continue;
-
-		fullname = g_build_filename(path, name, NULL);
-
-		if (rs_filetype_can_load(fullname))
-		{
-			rs_store_load_file(store, fullname);
-			count++;
-		}
-		else if (load_recursive && g_file_test(fullname, G_FILE_TEST_IS_DIR))
-			count += load_directory(store, fullname, library, load_8bit, load_recursive);
+	/* Remember the job, store_prioritize_visible() may want to move it ahead */
+	g_mutex_lock(&store->pending_lock);
+	g_hash_table_insert(store->pending, iter.user_data, job);
+	g_mutex_unlock(&store->pending_lock);
 
-		g_free(fullname);
-	}
+	const RSIoJob *io_job = rs_io_idle_read_metadata(job->filename, METADATA_CLASS, got_metadata, job);
 
-	g_free(path_normalized);
-	if (dir)
-		g_dir_close(dir);
+	/* The job may already be done */
+	g_mutex_lock(&store->pending_lock);
+	if (g_hash_table_lookup(store->pending, iter.user_data) == job)
+		job->io_job = io_job;
+	g_mutex_unlock(&store->pending_lock);
 
-	return count;
+	store_load_tick_start(store);
 }
 
 
@@ -1340,6 +1605,21 @@ rs_store_remove(RSStore *store, const gchar *filename, GtkTreeIter *iter)
 
 	/* By now we should have a valid store */
 	g_return_if_fail (RS_IS_STORE(store));
+
+	if (!filename && !iter)
+	{
+		store_scan_cancel(store);
+
+		/* Cancelled metadata jobs will never call got_metadata() */
+		g_mutex_lock(&store->pending_lock);
+		g_hash_table_remove_all(store->pending);
+		g_mutex_unlock(&store->pending_lock);
+
+		/* ... or end the library batch */
+		if (g_atomic_int_compare_and_exchange(&store->library_batch, TRUE, FALSE))
+			rs_library_end_batch(rs_library_get_singleton());
+	}
+
 	gdk_threads_enter();
 
 	/* If we got filename, but no iter, try to find correct iter */
@@ -1371,22 +1651,20 @@ rs_store_remove(RSStore *store, const gchar *filename, GtkTreeIter *iter)
 }
 
 /**
- * Load thumbnails from a directory into the store
+ * Load thumbnails from a directory into the store. The directory is read in
+ * the background and thumbnails are added as they are found
  * @param store A RSStore
  * @param path The path to load
- * @return The number of files loaded or -1
+ * @return 0 or -1
  */
 gint
 rs_store_load_directory(RSStore *store, const gchar *path)
 {
 	RSLibrary *library = rs_library_get_singleton();
-	static gboolean running = FALSE;
-	static GMutex lock;
-
+	DirectoryScan *scan;
 	GtkTreeSortable *sortable;
-	gboolean load_8bit = FALSE;
 	gboolean load_recursive = DEFAULT_CONF_LOAD_RECURSIVE;
-	gint items=0, n;
+	gint n;
 
 	g_return_val_if_fail(RS_IS_STORE(store), -1);
 	if (!path)
@@ -1403,45 +1681,36 @@ rs_store_load_directory(RSStore *store, const gchar *path)
 		store->last_path = g_strdup(path);
 	}
 
-	/* We should really only be running one instance at a time */
-	g_mutex_lock(&lock);
-	if (running)
-		return -1;
-	running = TRUE;
-	g_mutex_unlock(&lock);
+	/* Only one scan at a time */
+	store_scan_cancel(store);
 
-	rs_conf_get_boolean(CONF_LOAD_GDK, &load_8bit);
 	rs_conf_get_boolean(CONF_LOAD_RECURSIVE, &load_recursive);
 	if (!rs_conf_get_string(CONF_LWD))
 		load_recursive = FALSE;
 
+	gdk_threads_enter();
+
 	/* Disable sort while loading - this greatly reduces the change of triggering a GTK crash bug */
 	sortable = GTK_TREE_SORTABLE(store->store);
 	gtk_tree_sortable_set_sort_column_id(sortable, GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, GTK_SORT_ASCENDING);
 
-	g_atomic_int_set(&store->jobs_to_do, 0);
+	/* The scan itself counts as a job until it is done, see store_load_tick() */
+	g_atomic_int_set(&store->jobs_to_do, 1);
 	gtk_label_set_markup(GTK_LABEL(store->label[0]), _("* <small>(-)</small>"));
 	gtk_label_set_markup(GTK_LABEL(store->label[1]), _("1 <small>(-)</small>"));
 	gtk_label_set_markup(GTK_LABEL(store->label[2]), _("2 <small>(-)</small>"));
 	gtk_label_set_markup(GTK_LABEL(store->label[3]), _("3 <small>(-)</small>"));
 	gtk_label_set_markup(GTK_LABEL(store->label[4]), _("U <small>(-)</small>"));
 	gtk_label_set_markup(GTK_LABEL(store->label[5]), _("D <small>(-)</small>"));
-	g_signal_handler_block(store->store, store->counthandler);
+	if (!store->counter_blocked)
+		g_signal_handler_block(store->store, store->counthandler);
 	store->counter_blocked = TRUE;
 
-	/* While we're loading, we keep the IO lock to ourself. We need to read very basic meta and directory data */
-	rs_io_lock();
-	items = load_directory(store, path, library, load_8bit, load_recursive);
-	rs_io_unlock();
-
-	/* unset model and make sure we have enough columns */
-	gdk_threads_enter();
-	rs_store_set_iconview_size(store, items);
-
-	/* Sort the store */
-	rs_store_set_sort_method(store, store->sort_method);
+	/* Collect library inserts from the metadata jobs in one batch, this is ended by store_job_done() */
+	if (g_atomic_int_compare_and_exchange(&store->library_batch, FALSE, TRUE))
+		rs_library_begin_batch(library);
 
-	/* set model for all 6 iconviews */
+	/* Set model for all 6 iconviews now, thumbnails will show up as they are found */
 	for(n=0;n<NUM_VIEWS;n++)
 	{
 		GtkTreeModel *tree;
@@ -1456,16 +1725,24 @@ rs_store_load_directory(RSStore *store, const gchar *path)
 	/* load group file and group photos */
 	store_load_groups(store->store);
 #endif
-	gdk_threads_leave();
 
-	/* Start the preloader */
-	predict_preload(store, TRUE);
+	scan = g_new0(DirectoryScan, 1);
+	scan->ref_count = 1;
+	g_mutex_init(&scan->lock);
+	scan->recursive = load_recursive;
+	scan->found = g_ptr_array_new();
+	scan->pool = g_thread_pool_new(scan_directory, scan, SCAN_THREADS, FALSE, NULL);
+
+	g_mutex_lock(&scan->lock);
+	scan_push_unlocked(scan, g_strdup(path));
+	g_mutex_unlock(&scan->lock);
+
+	store->scan = scan;
+	store_load_tick_start(store);
+
+	gdk_threads_leave();
 
-	g_mutex_lock(&lock);
-	running = FALSE;
-	g_mutex_unlock(&lock);
-	/* Return the number of files successfully recognized */
-	return items;
+	return 0;
 }
 
 /**
@@ -1586,6 +1863,13 @@ rs_store_set_selected_name(RSStore *store, const gchar *filename, gboolean desel
 		gtk_tree_path_free(iconpath);
 		ret = TRUE;
 	}
+	else if (store->scan)
+	{
+		/* Not found yet, try again when the scan has added more photos */
+		g_free(store->select_pending);
+		store->select_pending = g_strdup(filename);
+		store->select_pending_deselect = deselect_others;
+	}
 	return ret;
 }
 
@@ -2836,6 +3120,34 @@ rs_store_update_thumbnail(RSStore *store, const gchar *filename, GdkPixbuf *pixb
 	}
 }
 
+/**
+ * Called when a metadata job or a directory scan is done, the last one to
+ * finish re-enables counting and sorting
+ */
+static void
+store_job_done(RSStore *store)
+{
+	if (!g_atomic_int_dec_and_test(&store->jobs_to_do))
+		return;
+
+	if (g_atomic_int_compare_and_exchange(&store->library_batch, TRUE, FALSE))
+		rs_library_end_batch(rs_library_get_singleton());
+
+	gdk_threads_enter();
+	/* FIXME: Refilter as this point - not before */
+	if (store->counter_blocked)
+		g_signal_handler_unblock(store->store, store->counthandler);
+	store->counter_blocked = FALSE;
+
+	count_priorities(GTK_TREE_MODEL(store->store), NULL, NULL, store->label);
+	RS_STORE_SORT_METHOD sort_method;
+	if (rs_conf_get_integer(CONF_STORE_SORT_METHOD, (gint*)&sort_method))
+		rs_store_set_sort_method(store, sort_method);
+	else
+		rs_store_set_sort_method(store, RS_STORE_SORT_BY_NAME);
+	gdk_threads_leave();
+}
+
 void
 got_metadata(RSMetadata *metadata, gpointer user_data)
 {
@@ -2891,22 +3203,13 @@ got_metadata(RSMetadata *metadata, gpointer user_data)
 	g_object_unref(pixbuf);
 	g_object_unref(pixbuf_clean);
 
-	if (g_atomic_int_dec_and_test(&job->store->jobs_to_do))
-	{
-		gdk_threads_enter();
-		/* FIXME: Refilter as this point - not before */
-		if (job->store->counter_blocked)
-			g_signal_handler_unblock(job->store->store, job->store->counthandler);
-		job->store->counter_blocked = FALSE;
-
-		count_priorities(GTK_TREE_MODEL(job->store->store), NULL, NULL, job->store->label);
-		RS_STORE_SORT_METHOD sort_method;
-		if (rs_conf_get_integer(CONF_STORE_SORT_METHOD, (gint*)&sort_method))
-			rs_store_set_sort_method(job->store, sort_method);
-		else
-			rs_store_set_sort_method(job->store, RS_STORE_SORT_BY_NAME);
-		gdk_threads_leave();
-	}
+	g_mutex_lock(&job->store->pending_lock);
+	if (g_hash_table_lookup(job->store->pending, job->iter.user_data) == job)
+		g_hash_table_remove(job->store->pending, job->iter.user_data);
+	g_mutex_unlock(&job->store->pending_lock);
+
+	store_job_done(job->store);
+
 	/* Clean up the job */
 	g_free(job->filename);
 	g_object_unref(job->store);
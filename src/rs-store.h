@@ -60,10 +60,11 @@ rs_store_new(void);
 #define RESTORE_TAGS_CLASS (4845658)
 
 /**
- * Load thumbnails from a directory into the store
+ * Load thumbnails from a directory into the store. The directory is read in
+ * the background and thumbnails are added as they are found
  * @param store A RSStore
  * @param path The path to load
- * @return The number of files loaded or -1
+ * @return 0 or -1
  */
 extern gint
 rs_store_load_directory(RSStore *store, const gchar *path);
@@ -35,13 +35,12 @@ typedef struct {
 	RSStore *store;
 } cb_carrier;
 
-static void
-load_photos(gpointer data, gpointer user_data) {
+static gboolean
+load_photo(const gchar *filename, gpointer user_data) {
 	RSStore *store = user_data;
-	gchar *text = (gchar *) data;
 	/* FIXME: Change this to be signal based at some point */
-	rs_store_load_file(store, text);
-	g_free(text);
+	rs_store_load_file(store, (gchar *) filename);
+	return TRUE;
 }
 
 static void 
@@ -50,14 +49,16 @@ search_changed(GtkEntry *entry, gpointer user_data)
 	cb_carrier *carrier = user_data;
 	const gchar *text = gtk_entry_get_text(entry);
 
-	GList *photos = rs_library_search(carrier->library, text);
+	gint found;
 
 	/* FIXME: deselect all photos in store */
 	rs_store_remove(carrier->store, NULL, NULL);
-	g_list_foreach(photos, load_photos, carrier->store);
+
+	/* Photos are loaded as the library finds them */
+	found = rs_library_search_foreach(carrier->library, text, load_photo, carrier->store);
 
 	/* Fix size of iconview */
-	rs_store_set_iconview_size(carrier->store, g_list_length(photos));
+	rs_store_set_iconview_size(carrier->store, found);
 
 	GString *window_title = g_string_new("");
 	g_string_printf(window_title, _("Tag search [%s]"), text);
@@ -66,8 +67,6 @@ search_changed(GtkEntry *entry, gpointer user_data)
 	
 	rs_conf_set_string(CONF_LIBRARY_TAG_SEARCH, text);
 	rs_conf_unset(CONF_LWD);
-
-	g_list_free(photos);
 }
 
 GtkWidget *